@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+//
+// jobs.h -- worker thread pool
+//
+// Job functions run on worker threads and must not call into cvars,
+// commands, filesystem or anything else that isn't thread safe. The zone
+// allocator is safe, but contended; prefer allocating on the calling
+// thread and giving each job its own slice of the output. Without worker
+// threads jobs run inline.
+//
+
+typedef struct {
+    int     pending;    // number of jobs queued or running
+} job_group_t;
+
+typedef void (*job_func_t)(void *arg);
+typedef void (*job_range_func_t)(void *arg, int start, int end);
+
+void    Com_InitJobs(void);
+void    Com_ShutdownJobs(void);
+int     Com_NumJobThreads(void);
+
+void    Com_QueueJob(job_group_t *group, job_func_t func, void *arg);
+qboolean Com_JobsPending(job_group_t *group);
+void    Com_WaitJobs(job_group_t *group);
+
+void    Com_ParallelFor(int count, int grain, job_range_func_t func, void *arg);
+
+#endif // JOBS_H
@@ -0,0 +1,61 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef PROF_H
+#define PROF_H
+
+//
+// prof.h -- scoped CPU zone profiler
+//
+// Zones are identified by name pointer and parent zone, so names must be
+// string literals or otherwise have static storage. Zones nest and must be
+// closed on the same thread they were opened on. When profiling is disabled
+// each zone costs one predictable branch on a global flag.
+//
+// Threads other than the main one call Prof_ReleaseThread before exiting,
+// so that their slot can be reused.
+//
+
+#define PROF_MAX_THREADS    16
+#define PROF_MAX_DEPTH      32
+#define PROF_MAX_ZONES      128
+
+typedef struct {
+    const char  *name;
+    int         depth;
+    float       avg_msec;       // average inclusive time per frame
+    float       max_msec;       // peak inclusive time per frame
+    float       avg_calls;      // average number of calls per frame
+} prof_stat_t;
+
+extern int prof_active;
+
+void    Prof_Init(void);
+void    Prof_SetThreadName(const char *name);
+void    Prof_ReleaseThread(void);
+void    Prof_BeginZone(const char *name);
+void    Prof_EndZone(void);
+void    Prof_EndFrame(void);
+int     Prof_GetStats(prof_stat_t *stats, int maxstats);
+
+#define PROF_BEGIN(name) \
+    do { if (q_unlikely(prof_active)) Prof_BeginZone(name); } while (0)
+#define PROF_END() \
+    do { if (q_unlikely(prof_active)) Prof_EndZone(); } while (0)
+
+#endif // PROF_H
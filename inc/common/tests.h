@@ -21,6 +21,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #if USE_TESTS
 void TST_Init(void);
+
+unsigned TST_Rand(unsigned *seed);
+float TST_Frand(unsigned *seed);
+void TST_FillRandom(void *data, size_t size, unsigned *seed);
+void TST_TimeVariants(void (*func)(void *, int), void *arg, int iterations, uint64_t usec[2]);
+void TST_PrintTimes(const char *what, const char *name0, const char *name1,
+                    const uint64_t usec[2], int iterations);
 #else
 #define TST_Init() (void)0
 #endif
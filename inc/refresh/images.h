@@ -83,6 +83,8 @@ typedef struct image_s {
 #endif
 #if REF_VKPT
     byte            *pix_data; // todo: add miplevels
+    byte            *dds_data; // block compressed, set instead of pix_data when loaded from the texture cache
+    size_t          dds_size;
     vec3_t          light_color; // use this color if this is a light source
 	vec2_t          min_light_texcoord;
 	vec2_t          max_light_texcoord;
@@ -107,6 +109,9 @@ extern uint32_t d_8to24table[256];
 // these are implemented in src/refresh/images.c
 void IMG_ReloadAll();
 image_t *IMG_Find(const char *name, imagetype_t type, imageflags_t flags);
+void IMG_QueueLoad(const char *name, imagetype_t type, imageflags_t flags);
+void IMG_FlushLoads(void);
+void IMG_EndFrame(void);
 void IMG_FreeUnused(void);
 void IMG_FreeAll(void);
 void IMG_Init(void);
@@ -124,6 +129,15 @@ extern void (*IMG_Unload)(image_t *image);
 extern void (*IMG_Load)(image_t *image, byte *pic);
 extern byte* (*IMG_ReadPixels)(int *width, int *height, int *rowbytes);
 
+// optional cache of preprocessed images. IMG_ReadCache is called on the main
+// thread with the source file found for the image and returns the cache entry
+// for it, if any. IMG_LoadCache may be called from worker threads; it checks
+// the entry against the source file contents and takes ownership of it if
+// the image could be loaded from it.
+extern void* (*IMG_ReadCache)(const image_t *image, size_t *len);
+extern qboolean (*IMG_LoadCache)(image_t *image, void *cache, size_t cache_len,
+                                 const void *src, size_t src_len);
+
 #endif // IMAGES_H
 
 /* vim: set ts=8 sw=4 tw=0 et : */
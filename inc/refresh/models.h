@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // models.h -- common models manager
 //
 
+#include "shared/list.h"
 #include "system/hunk.h"
 #include "common/error.h"
 
@@ -55,6 +56,7 @@ typedef struct model_s {
         MOD_SPRITE,
         MOD_EMPTY
     } type;
+    list_t entry;
     char name[MAX_QPATH];
     int registration_sequence;
     memhunk_t hunk;
@@ -107,5 +109,7 @@ extern qerror_t (*MOD_LoadMD2)(model_t *model, const void *rawdata, size_t lengt
 extern qerror_t (*MOD_LoadMD3)(model_t *model, const void *rawdata, size_t length);
 #endif
 extern void (*MOD_Reference)(model_t *model);
+// optional, releases renderer resources before the model hunk is freed
+extern void (*MOD_Unload)(model_t *model);
 
 #endif // MODELS_H
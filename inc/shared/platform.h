@@ -124,6 +124,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define q_unused            __attribute__((unused))
 
+#define q_thread_local      __thread
+
+// atomics are only used on naturally aligned 32-bit integers
+#define q_atomic_load(p)        __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define q_atomic_store(p, v)    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define q_atomic_add(p, v)      __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL)
+
 #else /* __GNUC__ */
 
 #define q_printf(f, a)
@@ -146,4 +153,21 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define q_unused
 
+#ifdef _MSC_VER
+#include <intrin.h>
+
+#define q_thread_local      __declspec(thread)
+
+#define q_atomic_load(p)        (*(volatile long *)(p))
+#define q_atomic_store(p, v)    (*(volatile long *)(p) = (v))
+#define q_atomic_add(p, v)      _InterlockedExchangeAdd((volatile long *)(p), (v))
+#endif
+
 #endif /* !__GNUC__ */
+
+// SSE2 is always there on x86-64 and optional on 32-bit x86
+#if (defined __SSE2__) || (defined _M_AMD64) || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define USE_SSE2    1
+#else
+#define USE_SSE2    0
+#endif
@@ -27,10 +27,32 @@ void    Sys_FreeLibrary(void *handle);
 void    *Sys_GetProcAddress(void *handle, const char *sym);
 
 unsigned    Sys_Milliseconds(void);
+uint64_t    Sys_Microseconds(void);
 void    Sys_Sleep(int msec);
 qboolean Sys_IsDir(const char *path);
 qboolean Sys_IsFile(const char *path);
 
+// threads and synchronization primitives
+typedef struct sys_thread_s     sys_thread_t;
+typedef struct sys_mutex_s      sys_mutex_t;
+typedef struct sys_cond_s       sys_cond_t;
+
+sys_thread_t    *Sys_CreateThread(void (*func)(void *), void *arg);
+void    Sys_JoinThread(sys_thread_t *thread);
+int     Sys_NumProcessors(void);
+
+sys_mutex_t     *Sys_CreateMutex(void);
+void    Sys_DestroyMutex(sys_mutex_t *mutex);
+void    Sys_LockMutex(sys_mutex_t *mutex);
+void    Sys_UnlockMutex(sys_mutex_t *mutex);
+
+// waiting with negative msec never times out, returns qfalse on timeout
+sys_cond_t      *Sys_CreateCond(void);
+void    Sys_DestroyCond(sys_cond_t *cond);
+qboolean Sys_WaitCond(sys_cond_t *cond, sys_mutex_t *mutex, int msec);
+void    Sys_SignalCond(sys_cond_t *cond);
+void    Sys_BroadcastCond(sys_cond_t *cond);
+
 void    Sys_Init(void);
 void    Sys_AddDefaultConfig(void);
 
@@ -747,6 +747,33 @@ static void CL_PlayDemo_f(void)
     }
 }
 
+/*
+====================
+CL_CaptureDemo_f
+
+Plays back a demo saving every frame as a screenshot at a fixed frame rate,
+capturing stops when the demo ends.
+====================
+*/
+static void CL_CaptureDemo_f(void)
+{
+    char name[MAX_QPATH];
+    char *next;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <filename> [fps] [format]\n", Cmd_Argv(0));
+        return;
+    }
+
+    COM_StripExtension(COM_SkipPath(Cmd_Argv(1)), name, sizeof(name));
+
+    next = Cvar_VariableString("nextserver");
+    Cvar_Set("nextserver", *next ? va("capture stop; %s", next) : "capture stop");
+
+    Cbuf_InsertText(&cmd_buffer, va("demo \"%s\"\ncapture \"%s\" %s %s\n", Cmd_Argv(1), name,
+                                    Cmd_Argc() > 2 ? Cmd_Argv(2) : "60", Cmd_Argv(3)));
+}
+
 static void CL_Demo_c(genctx_t *ctx, int argnum)
 {
     if (argnum == 1) {
@@ -1257,6 +1284,7 @@ void CL_DemoFrame(int msec)
 
 static const cmdreg_t c_demo[] = {
     { "demo", CL_PlayDemo_f, CL_Demo_c },
+    { "capturedemo", CL_CaptureDemo_f, CL_Demo_c },
     { "record", CL_Record_f, CL_Demo_c },
     { "stop", CL_Stop_f },
     { "suspend", CL_Suspend_f },
@@ -3176,7 +3176,9 @@ unsigned CL_Frame(unsigned msec)
     main_extra += msec;
     cls.realtime += msec;
 
+    PROF_BEGIN("CL_ProcessEvents");
     CL_ProcessEvents();
+    PROF_END();
 
     ref_frame = phys_frame = qtrue;
     switch (sync_mode) {
@@ -3286,7 +3288,9 @@ unsigned CL_Frame(unsigned msec)
     CL_SendCmd();
 
     // predict all unacknowledged movements
+    PROF_BEGIN("CL_PredictMovement");
     CL_PredictMovement();
+    PROF_END();
 
     Con_RunConsole();
 
@@ -3297,7 +3301,9 @@ unsigned CL_Frame(unsigned msec)
         if (host_speeds->integer)
             time_before_ref = Sys_Milliseconds();
 
+        PROF_BEGIN("SCR_UpdateScreen");
         SCR_UpdateScreen();
+        PROF_END();
 
         if (host_speeds->integer)
             time_after_ref = Sys_Milliseconds();
@@ -3307,7 +3313,9 @@ unsigned CL_Frame(unsigned msec)
 
 run_fx:
         // update audio after the 3D view was drawn
+        PROF_BEGIN("S_Update");
         S_Update();
+        PROF_END();
 
         // advance local effects for next frame
 #if USE_DLIGHTS
@@ -205,6 +205,7 @@ void CL_RegisterSounds(void)
     int i;
     char    *s;
 
+    PROF_BEGIN("CL_RegisterSounds");
     S_BeginRegistration();
     CL_RegisterTEntSounds();
     for (i = 1; i < MAX_SOUNDS; i++) {
@@ -214,6 +215,7 @@ void CL_RegisterSounds(void)
         cl.sound_precache[i] = S_RegisterSound(s);
     }
     S_EndRegistration();
+    PROF_END();
 }
 
 /*
@@ -340,11 +342,17 @@ void CL_PrepRefresh(void)
     if (!cl.mapname[0])
         return;     // no map loaded
 
+    PROF_BEGIN("CL_PrepRefresh");
+
     // register models, pics, and skins
+    PROF_BEGIN("R_BeginRegistration");
     R_BeginRegistration(cl.mapname);
+    PROF_END();
 
     CL_LoadState(LOAD_MODELS);
 
+    PROF_BEGIN("R_RegisterModels");
+
     CL_RegisterTEntModels();
 
 #if CL_RTX_SHADERBALLS
@@ -366,8 +374,10 @@ void CL_PrepRefresh(void)
         }
         cl.model_draw[i] = R_RegisterModel(name);
     }
+    PROF_END();
 
     CL_LoadState(LOAD_IMAGES);
+    PROF_BEGIN("R_RegisterPics");
     for (i = 1; i < MAX_IMAGES; i++) {
         name = cl.configstrings[CS_IMAGES + i];
         if (!name[0]) {
@@ -375,8 +385,10 @@ void CL_PrepRefresh(void)
         }
         cl.image_precache[i] = R_RegisterPic2(name);
     }
+    PROF_END();
 
     CL_LoadState(LOAD_CLIENTS);
+    PROF_BEGIN("CL_LoadClientinfo");
     for (i = 0; i < MAX_CLIENTS; i++) {
         name = cl.configstrings[CS_PLAYERSKINS + i];
         if (!name[0]) {
@@ -386,12 +398,17 @@ void CL_PrepRefresh(void)
     }
 
     CL_LoadClientinfo(&cl.baseclientinfo, "unnamed\\male/grunt");
+    PROF_END();
 
     // set sky textures and speed
     CL_SetSky();
 
     // the renderer can now free unneeded stuff
+    PROF_BEGIN("R_EndRegistration");
     R_EndRegistration();
+    PROF_END();
+
+    PROF_END();
 
     // clear any lines of console text
     Con_ClearNotify_f();
@@ -424,12 +424,15 @@ void(*R_AddDecal)(decal_t *d) = NULL;
 void(*IMG_Unload)(image_t *image) = NULL;
 void(*IMG_Load)(image_t *image, byte *pic) = NULL;
 byte* (*IMG_ReadPixels)(int *width, int *height, int *rowbytes) = NULL;
+void* (*IMG_ReadCache)(const image_t *image, size_t *len) = NULL;
+qboolean(*IMG_LoadCache)(image_t *image, void *cache, size_t cache_len, const void *src, size_t src_len) = NULL;
 
 qerror_t(*MOD_LoadMD2)(model_t *model, const void *rawdata, size_t length) = NULL;
 #if USE_MD3
 qerror_t(*MOD_LoadMD3)(model_t *model, const void *rawdata, size_t length) = NULL;
 #endif
 void(*MOD_Reference)(model_t *model) = NULL;
+void(*MOD_Unload)(model_t *model) = NULL;
 
 float R_ClampScale(cvar_t *var)
 {
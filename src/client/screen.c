@@ -53,6 +53,7 @@ static struct {
 cvar_t   *scr_viewsize;
 static cvar_t   *scr_centertime;
 static cvar_t   *scr_showpause;
+static cvar_t   *scr_profiler;
 #ifdef _DEBUG
 static cvar_t   *scr_showstats;
 static cvar_t   *scr_showpmove;
@@ -1008,6 +1009,39 @@ static void SCR_DrawTurtle(void)
 #undef DF
 }
 
+static void SCR_DrawProfiler(void)
+{
+    prof_stat_t stats[PROF_MAX_ZONES];
+    char buffer[MAX_QPATH];
+    int i, count, x, y;
+
+    if (!scr_profiler->integer || !prof_active)
+        return;
+
+    count = Prof_GetStats(stats, PROF_MAX_ZONES);
+    if (scr_profiler->integer > 1 && count > scr_profiler->integer)
+        count = scr_profiler->integer;
+
+    R_SetScale(scr.hud_scale);
+
+    x = CHAR_WIDTH;
+    y = CHAR_HEIGHT * 4;
+    R_DrawString(x, y, UI_ALTCOLOR, MAX_STRING_CHARS,
+                 "zone                         avg ms  max ms", scr.font_pic);
+    y += CHAR_HEIGHT;
+
+    for (i = 0; i < count; i++) {
+        Q_snprintf(buffer, sizeof(buffer), "%*s%-*.*s %7.2f %7.2f",
+                   stats[i].depth, "", 28 - stats[i].depth,
+                   28 - stats[i].depth, stats[i].name,
+                   stats[i].avg_msec, stats[i].max_msec);
+        R_DrawString(x, y, 0, MAX_STRING_CHARS, buffer, scr.font_pic);
+        y += CHAR_HEIGHT;
+    }
+
+    R_SetScale(1.0f);
+}
+
 #ifdef _DEBUG
 
 static void SCR_DrawDebugStats(void)
@@ -1389,6 +1423,7 @@ void SCR_Init(void)
     scr_lag_max = Cvar_Get("scr_lag_max", "200", 0);
 	scr_alpha = Cvar_Get("scr_alpha", "1", 0);
 	scr_fps = Cvar_Get("scr_fps", "0", CVAR_ARCHIVE);
+    scr_profiler = Cvar_Get("scr_profiler", "0", 0);
 #ifdef _DEBUG
     scr_showstats = Cvar_Get("scr_showstats", "0", 0);
     scr_showpmove = Cvar_Get("scr_showpmove", "0", 0);
@@ -2132,7 +2167,9 @@ void SCR_UpdateScreen(void)
 
     recursive++;
 
+    PROF_BEGIN("R_BeginFrame");
     R_BeginFrame();
+    PROF_END();
 
     // do 3D refresh drawing
     SCR_DrawActive();
@@ -2155,7 +2192,11 @@ void SCR_UpdateScreen(void)
         SCR_DrawDebugGraph();
 #endif
 
+    SCR_DrawProfiler();
+
+    PROF_BEGIN("R_EndFrame");
     R_EndFrame();
+    PROF_END();
 
     recursive--;
 }
@@ -19,17 +19,59 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "sound.h"
 
+#define MIX_QUEUE_SIZE      1024    // initial size, must be power of two
+#define MIX_INTERVAL        5       // msec mixer sleeps if not woken up
+
 dma_t       dma;
 
 cvar_t      *s_khz;
 cvar_t      *s_testsound;
+cvar_t      *s_mixahead;
+cvar_t      *s_resample;
+cvar_t      *s_resample_cache;
 #if USE_DSOUND
 static cvar_t       *s_direct;
 #endif
-static cvar_t       *s_mixahead;
+static cvar_t       *s_mixthread;
+static cvar_t       *s_nulldma;
 
 static snddmaAPI_t snddma;
 
+// single producer, single consumer command queue. main thread fills it
+// during the frame and publishes the whole batch at once in DMA_Update,
+// so that the mixer never sees half updated channel state. commands are
+// never dropped: main thread waits for the mixer when the queue is full,
+// and grows it while the mixer is idle if one frame fills it alone.
+static struct {
+    mixcmd_t    *cmds;
+    unsigned    size;       // power of two
+    unsigned    head;       // written by main thread
+    unsigned    tail;       // written by mixer
+    unsigned    pending;    // main thread only, head of unpublished batch
+    unsigned    stalls;     // main thread only, waits for a full queue
+} mixq;
+
+static struct {
+    sys_thread_t    *thread;
+    sys_mutex_t     *lock;
+    sys_cond_t      *wake;
+    int             quit;
+    int             reset;      // paintedtime wrapped, main thread must stop sounds
+
+    // written by mixer only
+    unsigned        updates;
+    unsigned        underruns;
+    unsigned        commands;
+    unsigned        max_usec;
+    uint64_t        usec;
+} mixer;
+
+#if USE_TESTS
+static void StressFrame(void);
+static void StressAccount(uint64_t start);
+static void StressFinish(void);
+#endif
+
 void DMA_SoundInfo(void)
 {
     Com_Printf("%5d channels\n", dma.channels);
@@ -39,8 +81,272 @@ void DMA_SoundInfo(void)
     Com_Printf("%5d submission_chunk\n", dma.submission_chunk);
     Com_Printf("%5d speed\n", dma.speed);
     Com_Printf("%p dma buffer\n", dma.buffer);
+    Com_Printf("mixer %s: %u updates, %.3f avg / %.3f max msec, "
+               "%u underruns, %u commands, %u queue stalls, queue size %u\n",
+               mixer.thread ? "thread" : "synchronous", mixer.updates,
+               mixer.usec * 0.001 / max(mixer.updates, 1),
+               mixer.max_usec * 0.001, mixer.underruns, mixer.commands,
+               mixq.stalls, mixq.size);
+}
+
+/*
+===============================================================================
+
+NULL OUTPUT
+
+Mixed samples are consumed in real time and discarded. Useful for machines
+without audio hardware and for benchmarking the mixer.
+
+===============================================================================
+*/
+
+static uint64_t null_start;
+
+static sndinitstat_t NULL_Init(void)
+{
+    switch (s_khz->integer) {
+    case 48:
+        dma.speed = 48000;
+        break;
+    case 44:
+        dma.speed = 44100;
+        break;
+    case 22:
+        dma.speed = 22050;
+        break;
+    default:
+        dma.speed = 11025;
+        break;
+    }
+
+    dma.channels = 2;
+    dma.samples = 0x8000 * dma.channels;
+    dma.submission_chunk = 1;
+    dma.samplebits = 16;
+    dma.buffer = Z_Mallocz(dma.samples * 2);
+    dma.samplepos = 0;
+
+    null_start = Sys_Microseconds();
+
+    Com_Printf("Using null audio output\n");
+
+    return SIS_SUCCESS;
+}
+
+static void NULL_Shutdown(void)
+{
+    Com_Printf("Shutting down null audio output.\n");
+
+    if (dma.buffer) {
+        Z_Free(dma.buffer);
+        dma.buffer = NULL;
+    }
+}
+
+static void NULL_BeginPainting(void)
+{
+    uint64_t samples = (Sys_Microseconds() - null_start) * dma.speed / 1000000;
+
+    dma.samplepos = samples * dma.channels % dma.samples;
+}
+
+static void NULL_Submit(void)
+{
+}
+
+static void NULL_FillAPI(snddmaAPI_t *api)
+{
+    api->Init = NULL_Init;
+    api->Shutdown = NULL_Shutdown;
+    api->BeginPainting = NULL_BeginPainting;
+    api->Submit = NULL_Submit;
+    api->Activate = NULL;
+}
+
+/*
+===============================================================================
+
+MIXER
+
+===============================================================================
+*/
+
+static int DMA_GetTime(void)
+{
+    static  int     buffers;
+    static  int     oldsamplepos;
+    int fullsamples = dma.samples / dma.channels;
+
+// it is possible to miscount buffers if it has wrapped twice between
+// calls to S_Update.  Oh well.
+    if (dma.samplepos < oldsamplepos) {
+        buffers++;                  // buffer wrapped
+        if (paintedtime > 0x40000000) {
+            // time to chop things off to avoid 32 bit limits
+            buffers = 0;
+            q_atomic_store(&paintedtime, fullsamples);
+            S_StopAllVoices();
+            q_atomic_store(&mixer.reset, 1);
+        }
+    }
+    oldsamplepos = dma.samplepos;
+
+    return buffers * fullsamples + dma.samplepos / dma.channels;
+}
+
+static void DMA_ExecuteCommands(void)
+{
+    unsigned head, tail;
+
+    head = q_atomic_load(&mixq.head);
+    for (tail = mixq.tail; tail != head; tail++) {
+        S_ExecuteMixCommand(&mixq.cmds[tail & (mixq.size - 1)]);
+        mixer.commands++;
+    }
+    q_atomic_store(&mixq.tail, tail);
 }
 
+// called from mixer thread, or from main thread if there is none
+static void DMA_Mix(void)
+{
+    int soundtime, endtime;
+    int samps;
+    uint64_t start;
+    unsigned usec;
+
+    start = Sys_Microseconds();
+
+    DMA_ExecuteCommands();
+
+    snddma.BeginPainting();
+
+    if (!dma.buffer)
+        return;
+
+// Updates DMA time
+    soundtime = DMA_GetTime();
+
+// check to make sure that we haven't overshot
+    if (paintedtime < soundtime) {
+        mixer.underruns++;
+        q_atomic_store(&paintedtime, soundtime);
+    }
+
+// mix ahead of current position
+    endtime = soundtime + s_mixahead->value * dma.speed;
+//endtime = (soundtime + 4096) & ~4095;
+
+    // mix to an even submission block size
+    endtime = (endtime + dma.submission_chunk - 1)
+              & ~(dma.submission_chunk - 1);
+    samps = dma.samples >> (dma.channels - 1);
+    if (endtime - soundtime > samps)
+        endtime = soundtime + samps;
+
+    S_PaintChannels(endtime);
+
+    snddma.Submit();
+
+    usec = Sys_Microseconds() - start;
+    mixer.usec += usec;
+    mixer.max_usec = max(mixer.max_usec, usec);
+    mixer.updates++;
+}
+
+static void DMA_MixerThread(void *arg)
+{
+    Prof_SetThreadName("mixer");
+
+    while (!q_atomic_load(&mixer.quit)) {
+        PROF_BEGIN("DMA_Mix");
+        DMA_Mix();
+        PROF_END();
+
+        // woken up early by main thread when new commands are published
+        Sys_LockMutex(mixer.lock);
+        if (!mixer.quit)
+            Sys_WaitCond(mixer.wake, mixer.lock, MIX_INTERVAL);
+        Sys_UnlockMutex(mixer.lock);
+    }
+
+    Prof_ReleaseThread();
+}
+
+static void DMA_StartMixer(void)
+{
+    mixer.lock = Sys_CreateMutex();
+    mixer.wake = Sys_CreateCond();
+    mixer.quit = 0;
+    mixer.thread = Sys_CreateThread(DMA_MixerThread, NULL);
+    if (!mixer.thread) {
+        Com_WPrintf("Couldn't start mixer thread, mixing synchronously.\n");
+        Sys_DestroyCond(mixer.wake);
+        Sys_DestroyMutex(mixer.lock);
+    }
+}
+
+static void DMA_StopMixer(void)
+{
+    if (!mixer.thread)
+        return;
+
+    Sys_LockMutex(mixer.lock);
+    mixer.quit = 1;
+    Sys_SignalCond(mixer.wake);
+    Sys_UnlockMutex(mixer.lock);
+
+    Sys_JoinThread(mixer.thread);
+    Sys_DestroyCond(mixer.wake);
+    Sys_DestroyMutex(mixer.lock);
+    mixer.thread = NULL;
+}
+
+// waits for mixer to apply published commands. mixer doesn't touch the
+// queue storage after that until more commands are published.
+static void DMA_WaitMixer(void)
+{
+    if (!mixer.thread) {
+        DMA_ExecuteCommands();
+        return;
+    }
+
+    while (q_atomic_load(&mixq.tail) != mixq.head) {
+        Sys_SignalCond(mixer.wake);
+        Sys_Sleep(1);
+    }
+}
+
+// publishes queued commands and waits for mixer to apply them
+static void DMA_Sync(void)
+{
+    q_atomic_store(&mixq.head, mixq.pending);
+    DMA_WaitMixer();
+}
+
+// doubles queue size, keeping unpublished commands. mixer must be idle.
+static void DMA_GrowQueue(void)
+{
+    unsigned size = mixq.size * 2;
+    mixcmd_t *cmds = S_Malloc(size * sizeof(*cmds));
+    unsigned i;
+
+    for (i = mixq.tail; i != mixq.pending; i++) {
+        cmds[i & (size - 1)] = mixq.cmds[i & (mixq.size - 1)];
+    }
+
+    Z_Free(mixq.cmds);
+    mixq.cmds = cmds;
+    mixq.size = size;
+}
+
+/*
+===============================================================================
+
+MAIN THREAD INTERFACE
+
+===============================================================================
+*/
+
 qboolean DMA_Init(void)
 {
     sndinitstat_t ret = SIS_FAILURE;
@@ -48,10 +354,18 @@ qboolean DMA_Init(void)
     s_khz = Cvar_Get("s_khz", "44", CVAR_ARCHIVE | CVAR_SOUND);
     s_mixahead = Cvar_Get("s_mixahead", "0.1", CVAR_ARCHIVE);
     s_testsound = Cvar_Get("s_testsound", "0", 0);
+    s_mixthread = Cvar_Get("s_mixthread", "1", CVAR_SOUND);
+    s_nulldma = Cvar_Get("s_nulldma", "0", CVAR_SOUND);
+    s_resample = Cvar_Get("s_resample", "1", CVAR_ARCHIVE | CVAR_SOUND);
+    s_resample_cache = Cvar_Get("s_resample_cache", "1", 0);
 
+    if (s_nulldma->integer) {
+        NULL_FillAPI(&snddma);
+        ret = snddma.Init();
+    }
 #if USE_DSOUND
     s_direct = Cvar_Get("s_direct", "1", CVAR_SOUND);
-    if (s_direct->integer) {
+    if (ret != SIS_SUCCESS && s_direct->integer) {
         DS_FillAPI(&snddma);
         ret = snddma.Init();
         if (ret != SIS_SUCCESS) {
@@ -67,10 +381,21 @@ qboolean DMA_Init(void)
         }
     }
 
+    memset(&mixq, 0, sizeof(mixq));
+    memset(&mixer, 0, sizeof(mixer));
+
+    mixq.size = MIX_QUEUE_SIZE;
+    mixq.cmds = S_Malloc(mixq.size * sizeof(mixq.cmds[0]));
+
+    S_StopAllVoices();
     S_InitScaletable();
 
     s_numchannels = MAX_CHANNELS;
 
+    if (s_mixthread->integer) {
+        DMA_StartMixer();
+    }
+
     Com_Printf("sound sampling rate: %i\n", dma.speed);
 
     return qtrue;
@@ -78,7 +403,14 @@ qboolean DMA_Init(void)
 
 void DMA_Shutdown(void)
 {
+#if USE_TESTS
+    StressFinish();
+#endif
+    DMA_StopMixer();
     snddma.Shutdown();
+    S_FreeResampler();
+    Z_Free(mixq.cmds);
+    mixq.cmds = NULL;
     s_numchannels = 0;
 }
 
@@ -86,7 +418,13 @@ void DMA_Activate(void)
 {
     if (snddma.Activate) {
         S_StopAllSounds();
+
+        // output buffers may be recreated, mixer must not paint meanwhile
+        DMA_StopMixer();
         snddma.Activate(s_active);
+        if (s_mixthread->integer) {
+            DMA_StartMixer();
+        }
     }
 }
 
@@ -125,61 +463,232 @@ void DMA_ClearBuffer(void)
     snddma.Submit();
 }
 
-static int DMA_GetTime(void)
-{
-    static  int     buffers;
-    static  int     oldsamplepos;
-    int fullsamples = dma.samples / dma.channels;
+/*
+=================
+DMA_QueueCommand
 
-// it is possible to miscount buffers if it has wrapped twice between
-// calls to S_Update.  Oh well.
-    if (dma.samplepos < oldsamplepos) {
-        buffers++;                  // buffer wrapped
-        if (paintedtime > 0x40000000) {
-            // time to chop things off to avoid 32 bit limits
-            buffers = 0;
-            paintedtime = fullsamples;
-            S_StopAllSounds();
+If the queue is full, waits for the mixer to apply published commands.
+If commands queued this frame fill the queue by themselves, grows it.
+=================
+*/
+void DMA_QueueCommand(const mixcmd_t *cmd)
+{
+    if (mixq.pending - q_atomic_load(&mixq.tail) >= mixq.size) {
+        mixq.stalls++;
+        DMA_WaitMixer();
+        if (mixq.pending - mixq.tail >= mixq.size) {
+            DMA_GrowQueue();
         }
     }
-    oldsamplepos = dma.samplepos;
 
-    return buffers * fullsamples + dma.samplepos / dma.channels;
+    mixq.cmds[mixq.pending++ & (mixq.size - 1)] = *cmd;
 }
 
+/*
+=================
+DMA_StopAllSounds
+
+Stops all mixer channels and clears the DMA buffer before returning, so
+that sound effects may be freed afterwards. This waits for the mixer.
+=================
+*/
+void DMA_StopAllSounds(void)
+{
+    mixcmd_t cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.op = MIX_STOPALL;
+    DMA_QueueCommand(&cmd);
+    DMA_Sync();
+}
+
+/*
+=================
+DMA_Update
+
+Called once per frame after all commands for this frame have been queued.
+=================
+*/
 void DMA_Update(void)
 {
-    int soundtime, endtime;
-    int samps;
+#if USE_TESTS
+    uint64_t start = Sys_Microseconds();
 
-    snddma.BeginPainting();
+    StressFrame();
+#endif
 
-    if (!dma.buffer)
+    // publish commands queued this frame as a single batch
+    q_atomic_store(&mixq.head, mixq.pending);
+
+    if (mixer.thread) {
+        Sys_SignalCond(mixer.wake);
+    } else {
+        DMA_Mix();
+    }
+
+    if (q_atomic_load(&mixer.reset)) {
+        q_atomic_store(&mixer.reset, 0);
+        S_StopAllSounds();
+    }
+
+#if USE_TESTS
+    StressAccount(start);
+#endif
+}
+
+#if USE_TESTS
+
+/*
+===============================================================================
+
+STRESS TEST
+
+Starts sounds at the given rate from random origins around the listener and
+reports time spent by mixer and by main thread in DMA_Update. Use with
+s_nulldma 1 to run without audio hardware, and with s_mixthread 0 to compare
+against synchronous mixing.
+
+===============================================================================
+*/
+
+static const char *const stress_sounds[] = {
+    "weapons/blastf1a.wav",
+    "weapons/machgf1b.wav",
+    "weapons/rocklx1a.wav",
+    "world/ric1.wav",
+    "world/ric2.wav",
+    "misc/menu1.wav"
+};
+
+static struct {
+    qhandle_t   handles[q_countof(stress_sounds)];
+    int         rate;
+    uint64_t    start, last, end;
+    float       budget;
+    unsigned    started;
+    unsigned    frames;
+    uint64_t    main_usec;
+    unsigned    main_max;
+    unsigned    updates;
+    unsigned    underruns;
+    unsigned    commands;
+    unsigned    stalls;
+    uint64_t    mix_usec;
+} stress;
+
+static void StressFinish(void)
+{
+    unsigned updates;
+    float secs;
+
+    if (!stress.rate)
         return;
 
-// Updates DMA time
-    soundtime = DMA_GetTime();
+    secs = (stress.last - stress.start) * 1e-6f;
+    updates = mixer.updates - stress.updates;
+
+    Com_Printf("%u sounds started in %.1f sec (%u frames)\n",
+               stress.started, secs, stress.frames);
+    Com_Printf("main thread: %.3f avg / %.3f max msec per frame\n",
+               stress.main_usec * 0.001 / max(stress.frames, 1),
+               stress.main_max * 0.001);
+    Com_Printf("mixer %s: %u updates, %.3f avg msec, %.1f%% busy, "
+               "%u underruns, %u commands, %u queue stalls\n",
+               mixer.thread ? "thread" : "synchronous", updates,
+               (mixer.usec - stress.mix_usec) * 0.001 / max(updates, 1),
+               (mixer.usec - stress.mix_usec) * 100.0 /
+               max(stress.last - stress.start, 1),
+               mixer.underruns - stress.underruns,
+               mixer.commands - stress.commands,
+               mixq.stalls - stress.stalls);
+
+    stress.rate = 0;
+}
 
-// check to make sure that we haven't overshot
-    if (paintedtime < soundtime) {
-        Com_DPrintf("S_Update_ : overflow\n");
-        paintedtime = soundtime;
+static void StressFrame(void)
+{
+    static const int channels[] = { CHAN_AUTO, CHAN_WEAPON, CHAN_VOICE, CHAN_ITEM, CHAN_BODY };
+    uint64_t now;
+    vec3_t origin;
+    int i;
+
+    if (!stress.rate)
+        return;
+
+    now = Sys_Microseconds();
+    stress.budget += (now - stress.last) * 1e-6f * stress.rate;
+    stress.last = now;
+
+    for (; stress.budget >= 1; stress.budget -= 1) {
+        for (i = 0; i < 3; i++)
+            origin[i] = listener_origin[i] + crand() * 512;
+
+        S_StartSound(origin, 1 + rand() % (MAX_EDICTS - 1),
+                     channels[rand() % q_countof(channels)],
+                     stress.handles[rand() % q_countof(stress.handles)],
+                     1, ATTN_NORM, 0);
+        stress.started++;
     }
+}
 
-// mix ahead of current position
-    endtime = soundtime + s_mixahead->value * dma.speed;
-//endtime = (soundtime + 4096) & ~4095;
+static void StressAccount(uint64_t start)
+{
+    unsigned usec;
 
-    // mix to an even submission block size
-    endtime = (endtime + dma.submission_chunk - 1)
-              & ~(dma.submission_chunk - 1);
-    samps = dma.samples >> (dma.channels - 1);
-    if (endtime - soundtime > samps)
-        endtime = soundtime + samps;
+    if (!stress.rate)
+        return;
 
-    S_PaintChannels(endtime);
+    usec = Sys_Microseconds() - start;
+    stress.main_usec += usec;
+    stress.main_max = max(stress.main_max, usec);
+    stress.frames++;
 
-    snddma.Submit();
+    if (stress.last >= stress.end) {
+        StressFinish();
+    }
 }
 
+void DMA_SoundStress_f(void)
+{
+    float secs;
+    int i;
+
+    if (s_started != SS_DMA) {
+        Com_Printf("DMA sound system not started.\n");
+        return;
+    }
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <sounds per second> [seconds]\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (stress.rate) {
+        StressFinish();
+    }
+
+    memset(&stress, 0, sizeof(stress));
+
+    for (i = 0; i < q_countof(stress_sounds); i++) {
+        stress.handles[i] = S_RegisterSound(stress_sounds[i]);
+    }
+
+    secs = Cmd_Argc() > 2 ? atof(Cmd_Argv(2)) : 10;
+    clamp(secs, 1, 3600);
+
+    stress.rate = atoi(Cmd_Argv(1));
+    clamp(stress.rate, 0, 1000000);
+    stress.start = stress.last = Sys_Microseconds();
+    stress.end = stress.start + secs * 1000000;
+    stress.updates = mixer.updates;
+    stress.underruns = mixer.underruns;
+    stress.commands = mixer.commands;
+    stress.stalls = mixq.stalls;
+    stress.mix_usec = mixer.usec;
+
+    if (!s_active) {
+        Com_Printf("Sound is not active, sounds will not be started.\n");
+    }
+}
 
+#endif // USE_TESTS
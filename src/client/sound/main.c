@@ -50,6 +50,9 @@ int         paintedtime;    // sample PAIRS
 static sfx_t        known_sfx[MAX_SFX];
 static int          num_sfx;
 
+#define     SFX_HASH    256
+static list_t       sfx_hash[SFX_HASH];
+
 #define     MAX_PLAYSOUNDS  128
 playsound_t s_playsounds[MAX_PLAYSOUNDS];
 playsound_t s_freeplays;
@@ -127,6 +130,10 @@ static const cmdreg_t c_sound[] = {
     { "stopsound", S_StopAllSounds },
     { "soundlist", S_SoundList_f },
     { "soundinfo", S_SoundInfo_f },
+#if USE_SNDDMA && USE_TESTS
+    { "mixtest", S_MixTest_f },
+    { "soundstress", DMA_SoundStress_f },
+#endif
 
     { NULL }
 };
@@ -147,6 +154,8 @@ S_Init
 */
 void S_Init(void)
 {
+    int     i;
+
     s_enable = Cvar_Get("s_enable", "2", CVAR_SOUND);
     if (s_enable->integer <= SS_NOT) {
         Com_Printf("Sound initialization disabled.\n");
@@ -163,6 +172,9 @@ void S_Init(void)
     s_auto_focus = Cvar_Get("s_auto_focus", "0", 0);
     s_swapstereo = Cvar_Get("s_swapstereo", "0", 0);
 
+    // mixer may start painting as soon as DMA is initialized
+    paintedtime = 0;
+
     // start one of available sound engines
     s_started = SS_NOT;
 
@@ -191,8 +203,8 @@ void S_Init(void)
     s_auto_focus_changed(s_auto_focus);
 
     num_sfx = 0;
-
-    paintedtime = 0;
+    for (i = 0; i < SFX_HASH; i++)
+        List_Init(&sfx_hash[i]);
 
     s_registration_sequence = 1;
     
@@ -220,6 +232,7 @@ static void S_FreeSound(sfx_t *sfx)
         Z_Free(sfx->cache);
     if (sfx->truename)
         Z_Free(sfx->truename);
+    List_Remove(&sfx->entry);
     memset(sfx, 0, sizeof(*sfx));
 }
 
@@ -350,11 +363,13 @@ S_FindName
 */
 static sfx_t *S_FindName(const char *name, size_t namelen)
 {
-    int     i;
-    sfx_t   *sfx;
+    unsigned    hash;
+    sfx_t       *sfx;
+
+    hash = FS_HashPathLen(name, namelen, SFX_HASH);
 
     // see if already loaded
-    for (i = 0, sfx = known_sfx; i < num_sfx; i++, sfx++) {
+    LIST_FOR_EACH(sfx_t, sfx, &sfx_hash[hash], entry) {
         if (!FS_pathcmp(sfx->name, name)) {
             sfx->registration_sequence = s_registration_sequence;
             return sfx;
@@ -366,6 +381,7 @@ static sfx_t *S_FindName(const char *name, size_t namelen)
     if (sfx) {
         memcpy(sfx->name, name, namelen + 1);
         sfx->registration_sequence = s_registration_sequence;
+        List_Append(&sfx_hash[hash], &sfx->entry);
     }
     return sfx;
 }
@@ -569,6 +585,21 @@ void S_EndRegistration(void)
 
 //=============================================================================
 
+#if USE_SNDDMA
+static void S_QueueMix(mixop_t op, const channel_t *ch, sfxcache_t *sc, int begin)
+{
+    mixcmd_t cmd;
+
+    cmd.op = op;
+    cmd.index = ch - channels;
+    cmd.leftvol = ch->leftvol;
+    cmd.rightvol = ch->rightvol;
+    cmd.begin = begin;
+    cmd.sc = sc;
+    DMA_QueueCommand(&cmd);
+}
+#endif
+
 /*
 =================
 S_PickChannel
@@ -618,6 +649,10 @@ channel_t *S_PickChannel(int entnum, int entchannel)
 #if USE_OPENAL
     if (s_started == SS_OAL && ch->sfx)
         AL_StopChannel(ch);
+#endif
+#if USE_SNDDMA
+    if (s_started == SS_DMA && ch->sfx)
+        S_QueueMix(MIX_STOP, ch, NULL, 0);
 #endif
     memset(ch, 0, sizeof(*ch));
 
@@ -760,6 +795,7 @@ void S_IssuePlaysound(playsound_t *ps)
 {
     channel_t   *ch;
     sfxcache_t  *sc;
+    int         begin;
 
 #ifdef _DEBUG
     if (s_show->integer)
@@ -801,8 +837,16 @@ void S_IssuePlaysound(playsound_t *ps)
         S_Spatialize(ch);
 #endif
 
+    // DMA sounds are issued ahead of time and delayed by the mixer
+    begin = max(paintedtime, (int)ps->begin);
+
     ch->pos = 0;
-    ch->end = paintedtime + sc->length;
+    ch->end = begin + sc->length;
+
+#if USE_SNDDMA
+    if (s_started == SS_DMA)
+        S_QueueMix(MIX_START, ch, sc, begin);
+#endif
 
     // free the playsound
     S_FreePlaysound(ps);
@@ -955,7 +999,7 @@ void S_StopAllSounds(void)
 
 #if USE_SNDDMA
     if (s_started == SS_DMA)
-        DMA_ClearBuffer();
+        DMA_StopAllSounds();
 #endif
 
     // clear all the channels
@@ -1065,6 +1109,8 @@ static void S_AddLoopSounds(void)
         ch->sfx = sfx;
         ch->pos = paintedtime % sc->length;
         ch->end = paintedtime + sc->length - ch->pos;
+
+        S_QueueMix(MIX_LOOP, ch, sc, 0);
     }
 }
 
@@ -1082,6 +1128,9 @@ void S_Update(void)
 #if USE_SNDDMA
     int         i;
     channel_t   *ch;
+    sfxcache_t  *sc;
+    playsound_t *ps;
+    int         painted, horizon;
 #endif
 
     if (cvar_modified & CVAR_SOUND) {
@@ -1122,6 +1171,8 @@ void S_Update(void)
     if (s_volume->modified)
         S_InitScaletable();
 
+    painted = q_atomic_load(&paintedtime);
+
     // update spatialization for dynamic sounds
     ch = channels;
     for (i = 0; i < s_numchannels; i++, ch++) {
@@ -1129,14 +1180,37 @@ void S_Update(void)
             continue;
         if (ch->autosound) {
             // autosounds are regenerated fresh each frame
+            S_QueueMix(MIX_STOP, ch, NULL, 0);
             memset(ch, 0, sizeof(*ch));
             continue;
         }
+        // mixer stops finished sounds and restarts looped ones on its own
+        sc = ch->sfx->cache;
+        if (ch->end - painted <= 0) {
+            if (!sc || sc->loopstart < 0) {
+                memset(ch, 0, sizeof(*ch));
+                continue;
+            }
+            ch->end = painted + sc->length - sc->loopstart;
+        }
         S_Spatialize(ch);         // respatialize channel
         if (!ch->leftvol && !ch->rightvol) {
+            S_QueueMix(MIX_STOP, ch, NULL, 0);
             memset(ch, 0, sizeof(*ch));
             continue;
         }
+        S_QueueMix(MIX_SPATIALIZE, ch, NULL, 0);
+    }
+
+    // start any playsounds that begin before the next mix
+    horizon = painted + s_mixahead->value * dma.speed;
+    while (1) {
+        ps = s_pendingplays.next;
+        if (ps == &s_pendingplays)
+            break;    // no more pending sounds
+        if ((int)ps->begin > horizon)
+            break;
+        S_IssuePlaysound(ps);
     }
 
     // add loopsounds
@@ -1163,7 +1237,7 @@ void S_Update(void)
     }
 #endif
 
-// mix some sound
+// hand this frame's commands to the mixer
     DMA_Update();
 #endif
 }
@@ -18,38 +18,333 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // snd_mem.c: sound caching
 
 #include "sound.h"
+#include "common/mdfour.h"
 
 wavinfo_t s_info;
 
 #if USE_SNDDMA
+
+/*
+===============================================================================
+
+RESAMPLING
+
+Sounds are converted to the output rate with a Kaiser windowed sinc filter.
+The ratio is reduced to up/down and a table of filter phases is built for
+it; when up is too large to tabulate every phase, the nearest of
+RESAMPLE_MAX_PHASES phases is used instead. Resampled data is always 16 bit
+and is cached on disk, keyed by checksum of the source file.
+
+===============================================================================
+*/
+
+#define RESAMPLE_ZEROS          16      // zero crossings on each side
+#define RESAMPLE_MAX_PHASES     1024
+#define RESAMPLE_BETA           8.0     // Kaiser window shape
+#define RESAMPLE_ROLLOFF        0.95    // cutoff relative to Nyquist
+
+#define RESAMPLE_CACHE_IDENT    MakeRawLong('S', 'R', 'C', '1')
+#define RESAMPLE_CACHE_VERSION  1       // bump when filter changes
+
+typedef struct {
+    uint32_t    ident;
+    uint32_t    version;
+    uint32_t    checksum;       // of source file
+    uint32_t    rate;
+    uint32_t    length;
+    int32_t     loopstart;
+} dsfxcache_t;
+
+static struct {
+    int     from, to;           // rates table was built for
+    int     up, down;
+    int     phases;
+    int     taps;               // multiple of 4
+    float   *coefs;             // phases * taps
+} filter;
+
+static int gcd(int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// zeroth order modified Bessel function of the first kind
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    int k;
+
+    for (k = 1; k < 32; k++) {
+        term *= (x * 0.5 / k) * (x * 0.5 / k);
+        sum += term;
+    }
+
+    return sum;
+}
+
+static void BuildFilter(int from, int to)
+{
+    double cutoff, half, t, x, w, h, sum;
+    int g, p, k;
+    float *c;
+
+    if (filter.from == from && filter.to == to)
+        return;
+
+    Z_Free(filter.coefs);
+
+    g = gcd(from, to);
+    filter.from = from;
+    filter.to = to;
+    filter.up = to / g;
+    filter.down = from / g;
+    filter.phases = min(filter.up, RESAMPLE_MAX_PHASES);
+
+    // when decimating, cutoff moves down to output Nyquist frequency
+    cutoff = RESAMPLE_ROLLOFF * min(1.0, (double)to / from);
+    filter.taps = (2 * (int)ceil(RESAMPLE_ZEROS / cutoff) + 3) & ~3;
+    filter.coefs = S_Malloc(filter.phases * filter.taps * sizeof(float));
+
+    half = filter.taps / 2;
+    for (p = 0, c = filter.coefs; p < filter.phases; p++, c += filter.taps) {
+        sum = 0;
+        for (k = 0; k < filter.taps; k++) {
+            // distance from output sample to this tap, in input samples
+            t = k - half + 1 - (double)p / filter.phases;
+            x = M_PI * cutoff * t;
+            h = x ? sin(x) / x : 1;
+            w = t / half;
+            w = 1 - w * w;
+            w = w > 0 ? bessel_i0(RESAMPLE_BETA * sqrt(w)) / bessel_i0(RESAMPLE_BETA) : 0;
+            c[k] = h * w;
+            sum += c[k];
+        }
+        // unity gain at DC
+        for (k = 0; k < filter.taps; k++) {
+            c[k] /= sum;
+        }
+    }
+}
+
+static inline float Convolve(const float *x, const float *h, int taps)
+{
+#if USE_SSE2
+    __m128 acc = _mm_setzero_ps();
+    int i;
+
+    for (i = 0; i < taps; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+    }
+
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#elif USE_SND_NEON
+    float32x4_t acc = vdupq_n_f32(0);
+    float32x2_t sum;
+    int i;
+
+    for (i = 0; i < taps; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(x + i), vld1q_f32(h + i));
+    }
+
+    sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#else
+    float acc[4] = { 0, 0, 0, 0 };
+    int i;
+
+    for (i = 0; i < taps; i += 4) {
+        acc[0] += x[i + 0] * h[i + 0];
+        acc[1] += x[i + 1] * h[i + 1];
+        acc[2] += x[i + 2] * h[i + 2];
+        acc[3] += x[i + 3] * h[i + 3];
+    }
+
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+}
+
+static void ResampleSinc(sfxcache_t *sc)
+{
+    int         i, n, p, val, pad;
+    float       *in, *x;
+    uint64_t    frac;
+    int16_t     *out = (int16_t *)sc->data;
+
+    BuildFilter(s_info.rate, dma.speed);
+    pad = filter.taps;
+
+    // convert to float, zero padded before start. looped sounds are padded
+    // after end with samples from loop start, so that loop is seamless.
+    in = S_Malloc((s_info.samples + pad * 2) * sizeof(float));
+    x = in + pad;
+    memset(in, 0, pad * sizeof(float));
+    if (s_info.width == 1) {
+        for (i = 0; i < s_info.samples; i++)
+            x[i] = (s_info.data[i] - 128) * 256;
+    } else {
+        for (i = 0; i < s_info.samples; i++)
+            x[i] = (int16_t)LittleShortMem(s_info.data + i * 2);
+    }
+    for (i = 0; i < pad; i++) {
+        if (s_info.loopstart >= 0 && s_info.loopstart < s_info.samples)
+            x[s_info.samples + i] = x[s_info.loopstart + i % (s_info.samples - s_info.loopstart)];
+        else
+            x[s_info.samples + i] = 0;
+    }
+
+    for (i = 0; i < sc->length; i++) {
+        frac = (uint64_t)i * filter.down;
+        n = frac / filter.up;
+        frac %= filter.up;
+
+        if (filter.phases == filter.up) {
+            p = frac;
+        } else {
+            p = (frac * filter.phases + filter.up / 2) / filter.up;
+            if (p == filter.phases) {
+                p = 0;
+                n++;
+            }
+        }
+
+        val = Q_rint(Convolve(x + n - filter.taps / 2 + 1,
+                              filter.coefs + p * filter.taps, filter.taps));
+        out[i] = clamp(val, INT16_MIN, INT16_MAX);
+    }
+
+    Z_Free(in);
+}
+
+static qboolean CacheFileName(char *buffer, size_t size)
+{
+    return Q_snprintf(buffer, size, "cache/%s.%d", s_info.name, dma.speed) < size;
+}
+
+static sfxcache_t *LoadResampled(sfx_t *sfx, uint32_t checksum)
+{
+    char        path[MAX_QPATH];
+    byte        *data;
+    ssize_t     len;
+    dsfxcache_t *h;
+    sfxcache_t  *sc;
+    int         length;
+
+    if (!CacheFileName(path, sizeof(path)))
+        return NULL;
+
+    len = FS_LoadFileEx(path, (void **)&data, FS_TYPE_REAL | FS_PATH_GAME, TAG_FILESYSTEM);
+    if (!data)
+        return NULL;
+
+    h = (dsfxcache_t *)data;
+    length = LittleLong(h->length);
+    if (len < sizeof(*h) ||
+        LittleLong(h->ident) != RESAMPLE_CACHE_IDENT ||
+        LittleLong(h->version) != RESAMPLE_CACHE_VERSION ||
+        LittleLong(h->checksum) != checksum ||
+        LittleLong(h->rate) != dma.speed ||
+        length < 1 || length > (len - sizeof(*h)) / 2) {
+        FS_FreeFile(data);
+        return NULL;
+    }
+
+    sc = sfx->cache = S_Malloc(length * 2 + sizeof(sfxcache_t) - 1);
+    sc->length = length;
+    sc->loopstart = LittleLong(h->loopstart);
+    sc->width = 2;
+    if (sc->loopstart >= length)
+        sc->loopstart = -1;
+    memcpy(sc->data, h + 1, length * 2);
+#if __BYTE_ORDER != __LITTLE_ENDIAN
+    for (int i = 0; i < length; i++) {
+        ((uint16_t *)sc->data)[i] = LittleShort(((uint16_t *)sc->data)[i]);
+    }
+#endif
+
+    FS_FreeFile(data);
+    return sc;
+}
+
+static void SaveResampled(const sfxcache_t *sc, uint32_t checksum)
+{
+    char        path[MAX_QPATH];
+    dsfxcache_t *h;
+    size_t      size;
+
+    if (!CacheFileName(path, sizeof(path)))
+        return;
+
+    size = sizeof(*h) + sc->length * 2;
+    h = FS_AllocTempMem(size);
+    h->ident = LittleLong(RESAMPLE_CACHE_IDENT);
+    h->version = LittleLong(RESAMPLE_CACHE_VERSION);
+    h->checksum = LittleLong(checksum);
+    h->rate = LittleLong(dma.speed);
+    h->length = LittleLong(sc->length);
+    h->loopstart = LittleLong(sc->loopstart);
+    memcpy(h + 1, sc->data, sc->length * 2);
+#if __BYTE_ORDER != __LITTLE_ENDIAN
+    for (int i = 0; i < sc->length; i++) {
+        ((uint16_t *)(h + 1))[i] = LittleShort(((uint16_t *)(h + 1))[i]);
+    }
+#endif
+
+    if (FS_WriteFile(path, h, size) < 0)
+        Com_DPrintf("Couldn't write %s\n", path);
+
+    FS_FreeTempMem(h);
+}
+
 /*
 ================
 ResampleSfx
 ================
 */
-static sfxcache_t *ResampleSfx(sfx_t *sfx)
+static sfxcache_t *ResampleSfx(sfx_t *sfx, void *file, size_t filelen)
 {
     int         outcount;
     int         srcsample;
     float       stepscale;
     int         i;
     int         samplefrac, fracstep;
+    int         width;
+    uint32_t    checksum;
     sfxcache_t  *sc;
 
     stepscale = (float)s_info.rate / dma.speed;      // this is usually 0.5, 1, or 2
 
-    outcount = s_info.samples / stepscale;
+    outcount = (int64_t)s_info.samples * dma.speed / s_info.rate;
     if (!outcount) {
         Com_DPrintf("%s resampled to zero length\n", s_info.name);
         sfx->error = Q_ERR_TOO_FEW;
         return NULL;
     }
 
-    sc = sfx->cache = S_Malloc(outcount * s_info.width + sizeof(sfxcache_t) - 1);
+    width = s_info.width;
+    checksum = 0;
+    if (stepscale != 1 && s_resample->integer) {
+        width = 2;
+        if (s_resample_cache->integer) {
+            checksum = Com_BlockChecksum(file, filelen);
+            sc = LoadResampled(sfx, checksum);
+            if (sc)
+                return sc;
+        }
+    }
+
+    sc = sfx->cache = S_Malloc(outcount * width + sizeof(sfxcache_t) - 1);
 
     sc->length = outcount;
-    sc->loopstart = s_info.loopstart == -1 ? -1 : s_info.loopstart / stepscale;
-    sc->width = s_info.width;
+    sc->loopstart = s_info.loopstart == -1 ? -1 :
+        (int64_t)s_info.loopstart * dma.speed / s_info.rate;
+    sc->width = width;
 
 // resample / decimate to the current source rate
 //Com_Printf("%s: %f, %d\n",sfx->name,stepscale,sc->width);
@@ -66,8 +361,13 @@ static sfxcache_t *ResampleSfx(sfx_t *sfx)
             }
 #endif
         }
+    } else if (s_resample->integer) {
+// band limited interpolation
+        ResampleSinc(sc);
+        if (s_resample_cache->integer)
+            SaveResampled(sc, checksum);
     } else {
-// general case
+// nearest sample
         samplefrac = 0;
         fracstep = stepscale * 256;
         if (sc->width == 1) {
@@ -87,6 +387,17 @@ static sfxcache_t *ResampleSfx(sfx_t *sfx)
 
     return sc;
 }
+
+/*
+================
+S_FreeResampler
+================
+*/
+void S_FreeResampler(void)
+{
+    Z_Free(filter.coefs);
+    memset(&filter, 0, sizeof(filter));
+}
 #endif
 
 /*
@@ -333,7 +644,7 @@ sfxcache_t *S_LoadSound(sfx_t *s)
 
 #if USE_SNDDMA
     if (s_started == SS_DMA)
-        sc = ResampleSfx(s);
+        sc = ResampleSfx(s, data, len);
 #endif
 
 fail:
@@ -18,16 +18,42 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // snd_mix.c -- portable code to mix sounds for snd_dma.c
 
 #include "sound.h"
+#include "common/tests.h"
 
 #define    PAINTBUFFER_SIZE    2048
 
+// mixer side copy of channel state, owned by whichever thread paints
+typedef struct {
+    sfxcache_t  *sc;
+    int         leftvol;        // 0-255 volume
+    int         rightvol;       // 0-255 volume
+    int         begin;          // don't paint before this sample
+    int         end;            // end time in global paintsamples
+    int         pos;            // sample position in sfx
+    qboolean    autosound;
+} voice_t;
+
+static voice_t  voices[MAX_CHANNELS];
+
 static int snd_scaletable[32][256];
 static int snd_vol;
 
 samplepair_t s_rawsamples[S_MAX_RAW_SAMPLES];
 int          s_rawend = 0;
 
-static void WriteLinearBlast(int16_t *out, samplepair_t *samp, int count)
+/*
+===============================================================================
+
+MIXING KERNELS
+
+Vectorized kernels produce bit exact results compared to the scalar ones:
+all intermediate products fit in 32 bits, and 17 bit volumes are split into
+two 8 bit halves where the instruction set only multiplies 16 bit values.
+
+===============================================================================
+*/
+
+static void WriteLinearBlast_C(int16_t *out, const samplepair_t *samp, int count)
 {
     int i, val;
 
@@ -40,6 +66,201 @@ static void WriteLinearBlast(int16_t *out, samplepair_t *samp, int count)
     }
 }
 
+// data is 8 bit unsigned, lscale and rscale are scaletable rows
+static void Paint8_C(const uint8_t *sfx, int lscale, int rscale,
+                     int count, samplepair_t *samp)
+{
+    const int *ltab = snd_scaletable[lscale];
+    const int *rtab = snd_scaletable[rscale];
+    int i, data;
+
+    for (i = 0; i < count; i++, samp++) {
+        data = *sfx++;
+        samp->left += ltab[data];
+        samp->right += rtab[data];
+    }
+}
+
+// leftvol and rightvol are premultiplied by snd_vol
+static void Paint16_C(const int16_t *sfx, int leftvol, int rightvol,
+                      int count, samplepair_t *samp)
+{
+    int i, data;
+
+    for (i = 0; i < count; i++, samp++) {
+        data = *sfx++;
+        samp->left += (data * leftvol) >> 8;
+        samp->right += (data * rightvol) >> 8;
+    }
+}
+
+#if USE_SSE2
+
+static void WriteLinearBlast_SIMD(int16_t *out, const samplepair_t *samp, int count)
+{
+    __m128i a, b;
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4, samp += 4, out += 8) {
+        a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)samp), 8);
+        b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(samp + 2)), 8);
+        _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(a, b));
+    }
+
+    WriteLinearBlast_C(out, samp, count - i);
+}
+
+// adds w * v to two sample pairs, w must hold each sample duplicated to
+// four 16 bit lanes, v holds left and right multipliers in even lanes
+static inline void paint_pairs(samplepair_t *samp, __m128i w, __m128i v)
+{
+    __m128i *p = (__m128i *)samp;
+
+    _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), _mm_madd_epi16(w, v)));
+}
+
+static void Paint8_SIMD(const uint8_t *sfx, int lscale, int rscale,
+                        int count, samplepair_t *samp)
+{
+    // scaletable entry is (data - 128) * scale * 8 * snd_vol, where the first
+    // product fits in 16 bits and the second one is done by pmaddwd
+    __m128i vol = _mm_set_epi16(0, rscale * 8, 0, lscale * 8, 0, rscale * 8, 0, lscale * 8);
+    __m128i mul = _mm_set1_epi32(snd_vol);
+    __m128i bias = _mm_set1_epi16(128);
+    __m128i zero = _mm_setzero_si128();
+    __m128i x, a, w;
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8, sfx += 8, samp += 8) {
+        x = _mm_loadl_epi64((const __m128i *)sfx);
+        x = _mm_sub_epi16(_mm_unpacklo_epi8(x, zero), bias);
+
+        a = _mm_unpacklo_epi16(x, x);
+        w = _mm_mullo_epi16(_mm_unpacklo_epi32(a, a), vol);
+        paint_pairs(samp + 0, w, mul);
+        w = _mm_mullo_epi16(_mm_unpackhi_epi32(a, a), vol);
+        paint_pairs(samp + 2, w, mul);
+
+        a = _mm_unpackhi_epi16(x, x);
+        w = _mm_mullo_epi16(_mm_unpacklo_epi32(a, a), vol);
+        paint_pairs(samp + 4, w, mul);
+        w = _mm_mullo_epi16(_mm_unpackhi_epi32(a, a), vol);
+        paint_pairs(samp + 6, w, mul);
+    }
+
+    Paint8_C(sfx, lscale, rscale, count - i, samp);
+}
+
+static inline void paint16_pairs(samplepair_t *samp, __m128i w, __m128i hi, __m128i lo)
+{
+    __m128i *p = (__m128i *)samp;
+    __m128i v;
+
+    // (data * vol) >> 8 == data * (vol >> 8) + ((data * (vol & 255)) >> 8)
+    v = _mm_add_epi32(_mm_madd_epi16(w, hi), _mm_srai_epi32(_mm_madd_epi16(w, lo), 8));
+    _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), v));
+}
+
+static void Paint16_SIMD(const int16_t *sfx, int leftvol, int rightvol,
+                         int count, samplepair_t *samp)
+{
+    __m128i hi = _mm_set_epi32(rightvol >> 8, leftvol >> 8, rightvol >> 8, leftvol >> 8);
+    __m128i lo = _mm_set_epi32(rightvol & 255, leftvol & 255, rightvol & 255, leftvol & 255);
+    __m128i x, a;
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8, sfx += 8, samp += 8) {
+        x = _mm_loadu_si128((const __m128i *)sfx);
+
+        a = _mm_unpacklo_epi16(x, x);
+        paint16_pairs(samp + 0, _mm_unpacklo_epi32(a, a), hi, lo);
+        paint16_pairs(samp + 2, _mm_unpackhi_epi32(a, a), hi, lo);
+
+        a = _mm_unpackhi_epi16(x, x);
+        paint16_pairs(samp + 4, _mm_unpacklo_epi32(a, a), hi, lo);
+        paint16_pairs(samp + 6, _mm_unpackhi_epi32(a, a), hi, lo);
+    }
+
+    Paint16_C(sfx, leftvol, rightvol, count - i, samp);
+}
+
+#elif USE_SND_NEON
+
+static void WriteLinearBlast_SIMD(int16_t *out, const samplepair_t *samp, int count)
+{
+    int16x4_t a, b;
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4, samp += 4, out += 8) {
+        a = vqshrn_n_s32(vld1q_s32((const int32_t *)samp), 8);
+        b = vqshrn_n_s32(vld1q_s32((const int32_t *)(samp + 2)), 8);
+        vst1q_s16(out, vcombine_s16(a, b));
+    }
+
+    WriteLinearBlast_C(out, samp, count - i);
+}
+
+static inline void paint_quad(samplepair_t *samp, int32x4_t x, int32_t lv, int32_t rv)
+{
+    int32x4x2_t p = vld2q_s32((const int32_t *)samp);
+
+    p.val[0] = vmlaq_n_s32(p.val[0], x, lv);
+    p.val[1] = vmlaq_n_s32(p.val[1], x, rv);
+    vst2q_s32((int32_t *)samp, p);
+}
+
+static void Paint8_SIMD(const uint8_t *sfx, int lscale, int rscale,
+                        int count, samplepair_t *samp)
+{
+    int32_t lv = lscale * 8 * snd_vol;
+    int32_t rv = rscale * 8 * snd_vol;
+    int16x8_t x;
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8, sfx += 8, samp += 8) {
+        x = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(sfx)));
+        x = vsubq_s16(x, vdupq_n_s16(128));
+        paint_quad(samp + 0, vmovl_s16(vget_low_s16(x)), lv, rv);
+        paint_quad(samp + 4, vmovl_s16(vget_high_s16(x)), lv, rv);
+    }
+
+    Paint8_C(sfx, lscale, rscale, count - i, samp);
+}
+
+static inline void paint16_quad(samplepair_t *samp, int32x4_t x, int32_t lv, int32_t rv)
+{
+    int32x4x2_t p = vld2q_s32((const int32_t *)samp);
+
+    p.val[0] = vsraq_n_s32(p.val[0], vmulq_n_s32(x, lv), 8);
+    p.val[1] = vsraq_n_s32(p.val[1], vmulq_n_s32(x, rv), 8);
+    vst2q_s32((int32_t *)samp, p);
+}
+
+static void Paint16_SIMD(const int16_t *sfx, int leftvol, int rightvol,
+                         int count, samplepair_t *samp)
+{
+    int16x8_t x;
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8, sfx += 8, samp += 8) {
+        x = vld1q_s16(sfx);
+        paint16_quad(samp + 0, vmovl_s16(vget_low_s16(x)), leftvol, rightvol);
+        paint16_quad(samp + 4, vmovl_s16(vget_high_s16(x)), leftvol, rightvol);
+    }
+
+    Paint16_C(sfx, leftvol, rightvol, count - i, samp);
+}
+
+#else
+
+#define WriteLinearBlast_SIMD   WriteLinearBlast_C
+#define Paint8_SIMD             Paint8_C
+#define Paint16_SIMD            Paint16_C
+
+#endif
+
+//=============================================================================
+
 static void TransferStereo16(samplepair_t *samp, int endtime)
 {
     int lpos;
@@ -58,7 +279,7 @@ static void TransferStereo16(samplepair_t *samp, int endtime)
             count = endtime - ltime;
 
         // write a linear blast of samples
-        WriteLinearBlast(out, samp, count);
+        WriteLinearBlast_SIMD(out, samp, count);
 
         samp += count;
         ltime += count;
@@ -128,63 +349,107 @@ CHANNEL MIXING
 ===============================================================================
 */
 
-static void Paint8(channel_t *ch, sfxcache_t *sc, int count, samplepair_t *samp)
+static void Paint8(voice_t *ch, sfxcache_t *sc, int count, samplepair_t *samp)
 {
-    int data;
-    int *lscale, *rscale;
-    uint8_t *sfx;
-    int i;
-
     if (ch->leftvol > 255)
         ch->leftvol = 255;
     if (ch->rightvol > 255)
         ch->rightvol = 255;
 
-    lscale = snd_scaletable[ch->leftvol >> 3];
-    rscale = snd_scaletable[ch->rightvol >> 3];
-    sfx = (uint8_t *)sc->data + ch->pos;
+    Paint8_SIMD((uint8_t *)sc->data + ch->pos, ch->leftvol >> 3,
+                ch->rightvol >> 3, count, samp);
 
-    for (i = 0; i < count; i++, samp++) {
-        data = *sfx++;
-        samp->left += lscale[data];
-        samp->right += rscale[data];
-    }
+    ch->pos += count;
+}
+
+static void Paint16(voice_t *ch, sfxcache_t *sc, int count, samplepair_t *samp)
+{
+    int16_t *sfx = (int16_t *)sc->data + ch->pos;
+
+    // vectorized path relies on 8 bit volumes
+    if (ch->leftvol > 255 || ch->rightvol > 255)
+        Paint16_C(sfx, ch->leftvol * snd_vol, ch->rightvol * snd_vol, count, samp);
+    else
+        Paint16_SIMD(sfx, ch->leftvol * snd_vol, ch->rightvol * snd_vol, count, samp);
 
     ch->pos += count;
 }
 
-static void Paint16(channel_t *ch, sfxcache_t *sc, int count, samplepair_t *samp)
+static void SetScaletable(int vol)
 {
-    int data;
-    int left, right;
-    int leftvol, rightvol;
-    int16_t *sfx;
-    int i;
+    int        i, j;
+    int        scale;
 
-    leftvol = ch->leftvol * snd_vol;
-    rightvol = ch->rightvol * snd_vol;
-    sfx = (int16_t *)sc->data + ch->pos;
+    snd_vol = vol;
+    for (i = 0; i < 32; i++) {
+        scale = i * 8 * snd_vol;
+        for (j = 0; j < 256; j++) {
+            snd_scaletable[i][j] = (j - 128) * scale;
+        }
+    }
+}
 
-    for (i = 0; i < count; i++, samp++) {
-        data = *sfx++;
-        left = (data * leftvol) >> 8;
-        right = (data * rightvol) >> 8;
-        samp->left += left;
-        samp->right += right;
+/*
+=================
+S_ExecuteMixCommand
+
+Applies command queued by the main thread to mixer channels.
+=================
+*/
+void S_ExecuteMixCommand(const mixcmd_t *cmd)
+{
+    voice_t *v = &voices[cmd->index];
+    sfxcache_t *sc = cmd->sc;
+
+    switch (cmd->op) {
+    case MIX_START:
+        v->sc = sc;
+        v->leftvol = cmd->leftvol;
+        v->rightvol = cmd->rightvol;
+        v->begin = max(cmd->begin, paintedtime);
+        v->pos = 0;
+        v->end = v->begin + sc->length;
+        v->autosound = qfalse;
+        break;
+    case MIX_LOOP:
+        v->sc = sc;
+        v->leftvol = cmd->leftvol;
+        v->rightvol = cmd->rightvol;
+        v->begin = paintedtime;
+        v->pos = paintedtime % sc->length;
+        v->end = paintedtime + sc->length - v->pos;
+        v->autosound = qtrue;
+        break;
+    case MIX_STOP:
+        memset(v, 0, sizeof(*v));
+        break;
+    case MIX_SPATIALIZE:
+        v->leftvol = cmd->leftvol;
+        v->rightvol = cmd->rightvol;
+        break;
+    case MIX_STOPALL:
+        S_StopAllVoices();
+        DMA_ClearBuffer();
+        break;
+    case MIX_VOLUME:
+        SetScaletable(cmd->leftvol);
+        break;
     }
+}
 
-    ch->pos += count;
+void S_StopAllVoices(void)
+{
+    memset(voices, 0, sizeof(voices));
 }
 
 void S_PaintChannels(int endtime)
 {
     samplepair_t paintbuffer[PAINTBUFFER_SIZE];
     int i;
-    int end;
-    channel_t *ch;
+    int end, rawend;
+    voice_t *ch;
     sfxcache_t *sc;
     int ltime, count;
-    playsound_t *ps;
 
     while (paintedtime < endtime) {
         // if paintbuffer is smaller than DMA buffer
@@ -192,31 +457,18 @@ void S_PaintChannels(int endtime)
         if (end - paintedtime > PAINTBUFFER_SIZE)
             end = paintedtime + PAINTBUFFER_SIZE;
 
-        // start any playsounds
-        while (1) {
-            ps = s_pendingplays.next;
-            if (ps == &s_pendingplays)
-                break;    // no more pending sounds
-            if (ps->begin <= paintedtime) {
-                S_IssuePlaysound(ps);
-                continue;
-            }
-
-            if (ps->begin < end)
-                end = ps->begin;        // stop here
-            break;
-        }
-
         // clear the paint buffer
         memset(paintbuffer, 0, (end - paintedtime) * sizeof(samplepair_t));
 
         // paint in the channels.
-        ch = channels;
+        ch = voices;
         for (i = 0; i < s_numchannels; i++, ch++) {
-            ltime = paintedtime;
+            // channels started ahead of time wait for their begin sample
+            ltime = max(paintedtime, ch->begin);
 
             while (ltime < end) {
-                if (!ch->sfx || (!ch->leftvol && !ch->rightvol))
+                sc = ch->sc;
+                if (!sc || (!ch->leftvol && !ch->rightvol))
                     break;
 
                 // max painting is to the end of the buffer
@@ -226,11 +478,7 @@ void S_PaintChannels(int endtime)
                 if (ch->end - ltime < count)
                     count = ch->end - ltime;
 
-                sc = S_LoadSound(ch->sfx);
-                if (!sc)
-                    break;
-
-                if (count > 0 && ch->sfx) {
+                if (count > 0) {
                     samplepair_t *samp = &paintbuffer[ltime - paintedtime];
                     if (sc->width == 1)
                         Paint8(ch, sc, count, samp);
@@ -251,17 +499,18 @@ void S_PaintChannels(int endtime)
                         ch->end = ltime + sc->length - ch->pos;
                     } else {
                         // channel just stopped
-                        ch->sfx = NULL;
+                        ch->sc = NULL;
                     }
                 }
             }
 
         }
 
-        if (s_rawend >= paintedtime)
+        rawend = q_atomic_load(&s_rawend);
+        if (rawend >= paintedtime)
         {
           /* add from the streaming sound source */
-          int stop = (end < s_rawend) ? end : s_rawend;
+          int stop = (end < rawend) ? end : rawend;
 
           for (int i = paintedtime; i < stop; i++)
           {
@@ -273,24 +522,29 @@ void S_PaintChannels(int endtime)
 
         // transfer out according to DMA format
         TransferPaintBuffer(paintbuffer, end);
-        paintedtime = end;
+
+        // main thread reads this to time new sounds
+        q_atomic_store(&paintedtime, end);
     }
 }
 
+/*
+=================
+S_InitScaletable
+
+Scale tables are owned by the mixer, so they are rebuilt on its side.
+=================
+*/
 void S_InitScaletable(void)
 {
-    int        i, j;
-    int        scale;
+    mixcmd_t cmd;
 
     Cvar_ClampValue(s_volume, 0, 1);
 
-    snd_vol = s_volume->value * 256;
-    for (i = 0; i < 32; i++) {
-        scale = i * 8 * snd_vol;
-        for (j = 0; j < 256; j++) {
-            snd_scaletable[i][j] = (j - 128) * scale;
-        }
-    }
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.op = MIX_VOLUME;
+    cmd.leftvol = s_volume->value * 256;
+    DMA_QueueCommand(&cmd);
 
     s_volume->modified = qfalse;
 }
@@ -312,8 +566,12 @@ S_RawSamples(int samples, int rate, int width,
 	  return;
   }
 
-  if (s_rawend < paintedtime)
-    s_rawend = paintedtime;
+  // samples are published to the mixer only after being written
+  int rawend = s_rawend;
+  int painted = q_atomic_load(&paintedtime);
+
+  if (rawend < painted)
+    rawend = painted;
 
   // mimic the OpenAL behavior: s_volume is master volume
   volume *= s_volume->value;
@@ -333,8 +591,8 @@ S_RawSamples(int samples, int rate, int width,
         break;
       }
 
-      int dst = s_rawend & (S_MAX_RAW_SAMPLES - 1);
-      s_rawend++;
+      int dst = rawend & (S_MAX_RAW_SAMPLES - 1);
+      rawend++;
       s_rawsamples[dst].left = ((short *)data)[src * 2] * intVolume;
       s_rawsamples[dst].right = ((short *)data)[src * 2 + 1] * intVolume;
     }
@@ -350,8 +608,8 @@ S_RawSamples(int samples, int rate, int width,
         break;
       }
 
-      int dst = s_rawend & (S_MAX_RAW_SAMPLES - 1);
-      s_rawend++;
+      int dst = rawend & (S_MAX_RAW_SAMPLES - 1);
+      rawend++;
       s_rawsamples[dst].left = ((short *)data)[src] * intVolume;
       s_rawsamples[dst].right = ((short *)data)[src] * intVolume;
     }
@@ -369,8 +627,8 @@ S_RawSamples(int samples, int rate, int width,
         break;
       }
 
-      int dst = s_rawend & (S_MAX_RAW_SAMPLES - 1);
-      s_rawend++;
+      int dst = rawend & (S_MAX_RAW_SAMPLES - 1);
+      rawend++;
       s_rawsamples[dst].left =
         (((byte *)data)[src * 2] - 128) * intVolume;
       s_rawsamples[dst].right =
@@ -390,11 +648,117 @@ S_RawSamples(int samples, int rate, int width,
         break;
       }
 
-      int dst = s_rawend & (S_MAX_RAW_SAMPLES - 1);
-      s_rawend++;
+      int dst = rawend & (S_MAX_RAW_SAMPLES - 1);
+      rawend++;
       s_rawsamples[dst].left = (((byte *)data)[src] - 128) * intVolume;
       s_rawsamples[dst].right = (((byte *)data)[src] - 128) * intVolume;
     }
   }
+
+  q_atomic_store(&s_rawend, rawend);
+}
+
+
+#if USE_TESTS
+
+typedef struct {
+    void (*paint8)(const uint8_t *, int, int, int, samplepair_t *);
+    void (*paint16)(const int16_t *, int, int, int, samplepair_t *);
+    void (*transfer)(int16_t *, const samplepair_t *, int);
+    samplepair_t *paint;
+    int16_t *out;
+} mixer_t;
+
+typedef struct {
+    mixer_t mixers[2];
+    int numchannels;
+    int *vols;
+    uint8_t *data8;
+    int16_t *data16;
+} mixtest_t;
+
+static void S_MixTestRun(void *arg, int k)
+{
+    mixtest_t *t = arg;
+    mixer_t *m = &t->mixers[k];
+    int j, count;
+
+    memset(m->paint, 0, PAINTBUFFER_SIZE * sizeof(samplepair_t));
+    for (j = 0; j < t->numchannels; j++) {
+        // vary length to exercise scalar tails
+        count = PAINTBUFFER_SIZE - (j & 7);
+        if (j & 1) {
+            m->paint16(t->data16 + j * PAINTBUFFER_SIZE,
+                       t->vols[j * 2] * snd_vol, t->vols[j * 2 + 1] * snd_vol,
+                       count, m->paint);
+        } else {
+            m->paint8(t->data8 + j * PAINTBUFFER_SIZE,
+                      t->vols[j * 2] >> 3, t->vols[j * 2 + 1] >> 3,
+                      count, m->paint);
+        }
+    }
+    m->transfer(m->out, m->paint, PAINTBUFFER_SIZE);
+}
+
+/*
+=================
+S_MixTest_f
+
+Checks vectorized mixing kernels against the scalar ones on random data and
+measures time spent mixing the given number of channels into the paint
+buffer and transferring it to 16 bit stereo output.
+=================
+*/
+void S_MixTest_f(void)
+{
+    mixtest_t t = {
+        .mixers = {
+            { Paint8_C, Paint16_C, WriteLinearBlast_C },
+            { Paint8_SIMD, Paint16_SIMD, WriteLinearBlast_SIMD }
+        }
+    };
+    int iterations, i, k;
+    unsigned seed = 1;
+    uint64_t usec[2] = { 0, 0 };
+
+    t.numchannels = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : MAX_CHANNELS;
+    clamp(t.numchannels, 1, 1024);
+    iterations = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 100;
+    clamp(iterations, 1, 100000);
+
+    t.data8 = Z_Malloc(t.numchannels * PAINTBUFFER_SIZE);
+    t.data16 = Z_Malloc(t.numchannels * PAINTBUFFER_SIZE * sizeof(int16_t));
+    t.vols = Z_Malloc(t.numchannels * 2 * sizeof(int));
+    for (i = 0; i < t.numchannels * PAINTBUFFER_SIZE; i++) {
+        t.data8[i] = TST_Rand(&seed);
+        t.data16[i] = TST_Rand(&seed);
+    }
+    for (i = 0; i < t.numchannels * 2; i++) {
+        t.vols[i] = TST_Rand(&seed) & 255;
+    }
+
+    for (k = 0; k < 2; k++) {
+        t.mixers[k].paint = Z_Malloc(PAINTBUFFER_SIZE * sizeof(samplepair_t));
+        t.mixers[k].out = Z_Malloc(PAINTBUFFER_SIZE * 2 * sizeof(int16_t));
+    }
+
+    TST_TimeVariants(S_MixTestRun, &t, iterations, usec);
+
+    if (memcmp(t.mixers[0].paint, t.mixers[1].paint, PAINTBUFFER_SIZE * sizeof(samplepair_t)) ||
+        memcmp(t.mixers[0].out, t.mixers[1].out, PAINTBUFFER_SIZE * 2 * sizeof(int16_t))) {
+        Com_EPrintf("Vectorized mixer output differs from scalar mixer\n");
+    }
+
+    TST_PrintTimes(va("%d channels, %d samples", t.numchannels, PAINTBUFFER_SIZE),
+                   "scalar", "vectorized", usec, iterations);
+
+    for (k = 0; k < 2; k++) {
+        Z_Free(t.mixers[k].paint);
+        Z_Free(t.mixers[k].out);
+    }
+    Z_Free(t.vols);
+    Z_Free(t.data16);
+    Z_Free(t.data8);
 }
 
+#endif // USE_TESTS
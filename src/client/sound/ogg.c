@@ -47,13 +47,50 @@ static cvar_t *ogg_shuffle;        /* Shuffle playback */
 static cvar_t *ogg_ignoretrack0;  /* Toggle track 0 playing */
 static cvar_t *ogg_volume;        /* Music volume. */
 static cvar_t* ogg_enable;        /* Music enable flag to toggle from the menu. */
+static cvar_t *ogg_buffer;        /* Decode ahead target, in milliseconds. */
 static int ogg_curfile;           /* Index of currently played file. */
 static int ogg_numbufs;           /* Number of buffers for OpenAL */
-static int ogg_numsamples;        /* Number of sambles read from the current file */
+static int ogg_numsamples;        /* Number of samples played from the current file */
 static ogg_status_t ogg_status;   /* Status indicator. */
-static stb_vorbis *ogg_file;      /* Ogg Vorbis file. */
+static stb_vorbis *ogg_file;      /* Ogg Vorbis file, guarded by ogg_decoder.lock. */
 static qboolean ogg_started;      /* Initialization flag. */
 
+/*
+ * Vorbis is decoded by a worker thread into a single producer, single
+ * consumer ring, so decode spikes never land in the client frame. The
+ * main thread only copies from the ring into the raw sample queue. Ring
+ * positions are free running sample counters, published with release
+ * semantics. The worker holds ogg_decoder.lock only to reserve ring
+ * space and to publish a chunk, the decoding itself runs unlocked with
+ * the busy flag set. The main thread waits for the flag to clear before
+ * it opens, closes or seeks the file.
+ */
+enum { OGG_CHUNK_SAMPLES = 4096 };
+
+static struct {
+	sys_thread_t *thread;     /* NULL when decoding synchronously. */
+	sys_mutex_t *lock;
+	sys_cond_t *wake;         /* Signaled when ring space frees up. */
+	sys_cond_t *idle;         /* Signaled when a chunk is published. */
+	int quit;
+	int busy;                 /* Worker is decoding a chunk. */
+
+	int rate;                 /* Format of samples in the ring. */
+	int channels;
+	int eof;                  /* Worker reached end of file. */
+
+	short *ring;
+	unsigned size;            /* In samples, power of two. */
+	unsigned head;            /* Written by worker. */
+	unsigned tail;            /* Written by main thread. */
+
+	/* Statistics, each written by a single thread. */
+	unsigned underruns;       /* Ring found empty when samples were due. */
+	unsigned decoded;         /* Chunks decoded. */
+	unsigned decode_usec;
+	unsigned decode_max;
+} ogg_decoder;
+
 enum { MAX_NUM_OGGTRACKS = 32 };
 static char* ogg_tracks[MAX_NUM_OGGTRACKS];
 static int ogg_maxfileindex;
@@ -229,37 +266,246 @@ OGG_InitTrackList(void)
 // --------
 
 /*
- * Play a portion of the currently opened file.
+ * Find ring space for the next chunk of the current file. Called with
+ * ogg_decoder.lock held, returns qfalse when there is nothing to do.
  */
-void
-static OGG_Read(void)
+static qboolean
+OGG_ReserveChunk(unsigned *offset, unsigned *count)
 {
-	short samples[4096] = {0};
+	unsigned head, space, contig;
 
-	int read_samples = stb_vorbis_get_samples_short_interleaved(ogg_file, ogg_file->channels, samples,
-		sizeof(samples) / ogg_file->channels);
+	if (!ogg_file || ogg_decoder.eof)
+	{
+		return qfalse;
+	}
+
+	head = ogg_decoder.head;
+	space = ogg_decoder.size - (head - q_atomic_load(&ogg_decoder.tail));
+	*offset = head & (ogg_decoder.size - 1);
 
-	if (read_samples > 0)
+	/* Only decode into contiguous space, whole frames at a time. Wait
+	   for at least half a chunk of space unless at the end of the ring. */
+	contig = ogg_decoder.size - *offset;
+	*count = min(space, contig);
+	*count = min(*count, OGG_CHUNK_SAMPLES);
+	*count -= *count % ogg_decoder.channels;
+
+	if (!*count || (*count < OGG_CHUNK_SAMPLES / 2 && *count < contig))
 	{
-		ogg_numsamples += read_samples;
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+ * Decode a reserved chunk. The main thread never reads or moves the
+ * reserved part of the ring, so this needs no lock.
+ */
+static int
+OGG_DecodeChunk(stb_vorbis *file, unsigned offset, unsigned count)
+{
+	uint64_t start;
+	unsigned usec;
+	int frames;
+
+	start = Sys_Microseconds();
+
+	PROF_BEGIN("OGG_Decode");
+	frames = stb_vorbis_get_samples_short_interleaved(file, ogg_decoder.channels,
+		ogg_decoder.ring + offset, count);
+	PROF_END();
 
-		S_RawSamples(read_samples, ogg_file->sample_rate, ogg_file->channels, ogg_file->channels,
-			(byte *)samples, ogg_volume->value);
+	usec = Sys_Microseconds() - start;
+	q_atomic_store(&ogg_decoder.decoded, ogg_decoder.decoded + 1);
+	q_atomic_store(&ogg_decoder.decode_usec, ogg_decoder.decode_usec + usec);
+	q_atomic_store(&ogg_decoder.decode_max, max(ogg_decoder.decode_max, usec));
+
+	return frames;
+}
+
+static void
+OGG_PublishChunk(int frames)
+{
+	if (frames <= 0)
+	{
+		q_atomic_store(&ogg_decoder.eof, 1);
+		return;
 	}
-	else
+
+	q_atomic_store(&ogg_decoder.head, ogg_decoder.head + frames * ogg_decoder.channels);
+}
+
+static void
+OGG_DecoderThread(void *arg)
+{
+	stb_vorbis *file;
+	unsigned offset, count;
+	int frames;
+
+	Prof_SetThreadName("ogg");
+
+	Sys_LockMutex(ogg_decoder.lock);
+
+	while (!ogg_decoder.quit)
+	{
+		if (!OGG_ReserveChunk(&offset, &count))
+		{
+			/* Woken up by main thread when space frees up. */
+			Sys_WaitCond(ogg_decoder.wake, ogg_decoder.lock, -1);
+			continue;
+		}
+
+		file = ogg_file;
+		ogg_decoder.busy = 1;
+		Sys_UnlockMutex(ogg_decoder.lock);
+
+		frames = OGG_DecodeChunk(file, offset, count);
+
+		Sys_LockMutex(ogg_decoder.lock);
+		ogg_decoder.busy = 0;
+		OGG_PublishChunk(frames);
+		Sys_SignalCond(ogg_decoder.idle);
+	}
+
+	Sys_UnlockMutex(ogg_decoder.lock);
+
+	Prof_ReleaseThread();
+}
+
+/*
+ * Lock the decoder and wait for the chunk in flight, if any, so that
+ * the file and the ring can be changed. Only used on track changes.
+ */
+static void
+OGG_LockDecoder(void)
+{
+	Sys_LockMutex(ogg_decoder.lock);
+
+	while (ogg_decoder.busy)
+	{
+		Sys_WaitCond(ogg_decoder.idle, ogg_decoder.lock, -1);
+	}
+}
+
+/*
+ * Ask the worker for more samples, or decode them right here
+ * if there is no worker. The worker holds the lock only briefly
+ * between chunks, so signaling doesn't wait for a decode. A wakeup
+ * lost while the worker is about to sleep is repeated next frame.
+ */
+static void
+OGG_Refill(void)
+{
+	unsigned offset, count;
+
+	if (ogg_decoder.thread)
+	{
+		Sys_LockMutex(ogg_decoder.lock);
+		Sys_SignalCond(ogg_decoder.wake);
+		Sys_UnlockMutex(ogg_decoder.lock);
+		return;
+	}
+
+	while (OGG_ReserveChunk(&offset, &count))
+	{
+		OGG_PublishChunk(OGG_DecodeChunk(ogg_file, offset, count));
+	}
+}
+
+/*
+ * Replace the file being decoded and discard buffered samples.
+ */
+static void
+OGG_SetFile(stb_vorbis *file)
+{
+	unsigned size;
+
+	OGG_LockDecoder();
+
+	if (ogg_file)
 	{
+		stb_vorbis_close(ogg_file);
+	}
+
+	ogg_file = file;
+	ogg_decoder.head = ogg_decoder.tail = 0;
+	ogg_decoder.eof = 0;
+
+	if (file)
+	{
+		ogg_decoder.rate = file->sample_rate;
+		ogg_decoder.channels = file->channels;
+
+		/* Size the ring by latency target, rounded up to a power of two. */
+		size = npot32(file->sample_rate * file->channels *
+			Cvar_ClampInteger(ogg_buffer, 100, 5000) / 1000);
+		size = max(size, OGG_CHUNK_SAMPLES * 2);
+
+		if (size != ogg_decoder.size)
+		{
+			Z_Free(ogg_decoder.ring);
+			ogg_decoder.ring = Z_Malloc(size * sizeof(short));
+			ogg_decoder.size = size;
+		}
+	}
+
+	Sys_UnlockMutex(ogg_decoder.lock);
+}
+
+/*
+ * Play a portion of the currently opened file. Returns qfalse when
+ * no decoded samples are available yet, which counts as an underrun
+ * if the output is already running low.
+ */
+static qboolean
+OGG_Read(qboolean starving)
+{
+	unsigned head, tail, offset, count;
+	int frames;
+
+	head = q_atomic_load(&ogg_decoder.head);
+	tail = ogg_decoder.tail;
+
+	if (head == tail)
+	{
+		if (!q_atomic_load(&ogg_decoder.eof))
+		{
+			if (starving && ogg_numsamples)
+			{
+				ogg_decoder.underruns++;
+			}
+
+			return qfalse;
+		}
+
 		// We cannot call OGG_Stop() here. It flushes the OpenAL sample
 		// queue, thus about 12 seconds of music are lost. Instead we
 		// just set the OGG state to stop and open a new file. The new
 		// files content is added to the sample queue after the remaining
 		// samples from the old file.
-		stb_vorbis_close(ogg_file);
+		OGG_SetFile(NULL);
 		ogg_status = STOP;
 		ogg_numbufs = 0;
 		ogg_numsamples = 0;
 
 		OGG_PlayTrack(ogg_curfile);
+
+		return qfalse;
 	}
+
+	offset = tail & (ogg_decoder.size - 1);
+	count = min(head - tail, ogg_decoder.size - offset);
+	count = min(count, OGG_CHUNK_SAMPLES);
+	frames = count / ogg_decoder.channels;
+
+	S_RawSamples(frames, ogg_decoder.rate, ogg_decoder.channels, ogg_decoder.channels,
+		(byte *)(ogg_decoder.ring + offset), ogg_volume->value);
+
+	ogg_numsamples += frames;
+	q_atomic_store(&ogg_decoder.tail, tail + count);
+
+	return qtrue;
 }
 
 /*
@@ -275,6 +521,11 @@ OGG_Stream(void)
 
 	if (ogg_status == PLAY)
 	{
+		if (!ogg_decoder.thread)
+		{
+			OGG_Refill();
+		}
+
 #ifdef USE_OPENAL
 		if (s_started == SS_OAL)
 		{
@@ -291,9 +542,12 @@ OGG_Stream(void)
 
 			/* active_buffers are all active OpenAL buffers,
 			   buffering normal sfx _and_ ogg/vorbis samples. */
-			while (active_buffers <= ogg_numbufs)
+			while (ogg_status == PLAY && active_buffers <= ogg_numbufs)
 			{
-				OGG_Read();
+				if (!OGG_Read(active_buffers == 0))
+				{
+					break;
+				}
 			}
 		}
 		else /* using SDL */
@@ -305,13 +559,22 @@ OGG_Stream(void)
 				   were played since the last call to this function.
 				   This keeps the buffer at all times at an "optimal"
 				   fill level. */
-				while (paintedtime + S_MAX_RAW_SAMPLES - 2048 > s_rawend)
+				while (ogg_status == PLAY && paintedtime + S_MAX_RAW_SAMPLES - 2048 > s_rawend)
 				{
-					OGG_Read();
+					if (!OGG_Read(s_rawend - paintedtime < (S_MAX_RAW_SAMPLES - 2048) / 2))
+					{
+						break;
+					}
 				}
 			}
 		}
 	}
+
+	/* Whatever was consumed can be decoded again. */
+	if (ogg_status == PLAY && ogg_decoder.thread)
+	{
+		OGG_Refill();
+	}
 }
 
 // --------
@@ -407,7 +670,7 @@ OGG_PlayTrack(int trackNo)
 	}
 
 	int res = 0;
-	ogg_file = stb_vorbis_open_file(f, qtrue, &res, NULL);
+	stb_vorbis *file = stb_vorbis_open_file(f, qtrue, &res, NULL);
 
 	if (res != 0)
 	{
@@ -418,6 +681,9 @@ OGG_PlayTrack(int trackNo)
 	}
 
 	/* Play file. */
+	OGG_SetFile(file);
+	OGG_Refill();
+
 	ogg_curfile = trackNo;
 	ogg_numsamples = 0;
 	if (ogg_enable->integer)
@@ -434,6 +700,8 @@ OGG_PlayTrack(int trackNo)
 static void
 OGG_Info(void)
 {
+	unsigned decoded;
+
 	Com_Printf("Tracks:\n");
 	int numFiles = 0;
 
@@ -456,12 +724,12 @@ OGG_Info(void)
 	{
 		case PLAY:
 			Com_Printf("State: Playing file %d (%s) at %i samples.\n",
-			           ogg_curfile, ogg_tracks[ogg_curfile], stb_vorbis_get_sample_offset(ogg_file));
+			           ogg_curfile, ogg_tracks[ogg_curfile], ogg_numsamples);
 			break;
 
 		case PAUSE:
 			Com_Printf("State: Paused file %d (%s) at %i samples.\n",
-			           ogg_curfile, ogg_tracks[ogg_curfile], stb_vorbis_get_sample_offset(ogg_file));
+			           ogg_curfile, ogg_tracks[ogg_curfile], ogg_numsamples);
 			break;
 
 		case STOP:
@@ -476,6 +744,22 @@ OGG_Info(void)
 
 			break;
 	}
+
+	if (ogg_status != STOP)
+	{
+		unsigned buffered = q_atomic_load(&ogg_decoder.head) - ogg_decoder.tail;
+
+		Com_Printf("Buffer: %u of %u ms, %s.\n",
+		           buffered * 1000 / (ogg_decoder.rate * ogg_decoder.channels),
+		           ogg_decoder.size * 1000 / (ogg_decoder.rate * ogg_decoder.channels),
+		           ogg_decoder.thread ? "decoding in background" : "decoding synchronously");
+	}
+
+	decoded = q_atomic_load(&ogg_decoder.decoded);
+	Com_Printf("Decoder: %u chunks, %.3f ms avg, %.3f ms max, %u underruns.\n",
+	           decoded,
+	           decoded ? q_atomic_load(&ogg_decoder.decode_usec) * 0.001 / decoded : 0.0,
+	           q_atomic_load(&ogg_decoder.decode_max) * 0.001, ogg_decoder.underruns);
 }
 
 /*
@@ -496,7 +780,7 @@ OGG_Stop(void)
 	}
 #endif
 
-	stb_vorbis_close(ogg_file);
+	OGG_SetFile(NULL);
 	ogg_status = STOP;
 	ogg_numbufs = 0;
 }
@@ -625,8 +909,19 @@ OGG_RecoverState(void)
 	Cvar_SetValue(ogg_shuffle, 0, FROM_CODE);
 
 	OGG_PlayTrack(ogg_saved_state.curfile);
-	stb_vorbis_seek_frame(ogg_file, ogg_saved_state.numsamples);
-	ogg_numsamples = ogg_saved_state.numsamples;
+
+	if (ogg_status != STOP)
+	{
+		/* Drop whatever the worker managed to decode from the start. */
+		OGG_LockDecoder();
+		stb_vorbis_seek_frame(ogg_file, ogg_saved_state.numsamples);
+		ogg_decoder.tail = ogg_decoder.head;
+		ogg_decoder.eof = 0;
+		Sys_UnlockMutex(ogg_decoder.lock);
+
+		ogg_numsamples = ogg_saved_state.numsamples;
+		OGG_Refill();
+	}
 
 	Cvar_SetValue(ogg_shuffle, shuffle_state, FROM_CODE);
 }
@@ -654,6 +949,7 @@ OGG_Init(void)
 	ogg_volume = Cvar_Get("ogg_volume", "1.0", CVAR_ARCHIVE);
 	ogg_enable = Cvar_Get("ogg_enable", "1", CVAR_ARCHIVE);
 	ogg_enable->changed = ogg_enable_changed;
+	ogg_buffer = Cvar_Get("ogg_buffer", "500", CVAR_ARCHIVE);
 
 	// Commands
 	Cmd_AddCommand("ogg", OGG_Cmd);
@@ -663,6 +959,18 @@ OGG_Init(void)
 	ogg_numsamples = 0;
 	ogg_status = STOP;
 
+	// Decoder thread
+	memset(&ogg_decoder, 0, sizeof(ogg_decoder));
+	ogg_decoder.lock = Sys_CreateMutex();
+	ogg_decoder.wake = Sys_CreateCond();
+	ogg_decoder.idle = Sys_CreateCond();
+	ogg_decoder.thread = Sys_CreateThread(OGG_DecoderThread, NULL);
+
+	if (!ogg_decoder.thread)
+	{
+		Com_WPrintf("Couldn't start music decoder thread, decoding synchronously.\n");
+	}
+
 	ogg_started = qtrue;
 }
 
@@ -680,6 +988,22 @@ OGG_Shutdown(void)
 	// Music must be stopped.
 	OGG_Stop();
 
+	if (ogg_decoder.thread)
+	{
+		Sys_LockMutex(ogg_decoder.lock);
+		ogg_decoder.quit = 1;
+		Sys_SignalCond(ogg_decoder.wake);
+		Sys_UnlockMutex(ogg_decoder.lock);
+
+		Sys_JoinThread(ogg_decoder.thread);
+	}
+
+	Sys_DestroyCond(ogg_decoder.wake);
+	Sys_DestroyCond(ogg_decoder.idle);
+	Sys_DestroyMutex(ogg_decoder.lock);
+	Z_Free(ogg_decoder.ring);
+	memset(&ogg_decoder, 0, sizeof(ogg_decoder));
+
 	// Free file lsit.
 	for(int i=0; i<MAX_NUM_OGGTRACKS; ++i)
 	{
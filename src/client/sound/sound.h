@@ -22,6 +22,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #if USE_SNDDMA
 #include "client/sound/dma.h"
+
+// vectorized mixing and resampling
+#if USE_SSE2
+#include <emmintrin.h>
+#elif (defined __ARM_NEON) || (defined __ARM_NEON__)
+#define USE_SND_NEON    1
+#include <arm_neon.h>
+#endif
 #endif
 
 // !!! if this is changed, the asm code must change !!!
@@ -42,6 +50,7 @@ typedef struct sfxcache_s {
 } sfxcache_t;
 
 typedef struct sfx_s {
+    list_t      entry;
     char        name[MAX_QPATH];
     int         registration_sequence;
     sfxcache_t  *cache;
@@ -103,13 +112,39 @@ typedef struct {
 */
 
 #if USE_SNDDMA
+// commands sent from the main thread to the mixer, applied in batches
+// between paints. index is the channel number in channels[].
+typedef enum {
+    MIX_START,          // start sc at begin sample
+    MIX_LOOP,           // start autosound sc in phase with paintedtime
+    MIX_STOP,
+    MIX_SPATIALIZE,     // update leftvol and rightvol
+    MIX_STOPALL,        // stop all channels and clear DMA buffer
+    MIX_VOLUME          // rebuild scale tables, leftvol is new snd_vol
+} mixop_t;
+
+typedef struct {
+    mixop_t     op;
+    int         index;
+    int         leftvol;
+    int         rightvol;
+    int         begin;
+    sfxcache_t  *sc;
+} mixcmd_t;
+
 void DMA_SoundInfo(void);
 qboolean DMA_Init(void);
 void DMA_Shutdown(void);
 void DMA_Activate(void);
 int DMA_DriftBeginofs(float timeofs);
 void DMA_ClearBuffer(void);
+void DMA_QueueCommand(const mixcmd_t *cmd);
+void DMA_StopAllSounds(void);
 void DMA_Update(void);
+void S_FreeResampler(void);
+#if USE_TESTS
+void DMA_SoundStress_f(void);
+#endif
 #endif
 
 #if USE_OPENAL
@@ -172,6 +207,9 @@ extern cvar_t   *s_volume;
 #if USE_SNDDMA
 extern cvar_t   *s_khz;
 extern cvar_t   *s_testsound;
+extern cvar_t   *s_mixahead;
+extern cvar_t   *s_resample;
+extern cvar_t   *s_resample_cache;
 #endif
 extern cvar_t   *s_ambient;
 extern cvar_t   *s_show;
@@ -186,6 +224,11 @@ void S_IssuePlaysound(playsound_t *ps);
 void S_BuildSoundList(int *sounds);
 #if USE_SNDDMA
 void S_InitScaletable(void);
+void S_ExecuteMixCommand(const mixcmd_t *cmd);
+void S_StopAllVoices(void);
 void S_PaintChannels(int endtime);
+#if USE_TESTS
+void S_MixTest_f(void);
+#endif
 #endif
 
@@ -486,7 +486,9 @@ void V_RenderView(void)
         qsort(cl.refdef.entities, cl.refdef.num_entities, sizeof(cl.refdef.entities[0]), entitycmpfnc);
     }
 
+    PROF_BEGIN("R_RenderFrame");
     R_RenderFrame(&cl.refdef);
+    PROF_END();
 #ifdef _DEBUG
     if (cl_stats->integer)
 #if USE_DLIGHTS
@@ -31,6 +31,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/error.h"
 #include "common/field.h"
 #include "common/fifo.h"
+#include "common/jobs.h"
 #include "common/files.h"
 #include "common/math.h"
 #include "common/mdfour.h"
@@ -38,6 +39,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/net/net.h"
 #include "common/net/chan.h"
 #include "common/pmove.h"
+#include "common/prof.h"
 #include "common/prompt.h"
 #include "common/protocol.h"
 #include "common/tests.h"
@@ -621,6 +623,7 @@ void Com_Quit(const char *reason, error_type_t type)
 
     SV_Shutdown(buffer, type);
     CL_Shutdown();
+    Com_ShutdownJobs();
     NET_Shutdown();
     logfile_close();
     FS_Shutdown();
@@ -1019,6 +1022,8 @@ void Qcommon_Init(int argc, char **argv)
     Cmd_AddCommand("recycle", Com_Recycle_f);
 #endif
 
+    Prof_Init();
+    Com_InitJobs();
     Netchan_Init();
     NET_Init();
     BSP_Init();
@@ -1150,13 +1155,17 @@ void Qcommon_Frame(void)
 
     NET_UpdateStats();
 
+    PROF_BEGIN("SV_Frame");
     remaining = SV_Frame(msec);
+    PROF_END();
 
 #if USE_CLIENT
     if (host_speeds->integer)
         time_between = Sys_Milliseconds();
 
+    PROF_BEGIN("CL_Frame");
     clientrem = CL_Frame(msec);
+    PROF_END();
     if (remaining > clientrem) {
         remaining = clientrem;
     }
@@ -1180,5 +1189,8 @@ void Qcommon_Frame(void)
                    all, ev, sv, gm, cl, rf);
     }
 #endif
+
+    // collect zones recorded during this frame
+    Prof_EndFrame();
 }
 
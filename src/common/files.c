@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cvar.h"
 #include "common/error.h"
 #include "common/files.h"
+#include "common/prof.h"
 #include "common/prompt.h"
 #include "system/system.h"
 #include "client/client.h"
@@ -1888,9 +1889,12 @@ ssize_t FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t
 
     file->mode = (flags & ~FS_MODE_MASK) | FS_MODE_READ;
 
+    PROF_BEGIN("FS_LoadFile");
+
     // look for it in the filesystem or pack files
     len = expand_open_file_read(file, path, qfalse);
     if (len < 0) {
+        PROF_END();
         return len;
     }
 
@@ -1921,6 +1925,7 @@ ssize_t FS_LoadFileEx(const char *path, void **buffer, unsigned flags, memtag_t
 
 done:
     FS_FCloseFile(f);
+    PROF_END();
     return len;
 }
 
@@ -0,0 +1,315 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// jobs.c -- worker thread pool
+//
+// A single FIFO queue protected by one mutex feeds all workers. Jobs are
+// expected to be coarse (a slice of a loop, a whole file), so the queue
+// lock is never hot. Threads waiting on a group help by running queued
+// jobs of that group instead of sleeping; worker threads waiting on a
+// nested group run any job, so nesting can't starve the pool.
+//
+
+#include "shared/shared.h"
+#include "common/common.h"
+#include "common/cvar.h"
+#include "common/jobs.h"
+#include "common/prof.h"
+#include "system/system.h"
+
+#define MAX_JOB_THREADS     32
+#define JOB_QUEUE_SIZE      1024    // must be power of two
+#define JOB_QUEUE_MASK      (JOB_QUEUE_SIZE - 1)
+
+typedef struct {
+    job_func_t  func;
+    void        *arg;
+    job_group_t *group;
+} job_t;
+
+typedef struct {
+    job_range_func_t    func;
+    void                *arg;
+    int                 count;
+    int                 chunk;
+    int                 next;
+} range_job_t;
+
+static struct {
+    sys_mutex_t     *lock;
+    sys_cond_t      *wake;      // signaled when a job is queued
+    sys_cond_t      *done;      // broadcast when a group completes
+    sys_thread_t    *threads[MAX_JOB_THREADS];
+    int             num_threads;
+    qboolean        quit;
+
+    unsigned        head;
+    unsigned        tail;
+    job_t           queue[JOB_QUEUE_SIZE];
+} jobs;
+
+static q_thread_local qboolean  job_worker;
+
+static cvar_t   *com_jobs;
+
+// called and returns with lock held
+static void run_job(const job_t *job)
+{
+    Sys_UnlockMutex(jobs.lock);
+    job->func(job->arg);
+    Sys_LockMutex(jobs.lock);
+
+    if (--job->group->pending == 0) {
+        Sys_BroadcastCond(jobs.done);
+    }
+}
+
+static void worker_func(void *arg)
+{
+    char name[16];
+    job_t job;
+
+    Q_snprintf(name, sizeof(name), "worker %d", (int)(intptr_t)arg);
+    Prof_SetThreadName(name);
+    job_worker = qtrue;
+
+    Sys_LockMutex(jobs.lock);
+    while (1) {
+        while (jobs.head == jobs.tail && !jobs.quit) {
+            Sys_WaitCond(jobs.wake, jobs.lock, -1);
+        }
+
+        // queue is drained before exiting
+        if (jobs.head == jobs.tail) {
+            break;
+        }
+
+        job = jobs.queue[jobs.tail++ & JOB_QUEUE_MASK];
+        run_job(&job);
+    }
+    Sys_UnlockMutex(jobs.lock);
+
+    Prof_ReleaseThread();
+}
+
+/*
+================
+Com_QueueJob
+
+Queues a job that belongs to the given group. Runs the job immediately
+if there are no worker threads or the queue is full.
+================
+*/
+void Com_QueueJob(job_group_t *group, job_func_t func, void *arg)
+{
+    job_t *job;
+
+    if (!jobs.num_threads) {
+        func(arg);
+        return;
+    }
+
+    Sys_LockMutex(jobs.lock);
+    if (jobs.head - jobs.tail >= JOB_QUEUE_SIZE) {
+        Sys_UnlockMutex(jobs.lock);
+        func(arg);
+        return;
+    }
+
+    job = &jobs.queue[jobs.head++ & JOB_QUEUE_MASK];
+    job->func = func;
+    job->arg = arg;
+    job->group = group;
+    group->pending++;
+
+    Sys_SignalCond(jobs.wake);
+    Sys_UnlockMutex(jobs.lock);
+}
+
+qboolean Com_JobsPending(job_group_t *group)
+{
+    qboolean pending;
+
+    if (!jobs.num_threads) {
+        return qfalse;
+    }
+
+    Sys_LockMutex(jobs.lock);
+    pending = group->pending > 0;
+    Sys_UnlockMutex(jobs.lock);
+
+    return pending;
+}
+
+/*
+================
+Com_WaitJobs
+
+Blocks until all jobs of the group are finished.
+================
+*/
+void Com_WaitJobs(job_group_t *group)
+{
+    job_t job;
+
+    if (!jobs.num_threads) {
+        return;
+    }
+
+    Sys_LockMutex(jobs.lock);
+    while (group->pending) {
+        if (jobs.head != jobs.tail) {
+            job = jobs.queue[jobs.tail & JOB_QUEUE_MASK];
+            if (job.group == group || job_worker) {
+                jobs.tail++;
+                run_job(&job);
+                continue;
+            }
+        }
+        Sys_WaitCond(jobs.done, jobs.lock, -1);
+    }
+    Sys_UnlockMutex(jobs.lock);
+}
+
+static void range_job(void *arg)
+{
+    range_job_t *r = arg;
+    int start;
+
+    while ((start = q_atomic_add(&r->next, r->chunk)) < r->count) {
+        r->func(r->arg, start, min(start + r->chunk, r->count));
+    }
+}
+
+/*
+================
+Com_ParallelFor
+
+Calls func on disjoint subranges covering [0, count) and returns when all
+of them are done. Subranges are at least grain items long (except the last
+one) and are handed out dynamically, so uneven items balance themselves.
+The calling thread takes part in the work.
+================
+*/
+void Com_ParallelFor(int count, int grain, job_range_func_t func, void *arg)
+{
+    job_group_t group = { 0 };
+    range_job_t r;
+    int i, n;
+
+    if (count <= 0) {
+        return;
+    }
+
+    grain = max(grain, 1);
+    if (!jobs.num_threads || count <= grain) {
+        func(arg, 0, count);
+        return;
+    }
+
+    r.func = func;
+    r.arg = arg;
+    r.count = count;
+    r.chunk = max(grain, count / ((jobs.num_threads + 1) * 8));
+    r.next = 0;
+
+    n = min(jobs.num_threads, (count - 1) / r.chunk);
+    for (i = 0; i < n; i++) {
+        Com_QueueJob(&group, range_job, &r);
+    }
+
+    range_job(&r);
+
+    Com_WaitJobs(&group);
+}
+
+int Com_NumJobThreads(void)
+{
+    return jobs.num_threads + 1;
+}
+
+static void start_workers(void)
+{
+    int i, n;
+
+    n = com_jobs->integer;
+    if (n < 0) {
+        n = Sys_NumProcessors() - 1;
+    }
+    n = min(n, MAX_JOB_THREADS);
+
+    jobs.quit = qfalse;
+    for (i = 0; i < n; i++) {
+        jobs.threads[i] = Sys_CreateThread(worker_func, (void *)(intptr_t)(i + 1));
+        if (!jobs.threads[i]) {
+            break;
+        }
+    }
+    jobs.num_threads = i;
+
+    Com_DPrintf("Started %d worker threads\n", jobs.num_threads);
+}
+
+static void stop_workers(void)
+{
+    int i;
+
+    Sys_LockMutex(jobs.lock);
+    jobs.quit = qtrue;
+    Sys_BroadcastCond(jobs.wake);
+    Sys_UnlockMutex(jobs.lock);
+
+    for (i = 0; i < jobs.num_threads; i++) {
+        Sys_JoinThread(jobs.threads[i]);
+        jobs.threads[i] = NULL;
+    }
+    jobs.num_threads = 0;
+}
+
+static void com_jobs_changed(cvar_t *self)
+{
+    stop_workers();
+    start_workers();
+}
+
+void Com_InitJobs(void)
+{
+    jobs.lock = Sys_CreateMutex();
+    jobs.wake = Sys_CreateCond();
+    jobs.done = Sys_CreateCond();
+
+    if (!jobs.lock || !jobs.wake || !jobs.done) {
+        Com_EPrintf("Couldn't create job queue, running jobs inline\n");
+        return;
+    }
+
+    com_jobs = Cvar_Get("com_jobs", "-1", 0);
+    com_jobs->changed = com_jobs_changed;
+
+    start_workers();
+}
+
+void Com_ShutdownJobs(void)
+{
+    if (!jobs.num_threads) {
+        return;
+    }
+
+    stop_workers();
+}
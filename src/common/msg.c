@@ -216,8 +216,6 @@ void MSG_WriteAngle(float f)
     MSG_WriteByte(ANGLE2BYTE(f));
 }
 
-#if USE_CLIENT
-
 /*
 =============
 MSG_WriteDeltaUsercmd
@@ -310,6 +308,9 @@ int MSG_WriteDeltaUsercmd(const usercmd_t *from, const usercmd_t *cmd, int versi
     return bits;
 }
 
+
+#if USE_CLIENT
+
 /*
 =============
 MSG_WriteBits
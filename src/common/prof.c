@@ -0,0 +1,568 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// prof.c -- scoped CPU zone profiler
+//
+// Each thread records zone begin and end events into its own ring buffer,
+// so zone begin/end never take a lock. The main thread drains all rings
+// once per frame in Prof_EndFrame, replaying each thread's zone stack to
+// aggregate statistics per call path, and optionally streams events into a
+// Chrome trace file (chrome://tracing, Perfetto).
+//
+// Threads own a slot from the first zone or Prof_SetThreadName call until
+// Prof_ReleaseThread, so restarted threads reuse the slots of old ones.
+//
+
+#include "shared/shared.h"
+#include "common/cmd.h"
+#include "common/common.h"
+#include "common/cvar.h"
+#include "common/files.h"
+#include "common/prof.h"
+#include "system/system.h"
+
+#define PROF_RING_SIZE      16384   // must be power of two
+#define PROF_RING_MASK      (PROF_RING_SIZE - 1)
+#define PROF_HASH_SIZE      256
+#define PROF_WINDOW         60      // frames statistics are averaged over
+
+typedef struct {
+    const char  *name;      // NULL for end of zone
+    uint64_t    time;
+} prof_event_t;
+
+typedef struct prof_zone_s {
+    const char          *name;
+    struct prof_zone_s  *parent;
+    int                 depth;
+    uint64_t            frame_usec;
+    int         frame_calls;
+    uint64_t    window_usec;
+    uint64_t    window_max;
+    int         window_calls;
+    prof_stat_t stat;
+} prof_zone_t;
+
+typedef struct {
+    char            name[32];
+    int             index;
+
+    // owner thread state
+    int             depth;
+    int             reserved;   // ring slots held for end events of open zones
+    qboolean        recorded[PROF_MAX_DEPTH];
+
+    // replayed zone stack, main thread only
+    int             open;
+    const char      *open_name[PROF_MAX_DEPTH];
+    prof_zone_t     *open_zone[PROF_MAX_DEPTH];
+    uint64_t        open_start[PROF_MAX_DEPTH];
+
+    unsigned        head;       // written by owner thread
+    unsigned        tail;       // written by main thread
+    unsigned        dropped;
+    prof_event_t    events[PROF_RING_SIZE];
+} prof_thread_t;
+
+int prof_active;
+
+static cvar_t   *prof_enable;
+
+static prof_thread_t    *prof_threads[PROF_MAX_THREADS];
+static int              prof_slot_owners[PROF_MAX_THREADS];
+
+static q_thread_local prof_thread_t *prof_self;
+static q_thread_local qboolean      prof_no_slot;
+
+static prof_zone_t  prof_zones[PROF_MAX_ZONES];
+static int          prof_num_zones;
+static prof_zone_t  *prof_hash[PROF_HASH_SIZE];
+static int          prof_window_frames;
+
+static struct {
+    qhandle_t   file;
+    char        path[MAX_OSPATH];
+    int         frames;
+    uint64_t    start;
+    unsigned    events;
+} prof_trace;
+
+static void update_active(void)
+{
+    prof_active = prof_enable->integer || prof_trace.file;
+}
+
+static prof_thread_t *get_thread(void)
+{
+    prof_thread_t *t;
+    int index;
+
+    if (q_likely(prof_self))
+        return prof_self;
+
+    if (prof_no_slot)
+        return NULL;
+
+    // a slot belongs to whoever raises its owner count from zero
+    for (index = 0; index < PROF_MAX_THREADS; index++) {
+        if (q_atomic_add(&prof_slot_owners[index], 1) == 0)
+            break;
+        q_atomic_add(&prof_slot_owners[index], -1);
+    }
+
+    if (index == PROF_MAX_THREADS) {
+        prof_no_slot = qtrue;
+        return NULL;
+    }
+
+    t = prof_threads[index];
+    if (!t) {
+        // not zone allocated, this may be called from any thread
+        t = calloc(1, sizeof(*t));
+        if (!t) {
+            q_atomic_add(&prof_slot_owners[index], -1);
+            prof_no_slot = qtrue;
+            return NULL;
+        }
+        t->index = index;
+        prof_threads[index] = t;
+    }
+
+    Q_snprintf(t->name, sizeof(t->name), "thread %d", index);
+    t->depth = 0;
+    t->reserved = 0;
+    prof_self = t;
+    return t;
+}
+
+/*
+================
+Prof_ReleaseThread
+
+Called by threads before they exit. Closes zones left open and frees the
+slot for use by another thread.
+================
+*/
+void Prof_ReleaseThread(void)
+{
+    prof_thread_t *t = prof_self;
+
+    if (!t)
+        return;
+
+    while (t->depth)
+        Prof_EndZone();
+
+    prof_self = NULL;
+    q_atomic_add(&prof_slot_owners[t->index], -1);
+}
+
+/*
+================
+Prof_SetThreadName
+
+Sets name displayed for calling thread in trace files.
+================
+*/
+void Prof_SetThreadName(const char *name)
+{
+    prof_thread_t *t = get_thread();
+
+    if (t) {
+        Q_strlcpy(t->name, name, sizeof(t->name));
+    }
+}
+
+static void write_event(prof_thread_t *t, const char *name)
+{
+    unsigned head = t->head;
+    prof_event_t *ev = &t->events[head & PROF_RING_MASK];
+
+    ev->name = name;
+    ev->time = Sys_Microseconds();
+
+    q_atomic_store(&t->head, head + 1);
+}
+
+void Prof_BeginZone(const char *name)
+{
+    prof_thread_t *t = get_thread();
+    unsigned used;
+
+    if (!t)
+        return;
+
+    if (t->depth < PROF_MAX_DEPTH) {
+        // record only if the parent was recorded, and there is room for the
+        // end events of this and all enclosing zones
+        used = t->head - q_atomic_load(&t->tail) + t->reserved;
+        if ((t->depth && !t->recorded[t->depth - 1]) || used + 2 > PROF_RING_SIZE) {
+            t->recorded[t->depth] = qfalse;
+            t->dropped++;
+        } else {
+            t->recorded[t->depth] = qtrue;
+            t->reserved++;
+            write_event(t, name);
+        }
+    }
+    t->depth++;
+}
+
+void Prof_EndZone(void)
+{
+    prof_thread_t *t = prof_self;
+
+    if (!t || !t->depth)
+        return;
+
+    t->depth--;
+    if (t->depth >= PROF_MAX_DEPTH || !t->recorded[t->depth])
+        return;
+
+    t->reserved--;
+    write_event(t, NULL);
+}
+
+static prof_zone_t *find_zone(const char *name, prof_zone_t *parent)
+{
+    unsigned hash = ((size_t)name >> 3) + (parent ? parent - prof_zones + 1 : 0) * 31;
+    prof_zone_t *z;
+
+    hash &= PROF_HASH_SIZE - 1;
+
+    while ((z = prof_hash[hash]) != NULL) {
+        if (z->name == name && z->parent == parent)
+            return z;
+        hash = (hash + 1) & (PROF_HASH_SIZE - 1);
+    }
+
+    if (prof_num_zones == PROF_MAX_ZONES)
+        return NULL;
+
+    z = &prof_zones[prof_num_zones++];
+    z->name = name;
+    z->parent = parent;
+    z->depth = parent ? parent->depth + 1 : 0;
+    z->stat.name = name;
+    z->stat.depth = z->depth;
+    prof_hash[hash] = z;
+    return z;
+}
+
+static void trace_event(const prof_thread_t *t, const char *name, uint64_t start, uint64_t end)
+{
+    if (start < prof_trace.start)
+        return;
+
+    FS_FPrintf(prof_trace.file,
+               "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+               "\"ts\":%"PRIu64",\"dur\":%"PRIu64"}",
+               prof_trace.events ? ",\n" : "", name, t->index,
+               start - prof_trace.start, end - start);
+    prof_trace.events++;
+}
+
+static void trace_finish(void)
+{
+    prof_thread_t *t;
+    int i;
+
+    for (i = 0; i < PROF_MAX_THREADS; i++) {
+        t = prof_threads[i];
+        if (!t)
+            continue;
+        FS_FPrintf(prof_trace.file,
+                   "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                   prof_trace.events++ ? ",\n" : "", t->index, t->name);
+    }
+
+    FS_FPrintf(prof_trace.file, "\n]}\n");
+    FS_FCloseFile(prof_trace.file);
+
+    Com_Printf("Wrote %u trace events to %s\n",
+               prof_trace.events, prof_trace.path);
+
+    memset(&prof_trace, 0, sizeof(prof_trace));
+    update_active();
+}
+
+static void drain_thread(prof_thread_t *t)
+{
+    unsigned head, tail;
+    prof_event_t *ev;
+    prof_zone_t *z;
+    int i;
+
+    head = q_atomic_load(&t->head);
+    for (tail = t->tail; tail != head; tail++) {
+        ev = &t->events[tail & PROF_RING_MASK];
+
+        if (ev->name) {
+            if (t->open == PROF_MAX_DEPTH)
+                continue;   // can't happen, owner records at most that deep
+            i = t->open++;
+            z = NULL;
+            if (!i || t->open_zone[i - 1])
+                z = find_zone(ev->name, i ? t->open_zone[i - 1] : NULL);
+            t->open_name[i] = ev->name;
+            t->open_zone[i] = z;
+            t->open_start[i] = ev->time;
+            continue;
+        }
+
+        if (!t->open)
+            continue;
+        i = --t->open;
+
+        z = t->open_zone[i];
+        if (z) {
+            z->frame_usec += ev->time - t->open_start[i];
+            z->frame_calls++;
+        }
+
+        if (prof_trace.file) {
+            trace_event(t, t->open_name[i], t->open_start[i], ev->time);
+        }
+    }
+    q_atomic_store(&t->tail, tail);
+}
+
+static int sort_zones_r(prof_zone_t **sorted, int count, const prof_zone_t *parent)
+{
+    prof_zone_t *z;
+    int i;
+
+    for (i = 0, z = prof_zones; i < prof_num_zones; i++, z++) {
+        if (z->parent == parent) {
+            sorted[count++] = z;
+            count = sort_zones_r(sorted, count, z);
+        }
+    }
+
+    return count;
+}
+
+// returns zones in call tree order, children following their parent in
+// order of first appearance
+static int sort_zones(prof_zone_t **sorted)
+{
+    return sort_zones_r(sorted, 0, NULL);
+}
+
+static void update_stats(void)
+{
+    prof_zone_t *z;
+    int i;
+
+    prof_window_frames++;
+
+    for (i = 0, z = prof_zones; i < prof_num_zones; i++, z++) {
+        z->window_usec += z->frame_usec;
+        z->window_max = max(z->window_max, z->frame_usec);
+        z->window_calls += z->frame_calls;
+        z->frame_usec = 0;
+        z->frame_calls = 0;
+
+        if (prof_window_frames < PROF_WINDOW)
+            continue;
+
+        z->stat.avg_msec = z->window_usec * 0.001f / PROF_WINDOW;
+        z->stat.max_msec = z->window_max * 0.001f;
+        z->stat.avg_calls = (float)z->window_calls / PROF_WINDOW;
+        z->window_usec = 0;
+        z->window_max = 0;
+        z->window_calls = 0;
+    }
+
+    if (prof_window_frames >= PROF_WINDOW)
+        prof_window_frames = 0;
+}
+
+/*
+================
+Prof_EndFrame
+
+Called by the main thread once per frame, outside of any zones.
+================
+*/
+void Prof_EndFrame(void)
+{
+    prof_thread_t *t;
+    int i;
+
+    if (!prof_active)
+        return;
+
+    for (i = 0; i < PROF_MAX_THREADS; i++) {
+        t = prof_threads[i];
+        if (t) {
+            drain_thread(t);
+        }
+    }
+
+    // zones left open by a longjmp are discarded
+    t = prof_self;
+    if (t) {
+        t->depth = 0;
+        t->reserved = 0;
+        t->open = 0;
+    }
+
+    update_stats();
+
+    if (prof_trace.file && --prof_trace.frames <= 0) {
+        trace_finish();
+    }
+}
+
+/*
+================
+Prof_GetStats
+
+Returns number of zones filled in, in call tree order.
+================
+*/
+int Prof_GetStats(prof_stat_t *stats, int maxstats)
+{
+    prof_zone_t *sorted[PROF_MAX_ZONES];
+    int i, count;
+
+    count = sort_zones(sorted);
+    for (i = 0; i < count && i < maxstats; i++) {
+        stats[i] = sorted[i]->stat;
+    }
+
+    return i;
+}
+
+static void Prof_Stats_f(void)
+{
+    prof_zone_t *sorted[PROF_MAX_ZONES];
+    prof_stat_t *s;
+    prof_thread_t *t;
+    int i, count;
+
+    if (!prof_num_zones) {
+        Com_Printf("No zones recorded. Set prof_enable to 1 first.\n");
+        return;
+    }
+
+    Com_Printf("zone                              avg ms   max ms   calls\n"
+               "-------------------------------- -------- -------- -------\n");
+    count = sort_zones(sorted);
+    for (i = 0; i < count; i++) {
+        s = &sorted[i]->stat;
+        Com_Printf("%*s%-*s %8.3f %8.3f %7.1f\n", s->depth, "",
+                   32 - s->depth, s->name, s->avg_msec, s->max_msec,
+                   s->avg_calls);
+    }
+
+    for (i = 0; i < PROF_MAX_THREADS; i++) {
+        t = prof_threads[i];
+        if (t && t->dropped) {
+            Com_Printf("%s: %u zones dropped\n", t->name, t->dropped);
+        }
+    }
+}
+
+static void Prof_Reset_f(void)
+{
+    prof_thread_t *t;
+    int i, j;
+
+    // zones open during the reset are not counted, nor are their children
+    for (i = 0; i < PROF_MAX_THREADS; i++) {
+        t = prof_threads[i];
+        if (t) {
+            for (j = 0; j < t->open; j++) {
+                t->open_zone[j] = NULL;
+            }
+        }
+    }
+
+    prof_num_zones = 0;
+    prof_window_frames = 0;
+    memset(prof_zones, 0, sizeof(prof_zones));
+    memset(prof_hash, 0, sizeof(prof_hash));
+}
+
+static void Prof_Trace_f(void)
+{
+    char buffer[MAX_OSPATH];
+    qhandle_t f;
+    int frames;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <filename> [frames]\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (prof_trace.file) {
+        Com_Printf("Trace capture already in progress.\n");
+        return;
+    }
+
+    frames = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 100;
+    if (frames < 1) {
+        Com_Printf("Bad number of frames.\n");
+        return;
+    }
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE,
+                        "profiles/", Cmd_Argv(1), ".json");
+    if (!f) {
+        return;
+    }
+
+    FS_FPrintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    prof_trace.file = f;
+    prof_trace.frames = frames;
+    prof_trace.start = Sys_Microseconds();
+    Q_strlcpy(prof_trace.path, buffer, sizeof(prof_trace.path));
+    update_active();
+
+    Com_Printf("Capturing %d frames to %s\n", frames, buffer);
+}
+
+static void prof_enable_changed(cvar_t *self)
+{
+    update_active();
+}
+
+static const cmdreg_t c_prof[] = {
+    { "prof_stats", Prof_Stats_f },
+    { "prof_reset", Prof_Reset_f },
+    { "prof_trace", Prof_Trace_f },
+
+    { NULL }
+};
+
+void Prof_Init(void)
+{
+    prof_enable = Cvar_Get("prof_enable", "0", 0);
+    prof_enable->changed = prof_enable_changed;
+
+    Prof_SetThreadName("main");
+
+    update_active();
+
+    Cmd_Register(c_prof);
+}
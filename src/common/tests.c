@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/files.h"
 #include "common/tests.h"
 #include "refresh/refresh.h"
+#include "client/sound/sound.h"
 #include "system/system.h"
 
 // test error shutdown procedures
@@ -522,6 +523,120 @@ static void Com_TestModels_f(void)
 
     FS_FreeList(list);
 }
+
+#define REGISTER_PASSES     10
+
+static void test_register(const char *path, const char *ext,
+                          qhandle_t (*reg)(const char *), const char *prefix)
+{
+    char buffer[MAX_QPATH];
+    void **list;
+    int i, pass, count, errors;
+    uint64_t start, load, lookup;
+
+    list = FS_ListFiles(path, ext, FS_SEARCH_SAVEPATH, &count);
+    if (!list) {
+        Com_Printf("No %s found\n", path);
+        return;
+    }
+
+    errors = 0;
+    load = lookup = 0;
+    for (pass = 0; pass <= REGISTER_PASSES; pass++) {
+        start = Sys_Microseconds();
+        for (i = 0; i < count; i++) {
+            Q_concat(buffer, sizeof(buffer), prefix, list[i], NULL);
+            if (!reg(buffer) && !pass) {
+                errors++;
+            }
+        }
+        if (pass) {
+            lookup += Sys_Microseconds() - start;
+        } else {
+            load = Sys_Microseconds() - start;
+        }
+    }
+
+    Com_Printf("%s: %d registered, %d failures, %.1f msec to load, "
+               "%.3f usec per lookup\n", path, count - errors, errors,
+               load * 1e-3, (double)lookup / (count * REGISTER_PASSES));
+
+    FS_FreeList(list);
+}
+
+// measures registration of every sound and model found. first pass loads
+// everything, remaining passes look up names that are already registered.
+static void Com_TestRegister_f(void)
+{
+    test_register("sound", ".wav", S_RegisterSound, "#");
+    test_register("models", ".md2", R_RegisterModel, "");
+}
+#endif
+
+/*
+==============================================================================
+
+HELPERS FOR RANDOMIZED TESTS AND BENCHMARKS
+
+==============================================================================
+*/
+
+// fixed LCG so that randomized tests are reproducible, returns 16 bits
+unsigned TST_Rand(unsigned *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+// uniform in [0, 1)
+float TST_Frand(unsigned *seed)
+{
+    return TST_Rand(seed) * (1.0f / 65536);
+}
+
+void TST_FillRandom(void *data, size_t size, unsigned *seed)
+{
+    byte *p = data;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        p[i] = TST_Rand(seed);
+}
+
+// calls func(arg, k) the given number of times for k = 0 and k = 1, adding
+// the time spent on each to usec[k]
+void TST_TimeVariants(void (*func)(void *, int), void *arg, int iterations, uint64_t usec[2])
+{
+    uint64_t start;
+    int i, k;
+
+    for (k = 0; k < 2; k++) {
+        start = Sys_Microseconds();
+        for (i = 0; i < iterations; i++)
+            func(arg, k);
+        usec[k] += Sys_Microseconds() - start;
+    }
+}
+
+// prints msec per iteration of both variants and the speedup of the second
+void TST_PrintTimes(const char *what, const char *name0, const char *name1,
+                    const uint64_t usec[2], int iterations)
+{
+    Com_Printf("%s: %s %.3f msec, %s %.3f msec (%.2fx)\n", what,
+               name0, usec[0] * 1e-3 / iterations,
+               name1, usec[1] * 1e-3 / iterations,
+               (double)usec[0] / max(usec[1], 1));
+}
+
+#if REF_VKPT
+// CPU only checks of the RTX renderer world mesh build, texture cache, texture kernels
+// and model loading, these don't need the renderer to be running
+void bsp_mesh_weld_test_f(void);
+void bsp_mesh_cache_test_f(void);
+void bsp_mesh_cluster_lights_test_f(void);
+void vkpt_texture_cache_test_f(void);
+void vkpt_texture_kernel_test_f(void);
+void vkpt_model_load_test_f(void);
 #endif
 
 void TST_Init(void)
@@ -538,6 +653,15 @@ void TST_Init(void)
     Cmd_AddCommand("snprintftest", Com_TestSnprintf_f);
 #if USE_REF
     Cmd_AddCommand("modeltest", Com_TestModels_f);
+    Cmd_AddCommand("registertest", Com_TestRegister_f);
+#endif
+#if REF_VKPT
+    Cmd_AddCommand("weldtest", bsp_mesh_weld_test_f);
+    Cmd_AddCommand("meshtest", bsp_mesh_cache_test_f);
+    Cmd_AddCommand("lightlisttest", bsp_mesh_cluster_lights_test_f);
+    Cmd_AddCommand("texcachetest", vkpt_texture_cache_test_f);
+    Cmd_AddCommand("texkerneltest", vkpt_texture_kernel_test_f);
+    Cmd_AddCommand("modelloadtest", vkpt_model_load_test_f);
 #endif
 }
 
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "shared/shared.h"
 #include "common/common.h"
 #include "common/zone.h"
+#include "system/system.h"
 
 #define Z_MAGIC     0x1d0d
 #define Z_TAIL      0x5b7b
@@ -48,6 +49,14 @@ typedef struct zhead_s {
 
 static zhead_t      z_chain;
 
+// protects z_chain and z_stats, so that worker threads can allocate.
+// malloc and free are called outside of the lock. Z_FreeTags walks the
+// chain unlocked and must not run while jobs are allocating.
+static sys_mutex_t  *z_lock;
+
+#define Z_LOCK()    if (z_lock) Sys_LockMutex(z_lock)
+#define Z_UNLOCK()  if (z_lock) Sys_UnlockMutex(z_lock)
+
 typedef struct {
     zhead_t     z;
     char        data[2];
@@ -112,9 +121,14 @@ void Z_Check(void)
 {
     zhead_t *z;
 
+    Z_LOCK();
     Z_FOR_EACH(z) {
-        Z_Validate(z, __func__);
+        if (z->magic != Z_MAGIC || Z_TAIL_F(z) != Z_TAIL || z->tag == TAG_FREE) {
+            Z_UNLOCK();
+            Z_Validate(z, __func__);
+        }
     }
+    Z_UNLOCK();
 }
 
 void Z_LeakTest(memtag_t tag)
@@ -122,13 +136,16 @@ void Z_LeakTest(memtag_t tag)
     zhead_t *z;
     size_t numLeaks = 0, numBytes = 0;
 
+    Z_Check();
+
+    Z_LOCK();
     Z_FOR_EACH(z) {
-        Z_Validate(z, __func__);
         if (z->tag == tag) {
             numLeaks++;
             numBytes += z->size;
         }
     }
+    Z_UNLOCK();
 
     if (numLeaks) {
         Com_WPrintf("************* Z_LeakTest *************\n"
@@ -157,17 +174,23 @@ void Z_Free(void *ptr)
 
     Z_Validate(z, __func__);
 
+    Z_LOCK();
     s = &z_stats[z->tag < TAG_MAX ? z->tag : TAG_FREE];
     s->count--;
     s->bytes -= z->size;
 
-    if (z->tag != TAG_STATIC) {
-        z->prev->next = z->next;
-        z->next->prev = z->prev;
-        z->magic = 0xdead;
-        z->tag = TAG_FREE;
-        free(z);
+    if (z->tag == TAG_STATIC) {
+        Z_UNLOCK();
+        return;
     }
+
+    z->prev->next = z->next;
+    z->next->prev = z->prev;
+    Z_UNLOCK();
+
+    z->magic = 0xdead;
+    z->tag = TAG_FREE;
+    free(z);
 }
 
 /*
@@ -197,13 +220,18 @@ void *Z_Realloc(void *ptr, size_t size)
         Com_Error(ERR_FATAL, "%s: couldn't realloc static memory", __func__);
     }
 
-    s = &z_stats[z->tag < TAG_MAX ? z->tag : TAG_FREE];
-    s->bytes -= z->size;
-
     if (size > SIZE_MAX - Z_EXTRA - 3) {
         Com_Error(ERR_FATAL, "%s: bad size", __func__);
     }
 
+    // unlink while the block moves, neighbours may change meanwhile
+    Z_LOCK();
+    s = &z_stats[z->tag < TAG_MAX ? z->tag : TAG_FREE];
+    s->bytes -= z->size;
+    z->prev->next = z->next;
+    z->next->prev = z->prev;
+    Z_UNLOCK();
+
     size = (size + Z_EXTRA + 3) & ~3;
     z = realloc(z, size);
     if (!z) {
@@ -211,10 +239,14 @@ void *Z_Realloc(void *ptr, size_t size)
     }
 
     z->size = size;
-    z->prev->next = z;
-    z->next->prev = z;
 
+    Z_LOCK();
+    z->next = z_chain.next;
+    z->prev = &z_chain;
+    z_chain.next->prev = z;
+    z_chain.next = z;
     s->bytes += size;
+    Z_UNLOCK();
 
     Z_TAIL_F(z) = Z_TAIL;
 
@@ -309,20 +341,22 @@ void *Z_TagMalloc(size_t size, memtag_t tag)
     z->time = time(NULL);
 #endif
 
-    z->next = z_chain.next;
-    z->prev = &z_chain;
-    z_chain.next->prev = z;
-    z_chain.next = z;
-
     if (z_perturb && z_perturb->integer) {
         memset(z + 1, z_perturb->integer, size - Z_EXTRA);
     }
 
     Z_TAIL_F(z) = Z_TAIL;
 
+    Z_LOCK();
+    z->next = z_chain.next;
+    z->prev = &z_chain;
+    z_chain.next->prev = z;
+    z_chain.next = z;
+
     s = &z_stats[tag < TAG_MAX ? tag : TAG_FREE];
     s->count++;
     s->bytes += size;
+    Z_UNLOCK();
 
     return z + 1;
 }
@@ -392,6 +426,7 @@ Z_Init
 void Z_Init(void)
 {
     z_chain.next = z_chain.prev = &z_chain;
+    z_lock = Sys_CreateMutex();
 }
 
 /*
@@ -438,9 +473,11 @@ char *Z_CvarCopyString(const char *in)
 
     // return static storage
     z = (zstatic_t *)&z_static[i];
+    Z_LOCK();
     s = &z_stats[TAG_STATIC];
     s->count++;
     s->bytes += z->z.size;
+    Z_UNLOCK();
     return z->data;
 }
 
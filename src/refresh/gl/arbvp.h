@@ -0,0 +1,47 @@
+// Interpolates alias model frames and applies shell offset and dot shading,
+// matching the tess_* functions in gl_mesh.c. Plain models are drawn with
+// zero shade direction, which leaves the color unchanged.
+static const char gl_prog_alias[] =
+    "!!ARBvp1.0\n"
+
+    "ATTRIB newpos = vertex.position;\n"
+    "ATTRIB newnorm = vertex.normal;\n"
+    "ATTRIB oldpos = vertex.attrib[6];\n"
+    "ATTRIB oldnorm = vertex.attrib[7];\n"
+    "PARAM newscale = program.local[0];\n"
+    "PARAM oldscale = program.local[1];\n"
+    "PARAM translate = program.local[2];\n"    // w = shell scale
+    "PARAM lerp = program.local[3];\n"         // x = backlerp, y = frontlerp
+    "PARAM shadedir = program.local[4];\n"
+    "PARAM mvp[4] = { state.matrix.mvp };\n"
+    "PARAM consts = { 1, -0.7, 0, 0 };\n"
+    "TEMP pos, norm, tmp;\n"
+
+    "MUL pos, oldpos, oldscale;\n"
+    "MAD pos, newpos, newscale, pos;\n"
+    "ADD pos, pos, translate;\n"
+
+    "MUL norm, oldnorm, lerp.x;\n"
+    "MAD norm, newnorm, lerp.y, norm;\n"
+    "DP3 tmp.x, norm, norm;\n"
+    "RSQ tmp.x, tmp.x;\n"
+    "MUL norm, norm, tmp.x;\n"
+
+    "MAD pos, norm, translate.w, pos;\n"
+    "MOV pos.w, consts.x;\n"
+    "DP4 result.position.x, mvp[0], pos;\n"
+    "DP4 result.position.y, mvp[1], pos;\n"
+    "DP4 result.position.z, mvp[2], pos;\n"
+    "DP4 result.position.w, mvp[3], pos;\n"
+
+    // d = dot(n, dir), scaled by 0.3 when negative, plus one
+    "DP3 tmp.x, norm, shadedir;\n"
+    "SLT tmp.y, tmp.x, consts.z;\n"
+    "MAD tmp.y, tmp.y, consts.y, consts.x;\n"
+    "MAD tmp.x, tmp.x, tmp.y, consts.x;\n"
+    "MUL result.color.xyz, vertex.color, tmp.x;\n"
+    "MOV result.color.w, vertex.color.w;\n"
+
+    "MOV result.texcoord[0], vertex.texcoord[0];\n"
+    "END\n"
+;
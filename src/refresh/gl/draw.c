@@ -327,6 +327,19 @@ void Draw_Stats(void)
         y += 10;
     }
     Draw_Stringf(x, y, "2D batches   : %i", c.batchesDrawn2D); y += 10;
+    Draw_Stringf(x, y, "Draw calls   : %i", c.drawCalls); y += 10;
+    Draw_Stringf(x, y, "KB uploaded  : %.1f", c.bytesUploaded / 1024.0f); y += 10;
+    if (gl_cluster_batches->integer) {
+        Draw_Stringf(x, y, "World batches: %i", c.worldBatches); y += 10;
+        Draw_Stringf(x, y, "Batch culled : %i", c.worldBatchesCulled); y += 10;
+        if (c.clustersBuilt) {
+            Draw_Stringf(x, y, "New clusters : %i", c.clustersBuilt); y += 10;
+        }
+    }
+    Draw_Stringf(x, y, "World usec   : %i", c.worldUsec); y += 10;
+    if (c.texelsRebuilt) {
+        Draw_Stringf(x, y, "LM texels    : %i", c.texelsRebuilt); y += 10;
+    }
 }
 
 void Draw_Lightmaps(void)
@@ -30,6 +30,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "refresh/models.h"
 #include "system/hunk.h"
 
+#if USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #if USE_FIXED_LIBGL
 #include "qgl/fixed.h"
 #else
@@ -56,6 +60,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define NUM_TEXNUMS     6
 
+#define STREAM_SEGMENTS     4
+#define STREAM_SEGMENT_SIZE 0x100000
+#define STREAM_SIZE         (STREAM_SEGMENTS * STREAM_SEGMENT_SIZE)
+#define STREAM_ALIGN(size)  (((size) + 63) & ~(size_t)63)
+
 typedef struct {
     qboolean        registering;
     struct {
@@ -65,7 +74,17 @@ typedef struct {
         GLuint      bufnum;
         vec_t       size;
     } world;
+    struct {
+        GLuint      bufnum;
+        byte        *mapped;
+        GLsync      fences[STREAM_SEGMENTS];
+        size_t      offset;
+        size_t      reserved;
+        int         segment;
+        qboolean    bound;
+    } stream;
     GLuint          prognum_warp;
+    GLuint          prognum_alias;
     GLuint          texnums[NUM_TEXNUMS];
     GLbitfield      stencil_buffer_bit;
     float           entity_modulate;
@@ -147,6 +166,13 @@ typedef struct {
     int spheresCulled;
     int rotatedBoxesCulled;
     int batchesDrawn2D;
+    int drawCalls;
+    int bytesUploaded;
+    int worldBatches;
+    int worldBatchesCulled;
+    int clustersBuilt;
+    int worldUsec;
+    int texelsRebuilt;
 } statCounters_t;
 
 extern statCounters_t c;
@@ -168,7 +194,9 @@ extern cvar_t *gl_dlight_falloff;
 extern cvar_t *gl_modulate_entities;
 extern cvar_t *gl_doublelight_entities;
 extern cvar_t *gl_fragment_program;
+extern cvar_t *gl_vertex_program;
 extern cvar_t *gl_fontshadow;
+extern cvar_t *gl_stream_buffer;
 
 // development variables
 extern cvar_t *gl_znear;
@@ -180,6 +208,7 @@ extern cvar_t *gl_test;
 #endif
 extern cvar_t *gl_cull_nodes;
 extern cvar_t *gl_hash_faces;
+extern cvar_t *gl_cluster_batches;
 extern cvar_t *gl_clear;
 extern cvar_t *gl_novis;
 extern cvar_t *gl_lockpvs;
@@ -238,8 +267,15 @@ typedef struct maliasmesh_s {
     maliastc_t      *tcoords;
     image_t         *skins[MAX_ALIAS_SKINS];
     int             numskins;
+    GLuint          bufnum;     // tcoords and all frames for the vertex program
 } maliasmesh_t;
 
+// frame vertex layout in mesh buffer objects, follows the texture coordinates
+typedef struct {
+    short   pos[4];
+    int8_t  norm[4];
+} glAliasVert_t;
+
 // xyz[3] | color[1]  | st[2]    | lmst[2]
 // xyz[3] | unused[1] | color[4]
 #define VERTEX_SIZE 8
@@ -255,6 +291,10 @@ typedef struct maliasmesh_s {
 #define LM_BLOCK_WIDTH      256
 #define LM_BLOCK_HEIGHT     256
 
+typedef struct {
+    int         left, top, right, bottom;
+} lmrect_t;
+
 typedef struct {
     int         inuse[LM_BLOCK_WIDTH];
     byte        buffer[LM_BLOCK_WIDTH * LM_BLOCK_HEIGHT * 4];
@@ -263,12 +303,16 @@ typedef struct {
     float       add, modulate, scale;
     int         nummaps;
     GLuint      texnums[LM_MAX_LIGHTMAPS];
+    byte        *blocks[LM_MAX_LIGHTMAPS];  // copies for dynamic updates
+    lmrect_t    rects[LM_MAX_LIGHTMAPS];
+    uint32_t    dirtyblocks;
 } lightmap_builder_t;
 
 extern lightmap_builder_t lm;
 
 void GL_AdjustColor(vec3_t color);
 void GL_PushLights(mface_t *surf);
+void GL_UploadLightmaps(void);
 
 void GL_RebuildLighting(void);
 void GL_FreeWorld(void);
@@ -358,6 +402,12 @@ static inline void GL_ColorFloatPointer(GLint size, GLsizei stride, const GLfloa
     qglColorPointer(size, GL_FLOAT, sizeof(GLfloat) * stride, pointer);
 }
 
+static inline void GL_DrawTriangles(GLsizei numindices, const QGL_INDEX_TYPE *indices)
+{
+    qglDrawElements(GL_TRIANGLES, numindices, QGL_INDEX_ENUM, indices);
+    c.drawCalls++;
+}
+
 static inline void GL_LockArrays(GLsizei count)
 {
     if (qglLockArraysEXT) {
@@ -458,21 +508,35 @@ byte *IMG_ReadPixels_GL(int *width, int *height, int *rowbytes);
  */
 #define TESS_MAX_VERTICES   4096
 #define TESS_MAX_INDICES    (3 * TESS_MAX_VERTICES)
+#define TESS_MAX_FACES      1024
 
 typedef struct {
     GLfloat         vertices[VERTEX_SIZE * TESS_MAX_VERTICES];
     QGL_INDEX_TYPE  indices[TESS_MAX_INDICES];
     GLubyte         colors[4 * TESS_MAX_VERTICES];
+    GLint           firstverts[TESS_MAX_FACES];
+    GLsizei         numfaceverts[TESS_MAX_FACES];
     GLuint          texnum[MAX_TMUS];
     int             numverts;
     int             numindices;
+    int             numfaces;
     int             flags;
 } tesselator_t;
 
 extern tesselator_t tess;
 
+void GL_InitTess(void);
+void GL_ShutdownTess(void);
+void GL_BeginStreamFrame(void);
+void GL_StreamReserve(size_t size);
+const void *GL_StreamData(const void *data, size_t size);
+void GL_StreamDone(void);
+
 void GL_Flush2D(void);
 void GL_DrawParticles(void);
+#if USE_TESTS
+void GL_ParticleTest_f(void);
+#endif
 void GL_DrawBeams(void);
 
 void GL_BindArrays(void);
@@ -491,6 +555,7 @@ void GL_ClearSolidFaces(void);
  */
 void GL_DrawBspModel(mmodel_t *model);
 void GL_DrawWorld(void);
+void GL_FreeClusterCache(void);
 void GL_SampleLightPoint(vec3_t color);
 void GL_LightPoint(vec3_t origin, vec3_t color);
 void R_LightPoint_GL(vec3_t origin, vec3_t color);
@@ -523,3 +588,4 @@ void HQ2x_Init(void);
 qerror_t MOD_LoadMD2_GL(model_t *model, const void *rawdata, size_t length);
 qerror_t MOD_LoadMD3_GL(model_t *model, const void *rawdata, size_t length);
 void MOD_Reference_GL(model_t *model);
+void MOD_Unload_GL(model_t *model);
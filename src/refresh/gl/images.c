@@ -939,6 +939,8 @@ GL_ShutdownImages
 */
 void GL_ShutdownImages(void)
 {
+    int i;
+
     gl_bilerp_chars->changed = NULL;
     gl_bilerp_pics->changed = NULL;
     gl_texturemode->changed = NULL;
@@ -950,6 +952,11 @@ void GL_ShutdownImages(void)
     qglDeleteTextures(NUM_TEXNUMS, gl_static.texnums);
     qglDeleteTextures(LM_MAX_LIGHTMAPS, lm.texnums);
 
+    for (i = 0; i < LM_MAX_LIGHTMAPS; i++) {
+        Z_Free(lm.blocks[i]);
+        lm.blocks[i] = NULL;
+    }
+
 #ifdef _DEBUG
     r_charset = NULL;
 #endif
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
  */
 
 #include "gl.h"
+#include "system/system.h"
 
 glRefdef_t glr;
 glStatic_t gl_static;
@@ -50,7 +51,9 @@ cvar_t *gl_dlight_falloff;
 cvar_t *gl_modulate_entities;
 cvar_t *gl_doublelight_entities;
 cvar_t *gl_fragment_program;
+cvar_t *gl_vertex_program;
 cvar_t *gl_vertex_buffer_object;
+cvar_t *gl_stream_buffer;
 cvar_t *gl_fontshadow;
 
 // development variables
@@ -73,6 +76,7 @@ cvar_t *gl_cull_models;
 cvar_t *gl_clear;
 cvar_t *gl_finish;
 cvar_t *gl_hash_faces;
+cvar_t *gl_cluster_batches;
 cvar_t *gl_novis;
 cvar_t *gl_lockpvs;
 cvar_t *gl_lightmap;
@@ -81,6 +85,18 @@ cvar_t *gl_vertexlight;
 cvar_t *gl_polyblend;
 cvar_t *gl_showerrors;
 
+// counters accumulated over frames for the drawstats command
+static struct {
+    unsigned    frames;
+    unsigned    start;
+    uint64_t    drawCalls;
+    uint64_t    batchesDrawn;
+    uint64_t    trisDrawn;
+    uint64_t    bytesUploaded;
+    uint64_t    worldUsec;
+    uint64_t    texelsRebuilt;
+} stats;
+
 // ==============================================================================
 
 static void GL_SetupFrustum(void)
@@ -625,6 +641,8 @@ void R_BeginFrame_GL(void)
 
     memset(&c, 0, sizeof(c));
 
+    GL_BeginStreamFrame();
+
     if (gl_finish->integer) {
         qglFinish();
     }
@@ -655,11 +673,20 @@ void R_EndFrame_GL(void)
         GL_DrawTearing();
     }
 
-    // enable/disable fragment programs on the fly
-    if (gl_fragment_program->modified) {
+    stats.frames++;
+    stats.drawCalls += c.drawCalls;
+    stats.batchesDrawn += c.batchesDrawn + c.batchesDrawn2D;
+    stats.trisDrawn += c.trisDrawn;
+    stats.bytesUploaded += c.bytesUploaded;
+    stats.worldUsec += c.worldUsec;
+    stats.texelsRebuilt += c.texelsRebuilt;
+
+    // enable/disable fragment and vertex programs on the fly
+    if (gl_fragment_program->modified || gl_vertex_program->modified) {
         GL_ShutdownPrograms();
         GL_InitPrograms();
         gl_fragment_program->modified = qfalse;
+        gl_vertex_program->modified = qfalse;
     }
 
     GL_ShowErrors(__func__);
@@ -674,6 +701,8 @@ void R_EndFrame_GL(void)
     }
 #endif
 
+    IMG_EndFrame();
+
     VID_EndFrame();
 }
 
@@ -692,6 +721,149 @@ static void GL_Strings_f(void)
                gl_config.colorbits, gl_config.depthbits, gl_config.stencilbits);
 }
 
+// Prints per frame averages of the draw counters since the last call,
+// these are available in release builds unlike gl_showstats.
+static void GL_DrawStats_f(void)
+{
+    unsigned msec = Sys_Milliseconds() - stats.start;
+
+    if (stats.frames) {
+        Com_Printf("%u frames in %u msec (%.1f fps), per frame:\n"
+                   "%.1f draw calls\n"
+                   "%.1f batches\n"
+                   "%.1f triangles\n"
+                   "%.1f KB uploaded\n"
+                   "%.3f msec in world\n"
+                   "%.1f lightmap texels rebuilt\n",
+                   stats.frames, msec, stats.frames * 1000.0 / max(msec, 1),
+                   (double)stats.drawCalls / stats.frames,
+                   (double)stats.batchesDrawn / stats.frames,
+                   (double)stats.trisDrawn / stats.frames,
+                   stats.bytesUploaded / 1024.0 / stats.frames,
+                   stats.worldUsec * 1e-3 / stats.frames,
+                   (double)stats.texelsRebuilt / stats.frames);
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    stats.start = Sys_Milliseconds();
+}
+
+#if USE_TESTS
+/*
+=============
+GL_AliasBench_f
+
+Draws a grid of animated alias models with the vertex program and with
+CPU interpolation, times both and counts pixels that differ noticeably.
+=============
+*/
+static void GL_AliasBench_f(void)
+{
+    const char *name = Cmd_Argc() > 1 ? Cmd_Argv(1) : "players/male/tris.md2";
+    int count = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 256;
+    int frames = Cmd_Argc() > 3 ? atoi(Cmd_Argv(3)) : 100;
+    GLuint prognum = gl_static.prognum_alias;
+    lightstyle_t lightstyles[MAX_LIGHTSTYLES];
+    refdef_t *fd;
+    entity_t *ents, *ent;
+    model_t *model;
+    qhandle_t handle;
+    byte *pixels[2];
+    unsigned msec[2], start;
+    int calls[2], width, height, rowbytes;
+    int i, j, k, n, side, mismatch;
+
+    handle = R_RegisterModel(name);
+    model = MOD_ForHandle(handle);
+    if (!model || model->type != MOD_ALIAS || !model->numframes) {
+        Com_Printf("Couldn't load %s\n", name);
+        return;
+    }
+
+    if (!prognum) {
+        Com_Printf("Vertex program is not available, timing CPU path only\n");
+    }
+
+    clamp(count, 1, 4096);
+    clamp(frames, 1, 10000);
+
+    memset(lightstyles, 0, sizeof(lightstyles));
+    fd = Z_Mallocz(sizeof(*fd));
+    ents = Z_Mallocz(count * sizeof(*ents));
+
+    // models face the viewer from a square grid in front of it, every
+    // fourth one has a shell and every eighth one isn't interpolated
+    side = ceil(sqrt(count));
+    for (i = 0, ent = ents; i < count; i++, ent++) {
+        ent->model = handle;
+        ent->origin[0] = side * 48;
+        ent->origin[1] = (i % side - side / 2) * 48;
+        ent->origin[2] = (i / side - side / 2) * 64;
+        VectorCopy(ent->origin, ent->oldorigin);
+        ent->angles[YAW] = 180 + (i * 37) % 90 - 45;
+        ent->flags = RF_FULLBRIGHT;
+        if ((i & 3) == 3) {
+            ent->flags |= RF_SHELL_RED | RF_TRANSLUCENT;
+            ent->alpha = 0.3f;
+        }
+    }
+
+    fd->width = r_config.width;
+    fd->height = r_config.height;
+    fd->fov_x = 90;
+    fd->fov_y = RAD2DEG(atan(tan(DEG2RAD(fd->fov_x) / 2) * fd->height / fd->width)) * 2;
+    fd->rdflags = RDF_NOWORLDMODEL;
+    fd->lightstyles = lightstyles;
+    fd->num_entities = count;
+    fd->entities = ents;
+
+    for (k = 0; k < 2; k++) {
+        gl_static.prognum_alias = k ? 0 : prognum;
+
+        start = Sys_Milliseconds();
+        for (j = 0; j < frames; j++) {
+            for (i = 0, ent = ents; i < count; i++, ent++) {
+                n = i + j;
+                ent->frame = n % model->numframes;
+                ent->oldframe = (n + 1) % model->numframes;
+                ent->backlerp = (i & 7) ? (n & 3) * 0.25f : 0;
+            }
+            fd->time = j * 0.1f;
+
+            R_BeginFrame_GL();
+            qglClear(GL_COLOR_BUFFER_BIT);
+            R_RenderFrame_GL(fd);
+            calls[k] = c.drawCalls;
+            qglFinish();
+        }
+        msec[k] = Sys_Milliseconds() - start;
+
+        pixels[k] = IMG_ReadPixels_GL(&width, &height, &rowbytes);
+    }
+
+    gl_static.prognum_alias = prognum;
+
+    mismatch = 0;
+    for (i = 0; i < height; i++) {
+        byte *a = pixels[0] + i * rowbytes;
+        byte *b = pixels[1] + i * rowbytes;
+        for (j = 0; j < width; j++, a += 3, b += 3) {
+            if (abs(a[0] - b[0]) > 8 || abs(a[1] - b[1]) > 8 || abs(a[2] - b[2]) > 8)
+                mismatch++;
+        }
+    }
+
+    Com_Printf("%d x %s, %d frames: vertex program %u msec (%d draw calls), "
+               "CPU %u msec (%d draw calls), %d pixels differ\n",
+               count, name, frames, msec[0], calls[0], msec[1], calls[1], mismatch);
+
+    FS_FreeTempMem(pixels[1]);
+    FS_FreeTempMem(pixels[0]);
+    Z_Free(ents);
+    Z_Free(fd);
+}
+#endif
+
 static size_t GL_ViewCluster_m(char *buffer, size_t size)
 {
     return Q_scnprintf(buffer, size, "%d", glr.viewcluster1);
@@ -757,8 +929,10 @@ static void GL_Register(void)
     gl_modulate_entities->changed = gl_modulate_entities_changed;
     gl_doublelight_entities = Cvar_Get("gl_doublelight_entities", "1", 0);
     gl_fragment_program = Cvar_Get("gl_fragment_program", "1", 0);
+    gl_vertex_program = Cvar_Get("gl_vertex_program", "1", 0);
     gl_vertex_buffer_object = Cvar_Get("gl_vertex_buffer_object", "1", CVAR_FILES);
     gl_vertex_buffer_object->modified = qtrue;
+    gl_stream_buffer = Cvar_Get("gl_stream_buffer", "2", CVAR_REFRESH);
     gl_fontshadow = Cvar_Get("gl_fontshadow", "0", 0);
 
     // development variables
@@ -780,6 +954,7 @@ static void GL_Register(void)
     gl_cull_nodes = Cvar_Get("gl_cull_nodes", "1", 0);
     gl_cull_models = Cvar_Get("gl_cull_models", "1", 0);
     gl_hash_faces = Cvar_Get("gl_hash_faces", "1", 0);
+    gl_cluster_batches = Cvar_Get("gl_cluster_batches", "1", 0);
     gl_clear = Cvar_Get("gl_clear", "0", 0);
     gl_finish = Cvar_Get("gl_finish", "0", 0);
     gl_novis = Cvar_Get("gl_novis", "0", 0);
@@ -797,12 +972,23 @@ static void GL_Register(void)
     gl_modulate_entities_changed(NULL);
 
     Cmd_AddCommand("strings", GL_Strings_f);
+    Cmd_AddCommand("drawstats", GL_DrawStats_f);
+    stats.start = Sys_Milliseconds();
+#if USE_TESTS
+    Cmd_AddCommand("particletest", GL_ParticleTest_f);
+    Cmd_AddCommand("aliasbench", GL_AliasBench_f);
+#endif
     Cmd_AddMacro("gl_viewcluster", GL_ViewCluster_m);
 }
 
 static void GL_Unregister(void)
 {
     Cmd_RemoveCommand("strings");
+    Cmd_RemoveCommand("drawstats");
+#if USE_TESTS
+    Cmd_RemoveCommand("particletest");
+    Cmd_RemoveCommand("aliasbench");
+#endif
 }
 
 static qboolean GL_SetupConfig(void)
@@ -910,6 +1096,23 @@ static qboolean GL_SetupConfig(void)
         Com_Printf("GL_EXT_texture_filter_anisotropic not found\n");
     }
 
+    // persistent mapping is only used together with sync objects
+    if ((gl_config.ext_supported & QGL_ARB_buffer_storage) || AT_LEAST_OPENGL(4, 4)) {
+        if (AT_LEAST_OPENGL(3, 2)) {
+            Com_Printf("...enabling GL_ARB_buffer_storage\n");
+            gl_config.ext_enabled |= QGL_ARB_buffer_storage;
+        } else {
+            Com_Printf("...ignoring GL_ARB_buffer_storage,\n"
+                       "OpenGL 3.2 is required\n");
+        }
+    } else {
+        Com_Printf("GL_ARB_buffer_storage not found\n");
+    }
+
+    if (AT_LEAST_OPENGL(1, 4)) {
+        gl_config.ext_enabled |= QGL_1_4_core_functions;
+    }
+
     if (AT_LEAST_OPENGL(3, 0)) {
         gl_config.ext_enabled |= QGL_3_0_core_functions;
     }
@@ -992,6 +1195,7 @@ static void GL_PostInit(void)
         gl_vertex_buffer_object->modified = qfalse;
     }
 
+    GL_InitTess();
     GL_SetDefaultState();
     GL_InitImages();
     MOD_Init();
@@ -1046,6 +1250,7 @@ qboolean R_Init_GL(qboolean total)
 
     GL_InitPrograms();
     gl_fragment_program->modified = qfalse;
+    gl_vertex_program->modified = qfalse;
 
     GL_InitTables();
 
@@ -1072,6 +1277,7 @@ void R_Shutdown_GL(qboolean total)
     GL_FreeWorld();
     GL_ShutdownImages();
     MOD_Shutdown();
+    GL_ShutdownTess();
 
     if (gl_vertex_buffer_object->modified) {
         // disable buffer objects after map is freed
@@ -1172,7 +1378,10 @@ void R_RegisterFunctionsGL()
 	IMG_Load = IMG_Load_GL;
 	IMG_Unload = IMG_Unload_GL;
 	IMG_ReadPixels = IMG_ReadPixels_GL;
+	IMG_ReadCache = NULL;
+	IMG_LoadCache = NULL;
 	MOD_LoadMD2 = MOD_LoadMD2_GL;
 	MOD_LoadMD3 = MOD_LoadMD3_GL;
 	MOD_Reference = MOD_Reference_GL;
+	MOD_Unload = MOD_Unload_GL;
 }
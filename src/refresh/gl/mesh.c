@@ -39,6 +39,10 @@ static float    celscale;
 
 static GLfloat  shadowmatrix[16];
 
+// vertex program parameters, see arbvp.h
+static vec4_t   program_params[5];
+static qboolean use_program;
+
 static void setup_dotshading(void)
 {
     float cp, cy, sp, sy;
@@ -430,8 +434,7 @@ static void draw_celshading(maliasmesh_t *mesh)
     qglPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     qglCullFace(GL_FRONT);
     qglColor4f(0, 0, 0, color[3] * celscale);
-    qglDrawElements(GL_TRIANGLES, mesh->numindices, QGL_INDEX_ENUM,
-                    mesh->indices);
+    GL_DrawTriangles(mesh->numindices, mesh->indices);
     qglCullFace(GL_BACK);
     qglPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
     qglLineWidth(1);
@@ -531,8 +534,7 @@ static void draw_shadow(maliasmesh_t *mesh)
     qglEnable(GL_POLYGON_OFFSET_FILL);
     qglPolygonOffset(-1.0f, -2.0f);
     qglColor4f(0, 0, 0, color[3] * 0.5f);
-    qglDrawElements(GL_TRIANGLES, mesh->numindices, QGL_INDEX_ENUM,
-                    mesh->indices);
+    GL_DrawTriangles(mesh->numindices, mesh->indices);
     qglDisable(GL_POLYGON_OFFSET_FILL);
 
     // once we have drawn something to stencil buffer, continue to clear it for
@@ -544,6 +546,73 @@ static void draw_shadow(maliasmesh_t *mesh)
     }
 }
 
+static void setup_program(void)
+{
+    use_program = gl_static.prognum_alias != 0;
+    if (!use_program)
+        return;
+
+    memset(program_params, 0, sizeof(program_params));
+
+    VectorCopy(newscale, program_params[0]);
+    VectorCopy(translate, program_params[2]);
+
+    if (newframenum == oldframenum) {
+        program_params[3][1] = 1;
+    } else {
+        VectorCopy(oldscale, program_params[1]);
+        program_params[3][0] = backlerp;
+        program_params[3][1] = frontlerp;
+    }
+
+    if (glr.ent->flags & RF_SHELL_MASK)
+        program_params[2][3] = shellscale;
+
+    if (shadelight)
+        VectorCopy(shadedir, program_params[4]);
+}
+
+static void bind_alias_program(const maliasmesh_t *mesh)
+{
+    size_t tcsize = mesh->numverts * sizeof(maliastc_t);
+    size_t framesize = mesh->numverts * sizeof(glAliasVert_t);
+    const byte *newverts = (const byte *)NULL + tcsize + newframenum * framesize;
+    const byte *oldverts = (const byte *)NULL + tcsize + oldframenum * framesize;
+    int i;
+
+    qglEnable(GL_VERTEX_PROGRAM_ARB);
+    qglBindProgramARB(GL_VERTEX_PROGRAM_ARB, gl_static.prognum_alias);
+    for (i = 0; i < q_countof(program_params); i++)
+        qglProgramLocalParameter4fvARB(GL_VERTEX_PROGRAM_ARB, i, program_params[i]);
+
+    // new frame goes through the conventional arrays, old frame through
+    // generic attributes that don't alias any of them
+    GL_ArrayBits(GLA_VERTEX | GLA_TC);
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, mesh->bufnum);
+    qglVertexPointer(3, GL_SHORT, sizeof(glAliasVert_t), newverts);
+    qglNormalPointer(GL_BYTE, sizeof(glAliasVert_t), newverts + 8);
+    qglVertexAttribPointerARB(6, 3, GL_SHORT, GL_FALSE, sizeof(glAliasVert_t), oldverts);
+    qglVertexAttribPointerARB(7, 3, GL_BYTE, GL_TRUE, sizeof(glAliasVert_t), oldverts + 8);
+    GL_TexCoordPointer(2, 0, NULL);
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+    qglEnableClientState(GL_NORMAL_ARRAY);
+    qglEnableVertexAttribArrayARB(6);
+    qglEnableVertexAttribArrayARB(7);
+
+    qglColor4fv(color);
+}
+
+static void unbind_alias_program(void)
+{
+    qglDisableVertexAttribArrayARB(7);
+    qglDisableVertexAttribArrayARB(6);
+    qglDisableClientState(GL_NORMAL_ARRAY);
+
+    qglBindProgramARB(GL_VERTEX_PROGRAM_ARB, 0);
+    qglDisable(GL_VERTEX_PROGRAM_ARB);
+}
+
 static int texnum_for_mesh(maliasmesh_t *mesh)
 {
     entity_t *ent = glr.ent;
@@ -570,7 +639,11 @@ static int texnum_for_mesh(maliasmesh_t *mesh)
 
 static void draw_alias_mesh(maliasmesh_t *mesh)
 {
+    static const vec4_t noshade = { 0, 0, 0, 0 };
     glStateBits_t state = GLS_DEFAULT;
+    const GLfloat *vertices;
+    size_t size;
+    qboolean program = use_program && mesh->bufnum;
 
     // fall back to entity matrix
     GL_LoadMatrix(glr.entmatrix);
@@ -585,39 +658,59 @@ static void draw_alias_mesh(maliasmesh_t *mesh)
 
     GL_BindTexture(0, texnum_for_mesh(mesh));
 
-    (*tessfunc)(mesh);
     c.trisDrawn += mesh->numtris;
 
+    if (program) {
+        bind_alias_program(mesh);
+        goto draw;
+    }
+
+    (*tessfunc)(mesh);
+
     if (shadelight) {
         GL_ArrayBits(GLA_VERTEX | GLA_TC | GLA_COLOR);
-        GL_VertexPointer(3, VERTEX_SIZE, tess.vertices);
-        GL_ColorFloatPointer(4, VERTEX_SIZE, tess.vertices + 4);
+        size = mesh->numverts * VERTEX_SIZE * sizeof(GLfloat);
+        GL_StreamReserve(STREAM_ALIGN(size));
+        vertices = GL_StreamData(tess.vertices, size);
+        GL_VertexPointer(3, VERTEX_SIZE, vertices);
+        GL_ColorFloatPointer(4, VERTEX_SIZE, vertices + 4);
     } else {
         GL_ArrayBits(GLA_VERTEX | GLA_TC);
-        GL_VertexPointer(3, 4, tess.vertices);
+        size = mesh->numverts * 4 * sizeof(GLfloat);
+        GL_StreamReserve(STREAM_ALIGN(size));
+        vertices = GL_StreamData(tess.vertices, size);
+        GL_VertexPointer(3, 4, vertices);
         qglColor4fv(color);
     }
 
+    GL_StreamDone();
+
     GL_TexCoordPointer(2, 0, (GLfloat *)mesh->tcoords);
 
     GL_LockArrays(mesh->numverts);
 
-    qglDrawElements(GL_TRIANGLES, mesh->numindices, QGL_INDEX_ENUM,
-                    mesh->indices);
+draw:
+    GL_DrawTriangles(mesh->numindices, mesh->indices);
+
+    // the remaining passes are flat colored
+    if (program)
+        qglProgramLocalParameter4fvARB(GL_VERTEX_PROGRAM_ARB, 4, noshade);
 
     draw_celshading(mesh);
 
     if (gl_showtris->integer) {
         GL_EnableOutlines();
-        qglDrawElements(GL_TRIANGLES, mesh->numindices, QGL_INDEX_ENUM,
-                        mesh->indices);
+        GL_DrawTriangles(mesh->numindices, mesh->indices);
         GL_DisableOutlines();
     }
 
     // FIXME: unlock arrays before changing matrix?
     draw_shadow(mesh);
 
-    GL_UnlockArrays();
+    if (program)
+        unbind_alias_program();
+    else
+        GL_UnlockArrays();
 }
 
 void GL_DrawAliasModel(model_t *model)
@@ -680,6 +773,8 @@ void GL_DrawAliasModel(model_t *model)
             tess_static_plain : tess_lerped_plain;
     }
 
+    setup_program();
+
 	float scale = 1.f;
 	if (ent->scale > 0.f)
 		scale = ent->scale;
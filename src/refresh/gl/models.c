@@ -29,6 +29,71 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #error TESS_MAX_INDICES
 #endif
 
+// Uploads texture coordinates and all frames of each mesh into a buffer
+// object, so that the vertex program can interpolate them on the GPU.
+// Normals are decoded once here, vertex programs have no SIN/COS.
+static void MOD_LoadBuffers(model_t *model)
+{
+    maliasmesh_t *mesh;
+    maliasvert_t *src_vert;
+    glAliasVert_t *dst_vert;
+    size_t tcsize, size;
+    void *data;
+    int i, j;
+
+    for (i = 0; i < model->nummeshes; i++) {
+        model->meshes[i].bufnum = 0;
+    }
+
+    // buffers are only used by the vertex program. models loaded while it is
+    // disabled keep using the CPU path until they are reloaded
+    if (!qglGenBuffersARB || !gl_static.prognum_alias) {
+        return;
+    }
+
+    QGL_ClearErrors();
+
+    for (i = 0, mesh = model->meshes; i < model->nummeshes; i++, mesh++) {
+        tcsize = mesh->numverts * sizeof(maliastc_t);
+        size = tcsize + mesh->numverts * model->numframes * sizeof(glAliasVert_t);
+        data = Z_Malloc(size);
+
+        memcpy(data, mesh->tcoords, tcsize);
+
+        src_vert = mesh->verts;
+        dst_vert = (glAliasVert_t *)((byte *)data + tcsize);
+        for (j = 0; j < mesh->numverts * model->numframes; j++) {
+            unsigned lat = src_vert->norm[0];
+            unsigned lng = src_vert->norm[1];
+
+            dst_vert->pos[0] = src_vert->pos[0];
+            dst_vert->pos[1] = src_vert->pos[1];
+            dst_vert->pos[2] = src_vert->pos[2];
+            dst_vert->pos[3] = 1;
+            dst_vert->norm[0] = Q_rint(TAB_SIN(lat) * TAB_COS(lng) * 127);
+            dst_vert->norm[1] = Q_rint(TAB_SIN(lat) * TAB_SIN(lng) * 127);
+            dst_vert->norm[2] = Q_rint(TAB_COS(lat) * 127);
+            dst_vert->norm[3] = 0;
+
+            src_vert++;
+            dst_vert++;
+        }
+
+        qglGenBuffersARB(1, &mesh->bufnum);
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, mesh->bufnum);
+        qglBufferDataARB(GL_ARRAY_BUFFER_ARB, size, data, GL_STATIC_DRAW_ARB);
+
+        Z_Free(data);
+    }
+
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+    // the CPU path still works without buffers
+    if (GL_ShowErrors(__func__)) {
+        MOD_Unload_GL(model);
+    }
+}
+
 qerror_t MOD_LoadMD2_GL(model_t *model, const void *rawdata, size_t length)
 {
     dmd2header_t    header;
@@ -234,6 +299,8 @@ qerror_t MOD_LoadMD2_GL(model_t *model, const void *rawdata, size_t length)
     }
 
     Hunk_End(&model->hunk);
+
+    MOD_LoadBuffers(model);
     return Q_ERR_SUCCESS;
 
 fail:
@@ -414,6 +481,8 @@ qerror_t MOD_LoadMD3_GL(model_t *model, const void *rawdata, size_t length)
     }
 
     Hunk_End(&model->hunk);
+
+    MOD_LoadBuffers(model);
     return Q_ERR_SUCCESS;
 
 fail:
@@ -422,6 +491,23 @@ fail:
 }
 #endif
 
+void MOD_Unload_GL(model_t *model)
+{
+    maliasmesh_t *mesh;
+    int i;
+
+    if (model->type != MOD_ALIAS || !qglDeleteBuffersARB) {
+        return;
+    }
+
+    for (i = 0, mesh = model->meshes; i < model->nummeshes; i++, mesh++) {
+        if (mesh->bufnum) {
+            qglDeleteBuffersARB(1, &mesh->bufnum);
+            mesh->bufnum = 0;
+        }
+    }
+}
+
 void MOD_Reference_GL(model_t *model)
 {
     int i, j;
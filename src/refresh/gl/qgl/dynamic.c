@@ -29,8 +29,11 @@ QGL_ARB_fragment_program_IMP
 QGL_ARB_multitexture_IMP
 QGL_ARB_vertex_buffer_object_IMP
 QGL_EXT_compiled_vertex_array_IMP
+QGL_ARB_buffer_storage_IMP
+QGL_ARB_vertex_program_IMP
 #undef QGL
 
+qglMultiDrawArrays_t qglMultiDrawArrays;
 qglGenerateMipmap_t qglGenerateMipmap;
 
 // ==========================================================
@@ -45,6 +48,8 @@ QGL_ARB_fragment_program_IMP
 QGL_ARB_multitexture_IMP
 QGL_ARB_vertex_buffer_object_IMP
 QGL_EXT_compiled_vertex_array_IMP
+QGL_ARB_buffer_storage_IMP
+QGL_ARB_vertex_program_IMP
 #undef QGL
 
 #define SIG(x) fprintf(log_fp, "%s\n", x)
@@ -658,6 +663,18 @@ void QGL_ShutdownExtensions(unsigned mask)
         QGL_EXT_compiled_vertex_array_IMP
     }
 
+    if (mask & QGL_ARB_buffer_storage) {
+        QGL_ARB_buffer_storage_IMP
+    }
+
+    if (mask & QGL_ARB_vertex_program) {
+        QGL_ARB_vertex_program_IMP
+    }
+
+    if (mask & QGL_1_4_core_functions) {
+        qglMultiDrawArrays = NULL;
+    }
+
     if (mask & QGL_3_0_core_functions) {
         qglGenerateMipmap = NULL;
     }
@@ -703,6 +720,18 @@ void QGL_InitExtensions(unsigned mask)
         QGL_EXT_compiled_vertex_array_IMP
     }
 
+    if (mask & QGL_ARB_buffer_storage) {
+        QGL_ARB_buffer_storage_IMP
+    }
+
+    if (mask & QGL_ARB_vertex_program) {
+        QGL_ARB_vertex_program_IMP
+    }
+
+    if (mask & QGL_1_4_core_functions) {
+        qglMultiDrawArrays = GPA(MultiDrawArrays);
+    }
+
     if (mask & QGL_3_0_core_functions) {
         qglGenerateMipmap = GPA(GenerateMipmap);
     }
@@ -718,6 +747,8 @@ unsigned QGL_ParseExtensionString(const char *s)
         "GL_ARB_vertex_buffer_object",
         "GL_EXT_compiled_vertex_array",
         "GL_EXT_texture_filter_anisotropic",
+        "GL_ARB_buffer_storage",
+        "GL_ARB_vertex_program",
         NULL
     };
 
@@ -152,12 +152,30 @@ with this program; if not, write to the Free Software Foundation, Inc.,
     QGL(LockArraysEXT); \
     QGL(UnlockArraysEXT);
 
+// GL_ARB_vertex_program, program management functions are shared with
+// GL_ARB_fragment_program and loaded along with it
+#define QGL_ARB_vertex_program_IMP \
+    QGL(VertexAttribPointerARB); \
+    QGL(EnableVertexAttribArrayARB); \
+    QGL(DisableVertexAttribArrayARB);
+
+// GL_ARB_buffer_storage, along with OpenGL 3.2 functions it is used with
+#define QGL_ARB_buffer_storage_IMP \
+    QGL(BufferStorage); \
+    QGL(MapBufferRange); \
+    QGL(FenceSync); \
+    QGL(ClientWaitSync); \
+    QGL(DeleteSync);
+
 #define QGL_ARB_fragment_program            (1 << 0)
 #define QGL_ARB_multitexture                (1 << 1)
 #define QGL_ARB_vertex_buffer_object        (1 << 2)
 #define QGL_EXT_compiled_vertex_array       (1 << 3)
 #define QGL_EXT_texture_filter_anisotropic  (1 << 4)
+#define QGL_ARB_buffer_storage              (1 << 5)
+#define QGL_ARB_vertex_program              (1 << 6)
 
+#define QGL_1_4_core_functions              (1 << 30)
 #define QGL_3_0_core_functions              (1 << 31)
 
 // ==========================================================
@@ -242,6 +260,9 @@ typedef void (APIENTRY * qglTranslatef_t)(GLfloat x, GLfloat y, GLfloat z);
 typedef void (APIENTRY * qglVertexPointer_t)(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer);
 typedef void (APIENTRY * qglViewport_t)(GLint x, GLint y, GLsizei width, GLsizei height);
 
+// OpenGL 1.4 core function
+typedef void (APIENTRY * qglMultiDrawArrays_t)(GLenum mode, const GLint *first, const GLsizei *count, GLsizei drawcount);
+
 // OpenGL 3.0 core function
 typedef void (APIENTRY * qglGenerateMipmap_t)(GLenum target);
 
@@ -279,6 +300,18 @@ typedef void (APIENTRY * qglGetBufferPointervARB_t)(GLenum target, GLenum pname,
 typedef void (APIENTRY * qglLockArraysEXT_t)(GLint first, GLsizei count);
 typedef void (APIENTRY * qglUnlockArraysEXT_t)(void);
 
+// GL_ARB_vertex_program
+typedef void (APIENTRY * qglVertexAttribPointerARB_t)(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid *pointer);
+typedef void (APIENTRY * qglEnableVertexAttribArrayARB_t)(GLuint index);
+typedef void (APIENTRY * qglDisableVertexAttribArrayARB_t)(GLuint index);
+
+// GL_ARB_buffer_storage
+typedef void (APIENTRY * qglBufferStorage_t)(GLenum target, GLsizeiptr size, const GLvoid *data, GLbitfield flags);
+typedef GLvoid * (APIENTRY * qglMapBufferRange_t)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLsync (APIENTRY * qglFenceSync_t)(GLenum condition, GLbitfield flags);
+typedef GLenum (APIENTRY * qglClientWaitSync_t)(GLsync sync, GLbitfield flags, GLuint64 timeout);
+typedef void (APIENTRY * qglDeleteSync_t)(GLsync sync);
+
 // ==========================================================
 
 qboolean QGL_Init(void);
@@ -300,8 +333,11 @@ QGL_ARB_fragment_program_IMP
 QGL_ARB_multitexture_IMP
 QGL_ARB_vertex_buffer_object_IMP
 QGL_EXT_compiled_vertex_array_IMP
+QGL_ARB_buffer_storage_IMP
+QGL_ARB_vertex_program_IMP
 #undef QGL
 
+extern qglMultiDrawArrays_t qglMultiDrawArrays;
 extern qglGenerateMipmap_t qglGenerateMipmap;
 
 #endif  // QGL_H
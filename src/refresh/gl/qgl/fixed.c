@@ -23,6 +23,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 // ==========================================================
 
+// OpenGL 1.4 core function
+PFNGLMULTIDRAWARRAYSPROC    qglMultiDrawArrays;
+
 // OpenGL 3.0 core function
 PFNGLGENERATEMIPMAPPROC     qglGenerateMipmap;
 
@@ -49,6 +52,18 @@ PFNGLBUFFERSUBDATAARBPROC   qglBufferSubDataARB;
 PFNGLLOCKARRAYSEXTPROC      qglLockArraysEXT;
 PFNGLUNLOCKARRAYSEXTPROC    qglUnlockArraysEXT;
 
+// GL_ARB_vertex_program
+PFNGLVERTEXATTRIBPOINTERARBPROC         qglVertexAttribPointerARB;
+PFNGLENABLEVERTEXATTRIBARRAYARBPROC     qglEnableVertexAttribArrayARB;
+PFNGLDISABLEVERTEXATTRIBARRAYARBPROC    qglDisableVertexAttribArrayARB;
+
+// GL_ARB_buffer_storage
+PFNGLBUFFERSTORAGEPROC      qglBufferStorage;
+PFNGLMAPBUFFERRANGEPROC     qglMapBufferRange;
+PFNGLFENCESYNCPROC          qglFenceSync;
+PFNGLCLIENTWAITSYNCPROC     qglClientWaitSync;
+PFNGLDELETESYNCPROC         qglDeleteSync;
+
 // ==========================================================
 
 void QGL_ShutdownExtensions(unsigned mask)
@@ -80,6 +95,24 @@ void QGL_ShutdownExtensions(unsigned mask)
         qglUnlockArraysEXT  = NULL;
     }
 
+    if (mask & QGL_ARB_buffer_storage) {
+        qglBufferStorage    = NULL;
+        qglMapBufferRange   = NULL;
+        qglFenceSync        = NULL;
+        qglClientWaitSync   = NULL;
+        qglDeleteSync       = NULL;
+    }
+
+    if (mask & QGL_ARB_vertex_program) {
+        qglVertexAttribPointerARB       = NULL;
+        qglEnableVertexAttribArrayARB   = NULL;
+        qglDisableVertexAttribArrayARB  = NULL;
+    }
+
+    if (mask & QGL_1_4_core_functions) {
+        qglMultiDrawArrays  = NULL;
+    }
+
     if (mask & QGL_3_0_core_functions) {
         qglGenerateMipmap   = NULL;
     }
@@ -116,6 +149,24 @@ void QGL_InitExtensions(unsigned mask)
         qglUnlockArraysEXT  = GPA("glUnlockArraysEXT");
     }
 
+    if (mask & QGL_ARB_buffer_storage) {
+        qglBufferStorage    = GPA("glBufferStorage");
+        qglMapBufferRange   = GPA("glMapBufferRange");
+        qglFenceSync        = GPA("glFenceSync");
+        qglClientWaitSync   = GPA("glClientWaitSync");
+        qglDeleteSync       = GPA("glDeleteSync");
+    }
+
+    if (mask & QGL_ARB_vertex_program) {
+        qglVertexAttribPointerARB       = GPA("glVertexAttribPointerARB");
+        qglEnableVertexAttribArrayARB   = GPA("glEnableVertexAttribArrayARB");
+        qglDisableVertexAttribArrayARB  = GPA("glDisableVertexAttribArrayARB");
+    }
+
+    if (mask & QGL_1_4_core_functions) {
+        qglMultiDrawArrays  = GPA("glMultiDrawArrays");
+    }
+
     if (mask & QGL_3_0_core_functions) {
         qglGenerateMipmap   = GPA("glGenerateMipmap");
     }
@@ -132,6 +183,8 @@ unsigned QGL_ParseExtensionString(const char *s)
         "GL_ARB_vertex_buffer_object",
         "GL_EXT_compiled_vertex_array",
         "GL_EXT_texture_filter_anisotropic",
+        "GL_ARB_buffer_storage",
+        "GL_ARB_vertex_program",
         NULL
     };
 
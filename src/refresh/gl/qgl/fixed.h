@@ -112,6 +112,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define qglVertexPointer glVertexPointer
 #define qglViewport glViewport
 
+// OpenGL 1.4 core function
+extern PFNGLMULTIDRAWARRAYSPROC     qglMultiDrawArrays;
+
 // OpenGL 3.0 core function
 extern PFNGLGENERATEMIPMAPPROC      qglGenerateMipmap;
 
@@ -138,6 +141,18 @@ extern PFNGLBUFFERSUBDATAARBPROC    qglBufferSubDataARB;
 extern PFNGLLOCKARRAYSEXTPROC       qglLockArraysEXT;
 extern PFNGLUNLOCKARRAYSEXTPROC     qglUnlockArraysEXT;
 
+// GL_ARB_vertex_program
+extern PFNGLVERTEXATTRIBPOINTERARBPROC      qglVertexAttribPointerARB;
+extern PFNGLENABLEVERTEXATTRIBARRAYARBPROC  qglEnableVertexAttribArrayARB;
+extern PFNGLDISABLEVERTEXATTRIBARRAYARBPROC qglDisableVertexAttribArrayARB;
+
+// GL_ARB_buffer_storage
+extern PFNGLBUFFERSTORAGEPROC       qglBufferStorage;
+extern PFNGLMAPBUFFERRANGEPROC      qglMapBufferRange;
+extern PFNGLFENCESYNCPROC           qglFenceSync;
+extern PFNGLCLIENTWAITSYNCPROC      qglClientWaitSync;
+extern PFNGLDELETESYNCPROC          qglDeleteSync;
+
 // ==========================================================
 
 #define QGL_ARB_fragment_program            (1 << 0)
@@ -145,7 +160,10 @@ extern PFNGLUNLOCKARRAYSEXTPROC     qglUnlockArraysEXT;
 #define QGL_ARB_vertex_buffer_object        (1 << 2)
 #define QGL_EXT_compiled_vertex_array       (1 << 3)
 #define QGL_EXT_texture_filter_anisotropic  (1 << 4)
+#define QGL_ARB_buffer_storage              (1 << 5)
+#define QGL_ARB_vertex_program              (1 << 6)
 
+#define QGL_1_4_core_functions              (1 << 30)
 #define QGL_3_0_core_functions              (1 << 31)
 
 #define QGL_Init()                      qtrue
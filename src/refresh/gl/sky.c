@@ -361,6 +361,7 @@ void R_DrawSkyBox(void)
         MakeSkyVec(skymaxs[0][i], skymaxs[1][i], i, verts[2]);
         MakeSkyVec(skymins[0][i], skymaxs[1][i], i, verts[3]);
         qglDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        c.drawCalls++;
     }
 }
 
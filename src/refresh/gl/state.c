@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "gl.h"
 #include "arbfp.h"
+#include "arbvp.h"
 
 glState_t gls;
 
@@ -474,16 +475,37 @@ void GL_DisableOutlines(void)
     qglPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
+#ifdef GL_ARB_fragment_program
+static GLuint GL_LoadProgram(GLenum target, const char *text, size_t len, const char *what)
+{
+    GLuint prog = 0;
+
+    QGL_ClearErrors();
+
+    qglGenProgramsARB(1, &prog);
+    qglBindProgramARB(target, prog);
+    qglProgramStringARB(target, GL_PROGRAM_FORMAT_ASCII_ARB, len, text);
+
+    if (GL_ShowErrors(va("Failed to initialize %s program", what))) {
+        qglBindProgramARB(target, 0);
+        qglDeleteProgramsARB(1, &prog);
+        return 0;
+    }
+
+    qglBindProgramARB(target, 0);
+    return prog;
+}
+#endif
+
 void GL_InitPrograms(void)
 {
 #ifdef GL_ARB_fragment_program
-    GLuint prog = 0;
+    unsigned mask = 0;
 
     if (gl_config.ext_supported & QGL_ARB_fragment_program) {
         if (gl_fragment_program->integer) {
             Com_Printf("...enabling GL_ARB_fragment_program\n");
-            QGL_InitExtensions(QGL_ARB_fragment_program);
-            gl_config.ext_enabled |= QGL_ARB_fragment_program;
+            mask |= QGL_ARB_fragment_program;
         } else {
             Com_Printf("...ignoring GL_ARB_fragment_program\n");
         }
@@ -492,26 +514,47 @@ void GL_InitPrograms(void)
         Cvar_Set("gl_fragment_program", "0");
     }
 
-    if (!qglGenProgramsARB || !qglBindProgramARB ||
-        !qglProgramStringARB || !qglDeleteProgramsARB) {
-        return;
+#ifdef GL_ARB_vertex_program
+    if (gl_config.ext_supported & QGL_ARB_vertex_program) {
+        if (gl_vertex_program->integer) {
+            Com_Printf("...enabling GL_ARB_vertex_program\n");
+            mask |= QGL_ARB_vertex_program;
+        } else {
+            Com_Printf("...ignoring GL_ARB_vertex_program\n");
+        }
+    } else if (gl_vertex_program->integer) {
+        Com_Printf("GL_ARB_vertex_program not found\n");
+        Cvar_Set("gl_vertex_program", "0");
     }
+#endif
 
-    QGL_ClearErrors();
+    if (!mask) {
+        return;
+    }
 
-    qglGenProgramsARB(1, &prog);
-    qglBindProgramARB(GL_FRAGMENT_PROGRAM_ARB, prog);
-    qglProgramStringARB(GL_FRAGMENT_PROGRAM_ARB, GL_PROGRAM_FORMAT_ASCII_ARB,
-                        sizeof(gl_prog_warp) - 1, gl_prog_warp);
+    // program management functions are shared by both extensions and are
+    // loaded along with GL_ARB_fragment_program
+    QGL_InitExtensions(mask | QGL_ARB_fragment_program);
+    gl_config.ext_enabled |= mask;
 
-    if (GL_ShowErrors("Failed to initialize fragment program")) {
-        qglBindProgramARB(GL_FRAGMENT_PROGRAM_ARB, 0);
-        qglDeleteProgramsARB(1, &prog);
+    if (!qglGenProgramsARB || !qglBindProgramARB ||
+        !qglProgramStringARB || !qglDeleteProgramsARB) {
         return;
     }
 
-    qglBindProgramARB(GL_FRAGMENT_PROGRAM_ARB, 0);
-    gl_static.prognum_warp = prog;
+    if (mask & QGL_ARB_fragment_program) {
+        gl_static.prognum_warp = GL_LoadProgram(GL_FRAGMENT_PROGRAM_ARB,
+                                                gl_prog_warp, sizeof(gl_prog_warp) - 1, "fragment");
+    }
+
+#ifdef GL_ARB_vertex_program
+    if ((mask & QGL_ARB_vertex_program) && qglProgramLocalParameter4fvARB &&
+        qglVertexAttribPointerARB && qglEnableVertexAttribArrayARB &&
+        qglDisableVertexAttribArrayARB) {
+        gl_static.prognum_alias = GL_LoadProgram(GL_VERTEX_PROGRAM_ARB,
+                                                 gl_prog_alias, sizeof(gl_prog_alias) - 1, "vertex");
+    }
+#endif
 #endif
 }
 
@@ -527,7 +570,12 @@ void GL_ShutdownPrograms(void)
         gl_static.prognum_warp = 0;
     }
 
-    QGL_ShutdownExtensions(QGL_ARB_fragment_program);
-    gl_config.ext_enabled &= ~QGL_ARB_fragment_program;
+    if (gl_static.prognum_alias) {
+        qglDeleteProgramsARB(1, &gl_static.prognum_alias);
+        gl_static.prognum_alias = 0;
+    }
+
+    QGL_ShutdownExtensions(QGL_ARB_fragment_program | QGL_ARB_vertex_program);
+    gl_config.ext_enabled &= ~(QGL_ARB_fragment_program | QGL_ARB_vertex_program);
 #endif
 }
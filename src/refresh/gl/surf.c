@@ -109,9 +109,54 @@ DYNAMIC BLOCKLIGHTS
 #define MAX_LIGHTMAP_EXTENTS    ((MAX_SURFACE_EXTENTS >> 4) + 1)
 #define MAX_BLOCKLIGHTS         (MAX_LIGHTMAP_EXTENTS * MAX_LIGHTMAP_EXTENTS)
 
-static float blocklights[MAX_BLOCKLIGHTS * 3];
+// one extra float for loading the last texel as a vector
+static float blocklights[MAX_BLOCKLIGHTS * 3 + 1];
 
 #if USE_DLIGHTS
+#if USE_SSE2
+// same as the scalar loop below, for four texels of a row at a time.
+// texels out of light radius get zero added.
+static void add_light_texels(float *bl, int ds, int td, const dlight_t *light,
+                             vec_t rad, vec_t minlight, vec_t scale, int count)
+{
+    const __m128i step = _mm_setr_epi32(0, 16, 32, 48);
+    const __m128i tdv = _mm_set1_epi32(td);
+    const __m128i tdh = _mm_set1_epi32(td >> 1);
+    const __m128 radv = _mm_set1_ps(rad);
+    const __m128 minv = _mm_set1_ps(minlight);
+    const __m128 scalev = _mm_set1_ps(scale);
+    const __m128 c0 = _mm_setr_ps(light->color[0], light->color[1], light->color[2], light->color[0]);
+    const __m128 c1 = _mm_setr_ps(light->color[1], light->color[2], light->color[0], light->color[1]);
+    const __m128 c2 = _mm_setr_ps(light->color[2], light->color[0], light->color[1], light->color[2]);
+    __m128i sd, sign, gt, di;
+    __m128 dist, mask, frac;
+
+    for (; count >= 4; count -= 4, ds -= 64, bl += 12) {
+        sd = _mm_sub_epi32(_mm_set1_epi32(ds), step);
+        sign = _mm_srai_epi32(sd, 31);
+        sd = _mm_sub_epi32(_mm_xor_si128(sd, sign), sign);
+
+        gt = _mm_cmpgt_epi32(sd, tdv);
+        di = _mm_or_si128(_mm_and_si128(gt, _mm_add_epi32(sd, tdh)),
+                          _mm_andnot_si128(gt, _mm_add_epi32(tdv, _mm_srai_epi32(sd, 1))));
+        dist = _mm_cvtepi32_ps(di);
+
+        mask = _mm_cmplt_ps(dist, minv);
+        if (!_mm_movemask_ps(mask))
+            continue;
+
+        frac = _mm_and_ps(mask, _mm_sub_ps(radv, _mm_mul_ps(dist, scalev)));
+
+        _mm_storeu_ps(bl + 0, _mm_add_ps(_mm_loadu_ps(bl + 0),
+            _mm_mul_ps(c0, _mm_shuffle_ps(frac, frac, _MM_SHUFFLE(1, 0, 0, 0)))));
+        _mm_storeu_ps(bl + 4, _mm_add_ps(_mm_loadu_ps(bl + 4),
+            _mm_mul_ps(c1, _mm_shuffle_ps(frac, frac, _MM_SHUFFLE(2, 2, 1, 1)))));
+        _mm_storeu_ps(bl + 8, _mm_add_ps(_mm_loadu_ps(bl + 8),
+            _mm_mul_ps(c2, _mm_shuffle_ps(frac, frac, _MM_SHUFFLE(3, 3, 3, 2)))));
+    }
+}
+#endif
+
 static void add_dynamic_lights(mface_t *surf)
 {
     dlight_t    *light;
@@ -155,7 +200,13 @@ static void add_dynamic_lights(mface_t *surf)
         bl = blocklights;
         for (t = 0; t < tmax; t++) {
             td = abs(local[1] - (t << 4));
-            for (s = 0; s < smax; s++) {
+            s = 0;
+#if USE_SSE2
+            add_light_texels(bl, local[0], td, light, rad, minlight, scale, smax);
+            s = smax & ~3;
+            bl += s * 3;
+#endif
+            for (; s < smax; s++) {
                 sd = abs(local[0] - (s << 4));
                 if (sd > td)
                     dist = sd + (td >> 1);
@@ -174,12 +225,67 @@ static void add_dynamic_lights(mface_t *surf)
 }
 #endif
 
+// bl = src * rgb, or bl += src * rgb when accumulating
+static void add_light_style(float *bl, const byte *src, const vec_t *rgb,
+                            int size, qboolean accumulate)
+{
+    int j = 0;
+
+#if USE_SSE2
+    const __m128 c0 = _mm_setr_ps(rgb[0], rgb[1], rgb[2], rgb[0]);
+    const __m128 c1 = _mm_setr_ps(rgb[1], rgb[2], rgb[0], rgb[1]);
+    const __m128 c2 = _mm_setr_ps(rgb[2], rgb[0], rgb[1], rgb[2]);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v, lo, hi;
+    __m128 f0, f1, f2;
+    uint32_t tail;
+
+    // four RGB texels are 12 bytes in and 12 floats out
+    for (; j + 4 <= size; j += 4, bl += 12, src += 12) {
+        memcpy(&tail, src + 8, sizeof(tail));
+        v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)src),
+                               _mm_cvtsi32_si128(tail));
+        lo = _mm_unpacklo_epi8(v, zero);
+        hi = _mm_unpackhi_epi8(v, zero);
+        f0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), c0);
+        f1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), c1);
+        f2 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), c2);
+        if (accumulate) {
+            f0 = _mm_add_ps(_mm_loadu_ps(bl + 0), f0);
+            f1 = _mm_add_ps(_mm_loadu_ps(bl + 4), f1);
+            f2 = _mm_add_ps(_mm_loadu_ps(bl + 8), f2);
+        }
+        _mm_storeu_ps(bl + 0, f0);
+        _mm_storeu_ps(bl + 4, f1);
+        _mm_storeu_ps(bl + 8, f2);
+    }
+#endif
+
+    if (accumulate) {
+        for (; j < size; j++) {
+            bl[0] += src[0] * rgb[0];
+            bl[1] += src[1] * rgb[1];
+            bl[2] += src[2] * rgb[2];
+
+            bl += 3; src += 3;
+        }
+    } else {
+        for (; j < size; j++) {
+            bl[0] = src[0] * rgb[0];
+            bl[1] = src[1] * rgb[1];
+            bl[2] = src[2] * rgb[2];
+
+            bl += 3; src += 3;
+        }
+    }
+}
+
 static void add_light_styles(mface_t *surf, int size)
 {
+    static const vec3_t white = { 1, 1, 1 };
     lightstyle_t *style;
     byte *src;
-    float *bl;
-    int i, j;
+    int i;
 
     if (!surf->numstyles) {
         // should this ever happen?
@@ -191,24 +297,8 @@ static void add_light_styles(mface_t *surf, int size)
     style = LIGHT_STYLE(surf, 0);
 
     src = surf->lightmap;
-    bl = blocklights;
-    if (style->white == 1) {
-        for (j = 0; j < size; j++) {
-            bl[0] = src[0];
-            bl[1] = src[1];
-            bl[2] = src[2];
-
-            bl += 3; src += 3;
-        }
-    } else {
-        for (j = 0; j < size; j++) {
-            bl[0] = src[0] * style->rgb[0];
-            bl[1] = src[1] * style->rgb[1];
-            bl[2] = src[2] * style->rgb[2];
-
-            bl += 3; src += 3;
-        }
-    }
+    add_light_style(blocklights, src, style->white == 1 ? white : style->rgb, size, qfalse);
+    src += size * 3;
 
     surf->stylecache[0] = style->white;
 
@@ -216,31 +306,107 @@ static void add_light_styles(mface_t *surf, int size)
     for (i = 1; i < surf->numstyles; i++) {
         style = LIGHT_STYLE(surf, i);
 
-        bl = blocklights;
-        for (j = 0; j < size; j++) {
-            bl[0] += src[0] * style->rgb[0];
-            bl[1] += src[1] * style->rgb[1];
-            bl[2] += src[2] * style->rgb[2];
+        add_light_style(blocklights, src, style->rgb, size, qtrue);
+        src += size * 3;
 
-            bl += 3; src += 3;
+        surf->stylecache[i] = style->white;
+    }
+}
+
+// converts blocklights into texture format, dst is inside a lightmap block
+static void write_lightmap(byte *dst, int smax, int tmax)
+{
+    float *bl = blocklights;
+    byte *ptr;
+    int i, j;
+
+#if USE_SSE2
+    const __m128 add = _mm_set1_ps(lm.add);
+    const __m128 modulate = _mm_set1_ps(lm.modulate);
+    const __m128 limit = _mm_set1_ps(255);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 rgbmask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    const __m128i alpha = _mm_setr_epi32(0, 0, 0, 255);
+    const __m128 weights = _mm_setr_ps(0.2126f, 0.7152f, 0.0722f, 0);
+    const __m128 scale = _mm_set1_ps(lm.scale);
+    __m128 v, m, y;
+    __m128i p;
+
+    // same steps as adjust_color_f, one texel per vector
+    for (i = 0; i < tmax; i++) {
+        ptr = dst;
+        for (j = 0; j < smax; j++) {
+            v = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(bl), add), modulate);
+            v = _mm_and_ps(_mm_max_ps(v, zero), rgbmask);
+
+            m = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1)));
+            m = _mm_max_ps(m, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2)));
+            y = _mm_cmpgt_ps(m, limit);
+            v = _mm_or_ps(_mm_and_ps(y, _mm_mul_ps(v, _mm_div_ps(limit, m))),
+                          _mm_andnot_ps(y, v));
+
+            if (lm.scale != 1) {
+                m = _mm_mul_ps(v, weights);
+                y = _mm_add_ss(_mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 2, 1, 1))),
+                               _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 2, 1, 2)));
+                y = _mm_shuffle_ps(y, y, _MM_SHUFFLE(0, 0, 0, 0));
+                v = _mm_add_ps(y, _mm_mul_ps(_mm_sub_ps(v, y), scale));
+                v = _mm_and_ps(v, rgbmask);
+            }
+
+            p = _mm_or_si128(_mm_cvttps_epi32(v), alpha);
+            p = _mm_packs_epi32(p, p);
+            p = _mm_packus_epi16(p, p);
+            *(uint32_t *)ptr = _mm_cvtsi128_si32(p);
+
+            bl += 3; ptr += 4;
         }
 
-        surf->stylecache[i] = style->white;
+        dst += LM_BLOCK_WIDTH * 4;
     }
+#else
+    for (i = 0; i < tmax; i++) {
+        ptr = dst;
+        for (j = 0; j < smax; j++) {
+            adjust_color_ub(ptr, bl);
+            bl += 3; ptr += 4;
+        }
+
+        dst += LM_BLOCK_WIDTH * 4;
+    }
+#endif
+}
+
+static int LM_BlockForTexnum(GLuint texnum)
+{
+    int i;
+
+    for (i = 0; i < lm.nummaps; i++) {
+        if (lm.texnums[i] == texnum) {
+            return i;
+        }
+    }
+
+    return -1;
 }
 
+// rebuilds the surface lightmap in the client copy of its block and extends
+// dirty rectangle of the block, which is uploaded before the next draw
 static void update_dynamic_lightmap(mface_t *surf)
 {
-    byte temp[MAX_BLOCKLIGHTS * 4], *dst;
-    int smax, tmax, size, i;
-    float *bl;
+    lmrect_t *rect;
+    int smax, tmax, block;
+
+    block = LM_BlockForTexnum(surf->texnum[1]);
+    if (block == -1 || !lm.blocks[block]) {
+        return;
+    }
 
     smax = S_MAX(surf);
     tmax = T_MAX(surf);
-    size = smax * tmax;
 
     // add all the lightmaps
-    add_light_styles(surf, size);
+    add_light_styles(surf, smax * tmax);
 
 #if USE_DLIGHTS
     // add all the dynamic lights
@@ -252,20 +418,63 @@ static void update_dynamic_lightmap(mface_t *surf)
 #endif
 
     // put into texture format
-    bl = blocklights;
-    dst = temp;
-    for (i = 0; i < size; i++) {
-        adjust_color_ub(dst, bl);
-        bl += 3; dst += 4;
+    write_lightmap(lm.blocks[block] + ((surf->light_t * LM_BLOCK_WIDTH + surf->light_s) << 2),
+                   smax, tmax);
+
+    rect = &lm.rects[block];
+    if (lm.dirtyblocks & (1U << block)) {
+        rect->left = min(rect->left, surf->light_s);
+        rect->top = min(rect->top, surf->light_t);
+        rect->right = max(rect->right, surf->light_s + smax);
+        rect->bottom = max(rect->bottom, surf->light_t + tmax);
+    } else {
+        rect->left = surf->light_s;
+        rect->top = surf->light_t;
+        rect->right = surf->light_s + smax;
+        rect->bottom = surf->light_t + tmax;
+        lm.dirtyblocks |= 1U << block;
     }
 
-    // upload lightmap subimage
-    GL_ForceTexture(1, surf->texnum[1]);
-    qglTexSubImage2D(GL_TEXTURE_2D, 0,
-                     surf->light_s, surf->light_t, smax, tmax,
-                     GL_RGBA, GL_UNSIGNED_BYTE, temp);
+    c.texelsRebuilt += smax * tmax;
+}
 
-    c.texUploads++;
+// uploads dirty rectangles of lightmap blocks, one update per block
+void GL_UploadLightmaps(void)
+{
+    qboolean rowlength = !gl_config.es_profile || AT_LEAST_OPENGL_ES(3, 0);
+    lmrect_t *rect;
+    int i, w, h;
+
+    for (i = 0; i < lm.nummaps; i++) {
+        if (!(lm.dirtyblocks & (1U << i))) {
+            continue;
+        }
+
+        rect = &lm.rects[i];
+        if (!rowlength) {
+            // upload whole rows if unpack row length is not supported
+            rect->left = 0;
+            rect->right = LM_BLOCK_WIDTH;
+        }
+        w = rect->right - rect->left;
+        h = rect->bottom - rect->top;
+
+        GL_ForceTexture(1, lm.texnums[i]);
+        if (rowlength) {
+            qglPixelStorei(GL_UNPACK_ROW_LENGTH, LM_BLOCK_WIDTH);
+        }
+        qglTexSubImage2D(GL_TEXTURE_2D, 0, rect->left, rect->top, w, h,
+                         GL_RGBA, GL_UNSIGNED_BYTE,
+                         lm.blocks[i] + ((rect->top * LM_BLOCK_WIDTH + rect->left) << 2));
+        if (rowlength) {
+            qglPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        }
+
+        c.texUploads++;
+        c.bytesUploaded += w * h * 4;
+    }
+
+    lm.dirtyblocks = 0;
 }
 
 void GL_PushLights(mface_t *surf)
@@ -329,6 +538,12 @@ static void LM_UploadBlock(void)
         return;
     }
 
+    // keep a copy for dynamic updates
+    if (!lm.blocks[lm.nummaps]) {
+        lm.blocks[lm.nummaps] = Z_Malloc(sizeof(lm.buffer));
+    }
+    memcpy(lm.blocks[lm.nummaps], lm.buffer, sizeof(lm.buffer));
+
     GL_ForceTexture(1, lm.texnums[lm.nummaps++]);
     qglTexImage2D(GL_TEXTURE_2D, 0, lm.comp, LM_BLOCK_WIDTH, LM_BLOCK_HEIGHT, 0,
                   GL_RGBA, GL_UNSIGNED_BYTE, lm.buffer);
@@ -370,6 +585,7 @@ static void LM_BeginBuilding(void)
     // lightmap textures are not deleted from memory when changing maps,
     // they are merely reused
     lm.nummaps = 0;
+    lm.dirtyblocks = 0;
 
     LM_InitBlock();
 
@@ -395,33 +611,21 @@ static void LM_EndBuilding(void)
 
 static void build_primary_lightmap(mface_t *surf)
 {
-    byte *ptr, *dst;
-    int smax, tmax, size, i, j;
-    float *bl;
+    int smax, tmax;
 
     smax = S_MAX(surf);
     tmax = T_MAX(surf);
-    size = smax * tmax;
 
     // add all the lightmaps
-    add_light_styles(surf, size);
+    add_light_styles(surf, smax * tmax);
 
 #if USE_DLIGHTS
     surf->dlightframe = 0;
 #endif
 
     // put into texture format
-    bl = blocklights;
-    dst = &lm.buffer[(surf->light_t * LM_BLOCK_WIDTH + surf->light_s) << 2];
-    for (i = 0; i < tmax; i++) {
-        ptr = dst;
-        for (j = 0; j < smax; j++) {
-            adjust_color_ub(ptr, bl);
-            bl += 3; ptr += 4;
-        }
-
-        dst += LM_BLOCK_WIDTH * 4;
-    }
+    write_lightmap(&lm.buffer[(surf->light_t * LM_BLOCK_WIDTH + surf->light_s) << 2],
+                   smax, tmax);
 }
 
 static void LM_BuildSurface(mface_t *surf, vec_t *vbo)
@@ -456,6 +660,15 @@ static void LM_BuildSurface(mface_t *surf, vec_t *vbo)
     build_primary_lightmap(surf);
 }
 
+static void LM_CopyBlock(GLuint texnum)
+{
+    int block = LM_BlockForTexnum(texnum);
+
+    if (block != -1 && lm.blocks[block]) {
+        memcpy(lm.blocks[block], lm.buffer, sizeof(lm.buffer));
+    }
+}
+
 static void LM_RebuildSurfaces(void)
 {
     bsp_t *bsp = gl_static.world.cache;
@@ -484,6 +697,7 @@ static void LM_RebuildSurfaces(void)
 
         if (surf->texnum[1] != texnum) {
             // done with previous lightmap
+            LM_CopyBlock(texnum);
             qglTexImage2D(GL_TEXTURE_2D, 0, lm.comp,
                           LM_BLOCK_WIDTH, LM_BLOCK_HEIGHT, 0,
                           GL_RGBA, GL_UNSIGNED_BYTE, lm.buffer);
@@ -491,17 +705,23 @@ static void LM_RebuildSurfaces(void)
             texnum = surf->texnum[1];
 
             c.texUploads++;
+            c.bytesUploaded += LM_BLOCK_WIDTH * LM_BLOCK_HEIGHT * 4;
         }
 
         build_primary_lightmap(surf);
     }
 
     // upload the last lightmap
+    LM_CopyBlock(texnum);
     qglTexImage2D(GL_TEXTURE_2D, 0, lm.comp,
                   LM_BLOCK_WIDTH, LM_BLOCK_HEIGHT, 0,
                   GL_RGBA, GL_UNSIGNED_BYTE, lm.buffer);
 
     c.texUploads++;
+    c.bytesUploaded += LM_BLOCK_WIDTH * LM_BLOCK_HEIGHT * 4;
+
+    // everything is up to date now
+    lm.dirtyblocks = 0;
 }
 
 
@@ -862,6 +1082,8 @@ void GL_FreeWorld(void)
         return;
     }
 
+    GL_FreeClusterCache();
+
     BSP_Free(gl_static.world.cache);
 
     if (gl_static.world.vertices) {
@@ -914,6 +1136,14 @@ void GL_LoadWorld(const char *name)
     // calculate world size for far clip plane and sky box
     set_world_size();
 
+    // decode all textures on worker threads first
+    for (i = 0, info = bsp->texinfo; i < bsp->numtexinfo; i++, info++) {
+        Q_concat(buffer, sizeof(buffer), "textures/", info->name, ".wal", NULL);
+        FS_NormalizePath(buffer, buffer);
+        IMG_QueueLoad(buffer, IT_WALL, (info->c.flags & SURF_WARP) ? IF_TURBULENT : IF_NONE);
+    }
+    IMG_FlushLoads();
+
     // register all texinfo
     for (i = 0, info = bsp->texinfo; i < bsp->numtexinfo; i++, info++) {
         if (info->c.flags & SURF_WARP)
@@ -17,20 +17,229 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "gl.h"
+#include "common/tests.h"
 
 tesselator_t tess;
 
-#define FACE_HASH_BITS  5
-#define FACE_HASH_SIZE  (1 << FACE_HASH_BITS)
-#define FACE_HASH_MASK  (FACE_HASH_SIZE - 1)
+// solid faces are sorted by a key made of their state and texture numbers,
+// with the index the face was added at in the low bits
+#define FACE_INDEX_BITS 20
+#define FACE_INDEX_MASK ((1 << FACE_INDEX_BITS) - 1)
 
-static mface_t  *faces_head[FACE_HASH_SIZE];
-static mface_t  **faces_next[FACE_HASH_SIZE];
+static uint64_t *faces_keys;
+static mface_t  **faces_solid;
+static int      faces_count;
+static int      faces_alloc;
 static mface_t  *faces_alpha;
 
+/*
+=============================================================================
+
+STREAM BUFFER
+
+Dynamic geometry is copied into a single ring buffer object instead of
+being sourced from client memory on every draw call. With
+GL_ARB_buffer_storage the buffer stays mapped and is split into segments
+that are fenced when the ring moves past them, so a segment is only
+overwritten once the GPU has finished reading it. Otherwise data is
+uploaded with glBufferSubData and the buffer orphaned when it wraps.
+Without buffer objects the data is drawn from client memory as before.
+
+Space for all arrays of a draw call is reserved up front, and that is the
+only place the buffer wraps. So arrays of one draw never end up split
+between orphaned and fresh storage, and a segment is fenced only after
+all draws reading it have been issued.
+
+=============================================================================
+*/
+
+#define STREAM_MAP_BITS \
+    (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+// nanoseconds to wait for the GPU before reusing a segment anyway
+#define STREAM_WAIT_TIMEOUT 1000000000
+
+void GL_InitTess(void)
+{
+    memset(&gl_static.stream, 0, sizeof(gl_static.stream));
+
+    if (gl_stream_buffer->integer < 1 || !qglGenBuffersARB) {
+        return;
+    }
+
+    QGL_ClearErrors();
+
+    if (gl_stream_buffer->integer > 1 && qglBufferStorage) {
+        qglGenBuffersARB(1, &gl_static.stream.bufnum);
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, gl_static.stream.bufnum);
+        qglBufferStorage(GL_ARRAY_BUFFER_ARB, STREAM_SIZE, NULL, STREAM_MAP_BITS);
+        gl_static.stream.mapped = qglMapBufferRange(GL_ARRAY_BUFFER_ARB, 0,
+                                                    STREAM_SIZE, STREAM_MAP_BITS);
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+        if (gl_static.stream.mapped && !GL_ShowErrors(__func__)) {
+            Com_DPrintf("%s: persistently mapped %d KB\n", __func__, STREAM_SIZE / 1024);
+            return;
+        }
+
+        // storage is immutable, start over with a regular buffer
+        qglDeleteBuffersARB(1, &gl_static.stream.bufnum);
+        gl_static.stream.mapped = NULL;
+    }
+
+    qglGenBuffersARB(1, &gl_static.stream.bufnum);
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, gl_static.stream.bufnum);
+    qglBufferDataARB(GL_ARRAY_BUFFER_ARB, STREAM_SIZE, NULL, GL_STREAM_DRAW_ARB);
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+    if (GL_ShowErrors(__func__)) {
+        qglDeleteBuffersARB(1, &gl_static.stream.bufnum);
+        gl_static.stream.bufnum = 0;
+        return;
+    }
+
+    Com_DPrintf("%s: created %d KB stream buffer\n", __func__, STREAM_SIZE / 1024);
+}
+
+void GL_ShutdownTess(void)
+{
+    int i;
+
+    if (gl_static.stream.bufnum) {
+        for (i = 0; i < STREAM_SEGMENTS; i++) {
+            if (gl_static.stream.fences[i]) {
+                qglDeleteSync(gl_static.stream.fences[i]);
+            }
+        }
+
+        // deleting the buffer also unmaps it
+        qglDeleteBuffersARB(1, &gl_static.stream.bufnum);
+    }
+
+    memset(&gl_static.stream, 0, sizeof(gl_static.stream));
+
+    Z_Free(faces_keys);
+    Z_Free(faces_solid);
+    faces_keys = NULL;
+    faces_solid = NULL;
+    faces_count = faces_alloc = 0;
+}
+
+static void GL_NextStreamSegment(void)
+{
+    int segment = (gl_static.stream.segment + 1) % STREAM_SEGMENTS;
+    GLsync fence = gl_static.stream.fences[segment];
+
+    gl_static.stream.fences[gl_static.stream.segment] =
+        qglFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    if (fence) {
+        qglClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, STREAM_WAIT_TIMEOUT);
+        qglDeleteSync(fence);
+        gl_static.stream.fences[segment] = NULL;
+    }
+
+    gl_static.stream.segment = segment;
+    gl_static.stream.offset = segment * STREAM_SEGMENT_SIZE;
+}
+
+// Gives each frame a fresh segment, so that the fence placed at its end
+// covers all draw calls of the previous frame.
+void GL_BeginStreamFrame(void)
+{
+    if (gl_static.stream.mapped &&
+        gl_static.stream.offset != gl_static.stream.segment * STREAM_SEGMENT_SIZE) {
+        GL_NextStreamSegment();
+    }
+}
+
+/*
+=============
+GL_StreamReserve
+
+Makes room for all arrays of the next draw call, size being the sum of
+their STREAM_ALIGN'ed sizes. If they don't fit into a segment, the
+following GL_StreamData calls return client memory instead.
+=============
+*/
+void GL_StreamReserve(size_t size)
+{
+    gl_static.stream.reserved = 0;
+
+    if (!gl_static.stream.bufnum || size > STREAM_SEGMENT_SIZE) {
+        return;
+    }
+
+    if (gl_static.stream.mapped) {
+        if (gl_static.stream.offset + size > (gl_static.stream.segment + 1) * STREAM_SEGMENT_SIZE) {
+            GL_NextStreamSegment();
+        }
+    } else if (gl_static.stream.offset + size > STREAM_SIZE) {
+        if (!gl_static.stream.bound) {
+            qglBindBufferARB(GL_ARRAY_BUFFER_ARB, gl_static.stream.bufnum);
+            gl_static.stream.bound = qtrue;
+        }
+        // orphan the old storage, the driver keeps it for pending draws
+        qglBufferDataARB(GL_ARRAY_BUFFER_ARB, STREAM_SIZE, NULL, GL_STREAM_DRAW_ARB);
+        gl_static.stream.offset = 0;
+    }
+
+    gl_static.stream.reserved = size;
+}
+
+/*
+=============
+GL_StreamData
+
+Copies data into space reserved with GL_StreamReserve and leaves the
+buffer bound, so that the returned pointer can be passed to the
+gl*Pointer functions. Without a stream buffer or reservation, returns
+data itself. Call GL_StreamDone once all arrays are set up and before any
+client memory pointers are specified.
+=============
+*/
+const void *GL_StreamData(const void *data, size_t size)
+{
+    size_t offset = gl_static.stream.offset;
+
+    c.bytesUploaded += size;
+
+    if (STREAM_ALIGN(size) > gl_static.stream.reserved) {
+        GL_StreamDone();
+        return data;
+    }
+
+    if (!gl_static.stream.bound) {
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, gl_static.stream.bufnum);
+        gl_static.stream.bound = qtrue;
+    }
+
+    if (gl_static.stream.mapped) {
+        memcpy(gl_static.stream.mapped + offset, data, size);
+    } else {
+        qglBufferSubDataARB(GL_ARRAY_BUFFER_ARB, offset, size, data);
+    }
+
+    gl_static.stream.offset = offset + STREAM_ALIGN(size);
+    gl_static.stream.reserved -= STREAM_ALIGN(size);
+
+    return (const byte *)NULL + offset;
+}
+
+void GL_StreamDone(void)
+{
+    if (gl_static.stream.bound) {
+        qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+        gl_static.stream.bound = qfalse;
+    }
+
+    gl_static.stream.reserved = 0;
+}
+
 void GL_Flush2D(void)
 {
     glStateBits_t bits;
+    const GLfloat *vertices;
 
     if (!tess.numverts) {
         return;
@@ -49,17 +258,21 @@ void GL_Flush2D(void)
     GL_StateBits(bits);
     GL_ArrayBits(GLA_VERTEX | GLA_TC | GLA_COLOR);
 
-    GL_VertexPointer(2, 4, tess.vertices);
-    GL_TexCoordPointer(2, 4, tess.vertices + 2);
-    GL_ColorBytePointer(4, 0, tess.colors);
+    GL_StreamReserve(STREAM_ALIGN(tess.numverts * 4 * sizeof(GLfloat)) +
+                     STREAM_ALIGN(tess.numverts * 4));
+    vertices = GL_StreamData(tess.vertices, tess.numverts * 4 * sizeof(GLfloat));
+    GL_VertexPointer(2, 4, vertices);
+    GL_TexCoordPointer(2, 4, vertices + 2);
+    GL_ColorBytePointer(4, 0, GL_StreamData(tess.colors, tess.numverts * 4));
+    GL_StreamDone();
 
     GL_LockArrays(tess.numverts);
 
-    qglDrawElements(GL_TRIANGLES, tess.numindices, QGL_INDEX_ENUM, tess.indices);
+    GL_DrawTriangles(tess.numindices, tess.indices);
 
     if (gl_showtris->integer > 1) {
         GL_EnableOutlines();
-        qglDrawElements(GL_TRIANGLES, tess.numindices, QGL_INDEX_ENUM, tess.indices);
+        GL_DrawTriangles(tess.numindices, tess.indices);
         GL_DisableOutlines();
     }
 
@@ -76,16 +289,178 @@ void GL_Flush2D(void)
 #define PARTICLE_SIZE   (1 + M_SQRT1_2)
 #define PARTICLE_SCALE  (1 / (2 * PARTICLE_SIZE))
 
+typedef struct {
+    vec3_t  origin;
+    vec3_t  axis[3];
+    vec_t   scale;
+} particle_view_t;
+
+static inline uint32_t GL_ParticleColor(const particle_t *p)
+{
+    color_t color;
+
+    if (p->color == -1) {
+        color.u32 = p->rgba.u32;
+    } else {
+        color.u32 = d_8to24table[p->color & 0xff];
+        color.u8[3] = 255 * p->alpha;
+    }
+
+    return color.u32;
+}
+
+static void GL_WriteParticles_C(const particle_view_t *view, const particle_t *p,
+                                int count, vec_t *dst_vert, uint32_t *dst_color)
+{
+    vec3_t transformed;
+    vec_t scale, dist;
+
+    while (count--) {
+        VectorSubtract(p->origin, view->origin, transformed);
+        dist = DotProduct(transformed, view->axis[0]);
+
+        scale = view->scale;
+        if (dist > 20)
+            scale += dist * 0.01f;
+
+        VectorMA(p->origin, scale * PARTICLE_SCALE, view->axis[1], dst_vert);
+        VectorMA(dst_vert, -scale * PARTICLE_SCALE, view->axis[2], dst_vert);
+        VectorMA(dst_vert, scale, view->axis[2], dst_vert + 5);
+        VectorMA(dst_vert, -scale, view->axis[1], dst_vert + 10);
+
+        dst_vert[ 3] = 0;               dst_vert[ 4] = 0;
+        dst_vert[ 8] = 0;               dst_vert[ 9] = PARTICLE_SIZE;
+        dst_vert[13] = PARTICLE_SIZE;   dst_vert[14] = 0;
+
+        dst_color[0] = dst_color[1] = dst_color[2] = GL_ParticleColor(p);
+
+        p++;
+        dst_vert += 15;
+        dst_color += 3;
+    }
+}
+
+#if USE_SSE2
+
+// Same math as GL_WriteParticles_C, four particles at a time. Particle
+// origins are transposed into x/y/z vectors and the three output vertices
+// (interleaved with their texture coordinates) transposed back.
+static void GL_WriteParticles_SIMD(const particle_view_t *view, const particle_t *p,
+                                   int count, vec_t *dst_vert, uint32_t *dst_color)
+{
+    const __m128 ax0x = _mm_set1_ps(view->axis[0][0]);
+    const __m128 ax0y = _mm_set1_ps(view->axis[0][1]);
+    const __m128 ax0z = _mm_set1_ps(view->axis[0][2]);
+    const __m128 ax1x = _mm_set1_ps(view->axis[1][0]);
+    const __m128 ax1y = _mm_set1_ps(view->axis[1][1]);
+    const __m128 ax1z = _mm_set1_ps(view->axis[1][2]);
+    const __m128 ax2x = _mm_set1_ps(view->axis[2][0]);
+    const __m128 ax2y = _mm_set1_ps(view->axis[2][1]);
+    const __m128 ax2z = _mm_set1_ps(view->axis[2][2]);
+    const __m128 vox = _mm_set1_ps(view->origin[0]);
+    const __m128 voy = _mm_set1_ps(view->origin[1]);
+    const __m128 voz = _mm_set1_ps(view->origin[2]);
+    const __m128 base = _mm_set1_ps(view->scale);
+    const __m128 twenty = _mm_set1_ps(20);
+    const __m128 hundredth = _mm_set1_ps(0.01f);
+    const __m128 pscale = _mm_set1_ps((float)PARTICLE_SCALE);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 psize = _mm_set1_ps((float)PARTICLE_SIZE);
+    __m128 ox, oy, oz, w, dist, scale, s1;
+    __m128 v0x, v0y, v0z, v1x, v1y, v1z, v2x, v2y, v2z;
+    __m128 r0, r1, r2, r3;
+    int i;
+
+    for (; count >= 4; count -= 4, p += 4, dst_vert += 60, dst_color += 12) {
+        ox = _mm_setr_ps(p[0].origin[0], p[1].origin[0], p[2].origin[0], p[3].origin[0]);
+        oy = _mm_setr_ps(p[0].origin[1], p[1].origin[1], p[2].origin[1], p[3].origin[1]);
+        oz = _mm_setr_ps(p[0].origin[2], p[1].origin[2], p[2].origin[2], p[3].origin[2]);
+
+        dist = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_sub_ps(ox, vox), ax0x),
+            _mm_mul_ps(_mm_sub_ps(oy, voy), ax0y)),
+            _mm_mul_ps(_mm_sub_ps(oz, voz), ax0z));
+
+        w = _mm_and_ps(_mm_cmpgt_ps(dist, twenty), _mm_mul_ps(dist, hundredth));
+        scale = _mm_add_ps(base, w);
+        s1 = _mm_mul_ps(scale, pscale);
+
+        v0x = _mm_add_ps(ox, _mm_mul_ps(s1, ax1x));
+        v0y = _mm_add_ps(oy, _mm_mul_ps(s1, ax1y));
+        v0z = _mm_add_ps(oz, _mm_mul_ps(s1, ax1z));
+        v0x = _mm_sub_ps(v0x, _mm_mul_ps(s1, ax2x));
+        v0y = _mm_sub_ps(v0y, _mm_mul_ps(s1, ax2y));
+        v0z = _mm_sub_ps(v0z, _mm_mul_ps(s1, ax2z));
+
+        v1x = _mm_add_ps(v0x, _mm_mul_ps(scale, ax2x));
+        v1y = _mm_add_ps(v0y, _mm_mul_ps(scale, ax2y));
+        v1z = _mm_add_ps(v0z, _mm_mul_ps(scale, ax2z));
+
+        v2x = _mm_sub_ps(v0x, _mm_mul_ps(scale, ax1x));
+        v2y = _mm_sub_ps(v0y, _mm_mul_ps(scale, ax1y));
+        v2z = _mm_sub_ps(v0z, _mm_mul_ps(scale, ax1z));
+
+        // floats 0..3 of each particle: v0 xyz, s
+        r0 = v0x; r1 = v0y; r2 = v0z; r3 = zero;
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(dst_vert +  0, r0);
+        _mm_storeu_ps(dst_vert + 15, r1);
+        _mm_storeu_ps(dst_vert + 30, r2);
+        _mm_storeu_ps(dst_vert + 45, r3);
+
+        // floats 4..7: t, v1 xyz
+        r0 = zero; r1 = v1x; r2 = v1y; r3 = v1z;
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(dst_vert +  4, r0);
+        _mm_storeu_ps(dst_vert + 19, r1);
+        _mm_storeu_ps(dst_vert + 34, r2);
+        _mm_storeu_ps(dst_vert + 49, r3);
+
+        // floats 8..11: s, t, v2 xy
+        r0 = zero; r1 = psize; r2 = v2x; r3 = v2y;
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(dst_vert +  8, r0);
+        _mm_storeu_ps(dst_vert + 23, r1);
+        _mm_storeu_ps(dst_vert + 38, r2);
+        _mm_storeu_ps(dst_vert + 53, r3);
+
+        // floats 12..14: v2 z, s, t
+        for (i = 0; i < 4; i++) {
+            _mm_store_ss(dst_vert + i * 15 + 12, v2z);
+            v2z = _mm_shuffle_ps(v2z, v2z, _MM_SHUFFLE(0, 3, 2, 1));
+            dst_vert[i * 15 + 13] = PARTICLE_SIZE;
+            dst_vert[i * 15 + 14] = 0;
+        }
+
+        for (i = 0; i < 4; i++) {
+            dst_color[i * 3 + 0] =
+            dst_color[i * 3 + 1] =
+            dst_color[i * 3 + 2] = GL_ParticleColor(&p[i]);
+        }
+    }
+
+    GL_WriteParticles_C(view, p, count, dst_vert, dst_color);
+}
+
+#else
+#define GL_WriteParticles_SIMD GL_WriteParticles_C
+#endif
+
+static void GL_ParticleView(particle_view_t *view)
+{
+    VectorCopy(glr.fd.vieworg, view->origin);
+    VectorCopy(glr.viewaxis[0], view->axis[0]);
+    VectorCopy(glr.viewaxis[1], view->axis[1]);
+    VectorCopy(glr.viewaxis[2], view->axis[2]);
+    view->scale = gl_partscale->value;
+}
+
 void GL_DrawParticles(void)
 {
+    particle_view_t view;
+    const GLfloat *vertices;
     particle_t *p;
     int total, count;
-    vec3_t transformed;
-    vec_t scale, dist;
-    color_t color;
-    int numverts;
-    vec_t *dst_vert;
-    uint32_t *dst_color;
     int blend;
 
     if (!glr.fd.num_particles)
@@ -98,9 +473,7 @@ void GL_DrawParticles(void)
 
     GL_LoadMatrix(glr.viewmatrix);
 
-    GL_VertexPointer(3, 5, tess.vertices);
-    GL_TexCoordPointer(2, 5, tess.vertices + 3);
-    GL_ColorBytePointer(4, 0, tess.colors);
+    GL_ParticleView(&view);
 
     p = glr.fd.particles;
     total = glr.fd.num_particles;
@@ -115,51 +488,135 @@ void GL_DrawParticles(void)
 
         total -= count;
 
-        numverts = 0;
-        do {
-            VectorSubtract(p->origin, glr.fd.vieworg, transformed);
-            dist = DotProduct(transformed, glr.viewaxis[0]);
-
-            scale = gl_partscale->value;
-            if (dist > 20)
-                scale += dist * 0.01f;
-
-            if (p->color == -1) {
-                color.u32 = p->rgba.u32;
-            } else {
-                color.u32 = d_8to24table[p->color & 0xff];
-                color.u8[3] = 255 * p->alpha;
-            }
+        GL_WriteParticles_SIMD(&view, p, count, tess.vertices, (uint32_t *)tess.colors);
+        p += count;
 
-            dst_vert = tess.vertices + numverts * 5;
-            VectorMA(p->origin, scale * PARTICLE_SCALE, glr.viewaxis[1], dst_vert);
-            VectorMA(dst_vert, -scale * PARTICLE_SCALE, glr.viewaxis[2], dst_vert);
-            VectorMA(dst_vert, scale, glr.viewaxis[2], dst_vert + 5);
-            VectorMA(dst_vert, -scale, glr.viewaxis[1], dst_vert + 10);
+        GL_StreamReserve(STREAM_ALIGN(count * 15 * sizeof(GLfloat)) +
+                         STREAM_ALIGN(count * 3 * 4));
+        vertices = GL_StreamData(tess.vertices, count * 15 * sizeof(GLfloat));
+        GL_VertexPointer(3, 5, vertices);
+        GL_TexCoordPointer(2, 5, vertices + 3);
+        GL_ColorBytePointer(4, 0, GL_StreamData(tess.colors, count * 3 * 4));
+        GL_StreamDone();
 
-            dst_vert[ 3] = 0;               dst_vert[ 4] = 0;
-            dst_vert[ 8] = 0;               dst_vert[ 9] = PARTICLE_SIZE;
-            dst_vert[13] = PARTICLE_SIZE;   dst_vert[14] = 0;
-
-            dst_color = (uint32_t *)tess.colors + numverts;
-            dst_color[0] = color.u32;
-            dst_color[1] = color.u32;
-            dst_color[2] = color.u32;
-
-            p++;
-            numverts += 3;
-        } while (--count);
-
-        qglDrawArrays(GL_TRIANGLES, 0, numverts);
+        qglDrawArrays(GL_TRIANGLES, 0, count * 3);
+        c.drawCalls++;
 
         if (gl_showtris->integer) {
             GL_EnableOutlines();
-            qglDrawArrays(GL_TRIANGLES, 0, numverts);
+            qglDrawArrays(GL_TRIANGLES, 0, count * 3);
+            c.drawCalls++;
             GL_DisableOutlines();
         }
     } while (total);
 }
 
+#if USE_TESTS
+typedef struct {
+    const particle_view_t *view;
+    const particle_t *particles;
+    int count;
+    vec_t *vertices[2];
+    uint32_t *colors[2];
+} particle_test_t;
+
+static void GL_ParticleTestRun(void *arg, int k)
+{
+    particle_test_t *t = arg;
+
+    if (k)
+        GL_WriteParticles_SIMD(t->view, t->particles, t->count, t->vertices[k], t->colors[k]);
+    else
+        GL_WriteParticles_C(t->view, t->particles, t->count, t->vertices[k], t->colors[k]);
+}
+
+/*
+=============
+GL_ParticleTest_f
+
+Compares vectorized particle geometry against the scalar version and
+times both.
+=============
+*/
+void GL_ParticleTest_f(void)
+{
+    int count = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : TESS_MAX_VERTICES / 3;
+    int iterations = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 1000;
+    static vec_t vertices[2][TESS_MAX_VERTICES * 5];
+    static uint32_t colors[2][TESS_MAX_VERTICES];
+    particle_test_t t;
+    particle_t *particles, *p;
+    particle_view_t view;
+    unsigned seed = 1;
+    uint64_t usec[2] = { 0, 0 };
+    vec_t error = 0;
+    int i, mismatch = 0;
+
+    clamp(count, 1, TESS_MAX_VERTICES / 3);
+    clamp(iterations, 1, 100000);
+
+    VectorSet(view.origin, TST_Frand(&seed) * 4096 - 2048,
+              TST_Frand(&seed) * 4096 - 2048, TST_Frand(&seed) * 1024);
+    VectorSet(view.axis[0], TST_Frand(&seed) - 0.5f,
+              TST_Frand(&seed) - 0.5f, TST_Frand(&seed) - 0.5f);
+    VectorNormalize(view.axis[0]);
+    PerpendicularVector(view.axis[1], view.axis[0]);
+    CrossProduct(view.axis[0], view.axis[1], view.axis[2]);
+    view.scale = 2;
+
+    particles = Z_Malloc(count * sizeof(*particles));
+    for (i = 0, p = particles; i < count; i++, p++) {
+        VectorSet(p->origin, TST_Frand(&seed) * 8192 - 4096,
+                  TST_Frand(&seed) * 8192 - 4096, TST_Frand(&seed) * 2048 - 1024);
+        p->color = (TST_Rand(&seed) & 1) ? -1 : (int)(TST_Rand(&seed) & 255);
+        p->rgba.u32 = TST_Rand(&seed) | (TST_Rand(&seed) << 16);
+        p->alpha = TST_Frand(&seed);
+    }
+
+    t.view = &view;
+    t.particles = particles;
+    t.count = count;
+    for (i = 0; i < 2; i++) {
+        t.vertices[i] = vertices[i];
+        t.colors[i] = colors[i];
+    }
+    TST_TimeVariants(GL_ParticleTestRun, &t, iterations, usec);
+
+    for (i = 0; i < count * 15; i++)
+        error = max(error, fabsf(vertices[0][i] - vertices[1][i]));
+    for (i = 0; i < count * 3; i++)
+        mismatch += colors[0][i] != colors[1][i];
+
+    if (error > 1e-3f || mismatch)
+        Com_EPrintf("Vectorized particles differ from scalar particles\n");
+
+    Com_Printf("%d particles, max vertex error %g, %d color mismatches\n",
+               count, error, mismatch);
+    TST_PrintTimes("particles", "scalar", "vectorized", usec, iterations);
+
+    Z_Free(particles);
+}
+#endif
+
+static void GL_FlushBeams(int numverts, int numindices)
+{
+    const GLfloat *vertices;
+
+    if (!numindices) {
+        return;
+    }
+
+    GL_StreamReserve(STREAM_ALIGN(numverts * 5 * sizeof(GLfloat)) +
+                     STREAM_ALIGN(numverts * 4));
+    vertices = GL_StreamData(tess.vertices, numverts * 5 * sizeof(GLfloat));
+    GL_VertexPointer(3, 5, vertices);
+    GL_TexCoordPointer(2, 5, vertices + 3);
+    GL_ColorBytePointer(4, 0, GL_StreamData(tess.colors, numverts * 4));
+    GL_StreamDone();
+
+    GL_DrawTriangles(numindices, tess.indices);
+}
+
 /* all things serve the Beam */
 void GL_DrawBeams(void)
 {
@@ -184,10 +641,6 @@ void GL_DrawBeams(void)
     GL_StateBits(GLS_BLEND_BLEND | GLS_DEPTHMASK_FALSE);
     GL_ArrayBits(GLA_VERTEX | GLA_TC | GLA_COLOR);
 
-    GL_VertexPointer(3, 5, tess.vertices);
-    GL_TexCoordPointer(2, 5, tess.vertices + 3);
-    GL_ColorBytePointer(4, 0, tess.colors);
-
     numverts = numindices = 0;
     for (i = 0, ent = glr.fd.entities; i < glr.fd.num_entities; i++, ent++) {
         if (!(ent->flags & RF_BEAM)) {
@@ -214,8 +667,7 @@ void GL_DrawBeams(void)
 
         if (numverts + 4 > TESS_MAX_VERTICES ||
             numindices + 6 > TESS_MAX_INDICES) {
-            qglDrawElements(GL_TRIANGLES, numindices,
-                            QGL_INDEX_ENUM, tess.indices);
+            GL_FlushBeams(numverts, numindices);
             numverts = numindices = 0;
         }
 
@@ -248,8 +700,7 @@ void GL_DrawBeams(void)
         numindices += 6;
     }
 
-    qglDrawElements(GL_TRIANGLES, numindices,
-                    QGL_INDEX_ENUM, tess.indices);
+    GL_FlushBeams(numverts, numindices);
 }
 
 void GL_BindArrays(void)
@@ -281,15 +732,32 @@ void GL_BindArrays(void)
     }
 }
 
+static void GL_DrawBatch(void)
+{
+    if (tess.numfaces) {
+        qglMultiDrawArrays(GL_TRIANGLE_FAN, tess.firstverts,
+                           tess.numfaceverts, tess.numfaces);
+        c.drawCalls++;
+    } else {
+        GL_DrawTriangles(tess.numindices, tess.indices);
+    }
+}
+
 void GL_Flush3D(void)
 {
     glStateBits_t state = tess.flags;
     glArrayBits_t array = GLA_VERTEX | GLA_TC;
 
-    if (!tess.numindices) {
+    if (!tess.numindices && !tess.numfaces) {
         return;
     }
 
+    // dynamic lightmap updates are batched until something is drawn. this
+    // doesn't depend on texnum[1], gl_lightmap 1 binds lightmaps as texnum[0]
+    if (lm.dirtyblocks) {
+        GL_UploadLightmaps();
+    }
+
     if (q_likely(tess.texnum[1])) {
         state |= GLS_LIGHTMAP_ENABLE;
         array |= GLA_LMTC;
@@ -311,11 +779,11 @@ void GL_Flush3D(void)
         GL_LockArrays(tess.numverts);
     }
 
-    qglDrawElements(GL_TRIANGLES, tess.numindices, QGL_INDEX_ENUM, tess.indices);
+    GL_DrawBatch();
 
     if (gl_showtris->integer) {
         GL_EnableOutlines();
-        qglDrawElements(GL_TRIANGLES, tess.numindices, QGL_INDEX_ENUM, tess.indices);
+        GL_DrawBatch();
         GL_DisableOutlines();
     }
 
@@ -328,6 +796,7 @@ void GL_Flush3D(void)
     tess.texnum[0] = tess.texnum[1] = 0;
     tess.numindices = 0;
     tess.numverts = 0;
+    tess.numfaces = 0;
     tess.flags = 0;
 }
 
@@ -385,7 +854,8 @@ void GL_DrawFace(mface_t *surf)
     if (tess.texnum[0] != texnum[0] ||
         tess.texnum[1] != texnum[1] ||
         tess.flags != surf->statebits ||
-        tess.numindices + numindices > TESS_MAX_INDICES) {
+        tess.numindices + numindices > TESS_MAX_INDICES ||
+        tess.numfaces == TESS_MAX_FACES) {
         GL_Flush3D();
     }
 
@@ -395,6 +865,13 @@ void GL_DrawFace(mface_t *surf)
 
     if (q_unlikely(gl_static.world.vertices)) {
         j = GL_CopyVerts(surf);
+    } else if (qglMultiDrawArrays) {
+        // faces are stored as triangle fans in the static buffer, draw
+        // them straight from there with a single call per batch
+        tess.firstverts[tess.numfaces] = surf->firstvert;
+        tess.numfaceverts[tess.numfaces] = surf->numsurfedges;
+        tess.numfaces++;
+        goto done;
     } else {
         j = surf->firstvert;
     }
@@ -408,6 +885,7 @@ void GL_DrawFace(mface_t *surf)
     }
     tess.numindices += numindices;
 
+done:
     c.trisDrawn += numtris;
     c.facesTris += numtris;
     c.facesDrawn++;
@@ -426,20 +904,30 @@ static inline void GL_DrawChain(mface_t **head)
 
 void GL_ClearSolidFaces(void)
 {
-    int i;
+    faces_count = 0;
+}
 
-    for (i = 0; i < FACE_HASH_SIZE; i++) {
-        faces_next[i] = &faces_head[i];
-    }
+static int GL_FaceKeyCmp(const void *p1, const void *p2)
+{
+    uint64_t k1 = *(const uint64_t *)p1;
+    uint64_t k2 = *(const uint64_t *)p2;
+
+    return (k1 > k2) - (k1 < k2);
 }
 
 void GL_DrawSolidFaces(void)
 {
     int i;
 
-    for (i = 0; i < FACE_HASH_SIZE; i++) {
-        GL_DrawChain(&faces_head[i]);
+    // faces with the same state end up next to each other, keeping the
+    // front-to-back order they were added in
+    qsort(faces_keys, faces_count, sizeof(faces_keys[0]), GL_FaceKeyCmp);
+
+    for (i = 0; i < faces_count; i++) {
+        GL_DrawFace(faces_solid[faces_keys[i] & FACE_INDEX_MASK]);
     }
+
+    faces_count = 0;
 }
 
 void GL_DrawAlphaFaces(void)
@@ -461,16 +949,27 @@ void GL_DrawAlphaFaces(void)
 
 void GL_AddSolidFace(mface_t *face)
 {
-    unsigned hash;
+    uint64_t key;
 
-    hash = face->texnum[0] ^ face->texnum[1] ^ face->statebits;
-    hash ^= hash >> FACE_HASH_BITS;
-    hash &= FACE_HASH_MASK;
+    if (faces_count == faces_alloc) {
+        if (faces_alloc > FACE_INDEX_MASK) {
+            GL_DrawFace(face);
+            return;
+        }
+        faces_alloc = max(faces_alloc * 2, 1024);
+        faces_keys = Z_Realloc(faces_keys, faces_alloc * sizeof(faces_keys[0]));
+        faces_solid = Z_Realloc(faces_solid, faces_alloc * sizeof(faces_solid[0]));
+    }
 
-    // preserve front-to-back ordering
-    face->next = NULL;
-    *faces_next[hash] = face;
-    faces_next[hash] = &face->next;
+    // texture numbers are truncated, this only affects sorting
+    key = (uint64_t)face->statebits << 52;
+    key |= (uint64_t)(face->texnum[0] & 0xffff) << 36;
+    key |= (uint64_t)(face->texnum[1] & 0xffff) << FACE_INDEX_BITS;
+    key |= faces_count;
+
+    faces_keys[faces_count] = key;
+    faces_solid[faces_count] = face;
+    faces_count++;
 }
 
 void GL_AddAlphaFace(mface_t *face)
@@ -479,4 +978,3 @@ void GL_AddAlphaFace(mface_t *face)
     face->next = faces_alpha;
     faces_alpha = face;
 }
-
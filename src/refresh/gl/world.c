@@ -17,6 +17,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "gl.h"
+#include "system/system.h"
 
 void GL_SampleLightPoint(vec3_t color)
 {
@@ -262,21 +263,15 @@ void R_LightPoint_GL(vec3_t origin, vec3_t color)
     }
 }
 
-static void GL_MarkLeaves(void)
+// finds the view cluster and the cluster slightly above or below it, so
+// that water surfaces are visible from both sides
+static void GL_ViewClusters(bsp_t *bsp, int *cluster1, int *cluster2)
 {
-    static int lastNodesVisible;
-    byte vis1[VIS_MAX_BYTES];
-    byte vis2[VIS_MAX_BYTES];
     mleaf_t *leaf;
-    mnode_t *node;
-    uint_fast32_t *src1, *src2;
-    int cluster1, cluster2, longs;
     vec3_t tmp;
-    int i;
-    bsp_t *bsp = gl_static.world.cache;
 
     leaf = BSP_PointLeaf(bsp->nodes, glr.fd.vieworg);
-    cluster1 = cluster2 = leaf->cluster;
+    *cluster1 = *cluster2 = leaf->cluster;
     VectorCopy(glr.fd.vieworg, tmp);
     if (!leaf->contents) {
         tmp[2] -= 16;
@@ -285,8 +280,40 @@ static void GL_MarkLeaves(void)
     }
     leaf = BSP_PointLeaf(bsp->nodes, tmp);
     if (!(leaf->contents & CONTENTS_SOLID)) {
-        cluster2 = leaf->cluster;
+        *cluster2 = leaf->cluster;
+    }
+}
+
+// merges PVS of both view clusters into vis1
+static void GL_ClusterVis(bsp_t *bsp, byte *vis1, int cluster1, int cluster2)
+{
+    byte vis2[VIS_MAX_BYTES];
+    uint_fast32_t *src1, *src2;
+    int longs;
+
+    BSP_ClusterVis(bsp, vis1, cluster1, DVIS_PVS);
+    if (cluster1 != cluster2) {
+        BSP_ClusterVis(bsp, vis2, cluster2, DVIS_PVS);
+        longs = VIS_FAST_LONGS(bsp);
+        src1 = (uint_fast32_t *)vis1;
+        src2 = (uint_fast32_t *)vis2;
+        while (longs--) {
+            *src1++ |= *src2++;
+        }
     }
+}
+
+static void GL_MarkLeaves(void)
+{
+    static int lastNodesVisible;
+    byte vis1[VIS_MAX_BYTES];
+    mleaf_t *leaf;
+    mnode_t *node;
+    int cluster1, cluster2;
+    int i;
+    bsp_t *bsp = gl_static.world.cache;
+
+    GL_ViewClusters(bsp, &cluster1, &cluster2);
 
     if (cluster1 == glr.viewcluster1 && cluster2 == glr.viewcluster2) {
         goto finish;
@@ -312,16 +339,7 @@ static void GL_MarkLeaves(void)
         goto finish;
     }
 
-    BSP_ClusterVis(bsp, vis1, cluster1, DVIS_PVS);
-    if (cluster1 != cluster2) {
-        BSP_ClusterVis(bsp, vis2, cluster2, DVIS_PVS);
-        longs = VIS_FAST_LONGS(bsp);
-        src1 = (uint_fast32_t *)vis1;
-        src2 = (uint_fast32_t *)vis2;
-        while (longs--) {
-            *src1++ |= *src2++;
-        }
-    }
+    GL_ClusterVis(bsp, vis1, cluster1, cluster2);
 
     lastNodesVisible = 0;
     for (i = 0, leaf = bsp->leafs; i < bsp->numleafs; i++, leaf++) {
@@ -549,15 +567,419 @@ static void GL_WorldNode_r(mnode_t *node, int clipflags)
     }
 }
 
+/*
+=============================================================================
+
+CLUSTER BATCHES
+
+Faces visible from a pair of view clusters with a given area portal state
+never change, so instead of marking leaves and walking the tree every time
+the view cluster changes, they are collected once into batches (one per
+node) and cached. Batch bounds are tight around the faces and culled
+against the frustum every frame.
+
+The nodes holding batches are cached too, with nodes that have no faces
+and only one non-empty side skipped, so batches can still be drawn in
+front-to-back BSP order with a plane side test per cached node. This
+keeps solid faces front-to-back within a state and alpha faces in the
+same back-to-front order as the node walk.
+
+=============================================================================
+*/
+
+#define CLUSTER_CACHE_SIZE  16
+
+typedef struct {
+    vec3_t      center;
+    vec3_t      extents;
+    int         firstface;
+    int         numsky;     // sky faces come first,
+    int         numalpha;   // then alpha faces,
+    int         numsolid;   // then solid faces sorted by state
+} worldBatch_t;
+
+typedef struct {
+    cplane_t    *plane;
+    int         children[2];    // -1 if there are no batches on that side
+    int         batch;          // -1 if the node has no visible faces
+} batchNode_t;
+
+typedef struct {
+    qboolean        inuse;
+    int             cluster1, cluster2; // -1 if everything is visible
+    qboolean        allareas;
+    byte            areabits[MAX_MAP_AREAS / 8];
+    int             lastused;
+    worldBatch_t    *batches;
+    int             numbatches;
+    batchNode_t     *nodes;
+    int             numnodes;
+    int             headnode;
+    mface_t         **faces;
+    int             numfaces;
+} clusterEntry_t;
+
+// frustum planes transposed for culling with SIMD
+typedef struct {
+    float   nx[4], ny[4], nz[4];
+    float   ax[4], ay[4], az[4];
+    float   dist[4];
+} batchFrustum_t;
+
+static clusterEntry_t   cluster_cache[CLUSTER_CACHE_SIZE];
+static clusterEntry_t   *cluster_current;
+
+void GL_FreeClusterCache(void)
+{
+    clusterEntry_t *entry;
+    int i;
+
+    for (i = 0, entry = cluster_cache; i < CLUSTER_CACHE_SIZE; i++, entry++) {
+        Z_Free(entry->batches);
+        Z_Free(entry->nodes);
+        Z_Free(entry->faces);
+    }
+
+    memset(cluster_cache, 0, sizeof(cluster_cache));
+    cluster_current = NULL;
+}
+
+static int GL_FaceStateCmp(const void *p1, const void *p2)
+{
+    const mface_t *f1 = *(const mface_t **)p1;
+    const mface_t *f2 = *(const mface_t **)p2;
+
+    if (f1->statebits != f2->statebits)
+        return f1->statebits - f2->statebits;
+    if (f1->texnum[0] != f2->texnum[0])
+        return f1->texnum[0] - f2->texnum[0];
+    if (f1->texnum[1] != f2->texnum[1])
+        return f1->texnum[1] - f2->texnum[1];
+
+    return (f1 > f2) - (f1 < f2);
+}
+
+static inline int GL_FaceKind(const mface_t *face)
+{
+    if (face->drawflags & SURF_SKY)
+        return 0;
+    if (face->drawflags & SURF_TRANS_MASK)
+        return 1;
+    return 2;
+}
+
+static qboolean GL_AddBatch(clusterEntry_t *entry, const byte *marked, mnode_t *node)
+{
+    mface_t *face, *last = node->firstface + node->numfaces;
+    mface_t **dst = entry->faces + entry->numfaces;
+    worldBatch_t *batch;
+    msurfedge_t *src_edge;
+    vec3_t mins, maxs;
+    int counts[3] = { 0 };
+    int kind, count, i;
+
+    ClearBounds(mins, maxs);
+
+    for (kind = 0, count = 0; kind < 3; kind++) {
+        for (face = node->firstface; face < last; face++) {
+            if (!marked[face - gl_static.world.cache->faces]) {
+                continue;
+            }
+            if (GL_FaceKind(face) != kind) {
+                continue;
+            }
+
+            src_edge = face->firstsurfedge;
+            for (i = 0; i < face->numsurfedges; i++, src_edge++) {
+                AddPointToBounds(src_edge->edge->v[src_edge->vert]->point, mins, maxs);
+            }
+
+            dst[count++] = face;
+            counts[kind]++;
+        }
+    }
+
+    if (!count) {
+        return qfalse;
+    }
+
+    qsort(dst + counts[0] + counts[1], counts[2], sizeof(dst[0]), GL_FaceStateCmp);
+
+    batch = &entry->batches[entry->numbatches++];
+    VectorAvg(mins, maxs, batch->center);
+    VectorSubtract(maxs, batch->center, batch->extents);
+    batch->firstface = entry->numfaces;
+    batch->numsky = counts[0];
+    batch->numalpha = counts[1];
+    batch->numsolid = counts[2];
+
+    entry->numfaces += count;
+    return qtrue;
+}
+
+// returns index of the cached node for this subtree, or -1 if it has no batches
+static int GL_AddBatches_r(clusterEntry_t *entry, const byte *marked, mnode_t *node)
+{
+    batchNode_t *n;
+    int children[2], batch = -1;
+
+    if (!node->plane) {
+        return -1;
+    }
+
+    children[0] = GL_AddBatches_r(entry, marked, node->children[0]);
+    children[1] = GL_AddBatches_r(entry, marked, node->children[1]);
+
+    if (node->numfaces && GL_AddBatch(entry, marked, node)) {
+        batch = entry->numbatches - 1;
+    } else if (children[0] == -1) {
+        return children[1];
+    } else if (children[1] == -1) {
+        return children[0];
+    }
+
+    n = &entry->nodes[entry->numnodes];
+    n->plane = node->plane;
+    n->children[0] = children[0];
+    n->children[1] = children[1];
+    n->batch = batch;
+    return entry->numnodes++;
+}
+
+static void GL_BuildCluster(clusterEntry_t *entry)
+{
+    bsp_t *bsp = gl_static.world.cache;
+    byte vis[VIS_MAX_BYTES];
+    byte *marked;
+    mleaf_t *leaf;
+    mface_t **face, **last;
+    int i, index, count;
+
+    if (entry->cluster1 != -1) {
+        GL_ClusterVis(bsp, vis, entry->cluster1, entry->cluster2);
+    }
+
+    // mark faces of all potentially visible leaves
+    marked = Z_Mallocz(bsp->numfaces);
+    count = 0;
+    for (i = 0, leaf = bsp->leafs; i < bsp->numleafs; i++, leaf++) {
+        if (leaf->contents == CONTENTS_SOLID) {
+            continue;
+        }
+        if (entry->cluster1 != -1) {
+            if (leaf->cluster == -1 || !Q_IsBitSet(vis, leaf->cluster)) {
+                continue;
+            }
+        }
+        if (!entry->allareas && !Q_IsBitSet(entry->areabits, leaf->area)) {
+            continue;
+        }
+
+        last = leaf->firstleafface + leaf->numleaffaces;
+        for (face = leaf->firstleafface; face < last; face++) {
+            index = *face - bsp->faces;
+            if (!marked[index]) {
+                marked[index] = 1;
+                count++;
+            }
+        }
+    }
+
+    entry->faces = Z_Malloc(count * sizeof(entry->faces[0]));
+    entry->batches = Z_Malloc(bsp->numnodes * sizeof(entry->batches[0]));
+    entry->nodes = Z_Malloc(bsp->numnodes * sizeof(entry->nodes[0]));
+    entry->headnode = GL_AddBatches_r(entry, marked, bsp->nodes);
+    entry->batches = Z_Realloc(entry->batches, entry->numbatches * sizeof(entry->batches[0]));
+    entry->nodes = Z_Realloc(entry->nodes, entry->numnodes * sizeof(entry->nodes[0]));
+
+    Z_Free(marked);
+
+    c.clustersBuilt++;
+}
+
+static clusterEntry_t *GL_FindCluster(void)
+{
+    bsp_t *bsp = gl_static.world.cache;
+    clusterEntry_t *entry, *oldest;
+    qboolean allareas = !glr.fd.areabits;
+    int cluster1, cluster2, areabytes, i;
+
+    if (gl_lockpvs->integer && cluster_current) {
+        return cluster_current;
+    }
+
+    GL_ViewClusters(bsp, &cluster1, &cluster2);
+    glr.viewcluster1 = cluster1;
+    glr.viewcluster2 = cluster2;
+    if (!bsp->vis || gl_novis->integer || cluster1 == -1) {
+        cluster1 = cluster2 = -1;
+    }
+
+    areabytes = min((bsp->numareas + 7) >> 3, MAX_MAP_AREAS / 8);
+
+    oldest = cluster_cache;
+    for (i = 0, entry = cluster_cache; i < CLUSTER_CACHE_SIZE; i++, entry++) {
+        if (!entry->inuse) {
+            oldest = entry;
+            break;
+        }
+        if (entry->cluster1 == cluster1 && entry->cluster2 == cluster2 &&
+            entry->allareas == allareas &&
+            (allareas || !memcmp(entry->areabits, glr.fd.areabits, areabytes))) {
+            goto found;
+        }
+        if (entry->lastused < oldest->lastused) {
+            oldest = entry;
+        }
+    }
+
+    // evict the least recently used entry
+    entry = oldest;
+    Z_Free(entry->batches);
+    Z_Free(entry->nodes);
+    Z_Free(entry->faces);
+    memset(entry, 0, sizeof(*entry));
+
+    entry->inuse = qtrue;
+    entry->cluster1 = cluster1;
+    entry->cluster2 = cluster2;
+    entry->allareas = allareas;
+    if (!allareas) {
+        memcpy(entry->areabits, glr.fd.areabits, areabytes);
+    }
+
+    GL_BuildCluster(entry);
+
+found:
+    entry->lastused = glr.drawframe;
+    cluster_current = entry;
+    return entry;
+}
+
+static void GL_SetupBatchFrustum(batchFrustum_t *f)
+{
+    cplane_t *p;
+    int i;
+
+    for (i = 0, p = glr.frustumPlanes; i < 4; i++, p++) {
+        f->nx[i] = p->normal[0];
+        f->ny[i] = p->normal[1];
+        f->nz[i] = p->normal[2];
+        f->ax[i] = fabsf(p->normal[0]);
+        f->ay[i] = fabsf(p->normal[1]);
+        f->az[i] = fabsf(p->normal[2]);
+        f->dist[i] = p->dist;
+    }
+}
+
+// returns qtrue if the box is entirely behind any of the frustum planes
+static inline qboolean GL_CullBatch(const batchFrustum_t *f, const worldBatch_t *batch)
+{
+#if USE_SSE2
+    __m128 d, r;
+
+    d = _mm_mul_ps(_mm_loadu_ps(f->nx), _mm_set1_ps(batch->center[0]));
+    d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(f->ny), _mm_set1_ps(batch->center[1])));
+    d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(f->nz), _mm_set1_ps(batch->center[2])));
+
+    r = _mm_mul_ps(_mm_loadu_ps(f->ax), _mm_set1_ps(batch->extents[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(f->ay), _mm_set1_ps(batch->extents[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(f->az), _mm_set1_ps(batch->extents[2])));
+
+    return _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d, r), _mm_loadu_ps(f->dist))) != 0;
+#else
+    vec_t d, r;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        d = f->nx[i] * batch->center[0] + f->ny[i] * batch->center[1] + f->nz[i] * batch->center[2];
+        r = f->ax[i] * batch->extents[0] + f->ay[i] * batch->extents[1] + f->az[i] * batch->extents[2];
+        if (d + r < f->dist[i]) {
+            return qtrue;
+        }
+    }
+
+    return qfalse;
+#endif
+}
+
+static void GL_DrawWorldBatch(const clusterEntry_t *entry, const worldBatch_t *batch)
+{
+    mface_t **face = entry->faces + batch->firstface;
+    int i;
+
+    for (i = 0; i < batch->numsky; i++, face++) {
+        R_AddSkySurface(*face);
+    }
+
+    // alpha faces are added nearest first, the chain is drawn back-to-front
+    for (i = 0; i < batch->numalpha; i++, face++) {
+        GL_AddAlphaFace(*face);
+    }
+
+    for (i = 0; i < batch->numsolid; i++, face++) {
+        if (gl_dynamic->integer) {
+            GL_PushLights(*face);
+        }
+
+        if (gl_hash_faces->integer) {
+            GL_AddSolidFace(*face);
+        } else {
+            GL_DrawFace(*face);
+        }
+    }
+
+    c.worldBatches++;
+}
+
+static void GL_DrawBatchNode_r(const clusterEntry_t *entry,
+                               const batchFrustum_t *frustum, int index)
+{
+    const batchNode_t *node;
+    const worldBatch_t *batch;
+    int side;
+
+    while (index != -1) {
+        node = &entry->nodes[index];
+        side = PlaneDiffFast(glr.fd.vieworg, node->plane) < 0;
+
+        GL_DrawBatchNode_r(entry, frustum, node->children[side]);
+
+        if (node->batch != -1) {
+            batch = &entry->batches[node->batch];
+            if (frustum && GL_CullBatch(frustum, batch)) {
+                c.worldBatchesCulled++;
+            } else {
+                GL_DrawWorldBatch(entry, batch);
+            }
+        }
+
+        index = node->children[side ^ 1];
+    }
+}
+
+static void GL_DrawClusterBatches(void)
+{
+    clusterEntry_t *entry = GL_FindCluster();
+    batchFrustum_t frustum;
+
+    if (gl_cull_nodes->integer) {
+        GL_SetupBatchFrustum(&frustum);
+        GL_DrawBatchNode_r(entry, &frustum, entry->headnode);
+    } else {
+        GL_DrawBatchNode_r(entry, NULL, entry->headnode);
+    }
+}
+
 void GL_DrawWorld(void)
 {
+    uint64_t start = Sys_Microseconds();
+
     // auto cycle the world frame for texture animation
     gl_world.frame = (int)(glr.fd.time * 2);
 
     glr.ent = &gl_world;
 
-    GL_MarkLeaves();
-
     GL_MarkLights();
 
     R_ClearSkyBox();
@@ -568,13 +990,25 @@ void GL_DrawWorld(void)
 
     GL_ClearSolidFaces();
 
-    GL_WorldNode_r(gl_static.world.cache->nodes,
-                   gl_cull_nodes->integer ? NODE_CLIPPED : NODE_UNCLIPPED);
+    if (gl_cluster_batches->integer) {
+        GL_DrawClusterBatches();
+    } else {
+        // leaves were not marked while cluster batches were in use
+        if (cluster_current) {
+            glr.viewcluster1 = glr.viewcluster2 = -2;
+            cluster_current = NULL;
+        }
+        GL_MarkLeaves();
+        GL_WorldNode_r(gl_static.world.cache->nodes,
+                       gl_cull_nodes->integer ? NODE_CLIPPED : NODE_UNCLIPPED);
+    }
 
     GL_DrawSolidFaces();
 
     GL_Flush3D();
 
     R_DrawSkyBox();
+
+    c.worldUsec += Sys_Microseconds() - start;
 }
 
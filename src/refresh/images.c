@@ -26,27 +26,31 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/common.h"
 #include "common/cvar.h"
 #include "common/files.h"
+#include "common/jobs.h"
+#include "common/mdfour.h"
+#include "common/tests.h"
+#include "client/client.h"
 #include "refresh/images.h"
 #include "format/pcx.h"
 #include "format/wal.h"
+#include "system/system.h"
 #include "stb_image.h"
 #include "stb_image_write.h"
 
 #define R_COLORMAP_PCX    "pics/colormap.pcx"
 
+#if USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #define IMG_LOAD(x) \
     static qerror_t IMG_Load##x(byte *rawdata, size_t rawlen, \
         image_t *image, byte **pic)
 
 #define IMG_SAVE(x) \
-    static qerror_t IMG_Save##x(qhandle_t f, const char *filename, \
+    static qerror_t IMG_Save##x(membuf_t *buf, \
         byte *pic, int width, int height, int row_stride, int param)
 
-void stbi_write(void *context, void *data, int size)
-{
-	FS_Write(data, size, (qhandle_t)(size_t)context);
-}
-
 extern cvar_t* vid_rtx;
 
 /*
@@ -366,10 +370,30 @@ STB_IMAGE SAVING
 =================================================================
 */
 
+// screenshots are encoded into memory on worker threads, files are only
+// written on the main thread
+typedef struct {
+    byte    *data;
+    size_t  size;
+    size_t  maxsize;
+} membuf_t;
+
+static void stbi_write(void *context, void *data, int size)
+{
+    membuf_t *buf = context;
+
+    if (buf->size + size > buf->maxsize) {
+        buf->maxsize = max(buf->maxsize * 2, buf->size + size);
+        buf->data = Z_Realloc(buf->data, buf->maxsize);
+    }
+
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
 IMG_SAVE(TGA)
 {
-	stbi_flip_vertically_on_write(1);
-	int ret = stbi_write_tga_to_func(stbi_write, (void*)(size_t)f, width, height, 3, pic);
+	int ret = stbi_write_tga_to_func(stbi_write, buf, width, height, 3, pic);
 
 	if (ret) 
 		return Q_ERR_SUCCESS;
@@ -379,8 +403,7 @@ IMG_SAVE(TGA)
 
 IMG_SAVE(JPG)
 {
-	stbi_flip_vertically_on_write(1);
-	int ret = stbi_write_jpg_to_func(stbi_write, (void*)(size_t)f, width, height, 3, pic, param);
+	int ret = stbi_write_jpg_to_func(stbi_write, buf, width, height, 3, pic, param);
 
 	if (ret)
 		return Q_ERR_SUCCESS;
@@ -391,8 +414,7 @@ IMG_SAVE(JPG)
 
 IMG_SAVE(PNG)
 {
-	stbi_flip_vertically_on_write(1);
-	int ret = stbi_write_png_to_func(stbi_write, (void*)(size_t)f, width, height, 3, pic, row_stride);
+	int ret = stbi_write_png_to_func(stbi_write, buf, width, height, 3, pic, row_stride);
 
 	if (ret)
 		return Q_ERR_SUCCESS;
@@ -405,9 +427,47 @@ IMG_SAVE(PNG)
 
 SCREEN SHOTS
 
+Pixels are read back on the main thread and encoded by worker threads.
+At most MAX_SCREENSHOTS images are in flight; taking another screenshot
+waits for the oldest one, capturing drops the frame instead unless it
+runs at a fixed frame rate. Finished files are written by IMG_EndFrame.
+
 =========================================================
 */
 
+#define MAX_SCREENSHOTS     8
+
+typedef qerror_t (*save_func_t)(membuf_t *, byte *, int, int, int, int);
+
+typedef struct {
+    job_group_t group;
+    qboolean    busy;
+    qboolean    verbose;
+    unsigned    sequence;
+    char        filename[MAX_OSPATH];
+    save_func_t save;
+    byte        *pixels;
+    int         width, height, rowbytes, param;
+    membuf_t    buf;
+    qerror_t    ret;
+} screenshot_t;
+
+static screenshot_t img_screenshots[MAX_SCREENSHOTS];
+static unsigned     img_screenshot_sequence;
+
+static struct {
+    qboolean    active;
+    char        name[MAX_QPATH];
+    const char  *ext;
+    save_func_t save;
+    int         param;
+    int         fixedtime;      // non-zero when no frame may be dropped
+    char        old_fixedtime[MAX_QPATH];
+    int         frames;
+    int         dropped;
+    unsigned    start;
+} img_capture;
+
 static cvar_t *r_screenshot_format;
 static cvar_t *r_screenshot_quality;
 static cvar_t *r_screenshot_compression;
@@ -443,32 +503,138 @@ static qhandle_t create_screenshot(char *buffer, size_t size,
     return 0;
 }
 
+static void encode_screenshot(void *arg)
+{
+    screenshot_t *s = arg;
+
+    s->ret = s->save(&s->buf, s->pixels, s->width, s->height, s->rowbytes, s->param);
+}
+
+static void finish_screenshot(screenshot_t *s)
+{
+    qhandle_t f;
+    qerror_t ret;
+
+    Com_WaitJobs(&s->group);
+
+    ret = s->ret;
+    if (ret >= 0) {
+        // the file was created when the screenshot was taken to reserve its name
+        FS_FOpenFile(s->filename, &f, FS_MODE_WRITE);
+        if (f) {
+            if (FS_Write(s->buf.data, s->buf.size, f) != s->buf.size) {
+                ret = Q_ERR_FAILURE;
+            }
+            FS_FCloseFile(f);
+        } else {
+            ret = Q_ERR_FAILURE;
+        }
+    }
+
+    if (ret < 0) {
+        Com_EPrintf("Couldn't write %s: %s\n", s->filename, Q_ErrorString(ret));
+    } else if (s->verbose) {
+        Com_Printf("Wrote %s\n", s->filename);
+    }
+
+    FS_FreeTempMem(s->pixels);
+    Z_Free(s->buf.data);
+    memset(s, 0, sizeof(*s));
+}
+
+// writes out finished screenshots, or all of them if wait is set
+static void flush_screenshots(qboolean wait)
+{
+    screenshot_t *s;
+    int i;
+
+    for (i = 0, s = img_screenshots; i < MAX_SCREENSHOTS; i++, s++) {
+        if (s->busy && (wait || !Com_JobsPending(&s->group))) {
+            finish_screenshot(s);
+        }
+    }
+}
+
+static screenshot_t *alloc_screenshot(qboolean wait)
+{
+    screenshot_t *s, *oldest = NULL;
+    int i;
+
+    flush_screenshots(qfalse);
+
+    for (i = 0, s = img_screenshots; i < MAX_SCREENSHOTS; i++, s++) {
+        if (!s->busy) {
+            return s;
+        }
+        if (!oldest || s->sequence - oldest->sequence > INT_MAX) {
+            oldest = s;
+        }
+    }
+
+    if (!wait) {
+        return NULL;
+    }
+
+    finish_screenshot(oldest);
+    return oldest;
+}
+
+static qboolean queue_screenshot(screenshot_t *s, qhandle_t f, const char *filename,
+                                 save_func_t save, int param, qboolean verbose)
+{
+    // only keep the name reserved, handles are scarce
+    FS_FCloseFile(f);
+
+    s->pixels = IMG_ReadPixels(&s->width, &s->height, &s->rowbytes);
+    if (!s->pixels) {
+        return qfalse;
+    }
+
+    s->busy = qtrue;
+    s->verbose = verbose;
+    s->sequence = img_screenshot_sequence++;
+    Q_strlcpy(s->filename, filename, sizeof(s->filename));
+    s->save = save;
+    s->param = param;
+    Com_QueueJob(&s->group, encode_screenshot, s);
+    return qtrue;
+}
+
 static void make_screenshot(const char *name, const char *ext,
-                            qerror_t (*save)(qhandle_t, const char *, byte *, int, int, int, int),
-                            int param)
+                            save_func_t save, int param)
 {
     char        buffer[MAX_OSPATH];
-    byte        *pixels;
-    qerror_t    ret;
+    screenshot_t *s;
     qhandle_t   f;
-    int         w, h, rowbytes;
 
     f = create_screenshot(buffer, sizeof(buffer), name, ext);
     if (!f) {
         return;
     }
 
-    pixels = IMG_ReadPixels(&w, &h, &rowbytes);
-    ret = save(f, buffer, pixels, w, h, rowbytes, param);
-    FS_FreeTempMem(pixels);
+    s = alloc_screenshot(qtrue);
+    if (!queue_screenshot(s, f, buffer, save, param, qtrue)) {
+        Com_EPrintf("Couldn't read back %s\n", buffer);
+    }
+}
 
-    FS_FCloseFile(f);
+static save_func_t screenshot_format(const char *s, const char **ext, int *param)
+{
+    if (*s == 'j') {
+        *ext = ".jpg";
+        *param = r_screenshot_quality->integer;
+        return IMG_SaveJPG;
+    }
 
-    if (ret < 0) {
-        Com_EPrintf("Couldn't write %s: %s\n", buffer, Q_ErrorString(ret));
-    } else {
-        Com_Printf("Wrote %s\n", buffer);
+    if (*s == 'p') {
+        *ext = ".png";
+        *param = r_screenshot_compression->integer;
+        return IMG_SavePNG;
     }
+
+    *ext = ".tga";
+    *param = 0;
+    return IMG_SaveTGA;
 }
 
 /*
@@ -483,7 +649,9 @@ if no formats are available.
 */
 static void IMG_ScreenShot_f(void)
 {
-    const char *s;
+    const char *s, *ext;
+    save_func_t save;
+    int param;
 
     if (Cmd_Argc() > 2) {
         Com_Printf("Usage: %s [format]\n", Cmd_Argv(0));
@@ -496,19 +664,8 @@ static void IMG_ScreenShot_f(void)
         s = r_screenshot_format->string;
     }
 
-    if (*s == 'j') {
-        make_screenshot(NULL, ".jpg", IMG_SaveJPG,
-                        r_screenshot_quality->integer);
-        return;
-    }
-
-    if (*s == 'p') {
-        make_screenshot(NULL, ".png", IMG_SavePNG,
-                        r_screenshot_compression->integer);
-        return;
-    }
-
-    make_screenshot(NULL, ".tga", IMG_SaveTGA, 0);
+    save = screenshot_format(s, &ext, &param);
+    make_screenshot(NULL, ext, save, param);
 }
 
 /*
@@ -566,6 +723,121 @@ static void IMG_ScreenShotPNG_f(void)
     make_screenshot(Cmd_Argv(1), ".png", IMG_SavePNG, compression);
 }
 
+static void capture_frame(void)
+{
+    char        buffer[MAX_OSPATH];
+    screenshot_t *s;
+    qhandle_t   f;
+
+    s = alloc_screenshot(img_capture.fixedtime);
+    if (!s) {
+        img_capture.dropped++;
+        return;
+    }
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE, "screenshots/",
+                        va("%s_%05d", img_capture.name, img_capture.frames), img_capture.ext);
+    if (!f || !queue_screenshot(s, f, buffer, img_capture.save, img_capture.param, qfalse)) {
+        img_capture.dropped++;
+        return;
+    }
+
+    img_capture.frames++;
+}
+
+static void stop_capture(void)
+{
+    unsigned msec;
+
+    if (!img_capture.active) {
+        return;
+    }
+
+    flush_screenshots(qtrue);
+
+    // if cheats were lost meanwhile, fixedtime has already been reset
+    if (img_capture.fixedtime && CL_CheatsOK()) {
+        Cvar_SetEx("fixedtime", img_capture.old_fixedtime, FROM_CODE);
+    }
+
+    msec = max(Sys_Milliseconds() - img_capture.start, 1);
+    Com_Printf("Captured %d frames to screenshots/%s_*%s, %d dropped, "
+               "%.1f sec, %.1f fps\n", img_capture.frames, img_capture.name,
+               img_capture.ext, img_capture.dropped, msec * 0.001f,
+               img_capture.frames * 1000.0f / msec);
+
+    memset(&img_capture, 0, sizeof(img_capture));
+}
+
+/*
+==================
+IMG_Capture_f
+
+Saves every rendered frame as a numbered screenshot until stopped. With a
+frame rate given, game time advances by a fixed step per frame (through
+the fixedtime cvar) and no frame is dropped, so demos can be captured at
+full quality regardless of how fast they are encoded. Since fixedtime is a
+cheat, that mode is only available when cheats are allowed, which includes
+demo playback; otherwise frames are captured in real time.
+==================
+*/
+static void IMG_Capture_f(void)
+{
+    const char *s;
+    int fps;
+
+    if (Cmd_Argc() < 2) {
+        if (img_capture.active) {
+            Com_Printf("Capturing %s: %d frames, %d dropped\n",
+                       img_capture.name, img_capture.frames, img_capture.dropped);
+        } else {
+            Com_Printf("Usage: %s <name|stop> [fps] [format]\n", Cmd_Argv(0));
+        }
+        return;
+    }
+
+    stop_capture();
+
+    if (!strcmp(Cmd_Argv(1), "stop")) {
+        return;
+    }
+
+    fps = atoi(Cmd_Argv(2));
+    s = Cmd_Argc() > 3 ? Cmd_Argv(3) : r_screenshot_format->string;
+
+    Q_strlcpy(img_capture.name, Cmd_Argv(1), sizeof(img_capture.name));
+    img_capture.save = screenshot_format(s, &img_capture.ext, &img_capture.param);
+    if (fps > 0 && !CL_CheatsOK()) {
+        Com_Printf("Fixed frame rate capture requires cheats or demo playback, "
+                   "capturing in real time.\n");
+    } else if (fps > 0) {
+        img_capture.fixedtime = max(1000 / fps, 1);
+        Q_strlcpy(img_capture.old_fixedtime, Cvar_VariableString("fixedtime"),
+                  sizeof(img_capture.old_fixedtime));
+        Cvar_SetEx("fixedtime", va("%d", img_capture.fixedtime), FROM_CODE);
+        Com_Printf("Capturing at %.1f fps\n", 1000.0f / img_capture.fixedtime);
+    }
+    img_capture.start = Sys_Milliseconds();
+    img_capture.active = qtrue;
+}
+
+/*
+==================
+IMG_EndFrame
+
+Called by the renderers once a frame is complete and can still be read
+back by IMG_ReadPixels.
+==================
+*/
+void IMG_EndFrame(void)
+{
+    if (img_capture.active) {
+        capture_frame();
+    }
+
+    flush_screenshots(qfalse);
+}
+
 /*
 =========================================================
 
@@ -574,14 +846,138 @@ IMAGE PROCESSING
 =========================================================
 */
 
-void IMG_ResampleTexture(const byte *in, int inwidth, int inheight,
-                         byte *out, int outwidth, int outheight)
+/*
+Both kernels are split into row functions with a scalar version and, where
+available, an SSE2 version doing four output pixels at a time. Sums of four
+8-bit channels fit in 16 bits, so the vectorized rows give exactly the same
+truncated averages as the scalar ones.
+*/
+
+typedef void (*resample_row_t)(byte *out, const byte *inrow1, const byte *inrow2,
+                               const unsigned *p1, const unsigned *p2, int count);
+typedef void (*mipmap_row_t)(byte *out, const byte *in1, const byte *in2, int count);
+
+static void resample_row_c(byte *out, const byte *inrow1, const byte *inrow2,
+                           const unsigned *p1, const unsigned *p2, int count)
 {
-    int i, j;
+    const byte  *pix1, *pix2, *pix3, *pix4;
+    int j;
+
+    for (j = 0; j < count; j++) {
+        pix1 = inrow1 + p1[j];
+        pix2 = inrow1 + p2[j];
+        pix3 = inrow2 + p1[j];
+        pix4 = inrow2 + p2[j];
+        out[0] = (pix1[0] + pix2[0] + pix3[0] + pix4[0]) >> 2;
+        out[1] = (pix1[1] + pix2[1] + pix3[1] + pix4[1]) >> 2;
+        out[2] = (pix1[2] + pix2[2] + pix3[2] + pix4[2]) >> 2;
+        out[3] = (pix1[3] + pix2[3] + pix3[3] + pix4[3]) >> 2;
+        out += 4;
+    }
+}
+
+static void mipmap_row_c(byte *out, const byte *in1, const byte *in2, int count)
+{
+    int j;
+
+    for (j = 0; j < count; j++, out += 4, in1 += 8, in2 += 8) {
+        out[0] = (in1[0] + in1[4] + in2[0] + in2[4]) >> 2;
+        out[1] = (in1[1] + in1[5] + in2[1] + in2[5]) >> 2;
+        out[2] = (in1[2] + in1[6] + in2[2] + in2[6]) >> 2;
+        out[3] = (in1[3] + in1[7] + in2[3] + in2[7]) >> 2;
+    }
+}
+
+#if USE_SSE2
+
+static inline uint32_t load_pixel(const byte *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// averages four vectors of four RGBA pixels each
+static inline __m128i average_pixels(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo, hi;
+
+    lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(c, zero));
+    lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(d, zero));
+    hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+    hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(c, zero));
+    hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(d, zero));
+
+    return _mm_packus_epi16(_mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2));
+}
+
+static void resample_row_sse2(byte *out, const byte *inrow1, const byte *inrow2,
+                              const unsigned *p1, const unsigned *p2, int count)
+{
+    __m128i a, b, c, d;
+    int j;
+
+    for (j = 0; j + 4 <= count; j += 4, out += 16) {
+        a = _mm_setr_epi32(load_pixel(inrow1 + p1[j + 0]), load_pixel(inrow1 + p1[j + 1]),
+                           load_pixel(inrow1 + p1[j + 2]), load_pixel(inrow1 + p1[j + 3]));
+        b = _mm_setr_epi32(load_pixel(inrow1 + p2[j + 0]), load_pixel(inrow1 + p2[j + 1]),
+                           load_pixel(inrow1 + p2[j + 2]), load_pixel(inrow1 + p2[j + 3]));
+        c = _mm_setr_epi32(load_pixel(inrow2 + p1[j + 0]), load_pixel(inrow2 + p1[j + 1]),
+                           load_pixel(inrow2 + p1[j + 2]), load_pixel(inrow2 + p1[j + 3]));
+        d = _mm_setr_epi32(load_pixel(inrow2 + p2[j + 0]), load_pixel(inrow2 + p2[j + 1]),
+                           load_pixel(inrow2 + p2[j + 2]), load_pixel(inrow2 + p2[j + 3]));
+        _mm_storeu_si128((__m128i *)out, average_pixels(a, b, c, d));
+    }
+
+    resample_row_c(out, inrow1, inrow2, p1 + j, p2 + j, count - j);
+}
+
+// the output may overlap the first input row, but never ahead of
+// what has been read already
+static void mipmap_row_sse2(byte *out, const byte *in1, const byte *in2, int count)
+{
+    __m128 a0, a1, b0, b1;
+    __m128i a, b, c, d;
+    int j;
+
+    for (j = 0; j + 4 <= count; j += 4, out += 16, in1 += 32, in2 += 32) {
+        a0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)in1));
+        a1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(in1 + 16)));
+        b0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)in2));
+        b1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(in2 + 16)));
+
+        // split into even and odd pixels
+        a = _mm_castps_si128(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)));
+        b = _mm_castps_si128(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1)));
+        c = _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+        d = _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+        _mm_storeu_si128((__m128i *)out, average_pixels(a, b, c, d));
+    }
+
+    mipmap_row_c(out, in1, in2, count - j);
+}
+
+#define resample_row    resample_row_sse2
+#define mipmap_row      mipmap_row_sse2
+
+#else
+
+#define resample_row    resample_row_c
+#define mipmap_row      mipmap_row_c
+
+#endif // USE_SSE2
+
+static void resample_texture(const byte *in, int inwidth, int inheight,
+                             byte *out, int outwidth, int outheight,
+                             resample_row_t row)
+{
+    int i;
     const byte  *inrow1, *inrow2;
     unsigned    frac, fracstep;
     unsigned    p1[MAX_TEXTURE_SIZE], p2[MAX_TEXTURE_SIZE];
-    const byte  *pix1, *pix2, *pix3, *pix4;
     float       heightScale;
 
     if (outwidth > MAX_TEXTURE_SIZE) {
@@ -606,36 +1002,37 @@ void IMG_ResampleTexture(const byte *in, int inwidth, int inheight,
     for (i = 0; i < outheight; i++) {
         inrow1 = in + inwidth * (int)((i + 0.25f) * heightScale);
         inrow2 = in + inwidth * (int)((i + 0.75f) * heightScale);
-        for (j = 0; j < outwidth; j++) {
-            pix1 = inrow1 + p1[j];
-            pix2 = inrow1 + p2[j];
-            pix3 = inrow2 + p1[j];
-            pix4 = inrow2 + p2[j];
-            out[0] = (pix1[0] + pix2[0] + pix3[0] + pix4[0]) >> 2;
-            out[1] = (pix1[1] + pix2[1] + pix3[1] + pix4[1]) >> 2;
-            out[2] = (pix1[2] + pix2[2] + pix3[2] + pix4[2]) >> 2;
-            out[3] = (pix1[3] + pix2[3] + pix3[3] + pix4[3]) >> 2;
-            out += 4;
-        }
+        row(out, inrow1, inrow2, p1, p2, outwidth);
+        out += outwidth * 4;
     }
 }
 
-void IMG_MipMap(byte *out, byte *in, int width, int height)
+static void mipmap(byte *out, byte *in, int width, int height, mipmap_row_t row)
 {
-    int     i, j;
+    int     i, count;
 
+    // odd widths round up, reading one pixel past the end of the row
+    count = (width + 1) >> 1;
     width <<= 2;
     height >>= 1;
-    for (i = 0; i < height; i++, in += width) {
-        for (j = 0; j < width; j += 8, out += 4, in += 8) {
-            out[0] = (in[0] + in[4] + in[width + 0] + in[width + 4]) >> 2;
-            out[1] = (in[1] + in[5] + in[width + 1] + in[width + 5]) >> 2;
-            out[2] = (in[2] + in[6] + in[width + 2] + in[width + 6]) >> 2;
-            out[3] = (in[3] + in[7] + in[width + 3] + in[width + 7]) >> 2;
-        }
+    for (i = 0; i < height; i++) {
+        row(out, in, in + width, count);
+        out += count * 4;
+        in += count * 8 + width;
     }
 }
 
+void IMG_ResampleTexture(const byte *in, int inwidth, int inheight,
+                         byte *out, int outwidth, int outheight)
+{
+    resample_texture(in, inwidth, inheight, out, outwidth, outheight, resample_row);
+}
+
+void IMG_MipMap(byte *out, byte *in, int width, int height)
+{
+    mipmap(out, in, width, height, mipmap_row);
+}
+
 /*
 =========================================================
 
@@ -784,43 +1181,47 @@ static image_t *lookup_image(const char *name,
     return NULL;
 }
 
-static int _try_image_format(imageformat_t fmt, image_t *image, byte **pic)
+typedef struct {
+    byte        *data;      // raw file contents
+    size_t      len;
+    byte        *cache;     // renderer cache entry for the file, if any
+    size_t      cache_len;
+} imgfile_t;
+
+// reads the file, decoding is done separately by decode_image
+static int _try_image_format(imageformat_t fmt, image_t *image, imgfile_t *file)
 {
-    byte        *data;
     ssize_t     len;
-    qerror_t    ret;
+
+    file->cache = NULL;
+    file->cache_len = 0;
 
     // load the file
-    len = FS_LoadFile(image->name, (void **)&data);
-    if (!data) {
+    len = FS_LoadFile(image->name, (void **)&file->data);
+    if (!file->data) {
         return len;
     }
 
-    // decompress the image
-    ret = img_loaders[fmt].load(data, len, image, pic);
+    file->len = len;
 
-    FS_FreeFile(data);
+    strcpy(image->filepath, image->name);
+    // record last modified time (skips reload when invoking IMG_ReloadAll)
+    image->last_modified = 0;
+    FS_LastModified(image->filepath, &image->last_modified);
 
-    image->filepath[0] = 0;
-    if (ret >= 0) {
-        strcpy(image->filepath, image->name);
-        // record last modified time (skips reload when invoking IMG_ReloadAll)
-        image->last_modified = 0;
-        FS_LastModified(image->filepath, &image->last_modified);
-    }
-    return ret < 0 ? ret : fmt;
+    return fmt;
 }
 
-static int try_image_format(imageformat_t fmt, image_t *image, byte **pic)
+static int try_image_format(imageformat_t fmt, image_t *image, imgfile_t *file)
 {
     // replace the extension
     memcpy(image->name + image->baselen + 1, img_loaders[fmt].ext, 4);
-    return _try_image_format(fmt, image, pic);
+    return _try_image_format(fmt, image, file);
 }
 
 
 // tries to load the image with a different extension
-static int try_other_formats(imageformat_t orig, image_t *image, byte **pic)
+static int try_other_formats(imageformat_t orig, image_t *image, imgfile_t *file)
 {
     imageformat_t   fmt;
     qerror_t        ret;
@@ -833,7 +1234,7 @@ static int try_other_formats(imageformat_t orig, image_t *image, byte **pic)
             continue;   // don't retry twice
         }
 
-        ret = try_image_format(fmt, image, pic);
+        ret = try_image_format(fmt, image, file);
         if (ret != Q_ERR_NOENT) {
             return ret; // found something
         }
@@ -845,7 +1246,38 @@ static int try_other_formats(imageformat_t orig, image_t *image, byte **pic)
         return Q_ERR_NOENT; // don't retry twice
     }
 
-    return try_image_format(fmt, image, pic);
+    return try_image_format(fmt, image, file);
+}
+
+// decompresses the file found by _try_image_format and frees it.
+// doesn't touch the filesystem, so it is safe to call from worker threads.
+static int decode_image(imageformat_t fmt, image_t *image, imgfile_t *file, byte **pic)
+{
+    qerror_t    ret;
+
+    // the cache entry is only used if it was made from this very file
+    if (file->cache) {
+        if (IMG_LoadCache(image, file->cache, file->cache_len, file->data, file->len)) {
+            FS_FreeFile(file->data);
+            file->data = NULL;
+            file->cache = NULL;
+            *pic = NULL;
+            return fmt;
+        }
+        FS_FreeFile(file->cache);
+        file->cache = NULL;
+    }
+
+    ret = img_loaders[fmt].load(file->data, file->len, image, pic);
+
+    FS_FreeFile(file->data);
+    file->data = NULL;
+
+    if (ret < 0) {
+        image->filepath[0] = 0;
+        return ret;
+    }
+    return fmt;
 }
 
 static void get_image_dimensions(imageformat_t fmt, image_t *image)
@@ -927,6 +1359,7 @@ qerror_t
 load_img(const char *name, image_t *image)
 {
     byte            *pic;
+    imgfile_t       file;
     imageformat_t   fmt;
     qerror_t        ret;
 
@@ -957,16 +1390,14 @@ load_img(const char *name, image_t *image)
     pic = NULL;
 
 	// first try with original extension
-	ret = _try_image_format(fmt, image, &pic);
+	ret = _try_image_format(fmt, image, &file);
 	if (ret == Q_ERR_NOENT) {
 		// retry with remaining extensions
-		ret = try_other_formats(fmt, image, &pic);
+		ret = try_other_formats(fmt, image, &file);
     }
 
-    // if we are replacing 8-bit texture with a higher resolution 32-bit
-    // texture, we need to recover original image dimensions
-    if (fmt <= IM_WAL && ret > IM_WAL) {
-        get_image_dimensions(fmt, image);
+    if (ret >= 0) {
+        ret = decode_image(ret, image, &file, &pic);
     }
 
     // if we are replacing 8-bit texture with a higher resolution 32-bit
@@ -987,48 +1418,25 @@ load_img(const char *name, image_t *image)
     return Q_ERR_SUCCESS;
 }
 
-// finds or loads the given image, adding it to the hash table.
-static qerror_t find_or_load_image(const char *name, size_t len,
-                                   imagetype_t type, imageflags_t flags,
-                                   image_t **image_p)
+static qboolean override_textures(imagetype_t type)
 {
-    image_t         *image;
-    byte            *pic;
-    unsigned        hash;
-    imageformat_t   fmt;
-    qerror_t        ret;
-
-    *image_p = NULL;
+    if (!vid_rtx->integer && type != IT_PIC)
+        return qfalse;
 
-    // must have an extension and at least 1 char of base name
-    if (len <= 4) {
-        return Q_ERR_NAMETOOSHORT;
-    }
-    if (name[len - 4] != '.') {
-        return Q_ERR_INVALID_PATH;
-    }
-
-    hash = FS_HashPathLen(name, len - 4, RIMAGES_HASH);
-
-    // look for it
-    if ((image = lookup_image(name, type, hash, len - 4)) != NULL) {
-        image->flags |= flags & IF_PERMANENT;
-        image->registration_sequence = registration_sequence;
-        *image_p = image;
-        return Q_ERR_SUCCESS;
-    }
-
-    // allocate image slot
-    image = alloc_image();
-    if (!image) {
-        return Q_ERR_OUT_OF_SLOTS;
-    }
+    return !!r_override_textures->integer;
+}
 
-	int override_textures = !!r_override_textures->integer;
-	if (!vid_rtx->integer && (type != IT_PIC))
-		override_textures = 0;
+// finds the file for an image, trying the overrides directory first if
+// requested. fills in the image and returns file format or error code.
+static int find_image_file(const char *name, size_t len,
+                           imagetype_t type, imageflags_t flags,
+                           image_t *image, imgfile_t *file)
+{
+    imageformat_t   fmt;
+    qerror_t        ret;
+    int             override = override_textures(type);
 
-    for (int use_override = override_textures; use_override >= 0; use_override--)
+    for (int use_override = override; use_override >= 0; use_override--)
 	{
 		// fill in some basic info
 		if (use_override)
@@ -1051,6 +1459,7 @@ static qerror_t find_or_load_image(const char *name, size_t len,
 		image->type = type;
 		image->flags = flags;
 		image->registration_sequence = registration_sequence;
+		image->filepath[0] = 0;
 
 		// find out original extension
 		for (fmt = 0; fmt < IM_MAX; fmt++) {
@@ -1059,27 +1468,24 @@ static qerror_t find_or_load_image(const char *name, size_t len,
 			}
 		}
 
-		// load the pic from disk
-		pic = NULL;
-
 		if (fmt == IM_MAX) {
 			// unknown extension, but give it a chance to load anyway
-			ret = try_other_formats(IM_MAX, image, &pic);
+			ret = try_other_formats(IM_MAX, image, file);
 			if (ret == Q_ERR_NOENT) {
 				// not found, change error to invalid path
 				ret = Q_ERR_INVALID_PATH;
 			}
 		}
-		else if (override_textures) {
+		else if (override) {
 			// forcibly replace the extension
-			ret = try_other_formats(IM_MAX, image, &pic);
+			ret = try_other_formats(IM_MAX, image, file);
 		}
 		else {
 			// first try with original extension
-			ret = _try_image_format(fmt, image, &pic);
+			ret = _try_image_format(fmt, image, file);
 			if (ret == Q_ERR_NOENT) {
 				// retry with remaining extensions
-				ret = try_other_formats(fmt, image, &pic);
+				ret = try_other_formats(fmt, image, file);
 			}
 		}
 
@@ -1093,16 +1499,86 @@ static qerror_t find_or_load_image(const char *name, size_t len,
 			image->baselen = len - 4;
 		}
 
-		// if we are replacing 8-bit texture with a higher resolution 32-bit
-		// texture, we need to recover original image dimensions
-		if (fmt <= IM_WAL && ret > IM_WAL) {
-			get_image_dimensions(fmt, image);
-		}
-
 		if(ret >= 0)
 			break;
 	}
 
+    if (ret >= 0 && IMG_ReadCache) {
+        file->cache = IMG_ReadCache(image, &file->cache_len);
+    }
+
+    return ret;
+}
+
+// finishes loading of a decoded image. main thread only.
+static qerror_t finish_image(const char *name, size_t len, image_t *image, int ret)
+{
+    imageformat_t   fmt;
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    // if we are replacing 8-bit texture with a higher resolution 32-bit
+    // texture, we need to recover original image dimensions
+    for (fmt = 0; fmt < IM_MAX; fmt++) {
+        if (!Q_stricmp(name + len - 3, img_loaders[fmt].ext)) {
+            break;
+        }
+    }
+    if (fmt <= IM_WAL && ret > IM_WAL) {
+        get_image_dimensions(fmt, image);
+    }
+
+    image->is_srgb = !!(image->flags & IF_SRGB);
+    return Q_ERR_SUCCESS;
+}
+
+// finds or loads the given image, adding it to the hash table.
+static qerror_t find_or_load_image(const char *name, size_t len,
+                                   imagetype_t type, imageflags_t flags,
+                                   image_t **image_p)
+{
+    image_t         *image;
+    imgfile_t       file;
+    byte            *pic;
+    unsigned        hash;
+    qerror_t        ret;
+
+    *image_p = NULL;
+
+    // must have an extension and at least 1 char of base name
+    if (len <= 4) {
+        return Q_ERR_NAMETOOSHORT;
+    }
+    if (name[len - 4] != '.') {
+        return Q_ERR_INVALID_PATH;
+    }
+
+    hash = FS_HashPathLen(name, len - 4, RIMAGES_HASH);
+
+    // look for it
+    if ((image = lookup_image(name, type, hash, len - 4)) != NULL) {
+        image->flags |= flags & IF_PERMANENT;
+        image->registration_sequence = registration_sequence;
+        *image_p = image;
+        return Q_ERR_SUCCESS;
+    }
+
+    // allocate image slot
+    image = alloc_image();
+    if (!image) {
+        return Q_ERR_OUT_OF_SLOTS;
+    }
+
+    // load the pic from disk
+    pic = NULL;
+    ret = find_image_file(name, len, type, flags, image, &file);
+    if (ret >= 0) {
+        ret = decode_image(ret, image, &file, &pic);
+    }
+
+    ret = finish_image(name, len, image, ret);
     if (ret < 0) {
         memset(image, 0, sizeof(*image));
         return ret;
@@ -1110,8 +1586,6 @@ static qerror_t find_or_load_image(const char *name, size_t len,
 
     List_Append(&r_imageHash[hash], &image->entry);
 
-	image->is_srgb = !!(flags & IF_SRGB);
-
     // upload the image
     IMG_Load(image, pic);
 
@@ -1148,6 +1622,465 @@ image_t *IMG_Find(const char *name, imagetype_t type, imageflags_t flags)
     return R_NOTEXTURE;
 }
 
+/*
+=========================================================
+
+PARALLEL LOADING
+
+Images queued with IMG_QueueLoad are read from disk on the main thread,
+decoded by worker threads and committed in queue order by IMG_FlushLoads.
+Slots and hash chains end up exactly as if the images were loaded one by
+one with IMG_Find.
+
+=========================================================
+*/
+
+// files read ahead of the commit point, bounded to cap memory use
+#define MAX_BATCH_IMAGES    64
+#define MAX_BATCH_BYTES     (256 << 20)
+
+typedef struct {
+    char            name[MAX_QPATH];
+    size_t          len;
+    imagetype_t     type;
+    imageflags_t    flags;
+    unsigned        hash;
+    int             next;       // next entry on the same hash chain
+    image_t         image;      // decoded into, copied to a slot on commit
+    imgfile_t       file;
+    byte            *pic;
+    int             ret;        // file format or error code
+} imgload_t;
+
+static struct {
+    imgload_t       *loads;
+    int             count;
+    int             size;
+    int             hash[RIMAGES_HASH];
+} img_queue;
+
+static void decode_queued_image(void *arg)
+{
+    imgload_t *load = arg;
+
+    if (load->ret >= 0) {
+        load->ret = decode_image(load->ret, &load->image, &load->file, &load->pic);
+    }
+}
+
+// frees the decoded data of an image that won't be committed
+static void discard_queued_image(imgload_t *load)
+{
+    if (load->pic) {
+        Z_Free(load->pic);
+    }
+#if REF_VKPT
+    if (load->image.dds_data) {
+        Z_Free(load->image.dds_data);
+    }
+#endif
+}
+
+static void commit_queued_image(imgload_t *load)
+{
+    image_t *image;
+    qerror_t ret;
+
+    // may have been loaded by IMG_Find in the meantime
+    image = lookup_image(load->name, load->type, load->hash, load->len - 4);
+    if (image) {
+        image->flags |= load->flags & IF_PERMANENT;
+        image->registration_sequence = registration_sequence;
+        discard_queued_image(load);
+        return;
+    }
+
+    ret = finish_image(load->name, load->len, &load->image, load->ret);
+    if (ret >= 0 && !(image = alloc_image())) {
+        ret = Q_ERR_OUT_OF_SLOTS;
+    }
+
+    if (ret < 0) {
+        // don't spam about missing images
+        if (ret != Q_ERR_NOENT) {
+            Com_EPrintf("Couldn't load %s: %s\n", load->name, Q_ErrorString(ret));
+        }
+        discard_queued_image(load);
+        return;
+    }
+
+    *image = load->image;
+    image->registration_sequence = registration_sequence;
+    List_Append(&r_imageHash[load->hash], &image->entry);
+
+    // upload the image
+    IMG_Load(image, load->pic);
+}
+
+/*
+===============
+IMG_QueueLoad
+
+Queues an image to be loaded by the next IMG_FlushLoads. Images that are
+already loaded are touched immediately, like IMG_Find does.
+===============
+*/
+void IMG_QueueLoad(const char *name, imagetype_t type, imageflags_t flags)
+{
+    imgload_t *load;
+    image_t *image;
+    size_t len;
+    unsigned hash;
+    int i;
+
+    len = strlen(name);
+    if (len >= MAX_QPATH) {
+        Com_Error(ERR_FATAL, "%s: oversize name", __func__);
+    }
+
+    // let IMG_Find report bad names
+    if (len <= 4 || name[len - 4] != '.') {
+        IMG_Find(name, type, flags);
+        return;
+    }
+
+    hash = FS_HashPathLen(name, len - 4, RIMAGES_HASH);
+
+    if ((image = lookup_image(name, type, hash, len - 4)) != NULL) {
+        image->flags |= flags & IF_PERMANENT;
+        image->registration_sequence = registration_sequence;
+        return;
+    }
+
+    if (!img_queue.count) {
+        for (i = 0; i < RIMAGES_HASH; i++) {
+            img_queue.hash[i] = -1;
+        }
+    }
+
+    // merge duplicates, keeping the first position
+    for (i = img_queue.hash[hash]; i >= 0; i = load->next) {
+        load = &img_queue.loads[i];
+        if (load->type == type && load->len == len &&
+            !FS_pathcmpn(load->name, name, len - 4)) {
+            load->flags |= flags & IF_PERMANENT;
+            return;
+        }
+    }
+
+    if (img_queue.count == img_queue.size) {
+        img_queue.size = max(img_queue.size * 2, 256);
+        img_queue.loads = Z_Realloc(img_queue.loads, img_queue.size * sizeof(*load));
+    }
+
+    load = &img_queue.loads[img_queue.count];
+    memcpy(load->name, name, len + 1);
+    load->len = len;
+    load->hash = hash;
+    load->type = type;
+    load->flags = flags;
+    load->next = img_queue.hash[hash];
+    img_queue.hash[hash] = img_queue.count++;
+}
+
+/*
+===============
+IMG_FlushLoads
+
+Loads all queued images. Reading the files of a batch overlaps with
+decoding the ones read before.
+===============
+*/
+void IMG_FlushLoads(void)
+{
+    job_group_t group = { 0 };
+    imgload_t *load;
+    size_t bytes;
+    int start, end;
+
+    for (start = 0; start < img_queue.count; start = end) {
+        bytes = 0;
+        for (end = start; end < img_queue.count; end++) {
+            if (end - start == MAX_BATCH_IMAGES || bytes >= MAX_BATCH_BYTES) {
+                break;
+            }
+
+            load = &img_queue.loads[end];
+            memset(&load->image, 0, sizeof(load->image));
+            load->file.data = NULL;
+            load->file.len = 0;
+            load->pic = NULL;
+            load->ret = find_image_file(load->name, load->len, load->type,
+                                        load->flags, &load->image, &load->file);
+            bytes += load->file.len;
+
+            Com_QueueJob(&group, decode_queued_image, load);
+        }
+
+        Com_WaitJobs(&group);
+
+        for (load = &img_queue.loads[start]; load < &img_queue.loads[end]; load++) {
+            commit_queued_image(load);
+        }
+    }
+
+    img_queue.count = 0;
+}
+
+#if USE_TESTS
+typedef struct {
+    imgload_t       load;
+    imageformat_t   fmt;
+    uint32_t        checksum;
+} decodeitem_t;
+
+typedef struct {
+    decodeitem_t    *items;
+    int         count;
+    int         files;
+    size_t      texels;
+    unsigned    read_msec;
+    unsigned    decode_msec[2];
+    int         failures;
+    int         mismatches;
+} decodetest_t;
+
+static void decode_test_batch(decodetest_t *t)
+{
+    job_group_t group = { 0 };
+    decodeitem_t *item;
+    imgload_t *load;
+    uint32_t checksum;
+    unsigned start;
+    int pass, i;
+
+    for (pass = 0; pass < 2; pass++) {
+        start = Sys_Milliseconds();
+        for (i = 0, item = t->items; i < t->count; i++, item++) {
+            load = &item->load;
+            memset(&load->image, 0, sizeof(load->image));
+            memcpy(load->image.name, load->name, load->len + 1);
+            load->image.type = IT_SKIN;
+            load->pic = NULL;
+            load->ret = _try_image_format(item->fmt, &load->image, &load->file);
+        }
+        t->read_msec += Sys_Milliseconds() - start;
+
+        start = Sys_Milliseconds();
+        for (i = 0, item = t->items; i < t->count; i++, item++) {
+            if (pass)
+                Com_QueueJob(&group, decode_queued_image, &item->load);
+            else
+                decode_queued_image(&item->load);
+        }
+        Com_WaitJobs(&group);
+        t->decode_msec[pass] += Sys_Milliseconds() - start;
+
+        for (i = 0, item = t->items; i < t->count; i++, item++) {
+            load = &item->load;
+            if (load->ret < 0) {
+                if (pass)
+                    t->failures++;
+                continue;
+            }
+
+            checksum = Com_BlockChecksum(load->pic, load->image.upload_width * load->image.upload_height * 4);
+            if (pass) {
+                t->texels += load->image.upload_width * load->image.upload_height;
+                t->mismatches += checksum != item->checksum;
+            } else {
+                item->checksum = checksum;
+            }
+            Z_Free(load->pic);
+        }
+    }
+
+    t->files += t->count;
+    t->count = 0;
+}
+
+static void decode_test_dir(decodetest_t *t, const char *path)
+{
+    decodeitem_t *item;
+    void **list;
+    size_t len;
+    int i, count;
+
+    list = FS_ListFiles(path, ".pcx;.wal;.tga;.jpg;.png", FS_SEARCH_SAVEPATH, &count);
+    for (i = 0; i < count; i++) {
+        len = strlen(list[i]);
+        if (len >= MAX_QPATH) {
+            continue;
+        }
+
+        item = &t->items[t->count++];
+        memcpy(item->load.name, list[i], len + 1);
+        item->load.len = len;
+        // the listing filter makes sure one of the loaders matches
+        for (item->fmt = 0; item->fmt < IM_MAX - 1; item->fmt++) {
+            if (!Q_stricmp(item->load.name + len - 3, img_loaders[item->fmt].ext)) {
+                break;
+            }
+        }
+
+        if (t->count == MAX_BATCH_IMAGES) {
+            decode_test_batch(t);
+        }
+    }
+
+    FS_FreeList(list);
+}
+
+/*
+===============
+IMG_DecodeTest_f
+
+Decodes all images under the given directory without uploading them, once
+on the main thread and once on worker threads, and compares the results.
+===============
+*/
+static void IMG_DecodeTest_f(void)
+{
+    const char *path = Cmd_Argc() > 1 ? Cmd_Argv(1) : "textures";
+    char buffer[MAX_QPATH];
+    decodetest_t t;
+    void **list;
+    int i, count;
+
+    memset(&t, 0, sizeof(t));
+    t.items = Z_Malloc(MAX_BATCH_IMAGES * sizeof(*t.items));
+
+    decode_test_dir(&t, path);
+
+    list = FS_ListFiles(path, NULL, FS_SEARCH_DIRSONLY, &count);
+    for (i = 0; i < count; i++) {
+        Q_concat(buffer, sizeof(buffer), path, "/", list[i], NULL);
+        decode_test_dir(&t, buffer);
+    }
+    FS_FreeList(list);
+
+    decode_test_batch(&t);
+    Z_Free(t.items);
+
+    if (t.mismatches) {
+        Com_EPrintf("%d images decoded differently on worker threads\n", t.mismatches);
+    }
+
+    Com_Printf("%d images, %d failed, %.1f Mtexels, %u msec reading (2 passes)\n"
+               "decoding on 1 thread: %u msec, on %d threads: %u msec (%.2fx)\n",
+               t.files, t.failures, t.texels * 1e-6, t.read_msec,
+               t.decode_msec[0], Com_NumJobThreads(), t.decode_msec[1],
+               (double)t.decode_msec[0] / max(t.decode_msec[1], 1));
+}
+
+typedef struct {
+    byte *in;
+    byte *out[2];
+} kernel_test_t;
+
+static void mipmap_test_run(void *arg, int k)
+{
+    kernel_test_t *t = arg;
+
+    mipmap(t->out[k], t->in, 1024, 1024, k ? mipmap_row : mipmap_row_c);
+}
+
+static void resample_test_run(void *arg, int k)
+{
+    kernel_test_t *t = arg;
+
+    resample_texture(t->in, 1024, 1024, t->out[k], 1000, 700,
+                     k ? resample_row : resample_row_c);
+}
+
+/*
+===============
+IMG_KernelTest_f
+
+Checks the image processing kernels on a known answer and compares the
+vectorized rows with the scalar ones on random images, then times both on
+a 1024x1024 image.
+===============
+*/
+static void IMG_KernelTest_f(void)
+{
+    static const byte mip_in[16] = {
+        255, 0, 1, 2,   255, 0, 1, 2,
+        255, 1, 1, 3,   255, 2, 0, 3
+    };
+    static const byte mip_out[4] = { 255, 0, 0, 2 };
+    static const int mip_sizes[][2] = {
+        { 2, 2 }, { 8, 2 }, { 10, 6 }, { 16, 16 }, { 34, 4 }, { 256, 128 }
+    };
+    static const int resample_sizes[][4] = {
+        { 4, 4, 3, 3 }, { 37, 23, 16, 9 }, { 256, 256, 200, 100 },
+        { 64, 32, 130, 70 }, { 640, 480, 1024, 768 }
+    };
+    int iterations = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 20;
+    unsigned seed = 1;
+    byte *in, *out[2];
+    uint64_t usec[2][2] = { { 0, 0 }, { 0, 0 } };
+    kernel_test_t t;
+    int i, w, h, errors = 0;
+    byte pix[16];
+
+    clamp(iterations, 1, 10000);
+
+    in = Z_Malloc(1024 * 1024 * 4);
+    out[0] = Z_Malloc(1024 * 1024 * 4);
+    out[1] = Z_Malloc(1024 * 1024 * 4);
+
+    memcpy(pix, mip_in, sizeof(pix));
+    IMG_MipMap(pix, pix, 2, 2);
+    if (memcmp(pix, mip_out, sizeof(mip_out))) {
+        Com_EPrintf("IMG_MipMap: wrong result for 2x2 image\n");
+        errors++;
+    }
+
+    for (i = 0; i < q_countof(mip_sizes); i++) {
+        w = mip_sizes[i][0];
+        h = mip_sizes[i][1];
+        TST_FillRandom(in, w * h * 4, &seed);
+        mipmap(out[0], in, w, h, mipmap_row_c);
+        // in place, like the GL renderer does it
+        memcpy(out[1], in, w * h * 4);
+        IMG_MipMap(out[1], out[1], w, h);
+        if (memcmp(out[0], out[1], (w / 2) * (h / 2) * 4)) {
+            Com_EPrintf("IMG_MipMap: wrong result for %dx%d image\n", w, h);
+            errors++;
+        }
+    }
+
+    for (i = 0; i < q_countof(resample_sizes); i++) {
+        const int *s = resample_sizes[i];
+        TST_FillRandom(in, s[0] * s[1] * 4, &seed);
+        resample_texture(in, s[0], s[1], out[0], s[2], s[3], resample_row_c);
+        IMG_ResampleTexture(in, s[0], s[1], out[1], s[2], s[3]);
+        if (memcmp(out[0], out[1], s[2] * s[3] * 4)) {
+            Com_EPrintf("IMG_ResampleTexture: wrong result for %dx%d -> %dx%d\n",
+                        s[0], s[1], s[2], s[3]);
+            errors++;
+        }
+    }
+
+    TST_FillRandom(in, 1024 * 1024 * 4, &seed);
+    t.in = in;
+    t.out[0] = out[0];
+    t.out[1] = out[1];
+    TST_TimeVariants(mipmap_test_run, &t, iterations, usec[0]);
+    TST_TimeVariants(resample_test_run, &t, iterations, usec[1]);
+
+    Z_Free(in);
+    Z_Free(out[0]);
+    Z_Free(out[1]);
+
+    Com_Printf("%d errors%s\n", errors,
+               USE_SSE2 ? "" : ", no vectorized kernels on this target");
+    TST_PrintTimes("mipmap 1024x1024", "scalar", "vectorized", usec[0], iterations);
+    TST_PrintTimes("resample 1024x1024 -> 1000x700", "scalar", "vectorized", usec[1], iterations);
+}
+#endif
+
 /*
 ===============
 IMG_ForHandle
@@ -1357,6 +2290,11 @@ static const cmdreg_t img_cmd[] = {
     { "screenshottga", IMG_ScreenShotTGA_f },
     { "screenshotjpg", IMG_ScreenShotJPG_f },
     { "screenshotpng", IMG_ScreenShotPNG_f },
+    { "capture", IMG_Capture_f },
+#if USE_TESTS
+    { "imagedecodetest", IMG_DecodeTest_f },
+    { "imagekerneltest", IMG_KernelTest_f },
+#endif
     { NULL }
 };
 
@@ -1381,6 +2319,9 @@ void IMG_Init(void)
 
     Cmd_Register(img_cmd);
 
+    // screenshots are read back bottom up
+    stbi_flip_vertically_on_write(1);
+
     for (i = 0; i < RIMAGES_HASH; i++) {
         List_Init(&r_imageHash[i]);
     }
@@ -1391,6 +2332,10 @@ void IMG_Init(void)
 
 void IMG_Shutdown(void)
 {
+    stop_capture();
+    flush_screenshots(qtrue);
     Cmd_Deregister(img_cmd);
+    Z_Free(img_queue.loads);
+    memset(&img_queue, 0, sizeof(img_queue));
     r_numImages = 0;
 }
@@ -36,9 +36,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // we are sure we won't need it.
 #define MAX_RMODELS     (MAX_MODELS * 2)
 
+#define RMODELS_HASH    256
+
 model_t      r_models[MAX_RMODELS];
 int          r_numModels;
 
+static list_t   r_modelHash[RMODELS_HASH];
+
 extern cvar_t *vid_rtx;
 
 static model_t *MOD_Alloc(void)
@@ -62,15 +66,11 @@ static model_t *MOD_Alloc(void)
     return model;
 }
 
-static model_t *MOD_Find(const char *name)
+static model_t *MOD_Find(const char *name, unsigned hash)
 {
     model_t *model;
-    int i;
 
-    for (i = 0, model = r_models; i < r_numModels; i++, model++) {
-        if (!model->type) {
-            continue;
-        }
+    LIST_FOR_EACH(model_t, model, &r_modelHash[hash], entry) {
         if (!FS_pathcmp(model->name, name)) {
             return model;
         }
@@ -79,6 +79,17 @@ static model_t *MOD_Find(const char *name)
     return NULL;
 }
 
+static void MOD_Free(model_t *model)
+{
+    if (MOD_Unload) {
+        MOD_Unload(model);
+    }
+
+    Hunk_Free(&model->hunk);
+    List_Remove(&model->entry);
+    memset(model, 0, sizeof(*model));
+}
+
 static void MOD_List_f(void)
 {
     static const char types[4] = "FASE";
@@ -116,8 +127,7 @@ void MOD_FreeUnused(void)
             Com_PageInMemory(model->hunk.base, model->hunk.cursize);
         } else {
             // don't need this model
-            Hunk_Free(&model->hunk);
-            memset(model, 0, sizeof(*model));
+            MOD_Free(model);
         }
     }
 }
@@ -132,8 +142,7 @@ void MOD_FreeAll(void)
             continue;
         }
 
-        Hunk_Free(&model->hunk);
-        memset(model, 0, sizeof(*model));
+        MOD_Free(model);
     }
 
     r_numModels = 0;
@@ -311,6 +320,7 @@ qhandle_t R_RegisterModel(const char *name)
     model_t *model;
     byte *rawdata = NULL;
     uint32_t ident;
+    unsigned hash;
     mod_load_t load;
     qerror_t ret;
 
@@ -338,7 +348,8 @@ qhandle_t R_RegisterModel(const char *name)
     }
 
     // see if it's already loaded
-    model = MOD_Find(normalized);
+    hash = FS_HashPathLen(normalized, namelen, RMODELS_HASH);
+    model = MOD_Find(normalized, hash);
     if (model) {
         MOD_Reference(model);
         goto done;
@@ -412,6 +423,8 @@ qhandle_t R_RegisterModel(const char *name)
 
 	model->model_class = get_model_class(model->name);
 
+    List_Append(&r_modelHash[hash], &model->entry);
+
 done:
     index = (model - r_models) + 1;
 #if USE_REF == REF_VKPT
@@ -449,10 +462,16 @@ model_t *MOD_ForHandle(qhandle_t h)
 
 void MOD_Init(void)
 {
+    int i;
+
     if (r_numModels) {
         Com_Error(ERR_FATAL, "%s: %d models not freed", __func__, r_numModels);
     }
 
+    for (i = 0; i < RMODELS_HASH; i++) {
+        List_Init(&r_modelHash[i]);
+    }
+
     Cmd_AddCommand("modellist", MOD_List_f);
 }
 
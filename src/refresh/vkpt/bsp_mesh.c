@@ -20,11 +20,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "vkpt.h"
 #include "shader/global_textures.h"
 #include "material.h"
+#include "system/system.h"
 
 #include <assert.h>
 #include <float.h>
 
 extern cvar_t *cvar_pt_enable_nodraw;
+extern cvar_t *cvar_pt_mesh_cache;
 
 static void
 remove_collinear_edges(float* positions, float* tex_coords, int* num_vertices)
@@ -405,13 +407,11 @@ static void make_pvs_symmetric(bsp_t* bsp)
 	}
 }
 
-static void build_pvs2(bsp_t* bsp)
+static void build_pvs2_range(void* arg, int start, int end)
 {
-	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
-
-	bsp->pvs2_matrix = Z_Mallocz(matrix_size);
+	bsp_t* bsp = arg;
 
-	for (int cluster = 0; cluster < bsp->vis->numclusters; cluster++)
+	for (int cluster = start; cluster < end; cluster++)
 	{
 		char* pvs = BSP_GetPvs(bsp, cluster);
 		char* dest_pvs = BSP_GetPvs2(bsp, cluster);
@@ -422,7 +422,53 @@ static void build_pvs2(bsp_t* bsp)
 			merge_pvs_rows(bsp, pvs2, dest_pvs);
 		FOREACH_BIT_END
 	}
+}
+
+static void build_pvs2(bsp_t* bsp)
+{
+	size_t matrix_size = bsp->visrowsize * bsp->vis->numclusters;
+
+	bsp->pvs2_matrix = Z_Mallocz(matrix_size);
+
+	// every row only reads the first order PVS
+	Com_ParallelFor(bsp->vis->numclusters, 16, build_pvs2_range, bsp);
+}
+
+typedef struct {
+	mface_t *surf;
+	uint32_t material_id;
+	int first_tri;
+	int num_tris;
+} surf_tris_t;
 
+typedef struct {
+	bsp_mesh_t *wm;
+	bsp_t *bsp;
+	int first_tri;
+	int *anti_clusters;
+} surf_clusters_t;
+
+static void
+find_clusters_range(void *arg, int start, int end)
+{
+	surf_clusters_t *sc = arg;
+
+	for (int i = start; i < end; i++)
+	{
+		int it = sc->first_tri + i;
+
+		// Compute the BSP node for this specific triangle based on its center.
+		// The face lists in the BSP are slightly incorrect, or the original code 
+		// in q2vkpt that was extracting them was incorrect.
+
+		vec3_t center, anti_center;
+		get_triangle_off_center(sc->wm->positions + it * 9, center, anti_center);
+
+		sc->wm->clusters[it] = BSP_PointLeaf(sc->bsp->nodes, center)->cluster;
+
+		if (sc->anti_clusters)
+			sc->anti_clusters[i] = BSP_PointLeaf(sc->bsp->nodes, anti_center)->cluster;
+	}
 }
 
 static void
@@ -431,6 +477,9 @@ collect_surfaces(int *idx_ctr, bsp_mesh_t *wm, bsp_t *bsp, int model_idx, int (*
 	mface_t *surfaces = model_idx < 0 ? bsp->faces : bsp->models[model_idx].firstface;
 	int num_faces = model_idx < 0 ? bsp->numfaces : bsp->models[model_idx].numfaces;
 	qboolean any_pvs_patches = qfalse;
+	surf_tris_t *surf_tris = Z_Malloc(max(num_faces, 1) * sizeof(surf_tris_t));
+	int num_surf_tris = 0;
+	int first_tri = *idx_ctr / 3;
 
 	for (int i = 0; i < num_faces; i++) {
 		mface_t *surf = surfaces + i;
@@ -488,55 +537,78 @@ collect_surfaces(int *idx_ctr, bsp_mesh_t *wm, bsp_t *bsp, int model_idx, int (*
 			&wm->tex_coords[*idx_ctr * 2],
 			&wm->materials[*idx_ctr / 3]);
 
-		for (int it = *idx_ctr / 3, k = 0; k < cnt; k += 3, ++it) 
-		{
-			if (model_idx < 0)
-			{
-				// Compute the BSP node for this specific triangle based on its center.
-				// The face lists in the BSP are slightly incorrect, or the original code 
-				// in q2vkpt that was extracting them was incorrect.
+		surf_tris_t *st = surf_tris + num_surf_tris++;
+		st->surf = surf;
+		st->material_id = material_id;
+		st->first_tri = *idx_ctr / 3;
+		st->num_tris = cnt / 3;
+
+		*idx_ctr += cnt;
+	}
 
-				vec3_t center, anti_center;
-				get_triangle_off_center(wm->positions + it * 9, center, anti_center);
+	int num_tris = *idx_ctr / 3 - first_tri;
 
-				int cluster = BSP_PointLeaf(bsp->nodes, center)->cluster;
-				wm->clusters[it] = cluster;
+	if (model_idx >= 0)
+	{
+		// It's a model: clusters are determined after model instantiation.
+		for (int i = 0; i < num_tris; i++)
+			wm->clusters[first_tri + i] = -1;
+
+		Z_Free(surf_tris);
+		return;
+	}
+
+	// Point lookups don't depend on the PVS, so they can run in parallel ahead of
+	// the patching below, which has to see the triangles in order.
+
+	surf_clusters_t sc = { .wm = wm, .bsp = bsp, .first_tri = first_tri };
+	if (!bsp->pvs_patched)
+		sc.anti_clusters = Z_Malloc(max(num_tris, 1) * sizeof(int));
+
+	Com_ParallelFor(num_tris, 256, find_clusters_range, &sc);
 
-				if (cluster >= 0 && (MAT_IsKind(material_id, MATERIAL_KIND_SKY) || MAT_IsKind(material_id, MATERIAL_KIND_LAVA)))
+	for (int i = 0; i < num_surf_tris; i++)
+	{
+		mface_t *surf = surf_tris[i].surf;
+		uint32_t material_id = surf_tris[i].material_id;
+
+		for (int it = surf_tris[i].first_tri, k = 0; k < surf_tris[i].num_tris; k++, ++it)
+		{
+			int cluster = wm->clusters[it];
+
+			if (cluster >= 0 && (MAT_IsKind(material_id, MATERIAL_KIND_SKY) || MAT_IsKind(material_id, MATERIAL_KIND_LAVA)))
+			{
+				if(is_sky_or_lava_cluster(wm, surf, cluster, material_id))
 				{
-					if(is_sky_or_lava_cluster(wm, surf, cluster, material_id))
-					{
-						wm->materials[it] |= MATERIAL_FLAG_LIGHT;
-					}
+					wm->materials[it] |= MATERIAL_FLAG_LIGHT;
 				}
+			}
 
-				if (!bsp->pvs_patched)
+			if (!bsp->pvs_patched)
+			{
+				if (MAT_IsKind(material_id, MATERIAL_KIND_SLIME) || MAT_IsKind(material_id, MATERIAL_KIND_WATER) || MAT_IsKind(material_id, MATERIAL_KIND_GLASS || MAT_IsKind(material_id, MATERIAL_KIND_TRANSPARENT)))
 				{
-					if (MAT_IsKind(material_id, MATERIAL_KIND_SLIME) || MAT_IsKind(material_id, MATERIAL_KIND_WATER) || MAT_IsKind(material_id, MATERIAL_KIND_GLASS || MAT_IsKind(material_id, MATERIAL_KIND_TRANSPARENT)))
+					int anti_cluster = sc.anti_clusters[it - first_tri];
+
+					if (cluster >= 0 && anti_cluster >= 0 && cluster != anti_cluster)
 					{
-						int anti_cluster = BSP_PointLeaf(bsp->nodes, anti_center)->cluster;
+						char* pvs_cluster = BSP_GetPvs(bsp, cluster);
+						char* pvs_anti_cluster = BSP_GetPvs(bsp, anti_cluster);
 
-						if (cluster >= 0 && anti_cluster >= 0 && cluster != anti_cluster)
+						if (!Q_IsBitSet(pvs_cluster, anti_cluster) || !Q_IsBitSet(pvs_anti_cluster, cluster))
 						{
-							char* pvs_cluster = BSP_GetPvs(bsp, cluster);
-							char* pvs_anti_cluster = BSP_GetPvs(bsp, anti_cluster);
-
-							if (!Q_IsBitSet(pvs_cluster, anti_cluster) || !Q_IsBitSet(pvs_anti_cluster, cluster))
-							{
-								connect_pvs(bsp, cluster, pvs_cluster, anti_cluster, pvs_anti_cluster);
-								any_pvs_patches = qtrue;
-							}
+							connect_pvs(bsp, cluster, pvs_cluster, anti_cluster, pvs_anti_cluster);
+							any_pvs_patches = qtrue;
 						}
 					}
 				}
 			}
-			else
-				wm->clusters[it] = -1;
 		}
-
-		*idx_ctr += cnt;
 	}
 
+	Z_Free(sc.anti_clusters);
+	Z_Free(surf_tris);
+
 	if (any_pvs_patches)
 		make_pvs_symmetric(bsp);
 }
@@ -691,267 +763,382 @@ is_light_material(uint32_t material)
 	return (material & MATERIAL_FLAG_LIGHT) != 0;
 }
 
-static void
-collect_ligth_polys(bsp_mesh_t *wm, bsp_t *bsp, int model_idx, int* num_lights, int* allocated_lights, light_poly_t** lights)
+typedef struct {
+	int num_lights;
+	int allocated_lights;
+	light_poly_t* lights;
+} light_list_t;
+
+typedef struct {
+	light_list_t lights;        // lights of the world or model being collected
+	light_list_t world_lights;  // model lights that go into the world list
+	qboolean failed;
+} light_chunk_t;
+
+typedef struct {
+	bsp_t* bsp;
+	int model_idx;
+	mface_t* surfaces;
+	int num_faces;
+	int num_chunks;
+	light_chunk_t* chunks;
+} light_job_t;
+
+// Same as append_light_poly, but safe to call from job threads.
+// Returns NULL and marks the chunk failed when out of memory.
+static light_poly_t*
+append_chunk_light_poly(light_chunk_t* chunk, light_list_t* list)
 {
-	mface_t *surfaces = model_idx < 0 ? bsp->faces : bsp->models[model_idx].firstface;
-	int num_faces = model_idx < 0 ? bsp->numfaces : bsp->models[model_idx].numfaces;
+	if (list->num_lights == list->allocated_lights)
+	{
+		int allocated = max(list->allocated_lights * 2, 128);
+		light_poly_t* lights = realloc(list->lights, allocated * sizeof(light_poly_t));
+		if (!lights)
+		{
+			chunk->failed = qtrue;
+			return NULL;
+		}
+		list->lights = lights;
+		list->allocated_lights = allocated;
+	}
+	return list->lights + list->num_lights++;
+}
 
-	*allocated_lights = 0;
-	*num_lights = 0;
-	*lights = NULL;
+static void
+append_light_polys(int* num_lights, int* allocated, light_poly_t** lights, const light_list_t* src)
+{
+	if (!src->num_lights)
+		return;
 
-	for (int i = 0; i < num_faces; i++) 
+	if (*num_lights + src->num_lights > *allocated)
 	{
-		mface_t *surf = surfaces + i;
+		*allocated = max(npot32(*num_lights + src->num_lights), 128);
+		*lights = Z_Realloc(*lights, *allocated * sizeof(light_poly_t));
+	}
+	memcpy(*lights + *num_lights, src->lights, src->num_lights * sizeof(light_poly_t));
+	*num_lights += src->num_lights;
+}
 
-		if (model_idx < 0 && belongs_to_model(bsp, surf))
-			continue;
+static void
+collect_face_ligth_polys(light_chunk_t* chunk, bsp_t *bsp, mface_t *surf, int model_idx)
+{
+	light_list_t* own = &chunk->lights;
+	light_list_t* world = model_idx < 0 ? &chunk->lights : &chunk->world_lights;
 
-		mtexinfo_t *texinfo = surf->texinfo;
+	mtexinfo_t *texinfo = surf->texinfo;
 
-		if(!texinfo->material)
-			continue;
+	if(!texinfo->material)
+		return;
 
-		uint32_t material_id = texinfo->material->flags;
+	uint32_t material_id = texinfo->material->flags;
 
-		if(!is_light_material(material_id))
-			continue;
+	if(!is_light_material(material_id))
+		return;
 
-		const image_t *image = texinfo->material->image_emissive;
-		if (!image)
-		{
-			// This algorithm relies on information from the emissive texture,
-			// specifically the extents of the emissive pixels in that texture.
-			// Ignore surfaces that don't have an emissive texture attached.
-			continue;
-		}
+	const image_t *image = texinfo->material->image_emissive;
+	if (!image)
+	{
+		// This algorithm relies on information from the emissive texture,
+		// specifically the extents of the emissive pixels in that texture.
+		// Ignore surfaces that don't have an emissive texture attached.
+		return;
+	}
 
-		if (image->entire_texture_emissive)
-		{
-			// In some cases, the texture is uniform - example is "lsrlt1" used in the "mine" maps.
-			// Such textures are tiled over the models, and the more complex lighting system below 
-			// breaks up the models into many small triangles, although there is no need to do that.
-			// In these cases, we just triangulate the surface polygon.
+	if (image->entire_texture_emissive)
+	{
+		// In some cases, the texture is uniform - example is "lsrlt1" used in the "mine" maps.
+		// Such textures are tiled over the models, and the more complex lighting system below 
+		// breaks up the models into many small triangles, although there is no need to do that.
+		// In these cases, we just triangulate the surface polygon.
 
-			float positions[3 * /*max_vertices*/ 32];
+		float positions[3 * /*max_vertices*/ 32];
 
-			for (int i = 0; i < surf->numsurfedges; i++)
-			{
-				msurfedge_t *src_surfedge = surf->firstsurfedge + i;
-				medge_t     *src_edge = src_surfedge->edge;
-				mvertex_t   *src_vert = src_edge->v[src_surfedge->vert];
+		for (int i = 0; i < surf->numsurfedges; i++)
+		{
+			msurfedge_t *src_surfedge = surf->firstsurfedge + i;
+			medge_t     *src_edge = src_surfedge->edge;
+			mvertex_t   *src_vert = src_edge->v[src_surfedge->vert];
 
-				float *p = positions + i * 3;
+			float *p = positions + i * 3;
 
-				VectorCopy(src_vert->point, p);
-			}
+			VectorCopy(src_vert->point, p);
+		}
 
-			int num_vertices = surf->numsurfedges;
-			remove_collinear_edges(positions, NULL, &num_vertices);
+		int num_vertices = surf->numsurfedges;
+		remove_collinear_edges(positions, NULL, &num_vertices);
 
-			const int num_triangles = surf->numsurfedges - 2;
+		const int num_triangles = surf->numsurfedges - 2;
 
-			for (int i = 0; i < num_triangles; i++)
-			{
-				const int e = surf->numsurfedges;
+		for (int i = 0; i < num_triangles; i++)
+		{
+			const int e = surf->numsurfedges;
 
-				int i1 = (i + 2) % e;
-				int i2 = (i + 1) % e;
+			int i1 = (i + 2) % e;
+			int i2 = (i + 1) % e;
 
-				light_poly_t light;
-				VectorCopy(positions, light.positions + 0);
-				VectorCopy(positions + i1 * 3, light.positions + 3);
-				VectorCopy(positions + i2 * 3, light.positions + 6);
-				VectorCopy(image->light_color, light.color);
+			light_poly_t light;
+			VectorCopy(positions, light.positions + 0);
+			VectorCopy(positions + i1 * 3, light.positions + 3);
+			VectorCopy(positions + i2 * 3, light.positions + 6);
+			VectorCopy(image->light_color, light.color);
 
-				light.material = image - r_images;
-				light.style = get_surf_light_style(surf);
+			light.material = image - r_images;
+			light.style = get_surf_light_style(surf);
 
-				if(!get_triangle_off_center(light.positions, light.off_center, NULL))
-					continue;
+			if(!get_triangle_off_center(light.positions, light.off_center, NULL))
+				continue;
 
-				light.cluster = BSP_PointLeaf(bsp->nodes, light.off_center)->cluster;
+			light.cluster = BSP_PointLeaf(bsp->nodes, light.off_center)->cluster;
 
-				if(light.cluster >= 0)
-				{
-					light_poly_t* list_light = append_light_poly(&wm->num_light_polys, &wm->allocated_light_polys, &wm->light_polys);
-					memcpy(list_light, &light, sizeof(light_poly_t));
-				}
+			if(light.cluster >= 0)
+			{
+				light_poly_t* list_light = append_chunk_light_poly(chunk, world);
+				if (!list_light)
+					return;
+				memcpy(list_light, &light, sizeof(light_poly_t));
 			}
-
-			continue;
 		}
 
-		vec4_t plane;
-		if (!get_surf_plane_equation(surf, plane))
-		{
-			// It's possible that some polygons in the game are degenerate, ignore these.
-			continue;
-		}
+		return;
+	}
 
-		image_t* image_diffuse = texinfo->material->image_diffuse;
-		float tex_scale[2] = { 1.0f / image_diffuse->width, 1.0f / image_diffuse->height };
+	vec4_t plane;
+	if (!get_surf_plane_equation(surf, plane))
+	{
+		// It's possible that some polygons in the game are degenerate, ignore these.
+		return;
+	}
 
-		// Scale the texture axes according to the original resolution of the game's .wal textures
-		vec4_t tex_axis0, tex_axis1;
-		VectorScale(texinfo->axis[0], tex_scale[0], tex_axis0);
-		VectorScale(texinfo->axis[1], tex_scale[1], tex_axis1);
-		tex_axis0[3] = texinfo->offset[0] * tex_scale[0];
-		tex_axis1[3] = texinfo->offset[1] * tex_scale[1];
+	image_t* image_diffuse = texinfo->material->image_diffuse;
+	float tex_scale[2] = { 1.0f / image_diffuse->width, 1.0f / image_diffuse->height };
 
-		// The texture basis is not normalized, so we need the lengths of the axes to convert
-		// texture coordinates back into world space
-		float tex_axis0_inv_square_length = 1.0f / DotProduct(tex_axis0, tex_axis0);
-		float tex_axis1_inv_square_length = 1.0f / DotProduct(tex_axis1, tex_axis1);
+	// Scale the texture axes according to the original resolution of the game's .wal textures
+	vec4_t tex_axis0, tex_axis1;
+	VectorScale(texinfo->axis[0], tex_scale[0], tex_axis0);
+	VectorScale(texinfo->axis[1], tex_scale[1], tex_axis1);
+	tex_axis0[3] = texinfo->offset[0] * tex_scale[0];
+	tex_axis1[3] = texinfo->offset[1] * tex_scale[1];
 
-		// Find the normal of the texture plane
-		vec3_t tex_normal;
-		CrossProduct(tex_axis0, tex_axis1, tex_normal);
-		VectorNormalize(tex_normal);
+	// The texture basis is not normalized, so we need the lengths of the axes to convert
+	// texture coordinates back into world space
+	float tex_axis0_inv_square_length = 1.0f / DotProduct(tex_axis0, tex_axis0);
+	float tex_axis1_inv_square_length = 1.0f / DotProduct(tex_axis1, tex_axis1);
 
-		float surf_normal_dot_tex_normal = DotProduct(tex_normal, plane);
+	// Find the normal of the texture plane
+	vec3_t tex_normal;
+	CrossProduct(tex_axis0, tex_axis1, tex_normal);
+	VectorNormalize(tex_normal);
 
-		if (surf_normal_dot_tex_normal == 0.f)
-		{
-			// Surface is perpendicular to texture plane, which means we can't un-project
-			// texture coordinates back onto the surface. This shouldn't happen though,
-			// so it should be safe to skip such lights.
-			continue;
-		}
+	float surf_normal_dot_tex_normal = DotProduct(tex_normal, plane);
+
+	if (surf_normal_dot_tex_normal == 0.f)
+	{
+		// Surface is perpendicular to texture plane, which means we can't un-project
+		// texture coordinates back onto the surface. This shouldn't happen though,
+		// so it should be safe to skip such lights.
+		return;
+	}
 
-		// Construct the surface polygon in texture space, and find its texture extents
+	// Construct the surface polygon in texture space, and find its texture extents
 
-		poly_t tex_poly;
-		tex_poly.len = surf->numsurfedges;
+	poly_t tex_poly;
+	tex_poly.len = surf->numsurfedges;
 
-		point2_t tex_min = { FLT_MAX, FLT_MAX };
-		point2_t tex_max = { -FLT_MAX, -FLT_MAX };
+	point2_t tex_min = { FLT_MAX, FLT_MAX };
+	point2_t tex_max = { -FLT_MAX, -FLT_MAX };
 
-		for (int i = 0; i < surf->numsurfedges; i++)
-		{
-			msurfedge_t *src_surfedge = surf->firstsurfedge + i;
-			medge_t     *src_edge = src_surfedge->edge;
-			mvertex_t   *src_vert = src_edge->v[src_surfedge->vert];
-			
-			point2_t t;
-			t.x = DotProduct(src_vert->point, tex_axis0) + tex_axis0[3];
-			t.y = DotProduct(src_vert->point, tex_axis1) + tex_axis1[3];
+	for (int i = 0; i < surf->numsurfedges; i++)
+	{
+		msurfedge_t *src_surfedge = surf->firstsurfedge + i;
+		medge_t     *src_edge = src_surfedge->edge;
+		mvertex_t   *src_vert = src_edge->v[src_surfedge->vert];
+		
+		point2_t t;
+		t.x = DotProduct(src_vert->point, tex_axis0) + tex_axis0[3];
+		t.y = DotProduct(src_vert->point, tex_axis1) + tex_axis1[3];
 
-			tex_poly.v[i] = t;
+		tex_poly.v[i] = t;
 
-			tex_min.x = min(tex_min.x, t.x);
-			tex_min.y = min(tex_min.y, t.y);
-			tex_max.x = max(tex_max.x, t.x);
-			tex_max.y = max(tex_max.y, t.y);
-		}
+		tex_min.x = min(tex_min.x, t.x);
+		tex_min.y = min(tex_min.y, t.y);
+		tex_max.x = max(tex_max.x, t.x);
+		tex_max.y = max(tex_max.y, t.y);
+	}
 
-		// Instantiate a square polygon for every repetition of the texture in this surface,
-		// then clip the original surface against that square polygon.
+	// Instantiate a square polygon for every repetition of the texture in this surface,
+	// then clip the original surface against that square polygon.
 
-		for (float y_tile = floorf(tex_min.y); y_tile <= ceilf(tex_max.y); y_tile++)
+	for (float y_tile = floorf(tex_min.y); y_tile <= ceilf(tex_max.y); y_tile++)
+	{
+		for (float x_tile = floorf(tex_min.x); x_tile <= ceilf(tex_max.x); x_tile++)
 		{
-			for (float x_tile = floorf(tex_min.x); x_tile <= ceilf(tex_max.x); x_tile++)
-			{
-				float x_min = x_tile + image->min_light_texcoord[0];
-				float x_max = x_tile + image->max_light_texcoord[0];
-				float y_min = y_tile + image->min_light_texcoord[1];
-				float y_max = y_tile + image->max_light_texcoord[1];
+			float x_min = x_tile + image->min_light_texcoord[0];
+			float x_max = x_tile + image->max_light_texcoord[0];
+			float y_min = y_tile + image->min_light_texcoord[1];
+			float y_max = y_tile + image->max_light_texcoord[1];
 
-				// The square polygon, for this repetition, according to the extents of emissive pixels
+			// The square polygon, for this repetition, according to the extents of emissive pixels
 
-				poly_t clipper;
-				clipper.len = 4;
-				clipper.v[0].x = x_min; clipper.v[0].y = y_min;
-				clipper.v[1].x = x_max; clipper.v[1].y = y_min;
-				clipper.v[2].x = x_max; clipper.v[2].y = y_max;
-				clipper.v[3].x = x_min; clipper.v[3].y = y_max;
+			poly_t clipper;
+			clipper.len = 4;
+			clipper.v[0].x = x_min; clipper.v[0].y = y_min;
+			clipper.v[1].x = x_max; clipper.v[1].y = y_min;
+			clipper.v[2].x = x_max; clipper.v[2].y = y_max;
+			clipper.v[3].x = x_min; clipper.v[3].y = y_max;
 
-				// Clip it
+			// Clip it
 
-				poly_t instance;
-				clip_polygon(&tex_poly, &clipper, &instance);
+			poly_t instance;
+			clip_polygon(&tex_poly, &clipper, &instance);
 
-				if (instance.len < 3)
-				{
-					// The square polygon was outside of the original surface
-					continue;
-				}
+			if (instance.len < 3)
+			{
+				// The square polygon was outside of the original surface
+				continue;
+			}
 
-				// Map the clipped polygon back onto the surface plane
+			// Map the clipped polygon back onto the surface plane
 
-				vec3_t instance_positions[MAX_POLY_VERTS];
-				for (int vert = 0; vert < instance.len; vert++)
-				{
-					// Find a world space point on the texture projection plane
+			vec3_t instance_positions[MAX_POLY_VERTS];
+			for (int vert = 0; vert < instance.len; vert++)
+			{
+				// Find a world space point on the texture projection plane
 
-					vec3_t p0, p1, point_on_texture_plane;
-					VectorScale(tex_axis0, (instance.v[vert].x - tex_axis0[3]) * tex_axis0_inv_square_length, p0);
-					VectorScale(tex_axis1, (instance.v[vert].y - tex_axis1[3]) * tex_axis1_inv_square_length, p1);
-					VectorAdd(p0, p1, point_on_texture_plane);
+				vec3_t p0, p1, point_on_texture_plane;
+				VectorScale(tex_axis0, (instance.v[vert].x - tex_axis0[3]) * tex_axis0_inv_square_length, p0);
+				VectorScale(tex_axis1, (instance.v[vert].y - tex_axis1[3]) * tex_axis1_inv_square_length, p1);
+				VectorAdd(p0, p1, point_on_texture_plane);
 
-					// Shoot a ray from that point in the texture normal direction,
-					// and intersect it with the surface plane.
+				// Shoot a ray from that point in the texture normal direction,
+				// and intersect it with the surface plane.
 
-					// plane: P.N + d = 0
-					// ray: P = At + B
-					// (At + B).N + d = 0
-					// (A.N)t + B.N + d = 0
-					// t = -(B.N + d) / (A.N)
+				// plane: P.N + d = 0
+				// ray: P = At + B
+				// (At + B).N + d = 0
+				// (A.N)t + B.N + d = 0
+				// t = -(B.N + d) / (A.N)
 
-					float bn = DotProduct(point_on_texture_plane, plane);
+				float bn = DotProduct(point_on_texture_plane, plane);
 
-					float ray_t = -(bn + plane[3]) / surf_normal_dot_tex_normal;
+				float ray_t = -(bn + plane[3]) / surf_normal_dot_tex_normal;
 
-					vec3_t p2;
-					VectorScale(tex_normal, ray_t, p2);
-					VectorAdd(p2, point_on_texture_plane, instance_positions[vert]);
-				}
+				vec3_t p2;
+				VectorScale(tex_normal, ray_t, p2);
+				VectorAdd(p2, point_on_texture_plane, instance_positions[vert]);
+			}
+
+			// Create triangles for the polygon, using a triangle fan topology
+
+			const int num_triangles = instance.len - 2;
+
+			for (int i = 0; i < num_triangles; i++)
+			{
+				const int e = instance.len;
+
+				int i1 = (i + 2) % e;
+				int i2 = (i + 1) % e;
 
-				// Create triangles for the polygon, using a triangle fan topology
+				light_poly_t* light = append_chunk_light_poly(chunk, own);
+				if (!light)
+					return;
 
-				const int num_triangles = instance.len - 2;
+				light->material = image - r_images;
+				light->style = get_surf_light_style(surf);
+				VectorCopy(instance_positions[0], light->positions + 0);
+				VectorCopy(instance_positions[i1], light->positions + 3);
+				VectorCopy(instance_positions[i2], light->positions + 6);
+				VectorCopy(image->light_color, light->color);
+				
+				get_triangle_off_center(light->positions, light->off_center, NULL);
 
-				for (int i = 0; i < num_triangles; i++)
+				if (model_idx < 0)
 				{
-					const int e = instance.len;
-
-					int i1 = (i + 2) % e;
-					int i2 = (i + 1) % e;
-
-					light_poly_t* light = append_light_poly(num_lights, allocated_lights, lights);
-					light->material = image - r_images;
-					light->style = get_surf_light_style(surf);
-					VectorCopy(instance_positions[0], light->positions + 0);
-					VectorCopy(instance_positions[i1], light->positions + 3);
-					VectorCopy(instance_positions[i2], light->positions + 6);
-					VectorCopy(image->light_color, light->color);
-					
-					get_triangle_off_center(light->positions, light->off_center, NULL);
-
-					if (model_idx < 0)
-					{
-						// Find the cluster for this triangle
-						light->cluster = BSP_PointLeaf(bsp->nodes, light->off_center)->cluster;
+					// Find the cluster for this triangle
+					light->cluster = BSP_PointLeaf(bsp->nodes, light->off_center)->cluster;
 
-						if (light->cluster < 0)
-						{
-							// Cluster not found - which happens sometimes.
-							// The lighting system can't work with lights that have no cluster, so remove the triangle.
-							(*num_lights)--;
-						}
-					}
-					else
+					if (light->cluster < 0)
 					{
-						// It's a model: cluster will be determined after model instantiation.
-						light->cluster = -1;
+						// Cluster not found - which happens sometimes.
+						// The lighting system can't work with lights that have no cluster, so remove the triangle.
+						own->num_lights--;
 					}
 				}
+				else
+				{
+					// It's a model: cluster will be determined after model instantiation.
+					light->cluster = -1;
+				}
 			}
 		}
 	}
 }
 
+static void
+collect_ligth_polys_range(void* arg, int start, int end)
+{
+	light_job_t* job = arg;
+
+	for (int c = start; c < end; c++)
+	{
+		light_chunk_t* chunk = job->chunks + c;
+		int first_face = (int64_t)job->num_faces * c / job->num_chunks;
+		int last_face = (int64_t)job->num_faces * (c + 1) / job->num_chunks;
+
+		for (int i = first_face; i < last_face && !chunk->failed; i++)
+		{
+			mface_t *surf = job->surfaces + i;
+
+			if (job->model_idx < 0 && belongs_to_model(job->bsp, surf))
+				continue;
+
+			collect_face_ligth_polys(chunk, job->bsp, surf, job->model_idx);
+		}
+	}
+}
+
+/*
+  Faces are split into a fixed number of chunks that collect lights in parallel
+  into their own lists. Concatenating the chunks in order gives the same list
+  as a serial walk over the faces.
+*/
+static void
+collect_ligth_polys(bsp_mesh_t *wm, bsp_t *bsp, int model_idx, int* num_lights, int* allocated_lights, light_poly_t** lights)
+{
+#define MAX_LIGHT_CHUNKS 64
+	light_job_t job;
+	job.bsp = bsp;
+	job.model_idx = model_idx;
+	job.surfaces = model_idx < 0 ? bsp->faces : bsp->models[model_idx].firstface;
+	job.num_faces = model_idx < 0 ? bsp->numfaces : bsp->models[model_idx].numfaces;
+	job.num_chunks = max(min(job.num_faces / 16, MAX_LIGHT_CHUNKS), 1);
+	job.chunks = Z_Mallocz(job.num_chunks * sizeof(light_chunk_t));
+
+	*allocated_lights = 0;
+	*num_lights = 0;
+	*lights = NULL;
+
+	Com_ParallelFor(job.num_chunks, 1, collect_ligth_polys_range, &job);
+
+	qboolean failed = qfalse;
+	for (int c = 0; c < job.num_chunks; c++)
+	{
+		light_chunk_t* chunk = job.chunks + c;
+
+		append_light_polys(num_lights, allocated_lights, lights, &chunk->lights);
+		append_light_polys(&wm->num_light_polys, &wm->allocated_light_polys, &wm->light_polys, &chunk->world_lights);
+
+		failed |= chunk->failed;
+		free(chunk->lights.lights);
+		free(chunk->world_lights.lights);
+	}
+
+	Z_Free(job.chunks);
+
+	if (failed)
+		Com_Error(ERR_FATAL, "%s: out of memory", __func__);
+#undef MAX_LIGHT_CHUNKS
+}
+
 static void
 collect_sky_and_lava_ligth_polys(bsp_mesh_t *wm, bsp_t* bsp)
 {
@@ -1090,18 +1277,12 @@ compute_aabb(const float* positions, int numvert, float* aabb_min, float* aabb_m
 	}
 }
 
-void
-compute_world_tangents(bsp_mesh_t* wm)
+static void
+compute_tangents_range(void* arg, int start, int end)
 {
-	// compute tangent space
-	uint32_t ntriangles = wm->num_indices / 3;
-
-	// tangent space is co-planar to triangle : only need to compute
-	// 1 vertex because all 3 verts share the same tangent space
-	wm->tangents = Z_Malloc(MAX_VERT_BSP * sizeof(*wm->tangents));
-	wm->texel_density = Z_Malloc(MAX_VERT_BSP * sizeof(float) / 3);
+	bsp_mesh_t* wm = arg;
 
-	for (int idx_tri = 0; idx_tri < ntriangles; ++idx_tri)
+	for (int idx_tri = start; idx_tri < end; ++idx_tri)
 	{
 		uint32_t iA = wm->indices[idx_tri * 3 + 0]; // no vertex indexing
 		uint32_t iB = wm->indices[idx_tri * 3 + 1];
@@ -1181,6 +1362,20 @@ compute_world_tangents(bsp_mesh_t* wm)
 	}
 }
 
+void
+compute_world_tangents(bsp_mesh_t* wm)
+{
+	// compute tangent space
+	uint32_t ntriangles = wm->num_indices / 3;
+
+	// tangent space is co-planar to triangle : only need to compute
+	// 1 vertex because all 3 verts share the same tangent space
+	wm->tangents = Z_Malloc(MAX_VERT_BSP * sizeof(*wm->tangents));
+	wm->texel_density = Z_Malloc(MAX_VERT_BSP * sizeof(float) / 3);
+
+	Com_ParallelFor(ntriangles, 1024, compute_tangents_range, wm);
+}
+
 static void
 load_sky_and_lava_clusters(bsp_mesh_t* wm, const char* map_name)
 {
@@ -1314,8 +1509,6 @@ get_aabb_corner(aabb_t* aabb, int corner_idx, vec3_t corner)
 	corner[2] = (corner_idx & 4) ? aabb->maxs[2] : aabb->mins[2];
 }
 
-static int lights_culled_bbox = 0;
-static int lights_culled_proj = 0;
 static const vec3_t luminance_coefficients = { 0.299f, 0.587f, 0.114f };
 static const float irradiance_threshold = 5e-5;
 
@@ -1353,10 +1546,7 @@ light_affects_cluster(light_poly_t* light, aabb_t* aabb)
 	}
 
 	if (all_culled)
-	{
-		lights_culled_bbox++;
 		return qfalse;
-	}
 
 	// Construct a bounding sphere for the cluster
 	vec3_t cluster_center;
@@ -1403,87 +1593,229 @@ light_affects_cluster(light_poly_t* light, aabb_t* aabb)
 			all_culled = qfalse;
 	}
 
-	if (all_culled)
-	{
-		lights_culled_proj++;
-		return qfalse;
-	}
-	else
-		return qtrue;
+	return !all_culled;
 }
 
+typedef struct {
+	int num_lights;
+	int allocated_lights;
+	int* lights;
+	qboolean failed;
+} cluster_light_chunk_t;
+
+typedef struct {
+	bsp_mesh_t* wm;
+	const char** light_pvs;
+	int* cluster_light_counts;
+	int num_chunks;
+	cluster_light_chunk_t* chunks;
+} cluster_lights_job_t;
+
 static void
-collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp)
+collect_lights_for_cluster(cluster_lights_job_t* job, cluster_light_chunk_t* chunk, int cluster)
 {
-#define MAX_LIGHTS_PER_CLUSTER 1024
-	int* cluster_lights = Z_Malloc(MAX_LIGHTS_PER_CLUSTER * wm->num_clusters * sizeof(int));
-	int* cluster_light_counts = Z_Mallocz(wm->num_clusters * sizeof(int));
+	bsp_mesh_t* wm = job->wm;
+	aabb_t* cluster_aabb = wm->cluster_aabbs + cluster;
+	int count = 0;
 
-	lights_culled_bbox = 0;
-	lights_culled_proj = 0;
-
-	// Construct an array of visible lights for each cluster.
-	// The array is in `cluster_lights`, with MAX_LIGHTS_PER_CLUSTER stride.
+	// Empty cluster, nothing is visible
+	if (cluster_aabb->mins[0] > cluster_aabb->maxs[0])
+		return;
 
 	for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
 	{
-		light_poly_t* light = wm->light_polys + nlight;
+		const char* pvs = job->light_pvs[nlight];
 
-		if(light->cluster < 0)
+		if (!pvs || !Q_IsBitSet(pvs, cluster))
 			continue;
 
-		const byte* pvs = BSP_GetPvs(bsp, light->cluster);
+		if (!light_affects_cluster(wm->light_polys + nlight, cluster_aabb))
+			continue;
 
-		FOREACH_BIT_BEGIN(pvs, bsp->visrowsize, other_cluster)
-			aabb_t* cluster_aabb = wm->cluster_aabbs + other_cluster;
-			if (light_affects_cluster(light, cluster_aabb))
+		if (chunk->num_lights == chunk->allocated_lights)
+		{
+			int allocated = max(chunk->allocated_lights * 2, 256);
+			int* lights = realloc(chunk->lights, allocated * sizeof(int));
+			if (!lights)
 			{
-				int* num_cluster_lights = cluster_light_counts + other_cluster;
-				if (*num_cluster_lights < MAX_LIGHTS_PER_CLUSTER)
-				{
-					cluster_lights[other_cluster * MAX_LIGHTS_PER_CLUSTER + *num_cluster_lights] = nlight;
-					(*num_cluster_lights)++;
-				}
+				chunk->failed = qtrue;
+				break;
 			}
-		FOREACH_BIT_END
+			chunk->lights = lights;
+			chunk->allocated_lights = allocated;
+		}
+
+		chunk->lights[chunk->num_lights++] = nlight;
+		count++;
 	}
 
-	// Count the total number of cluster <-> light relations to allocate memory
+	job->cluster_light_counts[cluster] = count;
+}
+
+// Each chunk owns a contiguous range of clusters and tests every light that
+// sees them, in light order, so the lists come out the same as from a walk
+// over lights.
+static void
+collect_cluster_lights_range(void* arg, int start, int end)
+{
+	cluster_lights_job_t* job = arg;
+	int num_clusters = job->wm->num_clusters;
 
+	for (int c = start; c < end; c++)
+	{
+		cluster_light_chunk_t* chunk = job->chunks + c;
+		int first_cluster = (int64_t)num_clusters * c / job->num_chunks;
+		int last_cluster = (int64_t)num_clusters * (c + 1) / job->num_chunks;
+
+		for (int cluster = first_cluster; cluster < last_cluster && !chunk->failed; cluster++)
+			collect_lights_for_cluster(job, chunk, cluster);
+	}
+}
+
+/*
+  Constructs the list of lights that can affect each cluster. The lists are
+  built in parallel into per-chunk buffers that only grow as far as needed,
+  and then concatenated into wm->cluster_lights, which is allocated to the
+  exact size. There is no limit on the number of lights per cluster.
+*/
+static void
+collect_cluster_lights(bsp_mesh_t *wm, bsp_t *bsp)
+{
+#define MAX_CLUSTER_CHUNKS 256
+	cluster_lights_job_t job;
+	job.wm = wm;
+	job.num_chunks = max(min(wm->num_clusters / 8, MAX_CLUSTER_CHUNKS), 1);
+	job.chunks = Z_Mallocz(job.num_chunks * sizeof(cluster_light_chunk_t));
+	job.cluster_light_counts = Z_Mallocz((wm->num_clusters + 1) * sizeof(int));
+	job.light_pvs = Z_Malloc(max(wm->num_light_polys, 1) * sizeof(char*));
+
+	for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
+	{
+		light_poly_t* light = wm->light_polys + nlight;
+		job.light_pvs[nlight] = light->cluster < 0 ? NULL : BSP_GetPvs(bsp, light->cluster);
+	}
+
+	Com_ParallelFor(job.num_chunks, 1, collect_cluster_lights_range, &job);
+
+	Z_Free(job.light_pvs);
+
+	qboolean failed = qfalse;
 	wm->num_cluster_lights = 0;
-	for (int cluster = 0; cluster < wm->num_clusters; cluster++)
+	for (int c = 0; c < job.num_chunks; c++)
 	{
-		wm->num_cluster_lights += cluster_light_counts[cluster];
+		failed |= job.chunks[c].failed;
+		wm->num_cluster_lights += job.chunks[c].num_lights;
 	}
 
-	wm->cluster_lights = Z_Mallocz(wm->num_cluster_lights * sizeof(int));
-	wm->cluster_light_offsets = Z_Mallocz((wm->num_clusters + 1) * sizeof(int));
+	if (failed)
+	{
+		for (int c = 0; c < job.num_chunks; c++)
+			free(job.chunks[c].lights);
+		Com_Error(ERR_FATAL, "%s: out of memory", __func__);
+	}
 
-	// Com_Printf("Total interactions: %d, culled bbox: %d, culled proj: %d\n", wm->num_cluster_lights, lights_culled_bbox, lights_culled_proj);
+	// Turn the counts into offsets, the chunks are already in cluster order
 
-	// Compact the previously constructed array into wm->cluster_lights
+	wm->cluster_light_offsets = job.cluster_light_counts;
+	wm->cluster_lights = Z_Malloc(max(wm->num_cluster_lights, 1) * sizeof(int));
 
 	int list_offset = 0;
 	for (int cluster = 0; cluster < wm->num_clusters; cluster++)
 	{
-		assert(list_offset >= 0);
+		int count = wm->cluster_light_offsets[cluster];
 		wm->cluster_light_offsets[cluster] = list_offset;
-		int count = cluster_light_counts[cluster];
-		memcpy(
-			wm->cluster_lights + list_offset, 
-			cluster_lights + MAX_LIGHTS_PER_CLUSTER * cluster, 
-			count * sizeof(int));
 		list_offset += count;
 	}
 	wm->cluster_light_offsets[wm->num_clusters] = list_offset;
 
-	Z_Free(cluster_lights);
-	Z_Free(cluster_light_counts);
-#undef MAX_LIGHTS_PER_CLUSTER
+	list_offset = 0;
+	for (int c = 0; c < job.num_chunks; c++)
+	{
+		cluster_light_chunk_t* chunk = job.chunks + c;
+		memcpy(wm->cluster_lights + list_offset, chunk->lights, chunk->num_lights * sizeof(int));
+		list_offset += chunk->num_lights;
+		free(chunk->lights);
+	}
+
+	Z_Free(job.chunks);
+#undef MAX_CLUSTER_CHUNKS
 }
 
-void
-bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
+static inline uint32_t
+hash_vertex(const uint32_t* v, int n)
+{
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < n; i++)
+		hash = (hash ^ v[i]) * 16777619u;
+	return hash ^ (hash >> 15);
+}
+
+/*
+  Collapses bit-identical vertices of the triangle soup produced by
+  collect_surfaces into compact position and texcoord arrays, and replaces
+  the identity index list with a real one. Materials, clusters, tangents
+  and texel density are stored per triangle and only get trimmed to size.
+  Everything that addresses the soup by triangle (model and cluster bounds)
+  must run before this.
+*/
+static void
+weld_vertices(bsp_mesh_t *wm)
+{
+	int num_tris = wm->num_indices / 3;
+	uint32_t mask = npot32(wm->num_indices * 2) - 1;
+	int* table = Z_Malloc((mask + 1) * sizeof(int));
+	float* positions = Z_Malloc(wm->num_indices * 3 * sizeof(float));
+	float* tex_coords = Z_Malloc(wm->num_indices * 2 * sizeof(float));
+	int num_vertices = 0;
+
+	memset(table, 0xff, (mask + 1) * sizeof(int));
+
+	for (int i = 0; i < wm->num_indices; i++)
+	{
+		uint32_t key[5];
+		memcpy(key + 0, wm->positions + i * 3, sizeof(float) * 3);
+		memcpy(key + 3, wm->tex_coords + i * 2, sizeof(float) * 2);
+
+		uint32_t h = hash_vertex(key, 5) & mask;
+		int v;
+
+		while ((v = table[h]) >= 0)
+		{
+			if (!memcmp(positions + v * 3, key + 0, sizeof(float) * 3) &&
+				!memcmp(tex_coords + v * 2, key + 3, sizeof(float) * 2))
+				break;
+
+			h = (h + 1) & mask;
+		}
+
+		if (v < 0)
+		{
+			v = num_vertices++;
+			memcpy(positions + v * 3, key + 0, sizeof(float) * 3);
+			memcpy(tex_coords + v * 2, key + 3, sizeof(float) * 2);
+			table[h] = v;
+		}
+
+		wm->indices[i] = v;
+	}
+
+	Z_Free(table);
+	Z_Free(wm->positions);
+	Z_Free(wm->tex_coords);
+
+	wm->positions = Z_Realloc(positions, max(num_vertices, 1) * 3 * sizeof(float));
+	wm->tex_coords = Z_Realloc(tex_coords, max(num_vertices, 1) * 2 * sizeof(float));
+	wm->num_vertices = num_vertices;
+
+	num_tris = max(num_tris, 1);
+	wm->materials = Z_Realloc(wm->materials, num_tris * sizeof(*wm->materials));
+	wm->clusters = Z_Realloc(wm->clusters, num_tris * sizeof(*wm->clusters));
+	wm->tangents = Z_Realloc(wm->tangents, num_tris * 3 * sizeof(*wm->tangents));
+	wm->texel_density = Z_Realloc(wm->texel_density, num_tris * sizeof(*wm->texel_density));
+}
+
+static void
+build_mesh(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 {
 	load_sky_and_lava_clusters(wm, map_name);
 
@@ -1583,9 +1915,795 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
 	compute_sky_visibility(wm, bsp);
 }
 
+/*
+  On-disk cache of the finished mesh in `maps/mesh/<name>.bin`. Apart from the
+  BSP checksum, it is keyed on a hash of everything else the mesh is built
+  from: material and image properties of every texinfo, the sky cluster list
+  and pt_enable_nodraw. Material and image indices are part of that hash, so
+  a different registration order simply rebuilds the cache. Like the patched
+  PVS file, the data is stored in native byte order.
+*/
+
+#define MESH_CACHE_IDENT    MakeRawLong('B', 'M', 'S', 'H')
+#define MESH_CACHE_VERSION  2
+
+typedef struct {
+	uint32_t ident;
+	uint32_t version;
+	uint32_t bsp_checksum;
+	uint32_t inputs_hash;
+
+	uint32_t world_idx_count;
+	uint32_t world_transparent_offset;
+	uint32_t world_transparent_count;
+	uint32_t world_sky_offset;
+	uint32_t world_sky_count;
+	aabb_t world_aabb;
+
+	int32_t num_indices;
+	int32_t num_vertices;
+	int32_t num_models;
+	int32_t num_clusters;
+	int32_t num_light_polys;
+	int32_t num_cluster_lights;
+} mesh_cache_header_t;
+
+typedef struct {
+	uint32_t idx_offset;
+	uint32_t idx_count;
+	vec3_t center;
+	vec3_t aabb_min;
+	vec3_t aabb_max;
+	int32_t num_light_polys;
+	int32_t transparent;
+} mesh_cache_model_t;
+
+typedef struct {
+	byte* data;
+	size_t size;
+	size_t pos;
+} mesh_cache_t;
+
+static uint32_t
+hash_data(uint32_t hash, const void* data, size_t size)
+{
+	const byte* p = data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ p[i]) * 16777619u;
+	return hash;
+}
+
+static uint32_t
+hash_mesh_inputs(const bsp_mesh_t* wm, const bsp_t* bsp)
+{
+	uint32_t hash = 2166136261u;
+	int nodraw = cvar_pt_enable_nodraw->integer;
+
+	hash = hash_data(hash, &nodraw, sizeof(nodraw));
+	hash = hash_data(hash, &wm->num_sky_clusters, sizeof(wm->num_sky_clusters));
+	hash = hash_data(hash, wm->sky_clusters, wm->num_sky_clusters * sizeof(wm->sky_clusters[0]));
+	hash = hash_data(hash, &wm->all_lava_emissive, sizeof(wm->all_lava_emissive));
+
+	for (int i = 0; i < bsp->numtexinfo; i++)
+	{
+		const pbr_material_t* mat = bsp->texinfo[i].material;
+		uint32_t flags = mat ? mat->flags : 0;
+
+		hash = hash_data(hash, &flags, sizeof(flags));
+		if (!mat)
+			continue;
+
+		const image_t* diffuse = mat->image_diffuse;
+		if (diffuse)
+		{
+			hash = hash_data(hash, &diffuse->width, sizeof(diffuse->width));
+			hash = hash_data(hash, &diffuse->height, sizeof(diffuse->height));
+		}
+
+		const image_t* emissive = mat->image_emissive;
+		if (emissive)
+		{
+			int index = emissive - r_images;
+			hash = hash_data(hash, &index, sizeof(index));
+			hash = hash_data(hash, emissive->light_color, sizeof(emissive->light_color));
+			hash = hash_data(hash, emissive->min_light_texcoord, sizeof(emissive->min_light_texcoord));
+			hash = hash_data(hash, emissive->max_light_texcoord, sizeof(emissive->max_light_texcoord));
+			hash = hash_data(hash, &emissive->entire_texture_emissive, sizeof(emissive->entire_texture_emissive));
+		}
+	}
+
+	return hash;
+}
+
+static qboolean
+get_mesh_cache_path(char* path, size_t size, const char* map_name)
+{
+	return Q_concat(path, size, "maps/mesh/", map_name, ".bin", NULL) < size;
+}
+
+// Returns a pointer to the next `size` bytes of the cache, or NULL if there
+// aren't that many left.
+static void*
+cache_data(mesh_cache_t* cache, size_t size)
+{
+	if (size > cache->size - cache->pos)
+		return NULL;
+
+	void* data = cache->data + cache->pos;
+	cache->pos += size;
+	return data;
+}
+
+static void
+cache_write(mesh_cache_t* cache, const void* data, size_t size)
+{
+	memcpy(cache_data(cache, size), data, size);
+}
+
+static qboolean
+cache_read(mesh_cache_t* cache, void* out, size_t count, size_t size)
+{
+	void* data = cache_data(cache, count * size);
+	if (!data)
+		return qfalse;
+
+	void** array = out;
+	*array = Z_Malloc(max(count * size, 1));
+	memcpy(*array, data, count * size);
+	return qtrue;
+}
+
+static size_t
+mesh_cache_size(const bsp_mesh_t* wm)
+{
+	int num_tris = wm->num_indices / 3;
+	size_t size = sizeof(mesh_cache_header_t);
+
+	size += wm->num_vertices * 5 * sizeof(float);
+	size += wm->num_indices * sizeof(int);
+	size += num_tris * (3 * sizeof(float) + sizeof(uint32_t) + sizeof(int) + sizeof(float));
+	size += wm->num_clusters * sizeof(aabb_t);
+	size += wm->num_light_polys * sizeof(light_poly_t);
+	size += (wm->num_clusters + 1) * sizeof(int);
+	size += wm->num_cluster_lights * sizeof(int);
+	size += wm->num_models * sizeof(mesh_cache_model_t);
+
+	for (int i = 0; i < wm->num_models; i++)
+		size += wm->models[i].num_light_polys * sizeof(light_poly_t);
+
+	return size;
+}
+
+static void
+save_mesh_cache(const bsp_mesh_t* wm, const bsp_t* bsp, const char* map_name, uint32_t inputs_hash)
+{
+	char path[MAX_QPATH];
+	if (!get_mesh_cache_path(path, sizeof(path), map_name))
+		return;
+
+	int num_tris = wm->num_indices / 3;
+	mesh_cache_t cache = { 0 };
+	cache.size = mesh_cache_size(wm);
+	cache.data = Z_Malloc(cache.size);
+
+	mesh_cache_header_t header = {
+		.ident = MESH_CACHE_IDENT,
+		.version = MESH_CACHE_VERSION,
+		.bsp_checksum = bsp->checksum,
+		.inputs_hash = inputs_hash,
+		.world_idx_count = wm->world_idx_count,
+		.world_transparent_offset = wm->world_transparent_offset,
+		.world_transparent_count = wm->world_transparent_count,
+		.world_sky_offset = wm->world_sky_offset,
+		.world_sky_count = wm->world_sky_count,
+		.world_aabb = wm->world_aabb,
+		.num_indices = wm->num_indices,
+		.num_vertices = wm->num_vertices,
+		.num_models = wm->num_models,
+		.num_clusters = wm->num_clusters,
+		.num_light_polys = wm->num_light_polys,
+		.num_cluster_lights = wm->num_cluster_lights
+	};
+	cache_write(&cache, &header, sizeof(header));
+
+	cache_write(&cache, wm->positions, wm->num_vertices * 3 * sizeof(float));
+	cache_write(&cache, wm->tex_coords, wm->num_vertices * 2 * sizeof(float));
+	cache_write(&cache, wm->indices, wm->num_indices * sizeof(int));
+	cache_write(&cache, wm->tangents, num_tris * 3 * sizeof(float));
+	cache_write(&cache, wm->materials, num_tris * sizeof(uint32_t));
+	cache_write(&cache, wm->clusters, num_tris * sizeof(int));
+	cache_write(&cache, wm->texel_density, num_tris * sizeof(float));
+	cache_write(&cache, wm->cluster_aabbs, wm->num_clusters * sizeof(aabb_t));
+	cache_write(&cache, wm->light_polys, wm->num_light_polys * sizeof(light_poly_t));
+	cache_write(&cache, wm->cluster_light_offsets, (wm->num_clusters + 1) * sizeof(int));
+	cache_write(&cache, wm->cluster_lights, wm->num_cluster_lights * sizeof(int));
+
+	for (int i = 0; i < wm->num_models; i++)
+	{
+		const bsp_model_t* model = wm->models + i;
+		mesh_cache_model_t m = {
+			.idx_offset = model->idx_offset,
+			.idx_count = model->idx_count,
+			.num_light_polys = model->num_light_polys,
+			.transparent = model->transparent
+		};
+		VectorCopy(model->center, m.center);
+		VectorCopy(model->aabb_min, m.aabb_min);
+		VectorCopy(model->aabb_max, m.aabb_max);
+		cache_write(&cache, &m, sizeof(m));
+	}
+
+	for (int i = 0; i < wm->num_models; i++)
+	{
+		const bsp_model_t* model = wm->models + i;
+		cache_write(&cache, model->light_polys, model->num_light_polys * sizeof(light_poly_t));
+	}
+
+	assert(cache.pos == cache.size);
+
+	if (FS_WriteFile(path, cache.data, cache.size) < 0)
+		Com_EPrintf("Couldn't save mesh cache for %s.\n", map_name);
+
+	Z_Free(cache.data);
+}
+
+static qboolean
+read_mesh_cache(bsp_mesh_t* wm, mesh_cache_t* cache, const bsp_t* bsp, uint32_t inputs_hash)
+{
+	const mesh_cache_header_t* header = cache_data(cache, sizeof(*header));
+	if (!header)
+		return qfalse;
+
+	if (header->ident != MESH_CACHE_IDENT ||
+		header->version != MESH_CACHE_VERSION ||
+		header->bsp_checksum != bsp->checksum ||
+		header->inputs_hash != inputs_hash)
+		return qfalse;
+
+	if (header->num_indices < 0 || header->num_indices >= MAX_VERT_BSP || header->num_indices % 3 ||
+		header->num_vertices < 0 || header->num_vertices > header->num_indices ||
+		header->num_models != bsp->nummodels ||
+		header->num_clusters != bsp->vis->numclusters ||
+		header->num_light_polys < 0 || header->num_cluster_lights < 0)
+		return qfalse;
+
+	if (header->world_idx_count > header->num_indices ||
+		(uint64_t)header->world_transparent_offset + header->world_transparent_count > header->num_indices ||
+		(uint64_t)header->world_sky_offset + header->world_sky_count > header->num_indices)
+		return qfalse;
+
+	int num_tris = header->num_indices / 3;
+
+	wm->world_idx_count = header->world_idx_count;
+	wm->world_transparent_offset = header->world_transparent_offset;
+	wm->world_transparent_count = header->world_transparent_count;
+	wm->world_sky_offset = header->world_sky_offset;
+	wm->world_sky_count = header->world_sky_count;
+	wm->world_aabb = header->world_aabb;
+	wm->num_indices = header->num_indices;
+	wm->num_vertices = header->num_vertices;
+	wm->num_clusters = header->num_clusters;
+	wm->num_light_polys = wm->allocated_light_polys = header->num_light_polys;
+	wm->num_cluster_lights = header->num_cluster_lights;
+
+	if (!cache_read(cache, &wm->positions, wm->num_vertices, 3 * sizeof(float)) ||
+		!cache_read(cache, &wm->tex_coords, wm->num_vertices, 2 * sizeof(float)) ||
+		!cache_read(cache, &wm->indices, wm->num_indices, sizeof(int)) ||
+		!cache_read(cache, &wm->tangents, num_tris, 3 * sizeof(float)) ||
+		!cache_read(cache, &wm->materials, num_tris, sizeof(uint32_t)) ||
+		!cache_read(cache, &wm->clusters, num_tris, sizeof(int)) ||
+		!cache_read(cache, &wm->texel_density, num_tris, sizeof(float)) ||
+		!cache_read(cache, &wm->cluster_aabbs, wm->num_clusters, sizeof(aabb_t)) ||
+		!cache_read(cache, &wm->light_polys, wm->num_light_polys, sizeof(light_poly_t)) ||
+		!cache_read(cache, &wm->cluster_light_offsets, wm->num_clusters + 1, sizeof(int)) ||
+		!cache_read(cache, &wm->cluster_lights, wm->num_cluster_lights, sizeof(int)))
+		return qfalse;
+
+	for (int i = 0; i < num_tris * 3; i++)
+	{
+		if (wm->indices[i] < 0 || wm->indices[i] >= wm->num_vertices)
+			return qfalse;
+	}
+
+	for (int i = 0; i <= wm->num_clusters; i++)
+	{
+		if (wm->cluster_light_offsets[i] < 0 || wm->cluster_light_offsets[i] > wm->num_cluster_lights)
+			return qfalse;
+	}
+
+	wm->num_models = header->num_models;
+	wm->models = Z_Mallocz(wm->num_models * sizeof(bsp_model_t));
+
+	const mesh_cache_model_t* models = cache_data(cache, wm->num_models * sizeof(mesh_cache_model_t));
+	if (!models)
+		return qfalse;
+
+	for (int i = 0; i < wm->num_models; i++)
+	{
+		bsp_model_t* model = wm->models + i;
+		const mesh_cache_model_t* m = models + i;
+
+		if (m->idx_count > wm->num_indices || m->idx_offset > wm->num_indices - m->idx_count)
+			return qfalse;
+
+		model->idx_offset = m->idx_offset;
+		model->idx_count = m->idx_count;
+		VectorCopy(m->center, model->center);
+		VectorCopy(m->aabb_min, model->aabb_min);
+		VectorCopy(m->aabb_max, model->aabb_max);
+		model->transparent = m->transparent;
+
+		if (m->num_light_polys < 0 || !cache_read(cache, &model->light_polys, m->num_light_polys, sizeof(light_poly_t)))
+			return qfalse;
+
+		model->num_light_polys = model->allocated_light_polys = m->num_light_polys;
+	}
+
+	return cache->pos == cache->size;
+}
+
+static qboolean
+load_mesh_cache(bsp_mesh_t* wm, const bsp_t* bsp, const char* map_name, uint32_t inputs_hash)
+{
+	char path[MAX_QPATH];
+	if (!get_mesh_cache_path(path, sizeof(path), map_name))
+		return qfalse;
+
+	mesh_cache_t cache = { 0 };
+	ssize_t len = FS_LoadFile(path, (void**)&cache.data);
+	if (!cache.data)
+		return qfalse;
+
+	cache.size = len;
+	qboolean ret = read_mesh_cache(wm, &cache, bsp, inputs_hash);
+
+	FS_FreeFile(cache.data);
+	return ret;
+}
+
+void
+bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp, const char* map_name)
+{
+	// without a patched PVS file, the mesh build has to patch the PVS again
+	if (cvar_pt_mesh_cache->integer && bsp->pvs_patched)
+	{
+		load_sky_and_lava_clusters(wm, map_name);
+
+		if (load_mesh_cache(wm, bsp, map_name, hash_mesh_inputs(wm, bsp)))
+		{
+			compute_sky_visibility(wm, bsp);
+			return;
+		}
+
+		bsp_mesh_destroy(wm);
+	}
+
+	build_mesh(wm, bsp, map_name);
+	weld_vertices(wm);
+
+	if (cvar_pt_mesh_cache->integer)
+		save_mesh_cache(wm, bsp, map_name, hash_mesh_inputs(wm, bsp));
+}
+
+#if USE_TESTS
+static size_t
+mesh_upload_size(int num_vertices, int num_indices, qboolean indexed)
+{
+	size_t size = num_vertices * (3 + 2) * sizeof(float);
+	size += num_indices / 3 * (3 * sizeof(float) + 2 * sizeof(uint32_t) + sizeof(float));
+	if (indexed)
+		size += num_indices * sizeof(uint32_t);
+	return size;
+}
+
+// the tests may run without the renderer being initialized
+static void
+get_test_cvars(void)
+{
+	cvar_pt_enable_nodraw = Cvar_Get("pt_enable_nodraw", "0", 0);
+	cvar_pt_mesh_cache = Cvar_Get("pt_mesh_cache", "1", 0);
+}
+
+/*
+  CPU-only check of vertex welding: builds the mesh for each map given,
+  keeps a copy of the triangle soup, welds it and verifies that every
+  indexed triangle is bit-identical to the original.
+*/
+void
+bsp_mesh_weld_test_f(void)
+{
+	if (Cmd_Argc() < 2)
+	{
+		Com_Printf("Usage: %s <map> [...]\n", Cmd_Argv(0));
+		return;
+	}
+
+	get_test_cvars();
+
+	for (int arg = 1; arg < Cmd_Argc(); arg++)
+	{
+		char *name = Cmd_Argv(arg);
+		char path[MAX_QPATH];
+		bsp_t *bsp;
+		bsp_mesh_t wm = { 0 };
+
+		Q_concat(path, sizeof(path), "maps/", name, ".bsp", NULL);
+		qerror_t ret = BSP_Load(path, &bsp);
+		if (!bsp)
+		{
+			Com_EPrintf("Couldn't load %s: %s\n", path, Q_ErrorString(ret));
+			continue;
+		}
+
+		uint64_t start = Sys_Microseconds();
+		build_mesh(&wm, bsp, name);
+		uint64_t built = Sys_Microseconds();
+
+		int soup_vertices = wm.num_indices;
+		float* soup_positions = Z_Malloc(soup_vertices * 3 * sizeof(float));
+		float* soup_tex_coords = Z_Malloc(soup_vertices * 2 * sizeof(float));
+		memcpy(soup_positions, wm.positions, soup_vertices * 3 * sizeof(float));
+		memcpy(soup_tex_coords, wm.tex_coords, soup_vertices * 2 * sizeof(float));
+
+		weld_vertices(&wm);
+		uint64_t welded = Sys_Microseconds();
+
+		int errors = 0;
+		for (int i = 0; i < wm.num_indices; i++)
+		{
+			int v = wm.indices[i];
+			if (v < 0 || v >= wm.num_vertices ||
+				memcmp(wm.positions + v * 3, soup_positions + i * 3, sizeof(float) * 3) ||
+				memcmp(wm.tex_coords + v * 2, soup_tex_coords + i * 2, sizeof(float) * 2))
+				errors++;
+		}
+
+		size_t before = mesh_upload_size(soup_vertices, soup_vertices, qfalse);
+		size_t after = mesh_upload_size(wm.num_vertices, wm.num_indices, qtrue);
+
+		Com_Printf("%s: %d triangles, %d -> %d vertices, %"PRIz" -> %"PRIz" KB upload (%.0f%%), "
+			"%d mismatches, build %.1f ms, weld %.1f ms\n",
+			name, wm.num_indices / 3, soup_vertices, wm.num_vertices,
+			before / 1024, after / 1024, before ? 100.0 * after / before : 0.0,
+			errors, (built - start) * 1e-3, (welded - built) * 1e-3);
+
+		Z_Free(soup_positions);
+		Z_Free(soup_tex_coords);
+		bsp_mesh_destroy(&wm);
+		BSP_Free(bsp);
+	}
+}
+
+static int
+compare_light_polys(const light_poly_t* a, const light_poly_t* b, int count)
+{
+	return memcmp(a, b, count * sizeof(light_poly_t)) != 0;
+}
+
+// returns the number of arrays that differ
+static int
+compare_meshes(const bsp_mesh_t* a, const bsp_mesh_t* b)
+{
+	int errors = 0;
+
+#define COMPARE(field, count) \
+	errors += memcmp(a->field, b->field, (count) * sizeof(*a->field)) != 0
+
+	if (a->num_vertices != b->num_vertices || a->num_indices != b->num_indices ||
+		a->num_clusters != b->num_clusters || a->num_light_polys != b->num_light_polys ||
+		a->num_cluster_lights != b->num_cluster_lights || a->num_models != b->num_models ||
+		a->world_idx_count != b->world_idx_count ||
+		a->world_transparent_offset != b->world_transparent_offset ||
+		a->world_transparent_count != b->world_transparent_count ||
+		a->world_sky_offset != b->world_sky_offset ||
+		a->world_sky_count != b->world_sky_count)
+		return 1;
+
+	int num_triangles = a->num_indices / 3;
+
+	COMPARE(positions, a->num_vertices * 3);
+	COMPARE(tex_coords, a->num_vertices * 2);
+	COMPARE(indices, a->num_indices);
+	COMPARE(tangents, num_triangles * 3);
+	COMPARE(materials, num_triangles);
+	COMPARE(clusters, num_triangles);
+	COMPARE(texel_density, num_triangles);
+	COMPARE(cluster_aabbs, a->num_clusters);
+	COMPARE(cluster_light_offsets, a->num_clusters + 1);
+	COMPARE(cluster_lights, a->num_cluster_lights);
+	errors += compare_light_polys(a->light_polys, b->light_polys, a->num_light_polys);
+	errors += memcmp(&a->world_aabb, &b->world_aabb, sizeof(a->world_aabb)) != 0;
+	errors += memcmp(a->sky_visibility, b->sky_visibility, sizeof(a->sky_visibility)) != 0;
+
+#undef COMPARE
+
+	for (int i = 0; i < a->num_models; i++)
+	{
+		const bsp_model_t* ma = a->models + i;
+		const bsp_model_t* mb = b->models + i;
+
+		if (ma->idx_offset != mb->idx_offset || ma->idx_count != mb->idx_count ||
+			ma->transparent != mb->transparent || ma->num_light_polys != mb->num_light_polys ||
+			!VectorCompare(ma->center, mb->center) ||
+			!VectorCompare(ma->aabb_min, mb->aabb_min) ||
+			!VectorCompare(ma->aabb_max, mb->aabb_max))
+			errors++;
+		else
+			errors += compare_light_polys(ma->light_polys, mb->light_polys, ma->num_light_polys);
+	}
+
+	return errors;
+}
+
+// Materials are only registered for the map loaded by the renderer. Any
+// other map would be built without lights and compare equal trivially.
+static bsp_t *
+load_test_map(const char *name)
+{
+	char path[MAX_QPATH];
+	bsp_t *bsp;
+
+	Q_concat(path, sizeof(path), "maps/", name, ".bsp", NULL);
+	qerror_t ret = BSP_Load(path, &bsp);
+	if (!bsp)
+	{
+		Com_EPrintf("Couldn't load %s: %s\n", path, Q_ErrorString(ret));
+		return NULL;
+	}
+
+	for (int i = 0; i < bsp->numtexinfo; i++)
+	{
+		if (bsp->texinfo[i].material)
+			return bsp;
+	}
+
+	Com_EPrintf("%s: no materials registered, only the map loaded by the renderer can be tested\n", name);
+	BSP_Free(bsp);
+	return NULL;
+}
+
+// world faces that should give light polygons, to tell maps without
+// lights from builds that lost them
+static int
+count_light_faces(bsp_t *bsp)
+{
+	int count = 0;
+
+	for (int i = 0; i < bsp->numfaces; i++)
+	{
+		const mtexinfo_t *texinfo = bsp->faces[i].texinfo;
+
+		if (belongs_to_model(bsp, bsp->faces + i))
+			continue;
+
+		if (texinfo && texinfo->material && texinfo->material->image_emissive &&
+			is_light_material(texinfo->material->flags))
+			count++;
+	}
+
+	return count;
+}
+
+/*
+  CPU-only check of the world mesh build: builds the mesh for the map loaded
+  by the renderer on the calling thread alone and on the job pool, then saves
+  it to the mesh cache and loads it back. All three meshes must be identical,
+  and must have light polygons if the map has emissive light faces. The map
+  needs a patched PVS, otherwise every build patches it again.
+*/
+void
+bsp_mesh_cache_test_f(void)
+{
+	if (Cmd_Argc() < 2)
+	{
+		Com_Printf("Usage: %s <map> [...]\n", Cmd_Argv(0));
+		return;
+	}
+
+	get_test_cvars();
+
+	char jobs[MAX_QPATH];
+	Cvar_VariableStringBuffer("com_jobs", jobs, sizeof(jobs));
+
+	for (int arg = 1; arg < Cmd_Argc(); arg++)
+	{
+		char *name = Cmd_Argv(arg);
+		bsp_mesh_t serial = { 0 }, parallel = { 0 }, cached = { 0 };
+
+		bsp_t *bsp = load_test_map(name);
+		if (!bsp)
+			continue;
+
+		if (!bsp->pvs_patched)
+		{
+			Com_Printf("%s: no patched PVS, load the map once first\n", name);
+			BSP_Free(bsp);
+			continue;
+		}
+
+		Cvar_Set("com_jobs", "0");
+		uint64_t start = Sys_Microseconds();
+		build_mesh(&serial, bsp, name);
+		weld_vertices(&serial);
+		uint64_t serial_done = Sys_Microseconds();
+
+		Cvar_Set("com_jobs", jobs);
+		build_mesh(&parallel, bsp, name);
+		weld_vertices(&parallel);
+		uint64_t parallel_done = Sys_Microseconds();
+
+		uint32_t inputs_hash = hash_mesh_inputs(&parallel, bsp);
+		save_mesh_cache(&parallel, bsp, name, inputs_hash);
+		uint64_t saved = Sys_Microseconds();
+
+		load_sky_and_lava_clusters(&cached, name);
+		qboolean loaded = load_mesh_cache(&cached, bsp, name, hash_mesh_inputs(&cached, bsp));
+		if (loaded)
+			compute_sky_visibility(&cached, bsp);
+		uint64_t load_done = Sys_Microseconds();
+
+		int parallel_errors = compare_meshes(&serial, &parallel);
+		int cache_errors = loaded ? compare_meshes(&parallel, &cached) : 1;
+		int light_faces = count_light_faces(bsp);
+
+		Com_Printf("%s: %d threads, serial %.1f ms, parallel %.1f ms, save %.1f ms, load %.1f ms, "
+			"%d light polys from %d faces, parallel %s, cache %s, lights %s\n",
+			name, Com_NumJobThreads(), (serial_done - start) * 1e-3,
+			(parallel_done - serial_done) * 1e-3, (saved - parallel_done) * 1e-3,
+			(load_done - saved) * 1e-3, serial.num_light_polys, light_faces,
+			parallel_errors ? "FAILED" : "ok",
+			!loaded ? "not loaded" : cache_errors ? "FAILED" : "ok",
+			light_faces && !serial.num_light_polys ? "FAILED" : "ok");
+
+		bsp_mesh_destroy(&serial);
+		bsp_mesh_destroy(&parallel);
+		bsp_mesh_destroy(&cached);
+		BSP_Free(bsp);
+	}
+}
+
+// Straightforward two-pass count and fill on one thread, as a reference
+static void
+reference_cluster_lights(bsp_mesh_t* wm, bsp_t* bsp, int** offsets_p, int** lights_p)
+{
+	int* offsets = Z_Mallocz((wm->num_clusters + 1) * sizeof(int));
+	int* lights = NULL;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		int total = 0;
+
+		for (int cluster = 0; cluster < wm->num_clusters; cluster++)
+		{
+			aabb_t* cluster_aabb = wm->cluster_aabbs + cluster;
+
+			offsets[cluster] = total;
+
+			if (cluster_aabb->mins[0] > cluster_aabb->maxs[0])
+				continue;
+
+			for (int nlight = 0; nlight < wm->num_light_polys; nlight++)
+			{
+				light_poly_t* light = wm->light_polys + nlight;
+
+				if (light->cluster < 0 || !Q_IsBitSet(BSP_GetPvs(bsp, light->cluster), cluster))
+					continue;
+
+				if (!light_affects_cluster(light, cluster_aabb))
+					continue;
+
+				if (lights)
+					lights[total] = nlight;
+				total++;
+			}
+		}
+
+		offsets[wm->num_clusters] = total;
+
+		if (!lights)
+			lights = Z_Malloc(max(total, 1) * sizeof(int));
+	}
+
+	*offsets_p = offsets;
+	*lights_p = lights;
+}
+
+/*
+  CPU-only check of the per-cluster light lists: builds the mesh for the map
+  loaded by the renderer, then rebuilds the light lists on one thread and on
+  the job pool and compares them against a simple reference build. A map with
+  emissive light faces must end up with non-empty lists. Also reports how
+  large the lists get, clusters with more than 1024 lights used to be
+  truncated.
+*/
+void
+bsp_mesh_cluster_lights_test_f(void)
+{
+	if (Cmd_Argc() < 2)
+	{
+		Com_Printf("Usage: %s <map> [...]\n", Cmd_Argv(0));
+		return;
+	}
+
+	get_test_cvars();
+
+	char jobs[MAX_QPATH];
+	Cvar_VariableStringBuffer("com_jobs", jobs, sizeof(jobs));
+
+	for (int arg = 1; arg < Cmd_Argc(); arg++)
+	{
+		char *name = Cmd_Argv(arg);
+		bsp_mesh_t wm = { 0 };
+
+		bsp_t *bsp = load_test_map(name);
+		if (!bsp)
+			continue;
+
+		build_mesh(&wm, bsp, name);
+
+		uint64_t start = Sys_Microseconds();
+		int *ref_offsets, *ref_lights;
+		reference_cluster_lights(&wm, bsp, &ref_offsets, &ref_lights);
+		uint64_t reference_done = Sys_Microseconds();
+
+		int errors = 0;
+		uint64_t times[2];
+		for (int pass = 0; pass < 2; pass++)
+		{
+			Cvar_Set("com_jobs", pass ? jobs : "0");
+
+			Z_Free(wm.cluster_lights);
+			Z_Free(wm.cluster_light_offsets);
+
+			uint64_t pass_start = Sys_Microseconds();
+			collect_cluster_lights(&wm, bsp);
+			times[pass] = Sys_Microseconds() - pass_start;
+
+			int total = ref_offsets[wm.num_clusters];
+			if (wm.num_cluster_lights != total ||
+				memcmp(wm.cluster_light_offsets, ref_offsets, (wm.num_clusters + 1) * sizeof(int)) ||
+				memcmp(wm.cluster_lights, ref_lights, total * sizeof(int)))
+				errors++;
+		}
+		Cvar_Set("com_jobs", jobs);
+
+		// equal empty lists would pass the comparison above
+		int light_faces = count_light_faces(bsp);
+		if (light_faces && (!wm.num_light_polys || !wm.num_cluster_lights))
+			errors++;
+
+		int longest = 0, truncated = 0;
+		for (int cluster = 0; cluster < wm.num_clusters; cluster++)
+		{
+			int count = ref_offsets[cluster + 1] - ref_offsets[cluster];
+			longest = max(longest, count);
+			if (count > 1024)
+				truncated++;
+		}
+
+		Com_Printf("%s: %d clusters, %d lights from %d faces, %d entries (%d KB, was %d KB scratch), "
+			"longest list %d, %d lists over 1024, reference %.1f ms, serial %.1f ms, "
+			"%d threads %.1f ms, %s\n",
+			name, wm.num_clusters, wm.num_light_polys, light_faces, wm.num_cluster_lights,
+			(int)(wm.num_cluster_lights * sizeof(int) / 1024),
+			(int)(wm.num_clusters * 1024 * sizeof(int) / 1024),
+			longest, truncated, (reference_done - start) * 1e-3, times[0] * 1e-3,
+			Com_NumJobThreads(), times[1] * 1e-3, errors ? "FAILED" : "ok");
+
+		Z_Free(ref_offsets);
+		Z_Free(ref_lights);
+		bsp_mesh_destroy(&wm);
+		BSP_Free(bsp);
+	}
+}
+#endif
+
 void
 bsp_mesh_destroy(bsp_mesh_t *wm)
 {
+	for (int i = 0; i < wm->num_models; i++)
+		Z_Free(wm->models[i].light_polys);
+
 	Z_Free(wm->models);
 
 	Z_Free(wm->positions);
@@ -1604,9 +2722,46 @@ bsp_mesh_destroy(bsp_mesh_t *wm)
 	memset(wm, 0, sizeof(*wm));
 }
 
+static void
+queue_texinfo_images(bsp_t *bsp, qboolean maps)
+{
+	for (int i = 0; i < bsp->numtexinfo; i++) {
+		mtexinfo_t *info = bsp->texinfo + i;
+		imageflags_t flags = (info->c.flags & SURF_WARP) ? IF_TURBULENT : IF_NONE;
+		char buffer[MAX_QPATH];
+
+		Q_concat(buffer, sizeof(buffer), "textures/", info->name, ".wal", NULL);
+		FS_NormalizePath(buffer, buffer);
+
+		if (!maps) {
+			IMG_QueueLoad(buffer, IT_WALL, flags | IF_SRGB);
+			continue;
+		}
+
+		// normal and emissive maps are only loaded along with a diffuse texture
+		if (IMG_Find(buffer, IT_WALL, flags | IF_SRGB) == R_NOTEXTURE)
+			continue;
+
+		Q_concat(buffer, sizeof(buffer), "textures/", info->name, "_n.tga", NULL);
+		FS_NormalizePath(buffer, buffer);
+		IMG_QueueLoad(buffer, IT_WALL, flags);
+
+		Q_concat(buffer, sizeof(buffer), "textures/", info->name, "_light.tga", NULL);
+		FS_NormalizePath(buffer, buffer);
+		IMG_QueueLoad(buffer, IT_WALL, flags | IF_SRGB);
+	}
+
+	IMG_FlushLoads();
+}
+
 void
 bsp_mesh_register_textures(bsp_t *bsp)
 {
+	// decode all textures on worker threads first, the loop below
+	// then finds them already loaded
+	queue_texinfo_images(bsp, qfalse);
+	queue_texinfo_images(bsp, qtrue);
+
 	for (int i = 0; i < bsp->numtexinfo; i++) {
 		mtexinfo_t *info = bsp->texinfo + i;
 		imageflags_t flags;
@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cvar.h"
 #include "common/files.h"
 #include "common/math.h"
+#include "common/tests.h"
 #include "client/video.h"
 #include "client/client.h"
 #include "refresh/refresh.h"
@@ -51,6 +52,9 @@ cvar_t *cvar_profiler = NULL;
 cvar_t *cvar_vsync = NULL;
 cvar_t *cvar_pt_caustics = NULL;
 cvar_t *cvar_pt_enable_nodraw = NULL;
+cvar_t *cvar_pt_mesh_cache = NULL;
+cvar_t *cvar_pt_texture_cache = NULL;
+cvar_t *cvar_pt_model_cache = NULL;
 cvar_t *cvar_pt_accumulation_rendering = NULL;
 cvar_t *cvar_pt_accumulation_rendering_framenum = NULL;
 cvar_t *cvar_pt_projection = NULL;
@@ -951,7 +955,7 @@ init_vulkan()
 			.samplerAnisotropy = 1,
 			.textureCompressionETC2 = 0,
 			.textureCompressionASTC_LDR = 0,
-			.textureCompressionBC = 0,
+			.textureCompressionBC = 1,
 			.occlusionQueryPrecise = 0,
 			.pipelineStatisticsQuery = 1,
 			.vertexPipelineStoresAndAtomics = 1,
@@ -1181,8 +1185,8 @@ static pbr_material_t const * get_mesh_material(const entity_t* entity, const ma
 	return mesh->materials[skinnum];
 }
 
-static inline uint32_t fill_model_instance(const entity_t* entity, const model_t* model, const maliasmesh_t* mesh,
-	const float* transform, int model_instance_index, qboolean is_viewer_weapon, qboolean is_double_sided)
+static inline uint32_t get_model_instance_material(const entity_t* entity, const model_t* model, const maliasmesh_t* mesh,
+	qboolean is_viewer_weapon, qboolean is_double_sided)
 {
 	pbr_material_t const * material = get_mesh_material(entity, mesh);
 
@@ -1219,6 +1223,12 @@ static inline uint32_t fill_model_instance(const entity_t* entity, const model_t
 			material_id |= MATERIAL_FLAG_SHELL_BLUE;
 	}
 
+	return material_id;
+}
+
+static inline void fill_model_instance(const entity_t* entity, const model_t* model, const maliasmesh_t* mesh,
+	const float* transform, int model_instance_index, uint32_t material_id)
+{
 	ModelInstance* instance = &vkpt_refdef.uniform_instance_buffer.model_instances[model_instance_index];
 
 	int frame = entity->frame;
@@ -1232,8 +1242,6 @@ static inline uint32_t fill_model_instance(const entity_t* entity, const model_t
 	instance->backlerp = entity->backlerp;
 	instance->material = material_id;
 	instance->alpha = (entity->flags & RF_TRANSLUCENT) ? entity->alpha : 1.0f;
-
-	return material_id;
 }
 
 static void
@@ -1267,14 +1275,59 @@ static inline void transform_point(const float* p, const float* matrix, float* r
 	VectorCopy(transformed, result); // vec4 -> vec3
 }
 
-static void process_bsp_entity(const entity_t* entity, int* bsp_mesh_idx, int* instance_idx, int* num_instanced_vert)
+/*
+  Entity preparation runs in two passes. The first one walks the entities in
+  draw order on the main thread, picks the meshes and materials and assigns
+  every instance, vertex and light slot. The second one fills the slots from
+  the entity alone, so it can run on the job pool and still produce the same
+  instance order as a serial walk.
+*/
+
+#define MAX_ENTITY_ITEMS (SHADER_MAX_ENTITIES + SHADER_MAX_BSP_ENTITIES)
+
+// Work list for the second pass, one item per BSP model entity or per alias
+// model entity drawn with a mesh filter
+static struct {
+	int num_items;
+	const entity_t* entity[MAX_ENTITY_ITEMS];
+	const model_t* model[MAX_ENTITY_ITEMS];       // NULL for BSP models
+	qboolean is_viewer_weapon[MAX_ENTITY_ITEMS];
+	int instance_idx[MAX_ENTITY_ITEMS];           // first slot in model_indices
+	int model_instance_idx[MAX_ENTITY_ITEMS];     // first model or BSP mesh instance
+	int num_model_instances[MAX_ENTITY_ITEMS];
+	int vertex_offset[MAX_ENTITY_ITEMS];          // first instanced vertex
+	int light_offset[MAX_ENTITY_ITEMS];           // first slot in lights, BSP models only
+
+	// one entry per model instance
+	int mesh[SHADER_MAX_ENTITIES];
+	uint32_t material[SHADER_MAX_ENTITIES];
+
+	// transformed BSP model lights, before the ones outside the world are dropped
+	int num_lights;
+	int allocated_lights;
+	light_poly_t* lights;
+} entity_batch;
+
+// entities with fewer items are prepared on the calling thread
+#define ENTITY_BATCH_GRAIN 32
+
+static int add_entity_item(const entity_t* entity, const model_t* model, qboolean is_viewer_weapon,
+	int model_instance_idx, int instance_idx, int num_instanced_vert)
 {
-	QVKInstanceBuffer_t* uniform_instance_buffer = &vkpt_refdef.uniform_instance_buffer;
-	uint32_t* ubo_bsp_cluster_id = (uint32_t*)uniform_instance_buffer->bsp_cluster_id;
-	uint32_t* ubo_bsp_prim_offset = (uint32_t*)uniform_instance_buffer->bsp_prim_offset;
-	uint32_t* ubo_instance_buf_offset = (uint32_t*)uniform_instance_buffer->bsp_instance_buf_offset;
-	uint32_t* ubo_instance_buf_size = (uint32_t*)uniform_instance_buffer->bsp_instance_buf_size;
+	int item = entity_batch.num_items++;
+	entity_batch.entity[item] = entity;
+	entity_batch.model[item] = model;
+	entity_batch.is_viewer_weapon[item] = is_viewer_weapon;
+	entity_batch.instance_idx[item] = instance_idx;
+	entity_batch.model_instance_idx[item] = model_instance_idx;
+	entity_batch.num_model_instances[item] = 0;
+	entity_batch.vertex_offset[item] = num_instanced_vert;
+	entity_batch.light_offset[item] = 0;
+	return item;
+}
 
+static void process_bsp_entity(const entity_t* entity, int* bsp_mesh_idx, int* instance_idx, int* num_instanced_vert)
+{
 	const int current_bsp_mesh_index = *bsp_mesh_idx;
 	if (current_bsp_mesh_index >= SHADER_MAX_BSP_ENTITIES)
 	{
@@ -1288,6 +1341,36 @@ static void process_bsp_entity(const entity_t* entity, int* bsp_mesh_idx, int* i
 		return;
 	}
 
+	bsp_model_t* model = vkpt_refdef.bsp_mesh_world.models + (~entity->model);
+
+	int item = add_entity_item(entity, NULL, qfalse, current_bsp_mesh_index, *instance_idx, *num_instanced_vert);
+	entity_batch.num_model_instances[item] = 1;
+	entity_batch.light_offset[item] = entity_batch.num_lights;
+
+	if (entity_batch.num_lights + model->num_light_polys > entity_batch.allocated_lights)
+	{
+		entity_batch.allocated_lights = npot32(entity_batch.num_lights + model->num_light_polys);
+		entity_batch.lights = Z_Realloc(entity_batch.lights, entity_batch.allocated_lights * sizeof(light_poly_t));
+	}
+	entity_batch.num_lights += model->num_light_polys;
+
+	*num_instanced_vert += model->idx_count;
+
+	(*bsp_mesh_idx)++;
+	(*instance_idx)++;
+}
+
+static void fill_bsp_entity(int item)
+{
+	QVKInstanceBuffer_t* uniform_instance_buffer = &vkpt_refdef.uniform_instance_buffer;
+	uint32_t* ubo_bsp_cluster_id = (uint32_t*)uniform_instance_buffer->bsp_cluster_id;
+	uint32_t* ubo_bsp_prim_offset = (uint32_t*)uniform_instance_buffer->bsp_prim_offset;
+	uint32_t* ubo_instance_buf_offset = (uint32_t*)uniform_instance_buffer->bsp_instance_buf_offset;
+	uint32_t* ubo_instance_buf_size = (uint32_t*)uniform_instance_buffer->bsp_instance_buf_size;
+
+	const entity_t* entity = entity_batch.entity[item];
+	const int current_bsp_mesh_index = entity_batch.model_instance_idx[item];
+
 	world_entity_ids[entity_frame_num][current_bsp_mesh_index] = entity->id;
 
 	float transform[16];
@@ -1305,7 +1388,7 @@ static void process_bsp_entity(const entity_t* entity, int* bsp_mesh_idx, int* i
 
 	if (cluster < 0)
 	{
-		// In some cases, a model slides into a wall, like a push button, so that its center 
+		// In some cases, a model slides into a wall, like a push button, so that its center
 		// is no longer in any BSP node. We still need to assign a cluster to the model,
 		// so try the corners of the model instead, see if any of them has a valid cluster.
 
@@ -1329,26 +1412,18 @@ static void process_bsp_entity(const entity_t* entity, int* bsp_mesh_idx, int* i
 	ubo_bsp_cluster_id[current_bsp_mesh_index] = cluster;
 
 	ubo_bsp_prim_offset[current_bsp_mesh_index] = model->idx_offset / 3;
-	
+
 	const int mesh_vertex_num = model->idx_count;
 
-	ubo_instance_buf_offset[current_bsp_mesh_index] = *num_instanced_vert / 3;
+	ubo_instance_buf_offset[current_bsp_mesh_index] = entity_batch.vertex_offset[item] / 3;
 	ubo_instance_buf_size[current_bsp_mesh_index] = mesh_vertex_num / 3;
-	
-	((int*)uniform_instance_buffer->model_indices)[*instance_idx] = ~current_bsp_mesh_index;
 
-	*num_instanced_vert += mesh_vertex_num;
+	((int*)uniform_instance_buffer->model_indices)[entity_batch.instance_idx[item]] = ~current_bsp_mesh_index;
 
 	for (int nlight = 0; nlight < model->num_light_polys; nlight++)
 	{
-		if (num_model_lights >= MAX_MODEL_LIGHTS)
-		{
-			assert(!"Model light count overflow");
-			break;
-		}
-
 		const light_poly_t* src_light = model->light_polys + nlight;
-		light_poly_t* dst_light = model_lights + num_model_lights;
+		light_poly_t* dst_light = entity_batch.lights + entity_batch.light_offset[item] + nlight;
 
 		// Transform the light's positions and center
 		transform_point(src_light->positions + 0, transform, dst_light->positions + 0);
@@ -1359,19 +1434,38 @@ static void process_bsp_entity(const entity_t* entity, int* bsp_mesh_idx, int* i
 		// Find the cluster based on the center. Maybe it's OK to use the model's cluster, need to test.
 		dst_light->cluster = BSP_PointLeaf(bsp_world_model->nodes, dst_light->off_center)->cluster;
 
+		// Copy the other light properties
+		VectorCopy(src_light->color, dst_light->color);
+		dst_light->material = src_light->material;
+	}
+}
+
+// Moves the transformed BSP model lights into model_lights, in entity order
+static void collect_bsp_entity_lights(void)
+{
+	for (int nlight = 0; nlight < entity_batch.num_lights; nlight++)
+	{
+		const light_poly_t* src_light = entity_batch.lights + nlight;
+
 		// We really need to map these lights to a cluster
-		if(dst_light->cluster < 0)
+		if (src_light->cluster < 0)
 			continue;
 
-		// Copy the other light properties
+		if (num_model_lights >= MAX_MODEL_LIGHTS)
+		{
+			assert(!"Model light count overflow");
+			break;
+		}
+
+		light_poly_t* dst_light = model_lights + num_model_lights;
+		memcpy(dst_light->positions, src_light->positions, sizeof(dst_light->positions));
+		VectorCopy(src_light->off_center, dst_light->off_center);
 		VectorCopy(src_light->color, dst_light->color);
 		dst_light->material = src_light->material;
+		dst_light->cluster = src_light->cluster;
 
 		num_model_lights++;
 	}
-
-	(*bsp_mesh_idx)++;
-	(*instance_idx)++;
 }
 
 static inline qboolean is_transparent_material(uint32_t material)
@@ -1387,28 +1481,20 @@ static inline qboolean is_transparent_material(uint32_t material)
 #define MESH_FILTER_ALL 3
 
 static void process_regular_entity(
-	const entity_t* entity, 
-	const model_t* model, 
-	qboolean is_viewer_weapon, 
-	qboolean is_double_sided, 
-	int* model_instance_idx, 
-	int* instance_idx, 
-	int* num_instanced_vert, 
-	int mesh_filter, 
+	const entity_t* entity,
+	const model_t* model,
+	qboolean is_viewer_weapon,
+	qboolean is_double_sided,
+	int* model_instance_idx,
+	int* instance_idx,
+	int* num_instanced_vert,
+	int mesh_filter,
 	qboolean* contains_transparent)
 {
-	QVKInstanceBuffer_t* uniform_instance_buffer = &vkpt_refdef.uniform_instance_buffer;
-	uint32_t* ubo_instance_buf_offset = (uint32_t*)uniform_instance_buffer->model_instance_buf_offset;
-	uint32_t* ubo_instance_buf_size = (uint32_t*)uniform_instance_buffer->model_instance_buf_size;
-	uint32_t* ubo_model_idx_offset = (uint32_t*)uniform_instance_buffer->model_idx_offset;
-	uint32_t* ubo_model_cluster_id = (uint32_t*)uniform_instance_buffer->model_cluster_id;
-
-	float transform[16];
-	create_entity_matrix(transform, (entity_t*)entity, is_viewer_weapon);
-	
 	int current_model_instance_index = *model_instance_idx;
 	int current_instance_index = *instance_idx;
 	int current_num_instanced_vert = *num_instanced_vert;
+	int item = -1;
 
 	if (contains_transparent)
 		*contains_transparent = qfalse;
@@ -1429,7 +1515,7 @@ static void process_regular_entity(
 			break;
 		}
 
-		uint32_t material_id = fill_model_instance(entity, model, mesh, transform, current_model_instance_index, is_viewer_weapon, is_double_sided);
+		uint32_t material_id = get_model_instance_material(entity, model, mesh, is_viewer_weapon, is_double_sided);
 		if (!material_id)
 			continue;
 
@@ -1447,6 +1533,52 @@ static void process_regular_entity(
 				continue;
 		}
 
+		if (item < 0)
+			item = add_entity_item(entity, model, is_viewer_weapon, current_model_instance_index, current_instance_index, current_num_instanced_vert);
+
+		entity_batch.num_model_instances[item]++;
+		entity_batch.mesh[current_model_instance_index] = i;
+		entity_batch.material[current_model_instance_index] = material_id;
+
+		current_model_instance_index++;
+		current_instance_index++;
+		current_num_instanced_vert += mesh->numtris * 3;
+	}
+
+	*model_instance_idx = current_model_instance_index;
+	*instance_idx = current_instance_index;
+	*num_instanced_vert = current_num_instanced_vert;
+}
+
+static void fill_regular_entity(int item)
+{
+	QVKInstanceBuffer_t* uniform_instance_buffer = &vkpt_refdef.uniform_instance_buffer;
+	uint32_t* ubo_instance_buf_offset = (uint32_t*)uniform_instance_buffer->model_instance_buf_offset;
+	uint32_t* ubo_instance_buf_size = (uint32_t*)uniform_instance_buffer->model_instance_buf_size;
+	uint32_t* ubo_model_idx_offset = (uint32_t*)uniform_instance_buffer->model_idx_offset;
+	uint32_t* ubo_model_cluster_id = (uint32_t*)uniform_instance_buffer->model_cluster_id;
+
+	const entity_t* entity = entity_batch.entity[item];
+	const model_t* model = entity_batch.model[item];
+
+	float transform[16];
+	create_entity_matrix(transform, (entity_t*)entity, entity_batch.is_viewer_weapon[item]);
+
+	uint32_t cluster_id = ~0u;
+	if(bsp_world_model)
+		cluster_id = BSP_PointLeaf(bsp_world_model->nodes, ((entity_t*)entity)->origin)->cluster;
+
+	int current_model_instance_index = entity_batch.model_instance_idx[item];
+	int current_instance_index = entity_batch.instance_idx[item];
+	int current_num_instanced_vert = entity_batch.vertex_offset[item];
+
+	for (int n = 0; n < entity_batch.num_model_instances[item]; n++)
+	{
+		int i = entity_batch.mesh[current_model_instance_index];
+		const maliasmesh_t* mesh = model->meshes + i;
+
+		fill_model_instance(entity, model, mesh, transform, current_model_instance_index, entity_batch.material[current_model_instance_index]);
+
 		entity_hash_t hash;
 		hash.entity = entity->id;
 		hash.model = entity->model;
@@ -1454,9 +1586,6 @@ static void process_regular_entity(
 
 		model_entity_ids[entity_frame_num][current_model_instance_index] = *(uint32_t*)&hash;
 
-		uint32_t cluster_id = ~0u;
-		if(bsp_world_model) 
-			cluster_id = BSP_PointLeaf(bsp_world_model->nodes, ((entity_t*)entity)->origin)->cluster;
 		ubo_model_cluster_id[current_model_instance_index] = cluster_id;
 
 		ubo_model_idx_offset[current_model_instance_index] = mesh->idx_offset;
@@ -1470,10 +1599,57 @@ static void process_regular_entity(
 		current_instance_index++;
 		current_num_instanced_vert += mesh->numtris * 3;
 	}
+}
 
-	*model_instance_idx = current_model_instance_index;
-	*instance_idx = current_instance_index;
-	*num_instanced_vert = current_num_instanced_vert;
+static void fill_entities_range(void* arg, int start, int end)
+{
+	for (int item = start; item < end; item++)
+	{
+		if (entity_batch.model[item])
+			fill_regular_entity(item);
+		else
+			fill_bsp_entity(item);
+	}
+}
+
+#define ENTITY_ID_HASH_SIZE 1024 // must be power of two
+
+/*
+  Links instances to the instances of the previous frame with the same ID,
+  in both directions. When IDs repeat, the last match wins, same as a check
+  of every pair in order would give.
+*/
+static void match_entity_ids(const int* ids, int count, const int* prev_ids, int prev_count,
+	qboolean skip_world_entity, uint32_t* current_to_prev, uint32_t* prev_to_current)
+{
+	static int hash_head[ENTITY_ID_HASH_SIZE];
+	static int hash_next[MAX_ENTITIES];
+
+	memset(hash_head, -1, sizeof(hash_head));
+
+	// chains go in increasing index order
+	for (int j = prev_count - 1; j >= 0; j--)
+	{
+		unsigned hash = (uint32_t)prev_ids[j] * 2654435761u >> 22;
+		hash_next[j] = hash_head[hash];
+		hash_head[hash] = j;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		if (skip_world_entity && ((entity_hash_t*)&ids[i])->entity == 0)
+			continue;
+
+		unsigned hash = (uint32_t)ids[i] * 2654435761u >> 22;
+		for (int j = hash_head[hash]; j >= 0; j = hash_next[j])
+		{
+			if (prev_ids[j] == ids[i])
+			{
+				current_to_prev[i] = j;
+				prev_to_current[j] = i;
+			}
+		}
+	}
 }
 
 #if CL_RTX_SHADERBALLS
@@ -1492,17 +1668,26 @@ vkpt_drop_shaderballs()
 static void
 prepare_entities(EntityUploadInfo* upload_info)
 {
-	entity_frame_num = !entity_frame_num;
-
 	QVKInstanceBuffer_t* instance_buffer = &vkpt_refdef.uniform_instance_buffer;
 
+	// Only the instances written last frame can be referenced as previous ones
+	int prev_bsp_mesh_num = world_entity_id_count[entity_frame_num];
+	int prev_model_instance_num = model_entity_id_count[entity_frame_num];
+
 	memcpy(instance_buffer->bsp_mesh_instances_prev, instance_buffer->bsp_mesh_instances,
-		sizeof(instance_buffer->bsp_mesh_instances_prev));
+		prev_bsp_mesh_num * sizeof(instance_buffer->bsp_mesh_instances[0]));
 	memcpy(instance_buffer->model_instances_prev, instance_buffer->model_instances,
-		sizeof(instance_buffer->model_instances_prev));
+		prev_model_instance_num * sizeof(instance_buffer->model_instances[0]));
+
+	memcpy(instance_buffer->bsp_cluster_id_prev, instance_buffer->bsp_cluster_id,
+		prev_bsp_mesh_num * sizeof(instance_buffer->bsp_cluster_id[0]));
+	memcpy(instance_buffer->model_cluster_id_prev, instance_buffer->model_cluster_id,
+		prev_model_instance_num * sizeof(instance_buffer->model_cluster_id[0]));
+
+	entity_frame_num = !entity_frame_num;
 
-	memcpy(instance_buffer->bsp_cluster_id_prev, instance_buffer->bsp_cluster_id, sizeof(instance_buffer->bsp_cluster_id));
-	memcpy(instance_buffer->model_cluster_id_prev, instance_buffer->model_cluster_id, sizeof(instance_buffer->model_cluster_id));
+	entity_batch.num_items = 0;
+	entity_batch.num_lights = 0;
 
 	static int transparent_model_indices[MAX_ENTITIES];
 	static int viewer_model_indices[MAX_ENTITIES];
@@ -1557,12 +1742,13 @@ prepare_entities(EntityUploadInfo* upload_info)
 
 #if CL_RTX_SHADERBALLS
 	if (cl_dev_shaderballs != -1)
-	{	
+	{
 		model_t * model = MOD_ForHandle(cl_dev_shaderballs);
 
 		if (model != NULL && model->meshes != NULL)
 		{
-			entity_t entity;
+			// filled in after this function returns, so it can't be on the stack
+			static entity_t entity;
 			entity.model = cl_dev_shaderballs;
 			VectorClear(entity.angles);
 			VectorCopy(cl_dev_shaderballs_pos, entity.origin);
@@ -1644,35 +1830,196 @@ prepare_entities(EntityUploadInfo* upload_info)
 	upload_info->num_instances = instance_idx;
 	upload_info->num_vertices  = num_instanced_vert;
 
+	Com_ParallelFor(entity_batch.num_items, ENTITY_BATCH_GRAIN, fill_entities_range, NULL);
+
+	collect_bsp_entity_lights();
+
 	memset(instance_buffer->world_current_to_prev, ~0u, sizeof(instance_buffer->world_current_to_prev));
 	memset(instance_buffer->world_prev_to_current, ~0u, sizeof(instance_buffer->world_prev_to_current));
 	memset(instance_buffer->model_current_to_prev, ~0u, sizeof(instance_buffer->model_current_to_prev));
 	memset(instance_buffer->model_prev_to_current, ~0u, sizeof(instance_buffer->model_prev_to_current));
 
 	world_entity_id_count[entity_frame_num] = bsp_mesh_idx;
-	for(int i = 0; i < world_entity_id_count[entity_frame_num]; i++) {
-		for(int j = 0; j < world_entity_id_count[!entity_frame_num]; j++) {
-			if(world_entity_ids[entity_frame_num][i] == world_entity_ids[!entity_frame_num][j]) {
-				instance_buffer->world_current_to_prev[i] = j;
-				instance_buffer->world_prev_to_current[j] = i;
-			}
-		}
-	}
+	match_entity_ids(world_entity_ids[entity_frame_num], world_entity_id_count[entity_frame_num],
+		world_entity_ids[!entity_frame_num], world_entity_id_count[!entity_frame_num], qfalse,
+		instance_buffer->world_current_to_prev, instance_buffer->world_prev_to_current);
 
 	model_entity_id_count[entity_frame_num] = model_instance_idx;
-	for(int i = 0; i < model_entity_id_count[entity_frame_num]; i++) {
-		for(int j = 0; j < model_entity_id_count[!entity_frame_num]; j++) {
-			entity_hash_t hash = *(entity_hash_t*)&model_entity_ids[entity_frame_num][i];
+	match_entity_ids(model_entity_ids[entity_frame_num], model_entity_id_count[entity_frame_num],
+		model_entity_ids[!entity_frame_num], model_entity_id_count[!entity_frame_num], qtrue,
+		instance_buffer->model_current_to_prev, instance_buffer->model_prev_to_current);
+}
 
-			if(model_entity_ids[entity_frame_num][i] == model_entity_ids[!entity_frame_num][j] && hash.entity != 0) {
-				instance_buffer->model_current_to_prev[i] = j;
-				instance_buffer->model_prev_to_current[j] = i;
-			}
+#if USE_TESTS
+/*
+  CPU-only benchmark of entity preparation: fills a synthetic scene with the
+  registered alias models and the inline models of the current map, prepares
+  it on one thread and on the job pool, checks that both produce the same
+  instance buffer and prints the average times. Renderer state is restored
+  afterwards, so this can run between frames.
+*/
+static void
+entity_test_f(void)
+{
+	if (!bsp_world_model || !vkpt_refdef.fd)
+	{
+		Com_Printf("Load a map first.\n");
+		return;
+	}
+
+	int num_entities = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : MAX_ENTITIES;
+	int iterations = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 1000;
+	clamp(num_entities, 1, MAX_ENTITIES);
+	iterations = max(iterations, 1);
+
+	static qhandle_t handles[MAX_ENTITIES];
+	int num_handles = 0;
+	for (int h = 1; h <= r_numModels && num_handles < MAX_ENTITIES; h++)
+	{
+		model_t* model = MOD_ForHandle(h);
+		if (model && model->meshes)
+			handles[num_handles++] = h;
+	}
+	for (int i = 1; i < vkpt_refdef.bsp_mesh_world.num_models && num_handles < MAX_ENTITIES; i++)
+		handles[num_handles++] = ~i;
+
+	if (!num_handles)
+	{
+		Com_Printf("No models registered.\n");
+		return;
+	}
+
+	entity_t* entities = Z_Mallocz(num_entities * sizeof(entity_t));
+	const aabb_t* world = &vkpt_refdef.bsp_mesh_world.world_aabb;
+	unsigned seed = 1;
+	for (int i = 0; i < num_entities; i++)
+	{
+		entity_t* entity = entities + i;
+
+		entity->model = handles[i % num_handles];
+		entity->id = i + 1;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float frac = TST_Frand(&seed);
+			entity->origin[axis] = world->mins[axis] + frac * (world->maxs[axis] - world->mins[axis]);
+			entity->oldorigin[axis] = entity->origin[axis] - 4.f;
+			entity->angles[axis] = frac * 360.f;
+		}
+		entity->backlerp = 0.5f;
+		entity->alpha = 1.f;
+		if (i % 8 == 7)
+			entity->flags |= RF_TRANSLUCENT;
+	}
+
+	// save everything prepare_entities touches
+	QVKInstanceBuffer_t* saved_buffer = Z_Malloc(sizeof(QVKInstanceBuffer_t));
+	QVKInstanceBuffer_t* serial_buffer = Z_Malloc(sizeof(QVKInstanceBuffer_t));
+	static int saved_model_ids[2][MAX_ENTITIES], saved_world_ids[2][MAX_ENTITIES];
+	int saved_model_count[2], saved_world_count[2];
+	int saved_frame_num = entity_frame_num;
+	refdef_t* saved_fd = vkpt_refdef.fd;
+
+	memcpy(saved_buffer, &vkpt_refdef.uniform_instance_buffer, sizeof(QVKInstanceBuffer_t));
+	memcpy(saved_model_ids, model_entity_ids, sizeof(model_entity_ids));
+	memcpy(saved_world_ids, world_entity_ids, sizeof(world_entity_ids));
+	memcpy(saved_model_count, model_entity_id_count, sizeof(model_entity_id_count));
+	memcpy(saved_world_count, world_entity_id_count, sizeof(world_entity_id_count));
+
+	char jobs[MAX_QPATH];
+	Cvar_VariableStringBuffer("com_jobs", jobs, sizeof(jobs));
+
+	refdef_t fd = *saved_fd;
+	fd.entities = entities;
+	fd.num_entities = num_entities;
+	vkpt_refdef.fd = &fd;
+
+	EntityUploadInfo upload_info;
+	uint64_t usec[2];
+	int num_lights[2];
+	int errors = 0;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		Cvar_Set("com_jobs", pass ? jobs : "0");
+
+		memcpy(&vkpt_refdef.uniform_instance_buffer, saved_buffer, sizeof(QVKInstanceBuffer_t));
+		memcpy(model_entity_ids, saved_model_ids, sizeof(model_entity_ids));
+		memcpy(world_entity_ids, saved_world_ids, sizeof(world_entity_ids));
+		memcpy(model_entity_id_count, saved_model_count, sizeof(model_entity_id_count));
+		memcpy(world_entity_id_count, saved_world_count, sizeof(world_entity_id_count));
+		entity_frame_num = saved_frame_num;
+
+		memset(&upload_info, 0, sizeof(upload_info));
+		num_model_lights = 0;
+		prepare_entities(&upload_info);
+		num_lights[pass] = num_model_lights;
+
+		if (!pass)
+			memcpy(serial_buffer, &vkpt_refdef.uniform_instance_buffer, sizeof(QVKInstanceBuffer_t));
+		else if (memcmp(serial_buffer, &vkpt_refdef.uniform_instance_buffer, sizeof(QVKInstanceBuffer_t)) ||
+			num_lights[0] != num_lights[1])
+			errors++;
+
+		uint64_t start = Sys_Microseconds();
+		for (int i = 0; i < iterations; i++)
+		{
+			num_model_lights = 0;
+			prepare_entities(&upload_info);
 		}
+		usec[pass] = Sys_Microseconds() - start;
 	}
+
+	Com_Printf("%d entities, %d instances, %d model lights, %s\n",
+		num_entities, upload_info.num_instances, num_lights[1], errors ? "FAILED" : "ok");
+	TST_PrintTimes("prepare_entities", "serial", va("%d threads", Com_NumJobThreads()), usec, iterations);
+
+	Cvar_Set("com_jobs", jobs);
+
+	memcpy(&vkpt_refdef.uniform_instance_buffer, saved_buffer, sizeof(QVKInstanceBuffer_t));
+	memcpy(model_entity_ids, saved_model_ids, sizeof(model_entity_ids));
+	memcpy(world_entity_ids, saved_world_ids, sizeof(world_entity_ids));
+	memcpy(model_entity_id_count, saved_model_count, sizeof(model_entity_id_count));
+	memcpy(world_entity_id_count, saved_world_count, sizeof(world_entity_id_count));
+	entity_frame_num = saved_frame_num;
+	vkpt_refdef.fd = saved_fd;
+	num_model_lights = 0;
+
+	Z_Free(saved_buffer);
+	Z_Free(serial_buffer);
+	Z_Free(entities);
 }
+#endif
 
 #ifdef VKPT_IMAGE_DUMPS
+// dumps are converted and written to disk by worker threads while the
+// next frames render; dump_image N dumps N consecutive frames
+#define MAX_DUMP_JOBS 4
+
+typedef struct {
+	job_group_t group;
+	uint64_t frame_counter;
+	uint32_t width, height;
+	uint64_t row_pitch;
+	char* data;
+} dump_job_t;
+
+static dump_job_t dump_jobs[MAX_DUMP_JOBS];
+
+static void
+write_dump(void* arg)
+{
+	dump_job_t* job = arg;
+	save_to_pfm_file("color_buffer", job->frame_counter, job->width, job->height, job->data, job->row_pitch, 0);
+}
+
+static void
+finish_dump(dump_job_t* job)
+{
+	Com_WaitJobs(&job->group);
+	Z_Free(job->data);
+	job->data = NULL;
+}
+
 static void 
 copy_to_dump_texture(VkCommandBuffer cmd_buf, int src_image_index)
 {
@@ -2391,15 +2738,29 @@ R_EndFrame_RTX(void)
 		VkSubresourceLayout subresource_layout;
 		vkGetImageSubresourceLayout(qvk.device, qvk.dump_image, &subresource, &subresource_layout);
 
+		dump_job_t* job = dump_jobs + qvk.frame_counter % MAX_DUMP_JOBS;
+		finish_dump(job);
+
+		job->frame_counter = qvk.frame_counter;
+		job->width = IMG_WIDTH;
+		job->height = IMG_HEIGHT;
+		job->row_pitch = subresource_layout.rowPitch;
+		job->data = Z_Malloc(subresource_layout.rowPitch * IMG_HEIGHT);
+
 		void *data;
 		_VK(vkMapMemory(qvk.device, qvk.dump_image_memory, 0, qvk.dump_image_memory_size, 0, &data));
-		save_to_pfm_file("color_buffer", qvk.frame_counter, IMG_WIDTH, IMG_HEIGHT, (char *)data, subresource_layout.rowPitch, 0);
+		memcpy(job->data, (char *)data + subresource_layout.offset, subresource_layout.rowPitch * IMG_HEIGHT);
 		vkUnmapMemory(qvk.device, qvk.dump_image_memory);
 
-		Cvar_SetInteger(cvar_dump_image, 0, FROM_CODE);
+		Com_QueueJob(&job->group, write_dump, job);
+
+		Cvar_SetInteger(cvar_dump_image, cvar_dump_image->integer - 1, FROM_CODE);
 	}
 #endif
 
+	// captured frames are read back before they are presented
+	IMG_EndFrame();
+
 	VkPresentInfoKHR present_info = {
 		.sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
 		.waitSemaphoreCount = qvk.device_count,
@@ -2480,6 +2841,15 @@ R_Init_RTX(qboolean total)
 	cvar_pt_caustics = Cvar_Get("pt_caustics", "1", CVAR_ARCHIVE);
 	cvar_pt_enable_nodraw = Cvar_Get("pt_enable_nodraw", "0", 0);
 
+	// 1 -> load the world mesh and light lists from maps/mesh/<map>.bin, or save them there after building
+	cvar_pt_mesh_cache = Cvar_Get("pt_mesh_cache", "1", 0);
+
+	// 1 -> load wall and skin textures from texcache/<file>.dds if it was built from the same source image
+	cvar_pt_texture_cache = Cvar_Get("pt_texture_cache", "1", 0);
+
+	// 1 -> load decoded MD2 and MD3 models from modelcache/<model>.bin, or save them there after decoding
+	cvar_pt_model_cache = Cvar_Get("pt_model_cache", "1", 0);
+
 	// 0 -> disabled, regular pause; 1 -> enabled; 2 -> enabled, hide GUI
 	cvar_pt_accumulation_rendering = Cvar_Get("pt_accumulation_rendering", "1", CVAR_ARCHIVE);
 
@@ -2542,6 +2912,7 @@ R_Init_RTX(qboolean total)
 
 	Cmd_AddCommand("reload_shader", (xcommand_t)&vkpt_reload_shader);
     Cmd_AddCommand("reload_textures", (xcommand_t)&vkpt_reload_textures);
+	Cmd_AddCommand("build_texture_cache", (xcommand_t)&vkpt_build_texture_cache);
 	Cmd_AddCommand("reload_materials", (xcommand_t)&vkpt_reload_materials);
 	Cmd_AddCommand("save_materials", (xcommand_t)&vkpt_save_materials);
 	Cmd_AddCommand("set_material", (xcommand_t)&vkpt_set_material);
@@ -2551,6 +2922,10 @@ R_Init_RTX(qboolean total)
 #if CL_RTX_SHADERBALLS
 	Cmd_AddCommand("drop_balls", (xcommand_t)&vkpt_drop_shaderballs);
 #endif
+#if USE_TESTS
+	Cmd_AddCommand("entitytest", entity_test_f);
+	Cmd_AddCommand("particletest", vkpt_particle_test_f);
+#endif
 
 	for (int i = 0; i < 256; i++) {
 		qvk.sintab[i] = sinf(i * (2 * M_PI / 255));
@@ -2567,6 +2942,7 @@ R_Shutdown_RTX(qboolean total)
 	
 	Cmd_RemoveCommand("reload_shader");
 	Cmd_RemoveCommand("reload_textures");
+	Cmd_RemoveCommand("build_texture_cache");
 	Cmd_RemoveCommand("reload_materials");
 	Cmd_RemoveCommand("save_materials");
 	Cmd_RemoveCommand("set_material");
@@ -2576,10 +2952,23 @@ R_Shutdown_RTX(qboolean total)
 #if CL_RTX_SHADERBALLS
 	Cmd_RemoveCommand("drop_balls");
 #endif
+#if USE_TESTS
+	Cmd_RemoveCommand("entitytest");
+	Cmd_RemoveCommand("particletest");
+#endif
 	
+	Z_Free(entity_batch.lights);
+	entity_batch.lights = NULL;
+	entity_batch.allocated_lights = 0;
+
 	IMG_FreeAll();
 	vkpt_textures_destroy_unused();
 
+#ifdef VKPT_IMAGE_DUMPS
+	for (int i = 0; i < MAX_DUMP_JOBS; i++)
+		finish_dump(dump_jobs + i);
+#endif
+
 	_VK(vkpt_destroy_all(VKPT_INIT_DEFAULT));
 	vkpt_destroy_shader_modules();
 
@@ -2843,8 +3232,12 @@ R_BeginRegistration_RTX(const char *name)
 	_VK(vkpt_pt_create_static(
 		qvk.buf_vertex.buffer, 
 		offsetof(VertexBuffer, positions_bsp), 
+		offsetof(VertexBuffer, idx_bsp), 
+		m->num_vertices, 
 		m->world_idx_count, 
+		m->world_transparent_offset,
 		m->world_transparent_count,
+		m->world_sky_offset,
 		m->world_sky_count));
 
 	memset(cluster_debug_mask, 0, sizeof(cluster_debug_mask));
@@ -3094,9 +3487,12 @@ void R_RegisterFunctionsRTX()
 	IMG_Load = IMG_Load_RTX;
 	IMG_Unload = IMG_Unload_RTX;
 	IMG_ReadPixels = IMG_ReadPixels_RTX;
+	IMG_ReadCache = IMG_ReadCache_RTX;
+	IMG_LoadCache = IMG_LoadCache_RTX;
 	MOD_LoadMD2 = MOD_LoadMD2_RTX;
 	MOD_LoadMD3 = MOD_LoadMD3_RTX;
 	MOD_Reference = MOD_Reference_RTX;
+	MOD_Unload = NULL;
 }
 
 // vim: shiftwidth=4 noexpandtab tabstop=4 cindent
@@ -43,6 +43,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "format/md3.h"
 #include "format/sp2.h"
 #include "material.h"
+#include "common/mdfour.h"
+#include "system/system.h"
 #include <assert.h>
 
 #if MAX_ALIAS_VERTS > TESS_MAX_VERTICES
@@ -53,87 +55,115 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #error TESS_MAX_INDICES
 #endif
 
+
+/*
+  Frames of a model are independent of each other, so decoding them and
+  computing their tangents is spread over the worker threads with
+  Com_ParallelFor. Every frame is computed exactly like it would be on a
+  single thread, so the results don't depend on the number of threads.
+*/
+
+#define FRAME_GRAIN 4
+
+// cleared by the model load test to get a single threaded reference
+static qboolean parallel_frames = qtrue;
+
+static void for_each_frame(int numframes, job_range_func_t func, void* arg)
+{
+	if (parallel_frames)
+		Com_ParallelFor(numframes, FRAME_GRAIN, func, arg);
+	else
+		func(arg, 0, numframes);
+}
+
+static void compute_tangents_frames(void* arg, int start, int end)
+{
+	maliasmesh_t * mesh = arg;
+
+	float * stangents = Z_Malloc(mesh->numverts * 2 * 3 * sizeof(float));
+	float * ttangents = stangents + (mesh->numverts * 3);
+
+	for (int idx_frame = start; idx_frame < end; ++idx_frame)
+	{
+		memset(stangents, 0, mesh->numverts * 2 * 3 * sizeof(float));
+
+		uint32_t offset = idx_frame * mesh->numverts;
+
+		for (int idx_tri = 0; idx_tri < mesh->numtris; ++idx_tri)
+		{
+			uint32_t iA = mesh->indices[idx_tri * 3 + 0];
+			uint32_t iB = mesh->indices[idx_tri * 3 + 1];
+			uint32_t iC = mesh->indices[idx_tri * 3 + 2];
+
+			float const * pA = (float const *)mesh->positions + ((offset + iA) * 3);
+			float const * pB = (float const *)mesh->positions + ((offset + iB) * 3);
+			float const * pC = (float const *)mesh->positions + ((offset + iC) * 3);
+
+			float const * tA = (float const *)mesh->tex_coords + ((offset + iA) * 2);
+			float const * tB = (float const *)mesh->tex_coords + ((offset + iB) * 2);
+			float const * tC = (float const *)mesh->tex_coords + ((offset + iC) * 2);
+
+			vec3_t dP0, dP1;
+			VectorSubtract(pB, pA, dP0);
+			VectorSubtract(pC, pA, dP1);
+
+			vec2_t dt0, dt1;
+			Vector2Subtract(tB, tA, dt0);
+			Vector2Subtract(tC, tA, dt1);
+
+			float r = 1.f / (dt0[0] * dt1[1] - dt1[0] * dt0[1]);
+
+			vec3_t sdir = {
+				(dt1[1] * dP0[0] - dt0[1] * dP1[0]) * r,
+				(dt1[1] * dP0[1] - dt0[1] * dP1[1]) * r,
+				(dt1[1] * dP0[2] - dt0[1] * dP1[2]) * r };
+
+			vec3_t tdir = {
+				(dt0[0] * dP1[0] - dt1[0] * dP0[0]) * r,
+				(dt0[0] * dP1[1] - dt1[0] * dP0[1]) * r,
+				(dt0[0] * dP1[2] - dt1[0] * dP0[2]) * r };
+
+			VectorAdd(stangents + (iA * 3), sdir, stangents + (iA * 3));
+			VectorAdd(stangents + (iB * 3), sdir, stangents + (iB * 3));
+			VectorAdd(stangents + (iC * 3), sdir, stangents + (iC * 3));
+
+			VectorAdd(ttangents + (iA * 3), tdir, ttangents + (iA * 3));
+			VectorAdd(ttangents + (iB * 3), tdir, ttangents + (iB * 3));
+			VectorAdd(ttangents + (iC * 3), tdir, ttangents + (iC * 3));
+		}
+
+		for (int idx_vert = 0; idx_vert < mesh->numverts; ++idx_vert)
+		{
+			float const * normal = (float const *)mesh->normals + ((offset + idx_vert) * 3);
+			float const * stan = stangents + (idx_vert * 3);
+			float const * ttan = ttangents + (idx_vert * 3);
+
+			float * tangent = (float *)mesh->tangents + ((offset+idx_vert) * 4);
+
+			vec3_t t;
+			VectorScale(normal, DotProduct(normal, stan), t);
+			VectorSubtract(stan, t, t);
+			VectorNormalize2(t, tangent); // Graham-Schmidt : t = normalize(t - n * (n.t))
+
+			vec3_t cross;
+			CrossProduct(normal, t, cross);
+			float dot = DotProduct(cross, ttan);
+			tangent[3] = dot < 0.0f ? -1.0f : 1.0f; // handedness
+		}
+	}
+
+	Z_Free(stangents);
+}
+
 static void computeTangents(model_t * model)
 {
-    for (int idx_mesh = 0; idx_mesh < model->nummeshes; ++idx_mesh)
-    {
-        maliasmesh_t * mesh = &model->meshes[idx_mesh];
-
-        assert(mesh->tangents);
-        float * stangents = Z_Malloc(mesh->numverts * 2 * 3 * sizeof(float));
-        float * ttangents = stangents + (mesh->numverts * 3);
- 
-        for (int idx_frame = 0; idx_frame < model->numframes; ++idx_frame)
-        {
-            memset(stangents, 0, mesh->numverts * 2 * 3 * sizeof(float));
-
-            uint32_t ntriangles = mesh->numindices / 3,
-                     offset = idx_frame * mesh->numverts;
-            
-            for (int idx_tri = 0; idx_tri < mesh->numtris; ++idx_tri)
-            {
-                uint32_t iA = mesh->indices[idx_tri * 3 + 0];
-                uint32_t iB = mesh->indices[idx_tri * 3 + 1];
-                uint32_t iC = mesh->indices[idx_tri * 3 + 2];
-
-                float const * pA = (float const *)mesh->positions + ((offset + iA) * 3);
-                float const * pB = (float const *)mesh->positions + ((offset + iB) * 3);
-                float const * pC = (float const *)mesh->positions + ((offset + iC) * 3);
-
-                float const * tA = (float const *)mesh->tex_coords + ((offset + iA) * 2);
-                float const * tB = (float const *)mesh->tex_coords + ((offset + iB) * 2);
-                float const * tC = (float const *)mesh->tex_coords + ((offset + iC) * 2);
-
-                vec3_t dP0, dP1;
-                VectorSubtract(pB, pA, dP0);
-                VectorSubtract(pC, pA, dP1);
-
-                vec2_t dt0, dt1;
-                Vector2Subtract(tB, tA, dt0);
-                Vector2Subtract(tC, tA, dt1);
-
-                float r = 1.f / (dt0[0] * dt1[1] - dt1[0] * dt0[1]);
-
-                vec3_t sdir = {
-                    (dt1[1] * dP0[0] - dt0[1] * dP1[0]) * r,
-                    (dt1[1] * dP0[1] - dt0[1] * dP1[1]) * r,
-                    (dt1[1] * dP0[2] - dt0[1] * dP1[2]) * r };
-
-                vec3_t tdir = {
-                    (dt0[0] * dP1[0] - dt1[0] * dP0[0]) * r,
-                    (dt0[0] * dP1[1] - dt1[0] * dP0[1]) * r,
-                    (dt0[0] * dP1[2] - dt1[0] * dP0[2]) * r };
-
-                VectorAdd(stangents + (iA * 3), sdir, stangents + (iA * 3));
-                VectorAdd(stangents + (iB * 3), sdir, stangents + (iB * 3));
-                VectorAdd(stangents + (iC * 3), sdir, stangents + (iC * 3));
-
-                VectorAdd(ttangents + (iA * 3), tdir, ttangents + (iA * 3));
-                VectorAdd(ttangents + (iB * 3), tdir, ttangents + (iB * 3));
-                VectorAdd(ttangents + (iC * 3), tdir, ttangents + (iC * 3));
-            }
-
-            for (int idx_vert = 0; idx_vert < mesh->numverts; ++idx_vert)
-            {
-                float const * normal = (float const *)mesh->normals + ((offset + idx_vert) * 3);
-                float const * stan = stangents + (idx_vert * 3);
-                float const * ttan = ttangents + (idx_vert * 3);
-
-                float * tangent = (float *)mesh->tangents + ((offset+idx_vert) * 4);
-
-                vec3_t t;
-                VectorScale(normal, DotProduct(normal, stan), t);
-                VectorSubtract(stan, t, t);
-                VectorNormalize2(t, tangent); // Graham-Schmidt : t = normalize(t - n * (n.t))
-
-                vec3_t cross;
-                CrossProduct(normal, t, cross);
-                float dot = DotProduct(cross, ttan);
-                tangent[3] = dot < 0.0f ? -1.0f : 1.0f; // handedness
-            }
-        }
-        Z_Free(stangents);
-    }
+	for (int idx_mesh = 0; idx_mesh < model->nummeshes; ++idx_mesh)
+	{
+		maliasmesh_t * mesh = &model->meshes[idx_mesh];
+
+		assert(mesh->tangents);
+		for_each_frame(model->numframes, compute_tangents_frames, mesh);
+	}
 }
 
 static void export_obj_frames(model_t* model, const char* path_pattern)
@@ -183,45 +213,476 @@ static void export_obj_frames(model_t* model, const char* path_pattern)
 	}
 }
 
-qerror_t MOD_LoadMD2_RTX(model_t *model, const void *rawdata, size_t length)
+// Registers the material of a skin along with its diffuse image and the
+// optional <skin>_n.tga normal map and <skin>_light.tga emissive map.
+static qerror_t load_skin(const char* name, pbr_material_t** material)
+{
+	char skinname[MAX_QPATH];
+
+	if (!Q_memccpy(skinname, name, 0, sizeof(skinname)))
+		return Q_ERR_STRING_TRUNCATED;
+	FS_NormalizePath(skinname, skinname);
+
+	pbr_material_t * mat = MAT_FindPBRMaterial(skinname);
+	if (!mat)
+		Com_EPrintf("error finding material '%s'\n", skinname);
+
+	image_t* image_diffuse = IMG_Find(skinname, IT_SKIN, IF_SRGB);
+	image_t* image_normals = NULL;
+	image_t* image_emissive = NULL;
+
+	if (image_diffuse != R_NOTEXTURE)
+	{
+		// attempt loading the normals texture
+		if (!Q_strlcpy(skinname, name, strlen(name) - 3))
+			return Q_ERR_STRING_TRUNCATED;
+
+		Q_concat(skinname, sizeof(skinname), skinname, "_n.tga", NULL);
+		FS_NormalizePath(skinname, skinname);
+		image_normals = IMG_Find(skinname, IT_SKIN, IF_NONE);
+		if (image_normals == R_NOTEXTURE) image_normals = NULL;
+
+		// attempt loading the emissive texture
+		if (!Q_strlcpy(skinname, name, strlen(name) - 3))
+			return Q_ERR_STRING_TRUNCATED;
+
+		Q_concat(skinname, sizeof(skinname), skinname, "_light.tga", NULL);
+		FS_NormalizePath(skinname, skinname);
+		image_emissive = IMG_Find(skinname, IT_SKIN, IF_SRGB);
+		if (image_emissive == R_NOTEXTURE) image_emissive = NULL;
+	}
+
+	MAT_RegisterPBRMaterial(mat, image_diffuse, image_normals, image_emissive);
+
+	*material = mat;
+	return Q_ERR_SUCCESS;
+}
+
+/*
+  On-disk cache of decoded models in `modelcache/<model>.bin`, where <model>
+  is the registered name, also when an .md3 replacement was loaded for it.
+  Entries hold everything but the skins: the frames, and the vertices,
+  tangents and indices of every mesh, so a cached model is loaded with one
+  read and a few copies. The source file is still read for the skins, and
+  an entry is only used if the size and checksum of the source file match.
+  Like the mesh cache, entries are stored in native byte order.
+*/
+
+#define MODEL_CACHE_IDENT    MakeRawLong('A', 'M', 'D', 'L')
+#define MODEL_CACHE_VERSION  1
+
+typedef struct {
+	uint32_t ident;
+	uint32_t version;
+	uint32_t checksum;
+	uint32_t filelen;
+	int32_t num_frames;
+	int32_t num_meshes;
+} model_cache_header_t;
+
+typedef struct {
+	int32_t numverts;
+	int32_t numtris;
+	int32_t numskins;
+} model_cache_mesh_t;
+
+typedef struct {
+	byte* data;
+	size_t size;
+	size_t pos;
+} model_cache_t;
+
+typedef qerror_t (*load_geometry_t)(model_t *model, const void *rawdata, size_t length);
+
+extern cvar_t *cvar_pt_model_cache;
+
+// Returns a pointer to the next `size` bytes of the cache, or NULL if there
+// aren't that many left.
+static void*
+cache_data(model_cache_t* cache, size_t size)
+{
+	if (size > cache->size - cache->pos)
+		return NULL;
+
+	void* data = cache->data + cache->pos;
+	cache->pos += size;
+	return data;
+}
+
+static void
+cache_write(model_cache_t* cache, const void* data, size_t size)
+{
+	memcpy(cache_data(cache, size), data, size);
+}
+
+static void*
+cache_copy(model_t* model, model_cache_t* cache, size_t size)
+{
+	void* data = MOD_Malloc(size);
+	memcpy(data, cache_data(cache, size), size);
+	return data;
+}
+
+static size_t
+vertex_size(void)
+{
+	return sizeof(vec3_t) * 2 + sizeof(vec2_t) + sizeof(vec4_t);
+}
+
+static byte*
+write_model_cache(const model_t* model, uint32_t checksum, size_t filelen, size_t* size_p)
+{
+	model_cache_t cache = { 0 };
+
+	cache.size = sizeof(model_cache_header_t) + model->numframes * sizeof(maliasframe_t);
+	for (int i = 0; i < model->nummeshes; i++)
+	{
+		const maliasmesh_t* mesh = &model->meshes[i];
+		cache.size += sizeof(model_cache_mesh_t) + mesh->numindices * sizeof(int);
+		cache.size += (size_t)mesh->numverts * model->numframes * vertex_size();
+	}
+	cache.data = Z_Malloc(cache.size);
+
+	model_cache_header_t header = {
+		.ident = MODEL_CACHE_IDENT,
+		.version = MODEL_CACHE_VERSION,
+		.checksum = checksum,
+		.filelen = filelen,
+		.num_frames = model->numframes,
+		.num_meshes = model->nummeshes
+	};
+	cache_write(&cache, &header, sizeof(header));
+	cache_write(&cache, model->frames, model->numframes * sizeof(maliasframe_t));
+
+	for (int i = 0; i < model->nummeshes; i++)
+	{
+		const maliasmesh_t* mesh = &model->meshes[i];
+		model_cache_mesh_t m = {
+			.numverts = mesh->numverts,
+			.numtris = mesh->numtris,
+			.numskins = mesh->numskins
+		};
+		cache_write(&cache, &m, sizeof(m));
+	}
+
+	for (int i = 0; i < model->nummeshes; i++)
+	{
+		const maliasmesh_t* mesh = &model->meshes[i];
+		size_t count = (size_t)mesh->numverts * model->numframes;
+
+		cache_write(&cache, mesh->indices, mesh->numindices * sizeof(int));
+		cache_write(&cache, mesh->positions, count * sizeof(vec3_t));
+		cache_write(&cache, mesh->normals, count * sizeof(vec3_t));
+		cache_write(&cache, mesh->tex_coords, count * sizeof(vec2_t));
+		cache_write(&cache, mesh->tangents, count * sizeof(vec4_t));
+	}
+
+	assert(cache.pos == cache.size);
+
+	*size_p = cache.size;
+	return cache.data;
+}
+
+// Fills in the model from a cache entry and leaves the hunk open, like the
+// geometry loaders do. Returns qfalse with nothing allocated if the entry
+// doesn't belong to the source file or is damaged.
+static qboolean
+read_model_cache(model_t* model, const byte* data, size_t size, uint32_t checksum, size_t filelen)
+{
+	model_cache_t cache = { (byte*)data, size, 0 };
+
+	const model_cache_header_t* header = cache_data(&cache, sizeof(*header));
+	if (!header)
+		return qfalse;
+
+	if (header->ident != MODEL_CACHE_IDENT ||
+		header->version != MODEL_CACHE_VERSION ||
+		header->checksum != checksum ||
+		header->filelen != filelen)
+		return qfalse;
+
+	if (header->num_frames < 1 || header->num_frames > MD3_MAX_FRAMES ||
+		header->num_meshes < 1 || header->num_meshes > MD3_MAX_MESHES)
+		return qfalse;
+
+	int num_frames = header->num_frames;
+	int num_meshes = header->num_meshes;
+
+	const maliasframe_t* frames = cache_data(&cache, num_frames * sizeof(maliasframe_t));
+	const model_cache_mesh_t* meshes = cache_data(&cache, num_meshes * sizeof(model_cache_mesh_t));
+	if (!frames || !meshes)
+		return qfalse;
+
+	// the rest of the entry must be exactly the mesh data
+	uint64_t data_size = 0;
+	for (int i = 0; i < num_meshes; i++)
+	{
+		const model_cache_mesh_t* m = meshes + i;
+
+		if (m->numverts < 1 || m->numverts > TESS_MAX_VERTICES ||
+			m->numtris < 1 || m->numtris > TESS_MAX_INDICES / 3 ||
+			m->numskins < 0 || m->numskins > MAX_ALIAS_SKINS)
+			return qfalse;
+
+		data_size += m->numtris * 3 * sizeof(int);
+		data_size += (uint64_t)m->numverts * num_frames * vertex_size();
+	}
+
+	if (data_size != cache.size - cache.pos)
+		return qfalse;
+
+	Hunk_Begin(&model->hunk, data_size + num_frames * sizeof(maliasframe_t) +
+		num_meshes * (sizeof(maliasmesh_t) + 5 * 64) + 2 * 64);
+	model->type = MOD_ALIAS;
+	model->numframes = num_frames;
+	model->nummeshes = num_meshes;
+	model->meshes = MOD_Malloc(num_meshes * sizeof(maliasmesh_t));
+	model->frames = MOD_Malloc(num_frames * sizeof(maliasframe_t));
+	memcpy(model->frames, frames, num_frames * sizeof(maliasframe_t));
+
+	for (int i = 0; i < num_meshes; i++)
+	{
+		const model_cache_mesh_t* m = meshes + i;
+		maliasmesh_t* mesh = &model->meshes[i];
+		size_t count = (size_t)m->numverts * num_frames;
+
+		mesh->numverts = m->numverts;
+		mesh->numtris = m->numtris;
+		mesh->numindices = m->numtris * 3;
+		mesh->numskins = m->numskins;
+		mesh->indices = cache_copy(model, &cache, mesh->numindices * sizeof(int));
+		mesh->positions = cache_copy(model, &cache, count * sizeof(vec3_t));
+		mesh->normals = cache_copy(model, &cache, count * sizeof(vec3_t));
+		mesh->tex_coords = cache_copy(model, &cache, count * sizeof(vec2_t));
+		mesh->tangents = cache_copy(model, &cache, count * sizeof(vec4_t));
+
+		for (int j = 0; j < mesh->numindices; j++)
+		{
+			if (mesh->indices[j] < 0 || mesh->indices[j] >= mesh->numverts)
+			{
+				Hunk_Free(&model->hunk);
+				return qfalse;
+			}
+		}
+	}
+
+	return qtrue;
+}
+
+static qboolean
+get_model_cache_path(char* path, size_t size, const model_t* model)
+{
+	return Q_concat(path, size, "modelcache/", model->name, ".bin", NULL) < size;
+}
+
+static qboolean
+load_model_cache(model_t* model, uint32_t checksum, size_t filelen)
+{
+	char path[MAX_QPATH];
+	if (!get_model_cache_path(path, sizeof(path), model))
+		return qfalse;
+
+	byte* data;
+	ssize_t len = FS_LoadFile(path, (void**)&data);
+	if (!data)
+		return qfalse;
+
+	qboolean ret = read_model_cache(model, data, len, checksum, filelen);
+
+	FS_FreeFile(data);
+	return ret;
+}
+
+static void
+save_model_cache(const model_t* model, uint32_t checksum, size_t filelen)
+{
+	char path[MAX_QPATH];
+	if (!get_model_cache_path(path, sizeof(path), model))
+		return;
+
+	size_t size;
+	byte* data = write_model_cache(model, checksum, filelen, &size);
+
+	if (FS_WriteFile(path, data, size) < 0)
+		Com_EPrintf("Couldn't save model cache for %s.\n", model->name);
+
+	Z_Free(data);
+}
+
+// Loads the frames and meshes of a model from the cache, or decodes them
+// with the given function and saves them to the cache.
+static qerror_t
+load_geometry(model_t* model, const void* rawdata, size_t length, load_geometry_t load)
+{
+	uint32_t checksum = 0;
+	qerror_t ret;
+
+	if (cvar_pt_model_cache->integer)
+	{
+		checksum = Com_BlockChecksum((void*)rawdata, length);
+		if (load_model_cache(model, checksum, length))
+			return Q_ERR_SUCCESS;
+	}
+
+	ret = load(model, rawdata, length);
+
+	if (!ret && cvar_pt_model_cache->integer)
+		save_model_cache(model, checksum, length);
+
+	return ret;
+}
+
+static qerror_t read_md2_header(dmd2header_t *header, const void *rawdata, size_t length)
+{
+	if (length < sizeof(*header)) {
+		return Q_ERR_FILE_TOO_SMALL;
+	}
+
+	// byte swap the header
+	*header = *(dmd2header_t *)rawdata;
+	for (int i = 0; i < sizeof(*header) / 4; i++) {
+		((uint32_t *)header)[i] = LittleLong(((uint32_t *)header)[i]);
+	}
+
+	// validate the header
+	return MOD_ValidateMD2(header, length);
+}
+
+typedef struct {
+	const dmd2header_t  *header;
+	const byte          *rawdata;
+	model_t             *model;
+	const uint16_t      *remap;
+	const uint16_t      *vertIndices;
+	const uint16_t      *tcIndices;
+	const uint16_t      *finalIndices;
+	int                 numindices;
+	qboolean            all_normals_same;
+} md2_frames_t;
+
+static void decode_md2_frames(void *arg, int start, int end)
+{
+	const md2_frames_t      *job = arg;
+	const dmd2header_t      *header = job->header;
+	const dmd2frame_t       *src_frame;
+	const dmd2trivertx_t    *src_vert;
+	const dmd2stvert_t      *src_tc;
+	maliasframe_t           *dst_frame;
+	maliasmesh_t            *dst_mesh = job->model->meshes;
+	const uint16_t          *remap = job->remap;
+	const uint16_t          *vertIndices = job->vertIndices;
+	const uint16_t          *tcIndices = job->tcIndices;
+	const uint16_t          *finalIndices = job->finalIndices;
+	int                     numindices = job->numindices;
+	int                     numverts = dst_mesh->numverts;
+	int                     val;
+	vec_t                   scale_s, scale_t;
+	vec3_t                  mins, maxs;
+
+	// load all tcoords
+	src_tc = (const dmd2stvert_t *)(job->rawdata + header->ofs_st);
+	scale_s = 1.0f / header->skinwidth;
+	scale_t = 1.0f / header->skinheight;
+
+	for (int j = start; j < end; j++) {
+		src_frame = (const dmd2frame_t *)(job->rawdata + header->ofs_frames + j * header->framesize);
+		dst_frame = &job->model->frames[j];
+
+		LittleVector(src_frame->scale, dst_frame->scale);
+		LittleVector(src_frame->translate, dst_frame->translate);
+
+		// load frame vertices
+		ClearBounds(mins, maxs);
+
+		for (int i = 0; i < numindices; i++) {
+			if (remap[i] != i) {
+				continue;
+			}
+			src_vert = &src_frame->verts[vertIndices[i]];
+			vec3_t *dst_pos = &dst_mesh->positions [j * numverts + finalIndices[i]];
+			vec3_t *dst_nrm = &dst_mesh->normals   [j * numverts + finalIndices[i]];
+			vec2_t *dst_tc  = &dst_mesh->tex_coords[j * numverts + finalIndices[i]];
+
+			(*dst_tc)[0] = scale_s * src_tc[tcIndices[i]].s;
+			(*dst_tc)[1] = scale_t * src_tc[tcIndices[i]].t;
+
+			(*dst_pos)[0] = src_vert->v[0] * dst_frame->scale[0] + dst_frame->translate[0];
+			(*dst_pos)[1] = src_vert->v[1] * dst_frame->scale[1] + dst_frame->translate[1];
+			(*dst_pos)[2] = src_vert->v[2] * dst_frame->scale[2] + dst_frame->translate[2];
+
+			(*dst_nrm)[0] = 0.0f;
+			(*dst_nrm)[1] = 0.0f;
+			(*dst_nrm)[2] = 0.0f;
+
+			val = src_vert->lightnormalindex;
+
+			if (val < NUMVERTEXNORMALS) {
+				(*dst_nrm)[0] = bytedirs[val][0];
+				(*dst_nrm)[1] = bytedirs[val][1];
+				(*dst_nrm)[2] = bytedirs[val][2];
+			}
+
+			for (int k = 0; k < 3; k++) {
+				val = (*dst_pos)[k];
+				if (val < mins[k])
+					mins[k] = val;
+				if (val > maxs[k])
+					maxs[k] = val;
+			}
+		}
+
+		// if all normals are the same, rebuild them as flat triangle normals
+		if (job->all_normals_same)
+		{
+			for (int tri = 0; tri < numindices / 3; tri++)
+			{
+				int i0 = j * numverts + finalIndices[tri * 3 + 0];
+				int i1 = j * numverts + finalIndices[tri * 3 + 1];
+				int i2 = j * numverts + finalIndices[tri * 3 + 2];
+
+				vec3_t *p0 = &dst_mesh->positions[i0];
+				vec3_t *p1 = &dst_mesh->positions[i1];
+				vec3_t *p2 = &dst_mesh->positions[i2];
+
+				vec3_t e1, e2, n;
+				VectorSubtract(*p1, *p0, e1);
+				VectorSubtract(*p2, *p0, e2);
+				CrossProduct(e2, e1, n);
+				VectorNormalize(n);
+
+				VectorCopy(n, dst_mesh->normals[i0]);
+				VectorCopy(n, dst_mesh->normals[i1]);
+				VectorCopy(n, dst_mesh->normals[i2]);
+			}
+		}
+
+		VectorVectorScale(mins, dst_frame->scale, mins);
+		VectorVectorScale(maxs, dst_frame->scale, maxs);
+
+		dst_frame->radius = RadiusFromBounds(mins, maxs);
+
+		VectorAdd(mins, dst_frame->translate, dst_frame->bounds[0]);
+		VectorAdd(maxs, dst_frame->translate, dst_frame->bounds[1]);
+	}
+}
+
+// Everything but the skins. Leaves the hunk open on success.
+static qerror_t load_md2_geometry(model_t *model, const void *rawdata, size_t length)
 {
 	dmd2header_t    header;
 	dmd2frame_t     *src_frame;
-	dmd2trivertx_t  *src_vert;
 	dmd2triangle_t  *src_tri;
 	dmd2stvert_t    *src_tc;
-	char            *src_skin;
-	maliasframe_t   *dst_frame;
 	maliasmesh_t    *dst_mesh;
-	int             val;
 	uint16_t        remap[TESS_MAX_INDICES];
 	uint16_t        vertIndices[TESS_MAX_INDICES];
 	uint16_t        tcIndices[TESS_MAX_INDICES];
 	uint16_t        finalIndices[TESS_MAX_INDICES];
 	int             numverts, numindices;
-	char            skinname[MAX_QPATH];
-	vec_t           scale_s, scale_t;
-	vec3_t          mins, maxs;
 	qerror_t        ret;
 
-	if (length < sizeof(header)) {
-		return Q_ERR_FILE_TOO_SMALL;
-	}
-
-	// byte swap the header
-	header = *(dmd2header_t *)rawdata;
-	for (int i = 0; i < sizeof(header) / 4; i++) {
-		((uint32_t *)&header)[i] = LittleLong(((uint32_t *)&header)[i]);
-	}
-
-	// validate the header
-	ret = MOD_ValidateMD2(&header, length);
+	ret = read_md2_header(&header, rawdata, length);
 	if (ret) {
-		if (ret == Q_ERR_TOO_FEW) {
-			// empty models draw nothing
-			model->type = MOD_EMPTY;
-			return Q_ERR_SUCCESS;
-		}
 		return ret;
 	}
 
@@ -317,7 +778,7 @@ qerror_t MOD_LoadMD2_RTX(model_t *model, const void *rawdata, size_t length)
 	dst_mesh->positions  = MOD_Malloc(numverts   * header.num_frames * sizeof(vec3_t));
 	dst_mesh->normals    = MOD_Malloc(numverts   * header.num_frames * sizeof(vec3_t));
 	dst_mesh->tex_coords = MOD_Malloc(numverts   * header.num_frames * sizeof(vec2_t));
-    dst_mesh->tangents   = MOD_Malloc(numverts   * header.num_frames * sizeof(vec4_t));
+	dst_mesh->tangents   = MOD_Malloc(numverts   * header.num_frames * sizeof(vec4_t));
 	dst_mesh->indices    = MOD_Malloc(numindices * sizeof(int));
 
 	if (dst_mesh->numtris != header.num_tris) {
@@ -329,148 +790,62 @@ qerror_t MOD_LoadMD2_RTX(model_t *model, const void *rawdata, size_t length)
 		dst_mesh->indices[i] = finalIndices[i];
 	}
 
-	// load all skins
-	src_skin = (char *)rawdata + header.ofs_skins;
-	for (int i = 0; i < header.num_skins; i++) {
-		if (!Q_memccpy(skinname, src_skin, 0, sizeof(skinname))) {
-			ret = Q_ERR_STRING_TRUNCATED;
-			goto fail;
-		}
-		FS_NormalizePath(skinname, skinname);
-
-		pbr_material_t * mat = MAT_FindPBRMaterial(skinname);
-		if (!mat)
-			Com_EPrintf("error finding material '%s'\n", skinname);
-
-		image_t* image_diffuse = IMG_Find(skinname, IT_SKIN, IF_SRGB);
-		image_t* image_normals = NULL;
-		image_t* image_emissive = NULL;
+	// load all frames
+	md2_frames_t frames = {
+		.header = &header,
+		.rawdata = rawdata,
+		.model = model,
+		.remap = remap,
+		.vertIndices = vertIndices,
+		.tcIndices = tcIndices,
+		.finalIndices = finalIndices,
+		.numindices = numindices,
+		.all_normals_same = all_normals_same
+	};
+	for_each_frame(header.num_frames, decode_md2_frames, &frames);
 
-		if (image_diffuse != R_NOTEXTURE)
-		{
-			// attempt loading the normals texture
-			if (!Q_strlcpy(skinname, src_skin, strlen(src_skin) - 3))
-				return Q_ERR_STRING_TRUNCATED;
-
-			Q_concat(skinname, sizeof(skinname), skinname, "_n.tga", NULL);
-			FS_NormalizePath(skinname, skinname);
-			image_normals = IMG_Find(skinname, IT_SKIN, IF_NONE);
-			if (image_normals == R_NOTEXTURE) image_normals = NULL;
-
-			// attempt loading the emissive texture
-			if (!Q_strlcpy(skinname, src_skin, strlen(src_skin) - 3))
-				return Q_ERR_STRING_TRUNCATED;
-
-			Q_concat(skinname, sizeof(skinname), skinname, "_light.tga", NULL);
-			FS_NormalizePath(skinname, skinname);
-			image_emissive = IMG_Find(skinname, IT_SKIN, IF_SRGB);
-			if (image_emissive == R_NOTEXTURE) image_emissive = NULL;
-		}
-
-		MAT_RegisterPBRMaterial(mat, image_diffuse, image_normals, image_emissive);
-
-		dst_mesh->materials[i] = mat;
-
-        src_skin += MD2_MAX_SKINNAME;
+	// fix winding order
+	for (int i = 0; i < dst_mesh->numindices; i += 3) {
+		int tmp = dst_mesh->indices[i + 1];
+		dst_mesh->indices[i + 1] = dst_mesh->indices[i + 2];
+		dst_mesh->indices[i + 2] = tmp;
 	}
 
-	// load all tcoords
-	src_tc = (dmd2stvert_t *)((byte *)rawdata + header.ofs_st);
-	scale_s = 1.0f / header.skinwidth;
-	scale_t = 1.0f / header.skinheight;
-
-	// load all frames
-	src_frame = (dmd2frame_t *)((byte *)rawdata + header.ofs_frames);
-	dst_frame = model->frames;
-	for (int j = 0; j < header.num_frames; j++) {
-		LittleVector(src_frame->scale, dst_frame->scale);
-		LittleVector(src_frame->translate, dst_frame->translate);
-
-		// load frame vertices
-		ClearBounds(mins, maxs);
-
-		for (int i = 0; i < numindices; i++) {
-			if (remap[i] != i) {
-				continue;
-			}
-			src_vert = &src_frame->verts[vertIndices[i]];
-			vec3_t *dst_pos = &dst_mesh->positions [j * numverts + finalIndices[i]];
-			vec3_t *dst_nrm = &dst_mesh->normals   [j * numverts + finalIndices[i]];
-			vec2_t *dst_tc  = &dst_mesh->tex_coords[j * numverts + finalIndices[i]];
-
-			(*dst_tc)[0] = scale_s * src_tc[tcIndices[i]].s;
-			(*dst_tc)[1] = scale_t * src_tc[tcIndices[i]].t;
-
-			(*dst_pos)[0] = src_vert->v[0] * dst_frame->scale[0] + dst_frame->translate[0];
-			(*dst_pos)[1] = src_vert->v[1] * dst_frame->scale[1] + dst_frame->translate[1];
-			(*dst_pos)[2] = src_vert->v[2] * dst_frame->scale[2] + dst_frame->translate[2];
-
-			(*dst_nrm)[0] = 0.0f;
-			(*dst_nrm)[1] = 0.0f;
-			(*dst_nrm)[2] = 0.0f;
-
-			val = src_vert->lightnormalindex;
-
-			if (val < NUMVERTEXNORMALS) {
-				(*dst_nrm)[0] = bytedirs[val][0];
-				(*dst_nrm)[1] = bytedirs[val][1];
-				(*dst_nrm)[2] = bytedirs[val][2];
-			}
+	computeTangents(model);
 
-			for (int k = 0; k < 3; k++) {
-				val = (*dst_pos)[k];
-				if (val < mins[k])
-					mins[k] = val;
-				if (val > maxs[k])
-					maxs[k] = val;
-			}
-		}
-
-		// if all normals are the same, rebuild them as flat triangle normals
-		if (all_normals_same)
-		{
-			for (int tri = 0; tri < numindices / 3; tri++)
-			{
-				int i0 = j * numverts + finalIndices[tri * 3 + 0];
-				int i1 = j * numverts + finalIndices[tri * 3 + 1];
-				int i2 = j * numverts + finalIndices[tri * 3 + 2];
-
-				vec3_t *p0 = &dst_mesh->positions[i0];
-				vec3_t *p1 = &dst_mesh->positions[i1];
-				vec3_t *p2 = &dst_mesh->positions[i2];
+	return Q_ERR_SUCCESS;
+}
 
-				vec3_t e1, e2, n;
-				VectorSubtract(*p1, *p0, e1);
-				VectorSubtract(*p2, *p0, e2);
-				CrossProduct(e2, e1, n);
-				VectorNormalize(n);
+qerror_t MOD_LoadMD2_RTX(model_t *model, const void *rawdata, size_t length)
+{
+	dmd2header_t    header;
+	char            *src_skin;
+	qerror_t        ret;
 
-				VectorCopy(n, dst_mesh->normals[i0]);
-				VectorCopy(n, dst_mesh->normals[i1]);
-				VectorCopy(n, dst_mesh->normals[i2]);
-			}
+	ret = read_md2_header(&header, rawdata, length);
+	if (ret) {
+		if (ret == Q_ERR_TOO_FEW) {
+			// empty models draw nothing
+			model->type = MOD_EMPTY;
+			return Q_ERR_SUCCESS;
 		}
-
-		VectorVectorScale(mins, dst_frame->scale, mins);
-		VectorVectorScale(maxs, dst_frame->scale, maxs);
-
-		dst_frame->radius = RadiusFromBounds(mins, maxs);
-
-		VectorAdd(mins, dst_frame->translate, dst_frame->bounds[0]);
-		VectorAdd(maxs, dst_frame->translate, dst_frame->bounds[1]);
-
-		src_frame = (dmd2frame_t *)((byte *)src_frame + header.framesize);
-		dst_frame++;
+		return ret;
 	}
 
-	// fix winding order
-	for (int i = 0; i < dst_mesh->numindices; i += 3) {
-		int tmp = dst_mesh->indices[i + 1];
-		dst_mesh->indices[i + 1] = dst_mesh->indices[i + 2];
-		dst_mesh->indices[i + 2] = tmp;
+	ret = load_geometry(model, rawdata, length, load_md2_geometry);
+	if (ret) {
+		return ret;
 	}
 
-    computeTangents(model);
+	// load all skins
+	src_skin = (char *)rawdata + header.ofs_skins;
+	for (int i = 0; i < header.num_skins; i++) {
+		ret = load_skin(src_skin, &model->meshes[0].materials[i]);
+		if (ret)
+			goto fail;
+
+		src_skin += MD2_MAX_SKINNAME;
+	}
 
 	Hunk_End(&model->hunk);
 	return Q_ERR_SUCCESS;
@@ -485,118 +860,106 @@ fail:
 #define TAB_SIN(x) qvk.sintab[(x) & 255]
 #define TAB_COS(x) qvk.sintab[((x) + 64) & 255]
 
-static qerror_t MOD_LoadMD3Mesh(model_t *model, maliasmesh_t *mesh,
-		const byte *rawdata, size_t length, size_t *offset_p)
+static qerror_t read_md3_header(dmd3header_t *header, const void *rawdata, size_t length)
+{
+	size_t          end;
+	int             i;
+
+	if (length < sizeof(*header))
+		return Q_ERR_FILE_TOO_SMALL;
+
+	// byte swap the header
+	*header = *(dmd3header_t *)rawdata;
+	for (i = 0; i < sizeof(*header) / 4; i++)
+		((uint32_t *)header)[i] = LittleLong(((uint32_t *)header)[i]);
+
+	if (header->ident != MD3_IDENT)
+		return Q_ERR_UNKNOWN_FORMAT;
+	if (header->version != MD3_VERSION)
+		return Q_ERR_UNKNOWN_FORMAT;
+	if (header->num_frames < 1)
+		return Q_ERR_TOO_FEW;
+	if (header->num_frames > MD3_MAX_FRAMES)
+		return Q_ERR_TOO_MANY;
+	end = header->ofs_frames + sizeof(dmd3frame_t) * header->num_frames;
+	if (end < header->ofs_frames || end > length)
+		return Q_ERR_BAD_EXTENT;
+	if (header->num_meshes < 1)
+		return Q_ERR_TOO_FEW;
+	if (header->num_meshes > MD3_MAX_MESHES)
+		return Q_ERR_TOO_MANY;
+	if (header->ofs_meshes > length)
+		return Q_ERR_BAD_EXTENT;
+
+	return Q_ERR_SUCCESS;
+}
+
+static qerror_t read_md3_mesh_header(dmd3mesh_t *header, const byte *rawdata, size_t length, int numframes)
 {
-	dmd3mesh_t      header;
 	size_t          end;
-	dmd3vertex_t    *src_vert;
-	dmd3coord_t     *src_tc;
-	dmd3skin_t      *src_skin;
-	uint32_t        *src_idx;
-	vec3_t          *dst_vert;
-	vec3_t          *dst_norm;
-	vec2_t          *dst_tc;
-    vec4_t          *dst_tan;
-	int  *dst_idx;
-	char            skinname[MAX_QPATH];
 	int             i;
 
-	if (length < sizeof(header))
+	if (length < sizeof(*header))
 		return Q_ERR_BAD_EXTENT;
 
 	// byte swap the header
-	header = *(dmd3mesh_t *)rawdata;
-	for (i = 0; i < sizeof(header) / 4; i++)
-		((uint32_t *)&header)[i] = LittleLong(((uint32_t *)&header)[i]);
+	*header = *(dmd3mesh_t *)rawdata;
+	for (i = 0; i < sizeof(*header) / 4; i++)
+		((uint32_t *)header)[i] = LittleLong(((uint32_t *)header)[i]);
 
-	if (header.meshsize < sizeof(header) || header.meshsize > length)
+	if (header->meshsize < sizeof(*header) || header->meshsize > length)
 		return Q_ERR_BAD_EXTENT;
-	if (header.num_verts < 3)
+	if (header->num_verts < 3)
 		return Q_ERR_TOO_FEW;
-	if (header.num_verts > TESS_MAX_VERTICES)
+	if (header->num_verts > TESS_MAX_VERTICES)
 		return Q_ERR_TOO_MANY;
-	if (header.num_tris < 1)
+	if (header->num_tris < 1)
 		return Q_ERR_TOO_FEW;
-	if (header.num_tris > TESS_MAX_INDICES / 3)
+	if (header->num_tris > TESS_MAX_INDICES / 3)
 		return Q_ERR_TOO_MANY;
-	if (header.num_skins > MAX_ALIAS_SKINS)
+	if (header->num_skins > MAX_ALIAS_SKINS)
 		return Q_ERR_TOO_MANY;
-	end = header.ofs_skins + header.num_skins * sizeof(dmd3skin_t);
-	if (end < header.ofs_skins || end > length)
+	end = header->ofs_skins + header->num_skins * sizeof(dmd3skin_t);
+	if (end < header->ofs_skins || end > length)
 		return Q_ERR_BAD_EXTENT;
-	end = header.ofs_verts + header.num_verts * model->numframes * sizeof(dmd3vertex_t);
-	if (end < header.ofs_verts || end > length)
+	end = header->ofs_verts + header->num_verts * numframes * sizeof(dmd3vertex_t);
+	if (end < header->ofs_verts || end > length)
 		return Q_ERR_BAD_EXTENT;
-	end = header.ofs_tcs + header.num_verts * sizeof(dmd3coord_t);
-	if (end < header.ofs_tcs || end > length)
+	end = header->ofs_tcs + header->num_verts * sizeof(dmd3coord_t);
+	if (end < header->ofs_tcs || end > length)
 		return Q_ERR_BAD_EXTENT;
-	end = header.ofs_indexes + header.num_tris * 3 * sizeof(uint32_t);
-	if (end < header.ofs_indexes || end > length)
+	end = header->ofs_indexes + header->num_tris * 3 * sizeof(uint32_t);
+	if (end < header->ofs_indexes || end > length)
 		return Q_ERR_BAD_EXTENT;
 
-	mesh->numtris = header.num_tris;
-	mesh->numindices = header.num_tris * 3;
-	mesh->numverts = header.num_verts;
-	mesh->numskins = header.num_skins;
-	mesh->positions = MOD_Malloc(header.num_verts * model->numframes * sizeof(vec3_t));
-	mesh->normals = MOD_Malloc(header.num_verts * model->numframes * sizeof(vec3_t));
-	mesh->tex_coords = MOD_Malloc(header.num_verts * model->numframes * sizeof(vec2_t));
-    mesh->tangents = MOD_Malloc(header.num_verts * header.num_frames * sizeof(vec4_t));
-	mesh->indices = MOD_Malloc(sizeof(int) * header.num_tris * 3);
-
-	// load all skins
-	src_skin = (dmd3skin_t *)(rawdata + header.ofs_skins);
-	for (i = 0; i < header.num_skins; i++) {
-		if (!Q_memccpy(skinname, src_skin->name, 0, sizeof(skinname)))
-			return Q_ERR_STRING_TRUNCATED;
-		FS_NormalizePath(skinname, skinname);
-
-		pbr_material_t * mat = MAT_FindPBRMaterial(skinname);
-		if (!mat)
-			Com_EPrintf("error finding material '%s'\n", skinname);
-
-		image_t* image_diffuse = IMG_Find(skinname, IT_SKIN, IF_SRGB);
-		image_t* image_normals = NULL;
-		image_t* image_emissive = NULL;
-
-		if (image_diffuse != R_NOTEXTURE)
-		{
-			// attempt loading the normals texture
-			if (!Q_strlcpy(skinname, src_skin->name, strlen(src_skin->name) - 3))
-				return Q_ERR_STRING_TRUNCATED;
-
-			Q_concat(skinname, sizeof(skinname), skinname, "_n.tga", NULL);
-			FS_NormalizePath(skinname, skinname);
-			image_normals = IMG_Find(skinname, IT_SKIN, IF_NONE);
-			if (image_normals == R_NOTEXTURE) image_normals = NULL;
-
-			// attempt loading the emissive texture
-			if (!Q_strlcpy(skinname, src_skin->name, strlen(src_skin->name) - 3))
-				return Q_ERR_STRING_TRUNCATED;
-
-			Q_concat(skinname, sizeof(skinname), skinname, "_light.tga", NULL);
-			FS_NormalizePath(skinname, skinname);
-			image_emissive = IMG_Find(skinname, IT_SKIN, IF_SRGB);
-			if (image_emissive == R_NOTEXTURE) image_emissive = NULL;
-		}
-
-		MAT_RegisterPBRMaterial(mat, image_diffuse, image_normals, image_emissive);
+	return Q_ERR_SUCCESS;
+}
 
-		mesh->materials[i] = mat;
-    }
+typedef struct {
+	const dmd3vertex_t  *verts;
+	const dmd3coord_t   *tcs;
+	maliasmesh_t        *mesh;
+} md3_frames_t;
 
-	// load all vertices
-	src_vert = (dmd3vertex_t *)(rawdata + header.ofs_verts);
-	dst_vert = mesh->positions;
-	dst_norm = mesh->normals;
-	dst_tc = mesh->tex_coords;
-    dst_tan = mesh->tangents;
-	for (int frame = 0; frame < header.num_frames; frame++)
+static void decode_md3_frames(void *arg, int start, int end)
+{
+	const md3_frames_t  *job = arg;
+	maliasmesh_t        *mesh = job->mesh;
+	const dmd3vertex_t  *src_vert;
+	const dmd3coord_t   *src_tc;
+	vec3_t              *dst_vert;
+	vec3_t              *dst_norm;
+	vec2_t              *dst_tc;
+
+	src_vert = job->verts + start * mesh->numverts;
+	dst_vert = mesh->positions + start * mesh->numverts;
+	dst_norm = mesh->normals + start * mesh->numverts;
+	dst_tc = mesh->tex_coords + start * mesh->numverts;
+	for (int frame = start; frame < end; frame++)
 	{
-		src_tc = (dmd3coord_t *)(rawdata + header.ofs_tcs);
+		src_tc = job->tcs;
 
-		for (i = 0; i < header.num_verts; i++) 
+		for (int i = 0; i < mesh->numverts; i++)
 		{
 			(*dst_vert)[0] = (float)(src_vert->point[0]) / 64.f;
 			(*dst_vert)[1] = (float)(src_vert->point[1]) / 64.f;
@@ -614,73 +977,80 @@ static qerror_t MOD_LoadMD3Mesh(model_t *model, maliasmesh_t *mesh,
 			(*dst_tc)[0] = LittleFloat(src_tc->st[0]);
 			(*dst_tc)[1] = LittleFloat(src_tc->st[1]);
 
-            (*dst_tan)[0] = 0.0f;
-            (*dst_tan)[1] = 0.0f;
-            (*dst_tan)[2] = 0.0f;
-            (*dst_tan)[3] = 0.0f;
-
 			src_vert++; dst_vert++; dst_norm++;
-            src_tc++; dst_tc++; dst_tan++;
+			src_tc++; dst_tc++;
 		}
 	}
+}
 
+static qerror_t MOD_LoadMD3Mesh(model_t *model, maliasmesh_t *mesh,
+		const byte *rawdata, size_t length, size_t *offset_p)
+{
+	dmd3mesh_t      header;
+	uint32_t        *src_idx;
+	int             *dst_idx;
+	int             i;
+	qerror_t        ret;
 
-	// load all triangle indices
+	ret = read_md3_mesh_header(&header, rawdata, length, model->numframes);
+	if (ret)
+		return ret;
+
+	mesh->numtris = header.num_tris;
+	mesh->numindices = header.num_tris * 3;
+	mesh->numverts = header.num_verts;
+	mesh->numskins = header.num_skins;
+	mesh->positions = MOD_Malloc(header.num_verts * model->numframes * sizeof(vec3_t));
+	mesh->normals = MOD_Malloc(header.num_verts * model->numframes * sizeof(vec3_t));
+	mesh->tex_coords = MOD_Malloc(header.num_verts * model->numframes * sizeof(vec2_t));
+	mesh->tangents = MOD_Malloc(header.num_verts * model->numframes * sizeof(vec4_t));
+	mesh->indices = MOD_Malloc(sizeof(int) * header.num_tris * 3);
+
+	// load all triangle indices, tangents are computed from all of them
 	src_idx = (uint32_t *)(rawdata + header.ofs_indexes);
 	dst_idx = mesh->indices;
-	for (i = 0; i < header.num_tris; i++) 
+	for (i = 0; i < header.num_tris; i++)
 	{
 		dst_idx[0] = LittleLong(src_idx[2]);
 		dst_idx[1] = LittleLong(src_idx[1]);
 		dst_idx[2] = LittleLong(src_idx[0]);
 
-		if (dst_idx[0] >= header.num_verts)
+		if (dst_idx[0] >= header.num_verts ||
+			dst_idx[1] >= header.num_verts ||
+			dst_idx[2] >= header.num_verts)
 			return Q_ERR_BAD_INDEX;
 
 		src_idx += 3;
 		dst_idx += 3;
 	}
-	
+
+	// load all vertices
+	md3_frames_t frames = {
+		.verts = (const dmd3vertex_t *)(rawdata + header.ofs_verts),
+		.tcs = (const dmd3coord_t *)(rawdata + header.ofs_tcs),
+		.mesh = mesh
+	};
+	for_each_frame(model->numframes, decode_md3_frames, &frames);
+
 	*offset_p = header.meshsize;
 
 	return Q_ERR_SUCCESS;
 }
 
-qerror_t MOD_LoadMD3_RTX(model_t *model, const void *rawdata, size_t length)
+// Everything but the skins. Leaves the hunk open on success.
+static qerror_t load_md3_geometry(model_t *model, const void *rawdata, size_t length)
 {
 	dmd3header_t    header;
-	size_t          end, offset, remaining;
+	size_t          offset, remaining;
 	dmd3frame_t     *src_frame;
 	maliasframe_t   *dst_frame;
 	const byte      *src_mesh;
 	int             i;
 	qerror_t        ret;
 
-	if (length < sizeof(header))
-		return Q_ERR_FILE_TOO_SMALL;
-
-	// byte swap the header
-	header = *(dmd3header_t *)rawdata;
-	for (i = 0; i < sizeof(header) / 4; i++)
-		((uint32_t *)&header)[i] = LittleLong(((uint32_t *)&header)[i]);
-
-	if (header.ident != MD3_IDENT)
-		return Q_ERR_UNKNOWN_FORMAT;
-	if (header.version != MD3_VERSION)
-		return Q_ERR_UNKNOWN_FORMAT;
-	if (header.num_frames < 1)
-		return Q_ERR_TOO_FEW;
-	if (header.num_frames > MD3_MAX_FRAMES)
-		return Q_ERR_TOO_MANY;
-	end = header.ofs_frames + sizeof(dmd3frame_t) * header.num_frames;
-	if (end < header.ofs_frames || end > length)
-		return Q_ERR_BAD_EXTENT;
-	if (header.num_meshes < 1)
-		return Q_ERR_TOO_FEW;
-	if (header.num_meshes > MD3_MAX_MESHES)
-		return Q_ERR_TOO_MANY;
-	if (header.ofs_meshes > length)
-		return Q_ERR_BAD_EXTENT;
+	ret = read_md3_header(&header, rawdata, length);
+	if (ret)
+		return ret;
 
 	Hunk_Begin(&model->hunk, 0x4000000);
 	model->type = MOD_ALIAS;
@@ -714,7 +1084,52 @@ qerror_t MOD_LoadMD3_RTX(model_t *model, const void *rawdata, size_t length)
 		remaining -= offset;
 	}
 
-    computeTangents(model);
+	computeTangents(model);
+
+	return Q_ERR_SUCCESS;
+
+fail:
+	Hunk_Free(&model->hunk);
+	return ret;
+}
+
+qerror_t MOD_LoadMD3_RTX(model_t *model, const void *rawdata, size_t length)
+{
+	dmd3header_t    header;
+	dmd3mesh_t      mesh_header;
+	dmd3skin_t      *src_skin;
+	const byte      *src_mesh;
+	size_t          remaining;
+	qerror_t        ret;
+
+	ret = read_md3_header(&header, rawdata, length);
+	if (ret)
+		return ret;
+
+	ret = load_geometry(model, rawdata, length, load_md3_geometry);
+	if (ret)
+		return ret;
+
+	// load all skins
+	src_mesh = (const byte *)rawdata + header.ofs_meshes;
+	remaining = length - header.ofs_meshes;
+	for (int i = 0; i < header.num_meshes; i++) {
+		maliasmesh_t *mesh = &model->meshes[i];
+
+		ret = read_md3_mesh_header(&mesh_header, src_mesh, remaining, model->numframes);
+		if (ret)
+			goto fail;
+
+		src_skin = (dmd3skin_t *)(src_mesh + mesh_header.ofs_skins);
+		for (int j = 0; j < mesh_header.num_skins; j++) {
+			ret = load_skin(src_skin[j].name, &mesh->materials[j]);
+			if (ret)
+				goto fail;
+		}
+
+		src_mesh += mesh_header.meshsize;
+		remaining -= mesh_header.meshsize;
+	}
 
 	//if (strstr(model->name, "v_blast"))
 	//	export_obj_frames(model, "export/v_blast_%d.obj");
@@ -728,6 +1143,173 @@ fail:
 }
 #endif
 
+#if USE_TESTS
+typedef struct {
+	int models;
+	int skipped;
+	int failures;
+	int mismatches;
+	size_t cache_size;
+	uint64_t serial_usec;
+	uint64_t parallel_usec;
+	uint64_t cache_usec;
+} model_test_t;
+
+static qboolean
+compare_models(const model_t* a, const model_t* b)
+{
+	if (a->numframes != b->numframes || a->nummeshes != b->nummeshes ||
+		memcmp(a->frames, b->frames, a->numframes * sizeof(maliasframe_t)))
+		return qfalse;
+
+	for (int i = 0; i < a->nummeshes; i++)
+	{
+		const maliasmesh_t* ma = &a->meshes[i];
+		const maliasmesh_t* mb = &b->meshes[i];
+		size_t count = (size_t)ma->numverts * a->numframes;
+
+		if (ma->numverts != mb->numverts || ma->numtris != mb->numtris ||
+			ma->numindices != mb->numindices || ma->numskins != mb->numskins)
+			return qfalse;
+
+		if (memcmp(ma->indices, mb->indices, ma->numindices * sizeof(int)) ||
+			memcmp(ma->positions, mb->positions, count * sizeof(vec3_t)) ||
+			memcmp(ma->normals, mb->normals, count * sizeof(vec3_t)) ||
+			memcmp(ma->tex_coords, mb->tex_coords, count * sizeof(vec2_t)) ||
+			memcmp(ma->tangents, mb->tangents, count * sizeof(vec4_t)))
+			return qfalse;
+	}
+
+	return qtrue;
+}
+
+// Decodes the model on one thread and on all worker threads, then round
+// trips it through a cache entry. All three must be bit identical.
+static void
+model_load_test_file(model_test_t* t, const char* name)
+{
+	model_t serial = { 0 }, parallel = { 0 }, cached = { 0 }, rejected = { 0 };
+	load_geometry_t load = load_md2_geometry;
+	void* rawdata;
+	uint64_t start;
+	qerror_t ret;
+
+	ssize_t len = FS_LoadFile(name, &rawdata);
+	if (!rawdata)
+	{
+		Com_EPrintf("%s: %s\n", name, Q_ErrorString(len));
+		t->failures++;
+		return;
+	}
+
+#if USE_MD3
+	if (len >= 4 && LittleLong(*(uint32_t*)rawdata) == MD3_IDENT)
+		load = load_md3_geometry;
+#endif
+
+	start = Sys_Microseconds();
+	parallel_frames = qfalse;
+	ret = load(&serial, rawdata, len);
+	parallel_frames = qtrue;
+	t->serial_usec += Sys_Microseconds() - start;
+
+	if (ret)
+	{
+		// empty models are fine
+		if (ret == Q_ERR_TOO_FEW)
+		{
+			t->skipped++;
+		}
+		else
+		{
+			Com_EPrintf("%s: %s\n", name, Q_ErrorString(ret));
+			t->failures++;
+		}
+		FS_FreeFile(rawdata);
+		return;
+	}
+
+	start = Sys_Microseconds();
+	load(&parallel, rawdata, len);
+	t->parallel_usec += Sys_Microseconds() - start;
+
+	uint32_t checksum = Com_BlockChecksum(rawdata, len);
+	size_t size;
+	byte* entry = write_model_cache(&parallel, checksum, len, &size);
+	t->cache_size += size;
+
+	start = Sys_Microseconds();
+	qboolean loaded = read_model_cache(&cached, entry, size, checksum, len);
+	t->cache_usec += Sys_Microseconds() - start;
+
+	if (!compare_models(&serial, &parallel))
+	{
+		Com_EPrintf("%s: threaded decode differs\n", name);
+		t->mismatches++;
+	}
+	else if (!loaded || !compare_models(&serial, &cached))
+	{
+		Com_EPrintf("%s: cached model differs\n", name);
+		t->mismatches++;
+	}
+
+	if (read_model_cache(&rejected, entry, size, checksum ^ 1, len) ||
+		read_model_cache(&rejected, entry, size, checksum, len + 1) ||
+		read_model_cache(&rejected, entry, size - 1, checksum, len))
+	{
+		Com_EPrintf("%s: stale or truncated cache entry accepted\n", name);
+		t->failures++;
+		Hunk_Free(&rejected.hunk);
+	}
+
+	Z_Free(entry);
+	Hunk_Free(&serial.hunk);
+	Hunk_Free(&parallel.hunk);
+	Hunk_Free(&cached.hunk);
+	FS_FreeFile(rawdata);
+	t->models++;
+}
+
+// Loads the geometry of every model, doesn't need the renderer to be running.
+void vkpt_model_load_test_f(void)
+{
+	static const char* const dirs[] = { "models", "players" };
+#if USE_MD3
+	static const char* const exts[] = { ".md2", ".md3" };
+#else
+	static const char* const exts[] = { ".md2" };
+#endif
+	model_test_t t = { 0 };
+
+	// set up by R_Init_RTX, which the test doesn't depend on
+	for (int i = 0; i < 256; i++) {
+		qvk.sintab[i] = sinf(i * (2 * M_PI / 255));
+	}
+
+	for (int i = 0; i < q_countof(dirs); i++)
+	{
+		for (int j = 0; j < q_countof(exts); j++)
+		{
+			int count;
+			void** list = FS_ListFiles(dirs[i], exts[j], FS_SEARCH_SAVEPATH, &count);
+			if (!list)
+				continue;
+
+			for (int k = 0; k < count; k++)
+				model_load_test_file(&t, list[k]);
+
+			FS_FreeList(list);
+		}
+	}
+
+	Com_Printf("%d models tested, %d empty, %d mismatches, %d failures\n",
+		t.models, t.skipped, t.mismatches, t.failures);
+	Com_Printf("%.1f msec on 1 thread, %.1f msec on %d threads, %.1f msec from %.1f MB of cache entries\n",
+		t.serial_usec * 1e-3, t.parallel_usec * 1e-3, Com_NumJobThreads(),
+		t.cache_usec * 1e-3, t.cache_size / 1048576.0);
+}
+#endif
+
 void MOD_Reference_RTX(model_t *model)
 {
 	int mesh_idx, skin_idx, frame_idx;
@@ -338,6 +338,21 @@ get_geometry(VkBuffer buffer, size_t offset, uint32_t num_vertices)
 	return geometry;
 }
 
+/* indexed variant for the welded world mesh: vertices are shared between
+ * triangles, so the vertex range covers the whole mesh and each part of it
+ * is selected by its range of indices */
+static inline VkGeometryNV
+get_geometry_indexed(VkBuffer buffer, size_t vertex_offset, uint32_t num_vertices,
+		size_t index_offset, uint32_t num_indices)
+{
+	VkGeometryNV geometry = get_geometry(buffer, vertex_offset, num_vertices);
+	geometry.geometry.triangles.indexData   = buffer;
+	geometry.geometry.triangles.indexOffset = index_offset;
+	geometry.geometry.triangles.indexCount  = num_indices;
+	geometry.geometry.triangles.indexType   = VK_INDEX_TYPE_UINT32;
+	return geometry;
+}
+
 VkResult
 vkpt_pt_destroy_static()
 {
@@ -450,10 +465,8 @@ static int accel_matches(accel_bottom_match_info_t *match,
 #define DYNAMIC_GEOMETRY_BLOAT_FACTOR 2
 
 static VkResult
-vkpt_pt_create_accel_bottom(
-		VkBuffer vertex_buffer,
-		size_t buffer_offset,
-		int num_vertices,
+vkpt_pt_build_accel_bottom(
+		VkGeometryNV geometry,
 		VkAccelerationStructureNV *accel,
 		accel_bottom_match_info_t *match,
 		VkDeviceMemory *mem_accel,
@@ -464,8 +477,6 @@ vkpt_pt_create_accel_bottom(
 	assert(accel);
 	assert(mem_accel);
 
-	VkGeometryNV geometry = get_geometry(vertex_buffer, buffer_offset, num_vertices);
-
 	int doFree = 0;
 	int doAlloc = 0;
 
@@ -559,23 +570,43 @@ vkpt_pt_create_accel_bottom(
 	return VK_SUCCESS;
 }
 
+static VkResult
+vkpt_pt_create_accel_bottom(
+		VkBuffer vertex_buffer,
+		size_t buffer_offset,
+		int num_vertices,
+		VkAccelerationStructureNV *accel,
+		accel_bottom_match_info_t *match,
+		VkDeviceMemory *mem_accel,
+		VkCommandBuffer cmd_buf,
+		int fast_build
+		)
+{
+	VkGeometryNV geometry = get_geometry(vertex_buffer, buffer_offset, num_vertices);
+
+	return vkpt_pt_build_accel_bottom(geometry, accel, match, mem_accel, cmd_buf, fast_build);
+}
+
 VkResult
 vkpt_pt_create_static(
 		VkBuffer vertex_buffer,
-		size_t buffer_offset,
-		int num_vertices, 
-		int num_vertices_transparent,
-		int num_vertices_sky
+		size_t vertex_offset,
+		size_t index_offset,
+		int num_vertices,
+		int num_indices,
+		int transparent_offset,
+		int num_indices_transparent,
+		int sky_offset,
+		int num_indices_sky
 		)
 {
 	VkCommandBuffer cmd_buf = vkpt_begin_command_buffer(&qvk.cmd_buffers_graphics);
 
 	scratch_buf_ptr = 0;
 
-	VkResult ret = vkpt_pt_create_accel_bottom(
-		vertex_buffer,
-		buffer_offset,
-		num_vertices,
+	VkResult ret = vkpt_pt_build_accel_bottom(
+		get_geometry_indexed(vertex_buffer, vertex_offset, num_vertices,
+			index_offset, num_indices),
 		&accel_static,
 		NULL,
 		&mem_accel_static,
@@ -585,10 +616,9 @@ vkpt_pt_create_static(
 	MEM_BARRIER_BUILD_ACCEL(cmd_buf);
 	scratch_buf_ptr = 0;
 
-	ret = vkpt_pt_create_accel_bottom(
-		vertex_buffer,
-		buffer_offset + num_vertices * sizeof(float) * 3,
-		num_vertices_transparent,
+	ret = vkpt_pt_build_accel_bottom(
+		get_geometry_indexed(vertex_buffer, vertex_offset, num_vertices,
+			index_offset + transparent_offset * sizeof(uint32_t), num_indices_transparent),
 		&accel_transparent,
 		NULL,
 		&mem_accel_transparent,
@@ -598,10 +628,9 @@ vkpt_pt_create_static(
 	MEM_BARRIER_BUILD_ACCEL(cmd_buf);
 	scratch_buf_ptr = 0;
 
-	ret = vkpt_pt_create_accel_bottom(
-		vertex_buffer,
-		buffer_offset + (num_vertices + num_vertices_transparent) * sizeof(float) * 3,
-		num_vertices_sky,
+	ret = vkpt_pt_build_accel_bottom(
+		get_geometry_indexed(vertex_buffer, vertex_offset, num_vertices,
+			index_offset + sky_offset * sizeof(uint32_t), num_indices_sky),
 		&accel_sky,
 		NULL,
 		&mem_accel_sky,
@@ -611,8 +640,8 @@ vkpt_pt_create_static(
 	MEM_BARRIER_BUILD_ACCEL(cmd_buf);
 	scratch_buf_ptr = 0;
 
-	transparent_primitive_offset = num_vertices / 3;
-	sky_primitive_offset = transparent_primitive_offset + num_vertices_transparent / 3;
+	transparent_primitive_offset = transparent_offset / 3;
+	sky_primitive_offset = sky_offset / 3;
 
 	vkpt_submit_command_buffer_simple(cmd_buf, qvk.queue_graphics, qtrue);
 	vkpt_wait_idle(qvk.queue_graphics, &qvk.cmd_buffers_graphics);
@@ -64,6 +64,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	VERTEX_BUFFER_LIST_DO(uint32_t, 1, materials_bsp,         (MAX_VERT_BSP / 3    )) \
 	VERTEX_BUFFER_LIST_DO(uint32_t, 1, clusters_bsp,          (MAX_VERT_BSP / 3    )) \
 	VERTEX_BUFFER_LIST_DO(float,    1, texel_density_bsp,     (MAX_VERT_BSP / 3    )) \
+	VERTEX_BUFFER_LIST_DO(uint32_t, 3, idx_bsp,               (MAX_VERT_BSP / 3    )) \
 	\
 	VERTEX_BUFFER_LIST_DO(float,    3, positions_model,       (MAX_VERT_MODEL      )) \
 	VERTEX_BUFFER_LIST_DO(float,    3, normals_model,         (MAX_VERT_MODEL      )) \
@@ -354,10 +355,12 @@ struct Triangle
 Triangle
 get_bsp_triangle(uint prim_id)
 {
+	uvec3 idx = get_idx_bsp(prim_id);
+
 	Triangle t;
-	t.positions[0] = get_positions_bsp(prim_id * 3 + 0);
-	t.positions[1] = get_positions_bsp(prim_id * 3 + 1);
-	t.positions[2] = get_positions_bsp(prim_id * 3 + 2);
+	t.positions[0] = get_positions_bsp(idx[0]);
+	t.positions[1] = get_positions_bsp(idx[1]);
+	t.positions[2] = get_positions_bsp(idx[2]);
 
 	t.positions_prev = t.positions;
 
@@ -369,9 +372,9 @@ get_bsp_triangle(uint prim_id)
 	t.normals[1] = normal;
 	t.normals[2] = normal;
 
-	t.tex_coords[0] = get_tex_coords_bsp(prim_id * 3 + 0);
-	t.tex_coords[1] = get_tex_coords_bsp(prim_id * 3 + 1);
-	t.tex_coords[2] = get_tex_coords_bsp(prim_id * 3 + 2);
+	t.tex_coords[0] = get_tex_coords_bsp(idx[0]);
+	t.tex_coords[1] = get_tex_coords_bsp(idx[1]);
+	t.tex_coords[2] = get_tex_coords_bsp(idx[2]);
 
     t.tangent = get_tangents_bsp(prim_id);
 
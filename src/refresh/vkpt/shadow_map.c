@@ -389,8 +389,9 @@ vkpt_shadow_map_render(VkCommandBuffer cmd_buf, float* view_projection_matrix, i
 
 	VkDeviceSize vertex_offset = offsetof(struct VertexBuffer, positions_bsp);
 	vkCmdBindVertexBuffers(cmd_buf, 0, 1, &qvk.buf_vertex.buffer, &vertex_offset);
+	vkCmdBindIndexBuffer(cmd_buf, qvk.buf_vertex.buffer, offsetof(struct VertexBuffer, idx_bsp), VK_INDEX_TYPE_UINT32);
 
-	vkCmdDraw(cmd_buf, num_static_verts, 1, 0, 0);
+	vkCmdDrawIndexed(cmd_buf, num_static_verts, 1, 0, 0, 0);
 
 	vertex_offset = offsetof(struct VertexBuffer, positions_instanced);
 	vkCmdBindVertexBuffers(cmd_buf, 0, 1, &qvk.buf_vertex.buffer, &vertex_offset);
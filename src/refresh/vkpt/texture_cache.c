@@ -0,0 +1,1664 @@
+/*
+Copyright (C) 2019, NVIDIA CORPORATION. All rights reserved.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+  Block compressed texture cache.
+
+  Wall and skin textures can be transcoded into BC1 (opaque) or BC3 (with
+  alpha) with a complete mip chain, and stored as `texcache/<file>.dds`,
+  where <file> is the path of the source image including its extension.
+  A texture loaded from the cache skips decoding the source image and the
+  mip generation blits, and takes 1/8 (BC1) or 1/4 (BC3) of the memory.
+  Textures with alpha can be stored as BC7 instead, which is the same size
+  as BC3 but keeps 8 bits per endpoint. Only BC7 mode 6 is encoded: one
+  RGBA line per block with 16 steps, and no partitions.
+
+  The source image is still read: an entry is only used if the size and a
+  64-bit checksum of the source file match the values stored in the entry,
+  so an edited texture never picks up stale data. Entries are regular DDS
+  files with a DX10 header, the cache fields live in the reserved part of
+  the header. Like the mesh cache, they are stored in native byte order.
+
+  The alpha channel of diffuse maps holds roughness, and the alpha channel
+  of normal maps holds metallic, while the length of filtered normals is
+  used for specular antialiasing. That's why two channel BC5 isn't used
+  for normal maps: it would drop both, and at 1 byte per texel it is no
+  smaller than BC3. Normal maps that don't carry metallic (opaque alpha)
+  are stored as BC1 without it. World normal maps are normalized on
+  registration, so their entries are only accepted if they were normalized
+  before encoding.
+
+  The cache is built from the currently registered textures with the
+  build_texture_cache command, "build_texture_cache bc7" uses BC7 in place
+  of BC3. It is used while pt_texture_cache is 1.
+*/
+
+#include "vkpt.h"
+#include "dds.h"
+#include "common/tests.h"
+#include "system/system.h"
+
+#include <float.h>
+#include <limits.h>
+
+#define TEXCACHE_IDENT          MakeRawLong('Q', 'T', 'E', 'X')
+#define TEXCACHE_VERSION        1
+
+#define TEXCACHE_NORMALIZED     1   // normal map went through vkpt_normalize_normal_map
+
+#define TEXCACHE_MAX_SIZE       16384
+
+// header fields stored in DDS_HEADER::reserved1
+enum {
+	FIELD_IDENT,
+	FIELD_VERSION,
+	FIELD_CHECKSUM_LO,
+	FIELD_CHECKSUM_HI,
+	FIELD_SOURCE_SIZE,
+	FIELD_FLAGS,
+};
+
+typedef struct {
+	DDS_HEADER header;
+	DDS_HEADER_DXT10 dxt10;
+} texcache_header_t;
+
+typedef struct {
+	VkFormat format;
+	int width;
+	int height;
+	int num_levels;
+	uint32_t flags;
+	uint64_t checksum;
+	uint32_t source_size;
+} texcache_info_t;
+
+extern cvar_t *cvar_pt_texture_cache;
+
+static float srgb_to_linear[256];
+static byte linear_to_srgb[4096];
+
+// called on the main thread before any mip chain is built
+static void
+init_tables(void)
+{
+	static qboolean initialized;
+
+	if (initialized)
+		return;
+
+	for (int i = 0; i < 256; i++)
+	{
+		float x = i / 255.f;
+		srgb_to_linear[i] = (x < 0.04045f) ? x / 12.92f : powf((x + 0.055f) / 1.055f, 2.4f);
+	}
+
+	for (int i = 0; i < 4096; i++)
+	{
+		float x = i / 4095.f;
+		x = (x <= 0.0031308f) ? x * 12.92f : 1.055f * powf(x, 1.f / 2.4f) - 0.055f;
+		linear_to_srgb[i] = (byte)(max(0.f, min(1.f, x)) * 255.f + 0.5f);
+	}
+
+	initialized = qtrue;
+}
+
+#define PRIME64_1   0x9E3779B185EBCA87ULL
+#define PRIME64_2   0xC2B2AE3D27D4EB4FULL
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+// Four independent lanes keep the multiplies pipelined, so verifying the
+// source of a cached texture costs much less than reading it.
+static uint64_t
+get_checksum(const void* data, size_t size)
+{
+	const byte* p = data;
+	uint64_t lanes[4] = { PRIME64_1, PRIME64_2, ~PRIME64_1, ~PRIME64_2 };
+	uint64_t word, hash;
+	size_t i;
+
+	for (i = 0; i + 32 <= size; i += 32)
+	{
+		for (int k = 0; k < 4; k++)
+		{
+			memcpy(&word, p + i + k * 8, 8);
+			lanes[k] = rotl64(lanes[k] + word * PRIME64_2, 31) * PRIME64_1;
+		}
+	}
+
+	hash = size;
+	for (int k = 0; k < 4; k++)
+		hash = (hash ^ rotl64(lanes[k], 7 * k + 1)) * PRIME64_1;
+
+	for (; i < size; i++)
+		hash = (hash ^ p[i]) * PRIME64_2;
+
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	return hash;
+}
+
+static int
+get_num_levels(int width, int height)
+{
+	int size = max(width, height);
+	int levels = 1;
+
+	while (size > 1)
+	{
+		size >>= 1;
+		levels++;
+	}
+
+	return levels;
+}
+
+static qboolean
+is_bc3(VkFormat format)
+{
+	return format == VK_FORMAT_BC3_UNORM_BLOCK || format == VK_FORMAT_BC3_SRGB_BLOCK;
+}
+
+static qboolean
+is_bc7(VkFormat format)
+{
+	return format == VK_FORMAT_BC7_UNORM_BLOCK || format == VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+static qboolean
+is_srgb(VkFormat format)
+{
+	return format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK || format == VK_FORMAT_BC3_SRGB_BLOCK ||
+		format == VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+size_t
+vkpt_texture_cache_level_size(VkFormat format, int width, int height)
+{
+	size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+	return blocks * (is_bc3(format) || is_bc7(format) ? 16 : 8);
+}
+
+static size_t
+get_data_size(VkFormat format, int width, int height)
+{
+	int levels = get_num_levels(width, height);
+	size_t size = 0;
+
+	for (int level = 0; level < levels; level++)
+	{
+		size += vkpt_texture_cache_level_size(format, max(width >> level, 1), max(height >> level, 1));
+	}
+
+	return size;
+}
+
+static size_t
+get_rgba_size(int width, int height)
+{
+	int levels = get_num_levels(width, height);
+	size_t size = 0;
+
+	for (int level = 0; level < levels; level++)
+	{
+		size += (size_t)max(width >> level, 1) * max(height >> level, 1) * 4;
+	}
+
+	return size;
+}
+
+static qboolean
+parse_entry(const byte* data, size_t size, texcache_info_t* info)
+{
+	const texcache_header_t* h = (const texcache_header_t*)data;
+
+	if (size < sizeof(*h))
+		return qfalse;
+
+	if (h->header.magic != DDS_MAGIC ||
+		h->header.size != sizeof(DDS_HEADER) - 4 ||
+		h->header.ddspf.fourCC != MAKEFOURCC('D', 'X', '1', '0') ||
+		h->header.reserved1[FIELD_IDENT] != TEXCACHE_IDENT ||
+		h->header.reserved1[FIELD_VERSION] != TEXCACHE_VERSION ||
+		h->dxt10.resourceDimension != DDS_DIMENSION_TEXTURE2D ||
+		h->dxt10.arraySize != 1)
+		return qfalse;
+
+	switch (h->dxt10.dxgiFormat)
+	{
+	case DXGI_FORMAT_BC1_UNORM:      info->format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK; break;
+	case DXGI_FORMAT_BC1_UNORM_SRGB: info->format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK;  break;
+	case DXGI_FORMAT_BC3_UNORM:      info->format = VK_FORMAT_BC3_UNORM_BLOCK;      break;
+	case DXGI_FORMAT_BC3_UNORM_SRGB: info->format = VK_FORMAT_BC3_SRGB_BLOCK;       break;
+	case DXGI_FORMAT_BC7_UNORM:      info->format = VK_FORMAT_BC7_UNORM_BLOCK;      break;
+	case DXGI_FORMAT_BC7_UNORM_SRGB: info->format = VK_FORMAT_BC7_SRGB_BLOCK;       break;
+	default: return qfalse;
+	}
+
+	if (h->header.width < 1 || h->header.width > TEXCACHE_MAX_SIZE ||
+		h->header.height < 1 || h->header.height > TEXCACHE_MAX_SIZE)
+		return qfalse;
+
+	info->width = h->header.width;
+	info->height = h->header.height;
+	info->num_levels = get_num_levels(info->width, info->height);
+
+	if (h->header.mipMapCount != info->num_levels ||
+		size - sizeof(*h) != get_data_size(info->format, info->width, info->height))
+		return qfalse;
+
+	info->flags = h->header.reserved1[FIELD_FLAGS];
+	info->checksum = h->header.reserved1[FIELD_CHECKSUM_LO] | ((uint64_t)h->header.reserved1[FIELD_CHECKSUM_HI] << 32);
+	info->source_size = h->header.reserved1[FIELD_SOURCE_SIZE];
+	return qtrue;
+}
+
+/*
+  BC1 / BC3 block encoding. Endpoints are placed at the extent of the block
+  along its principal axis, then refined once by a least squares fit to the
+  chosen indices. Blocks are always stored in 4 color mode.
+*/
+
+static inline int
+pack_565(const float* c)
+{
+	int r = (int)(max(0.f, min(255.f, c[0])) * (31.f / 255.f) + 0.5f);
+	int g = (int)(max(0.f, min(255.f, c[1])) * (63.f / 255.f) + 0.5f);
+	int b = (int)(max(0.f, min(255.f, c[2])) * (31.f / 255.f) + 0.5f);
+	return (r << 11) | (g << 5) | b;
+}
+
+static inline void
+unpack_565(int c, int* rgb)
+{
+	int r = (c >> 11) & 31;
+	int g = (c >> 5) & 63;
+	int b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+static void
+get_palette(int c0, int c1, int palette[4][3])
+{
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+
+	for (int k = 0; k < 3; k++)
+	{
+		palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+		palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+	}
+}
+
+// picks the closest palette entry for every texel, returns the total error
+static int
+select_indices(const byte* block, int palette[4][3], byte* indices)
+{
+	int error = 0;
+
+	for (int i = 0; i < 16; i++)
+	{
+		const byte* t = block + i * 4;
+		int best = 0, best_dist = INT_MAX;
+
+		for (int j = 0; j < 4; j++)
+		{
+			int dr = t[0] - palette[j][0];
+			int dg = t[1] - palette[j][1];
+			int db = t[2] - palette[j][2];
+			int dist = dr * dr + dg * dg + db * db;
+
+			if (dist < best_dist)
+			{
+				best = j;
+				best_dist = dist;
+			}
+		}
+
+		indices[i] = best;
+		error += best_dist;
+	}
+
+	return error;
+}
+
+static void
+fit_principal_axis(const byte* block, float* e0, float* e1)
+{
+	vec3_t mean, axis, next;
+	float cov[6] = { 0 };
+
+	VectorClear(mean);
+	for (int i = 0; i < 16; i++)
+	{
+		mean[0] += block[i * 4 + 0];
+		mean[1] += block[i * 4 + 1];
+		mean[2] += block[i * 4 + 2];
+	}
+	VectorScale(mean, 1.f / 16.f, mean);
+
+	for (int i = 0; i < 16; i++)
+	{
+		float r = block[i * 4 + 0] - mean[0];
+		float g = block[i * 4 + 1] - mean[1];
+		float b = block[i * 4 + 2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+
+	// power iteration, starting from the row with the largest variance
+	if (cov[0] >= cov[3] && cov[0] >= cov[5])
+		VectorSet(axis, cov[0], cov[1], cov[2]);
+	else if (cov[3] >= cov[5])
+		VectorSet(axis, cov[1], cov[3], cov[4]);
+	else
+		VectorSet(axis, cov[2], cov[4], cov[5]);
+
+	for (int iter = 0; iter < 4; iter++)
+	{
+		next[0] = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		next[1] = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		next[2] = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		if (VectorNormalize2(next, axis) == 0.f)
+			break;
+	}
+
+	float tmin = 0.f, tmax = 0.f;
+	if (VectorNormalize(axis) > 0.f)
+	{
+		tmin = FLT_MAX;
+		tmax = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = (block[i * 4 + 0] - mean[0]) * axis[0]
+			        + (block[i * 4 + 1] - mean[1]) * axis[1]
+			        + (block[i * 4 + 2] - mean[2]) * axis[2];
+			tmin = min(tmin, t);
+			tmax = max(tmax, t);
+		}
+	}
+
+	VectorMA(mean, tmax, axis, e0);
+	VectorMA(mean, tmin, axis, e1);
+}
+
+// least squares endpoints for the given indices, qfalse if degenerate
+static qboolean
+refit_endpoints(const byte* block, const byte* indices, float* e0, float* e1)
+{
+	static const float weights[4] = { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+	float aa = 0.f, ab = 0.f, bb = 0.f;
+	vec3_t ax, bx;
+
+	VectorClear(ax);
+	VectorClear(bx);
+	for (int i = 0; i < 16; i++)
+	{
+		float a = weights[indices[i]];
+		float b = 1.f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int k = 0; k < 3; k++)
+		{
+			ax[k] += a * block[i * 4 + k];
+			bx[k] += b * block[i * 4 + k];
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f)
+		return qfalse;
+
+	det = 1.f / det;
+	for (int k = 0; k < 3; k++)
+	{
+		e0[k] = (bb * ax[k] - ab * bx[k]) * det;
+		e1[k] = (aa * bx[k] - ab * ax[k]) * det;
+	}
+	return qtrue;
+}
+
+static void
+encode_color_block(const byte* block, byte* out)
+{
+	vec3_t e0, e1;
+	int palette[4][3];
+	byte indices[16], refit[16];
+
+	fit_principal_axis(block, e0, e1);
+
+	int c0 = pack_565(e0);
+	int c1 = pack_565(e1);
+	get_palette(c0, c1, palette);
+	int error = select_indices(block, palette, indices);
+
+	if (error > 0 && refit_endpoints(block, indices, e0, e1))
+	{
+		int r0 = pack_565(e0);
+		int r1 = pack_565(e1);
+		get_palette(r0, r1, palette);
+		if (select_indices(block, palette, refit) < error)
+		{
+			c0 = r0;
+			c1 = r1;
+			memcpy(indices, refit, sizeof(indices));
+		}
+	}
+
+	// c0 > c1 selects 4 color mode in BC1
+	if (c0 == c1)
+	{
+		memset(indices, 0, sizeof(indices));
+	}
+	else if (c0 < c1)
+	{
+		int c = c0; c0 = c1; c1 = c;
+		for (int i = 0; i < 16; i++)
+			indices[i] ^= 1;
+	}
+
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= (uint32_t)indices[i] << (i * 2);
+
+	out[0] = c0 & 0xff;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 0xff;
+	out[3] = c1 >> 8;
+	out[4] = bits & 0xff;
+	out[5] = (bits >> 8) & 0xff;
+	out[6] = (bits >> 16) & 0xff;
+	out[7] = bits >> 24;
+}
+
+// BC3 alpha block in 8 value mode, alpha0 = max and alpha1 = min
+static void
+encode_alpha_block(const byte* block, byte* out)
+{
+	int amin = 255, amax = 0;
+
+	for (int i = 0; i < 16; i++)
+	{
+		amin = min(amin, block[i * 4 + 3]);
+		amax = max(amax, block[i * 4 + 3]);
+	}
+
+	uint64_t bits = 0;
+	int range = amax - amin;
+	if (range > 0)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			// step 0 is alpha0, step 7 is alpha1, codes 2-7 are in between
+			int step = ((amax - block[i * 4 + 3]) * 7 + range / 2) / range;
+			int code = (step == 0) ? 0 : (step == 7) ? 1 : step + 1;
+			bits |= (uint64_t)code << (i * 3);
+		}
+	}
+
+	out[0] = amax;
+	out[1] = amin;
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (bits >> (i * 8)) & 0xff;
+}
+
+static void
+decode_color_block(const byte* in, byte* block, qboolean four_colors)
+{
+	int c0 = in[0] | (in[1] << 8);
+	int c1 = in[2] | (in[3] << 8);
+	uint32_t bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+	int palette[4][3];
+	int alpha[4] = { 255, 255, 255, 255 };
+
+	get_palette(c0, c1, palette);
+	if (!four_colors && c0 <= c1)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+			palette[3][k] = 0;
+		}
+		alpha[3] = 0;
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		int index = (bits >> (i * 2)) & 3;
+		block[i * 4 + 0] = palette[index][0];
+		block[i * 4 + 1] = palette[index][1];
+		block[i * 4 + 2] = palette[index][2];
+		block[i * 4 + 3] = alpha[index];
+	}
+}
+
+static void
+decode_alpha_block(const byte* in, byte* block)
+{
+	int alpha[8];
+	uint64_t bits = 0;
+
+	alpha[0] = in[0];
+	alpha[1] = in[1];
+	if (alpha[0] > alpha[1])
+	{
+		for (int k = 2; k < 8; k++)
+			alpha[k] = ((8 - k) * alpha[0] + (k - 1) * alpha[1]) / 7;
+	}
+	else
+	{
+		for (int k = 2; k < 6; k++)
+			alpha[k] = ((6 - k) * alpha[0] + (k - 1) * alpha[1]) / 5;
+		alpha[6] = 0;
+		alpha[7] = 255;
+	}
+
+	for (int i = 0; i < 6; i++)
+		bits |= (uint64_t)in[2 + i] << (i * 8);
+
+	for (int i = 0; i < 16; i++)
+		block[i * 4 + 3] = alpha[(bits >> (i * 3)) & 7];
+}
+
+/*
+  BC7 mode 6 block encoding. Endpoints are RGBA with 7 bits per channel
+  plus one low bit shared by the channels of each endpoint, and every texel
+  picks one of 16 steps between them. Like BC1, the endpoints start at the
+  extent of the block along its principal axis and are refined once by a
+  least squares fit to the chosen indices.
+*/
+
+static const int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// 7 bit channels and the shared low bit closest to the endpoint
+static void
+quantize_bc7_endpoint(const float* e, int* q, int* p)
+{
+	float best_error = FLT_MAX;
+
+	for (int pbit = 0; pbit < 2; pbit++)
+	{
+		int c[4];
+		float error = 0.f;
+
+		for (int k = 0; k < 4; k++)
+		{
+			float v = max(0.f, min(255.f, e[k]));
+			c[k] = (int)((v - pbit) * 0.5f + 0.5f);
+			clamp(c[k], 0, 127);
+			float d = ((c[k] << 1) | pbit) - v;
+			error += d * d;
+		}
+
+		if (error < best_error)
+		{
+			best_error = error;
+			memcpy(q, c, sizeof(c));
+			*p = pbit;
+		}
+	}
+}
+
+static void
+get_bc7_palette(const int* q0, int p0, const int* q1, int p1, int palette[16][4])
+{
+	for (int k = 0; k < 4; k++)
+	{
+		int e0 = (q0[k] << 1) | p0;
+		int e1 = (q1[k] << 1) | p1;
+
+		for (int i = 0; i < 16; i++)
+			palette[i][k] = ((64 - bc7_weights[i]) * e0 + bc7_weights[i] * e1 + 32) >> 6;
+	}
+}
+
+static int
+select_bc7_indices(const byte* block, int palette[16][4], byte* indices)
+{
+	int error = 0;
+
+	for (int i = 0; i < 16; i++)
+	{
+		const byte* t = block + i * 4;
+		int best = 0, best_dist = INT_MAX;
+
+		for (int j = 0; j < 16; j++)
+		{
+			int dist = 0;
+			for (int k = 0; k < 4; k++)
+				dist += (t[k] - palette[j][k]) * (t[k] - palette[j][k]);
+
+			if (dist < best_dist)
+			{
+				best = j;
+				best_dist = dist;
+			}
+		}
+
+		indices[i] = best;
+		error += best_dist;
+	}
+
+	return error;
+}
+
+static void
+fit_principal_axis_rgba(const byte* block, float* e0, float* e1)
+{
+	float mean[4] = { 0 }, axis[4], next[4];
+	float cov[4][4] = { { 0 } };
+
+	for (int i = 0; i < 16; i++)
+		for (int k = 0; k < 4; k++)
+			mean[k] += block[i * 4 + k] * (1.f / 16.f);
+
+	for (int i = 0; i < 16; i++)
+	{
+		for (int j = 0; j < 4; j++)
+			for (int k = 0; k < 4; k++)
+				cov[j][k] += (block[i * 4 + j] - mean[j]) * (block[i * 4 + k] - mean[k]);
+	}
+
+	// power iteration, starting from the row with the largest variance
+	int row = 0;
+	for (int k = 1; k < 4; k++)
+		if (cov[k][k] > cov[row][row])
+			row = k;
+	memcpy(axis, cov[row], sizeof(axis));
+
+	float len = 0.f;
+	for (int iter = 0; iter < 4; iter++)
+	{
+		len = 0.f;
+		for (int j = 0; j < 4; j++)
+		{
+			next[j] = 0.f;
+			for (int k = 0; k < 4; k++)
+				next[j] += cov[j][k] * axis[k];
+			len += next[j] * next[j];
+		}
+		if (len == 0.f)
+			break;
+
+		len = 1.f / sqrtf(len);
+		for (int j = 0; j < 4; j++)
+			axis[j] = next[j] * len;
+	}
+
+	float tmin = 0.f, tmax = 0.f;
+	if (len > 0.f)
+	{
+		tmin = FLT_MAX;
+		tmax = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.f;
+			for (int k = 0; k < 4; k++)
+				t += (block[i * 4 + k] - mean[k]) * axis[k];
+			tmin = min(tmin, t);
+			tmax = max(tmax, t);
+		}
+	}
+
+	for (int k = 0; k < 4; k++)
+	{
+		e0[k] = mean[k] + tmin * axis[k];
+		e1[k] = mean[k] + tmax * axis[k];
+	}
+}
+
+// least squares endpoints for the given indices, qfalse if degenerate
+static qboolean
+refit_bc7_endpoints(const byte* block, const byte* indices, float* e0, float* e1)
+{
+	float aa = 0.f, ab = 0.f, bb = 0.f;
+	float ax[4] = { 0 }, bx[4] = { 0 };
+
+	for (int i = 0; i < 16; i++)
+	{
+		float b = bc7_weights[indices[i]] * (1.f / 64.f);
+		float a = 1.f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int k = 0; k < 4; k++)
+		{
+			ax[k] += a * block[i * 4 + k];
+			bx[k] += b * block[i * 4 + k];
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f)
+		return qfalse;
+
+	det = 1.f / det;
+	for (int k = 0; k < 4; k++)
+	{
+		e0[k] = (bb * ax[k] - ab * bx[k]) * det;
+		e1[k] = (aa * bx[k] - ab * ax[k]) * det;
+	}
+	return qtrue;
+}
+
+static inline void
+put_bits(uint64_t* bits, int* pos, int value, int count)
+{
+	for (int i = 0; i < count; i++, (*pos)++)
+	{
+		if (value & (1 << i))
+			bits[*pos >> 6] |= 1ULL << (*pos & 63);
+	}
+}
+
+static inline int
+get_bits(const uint64_t* bits, int* pos, int count)
+{
+	int value = 0;
+
+	for (int i = 0; i < count; i++, (*pos)++)
+		value |= (int)((bits[*pos >> 6] >> (*pos & 63)) & 1) << i;
+
+	return value;
+}
+
+static void
+encode_bc7_block(const byte* block, byte* out)
+{
+	float e0[4], e1[4];
+	int q0[4], q1[4], p0, p1;
+	int palette[16][4];
+	byte indices[16], refit[16];
+
+	fit_principal_axis_rgba(block, e0, e1);
+	quantize_bc7_endpoint(e0, q0, &p0);
+	quantize_bc7_endpoint(e1, q1, &p1);
+	get_bc7_palette(q0, p0, q1, p1, palette);
+	int error = select_bc7_indices(block, palette, indices);
+
+	if (error > 0 && refit_bc7_endpoints(block, indices, e0, e1))
+	{
+		int r0[4], r1[4], s0, s1;
+
+		quantize_bc7_endpoint(e0, r0, &s0);
+		quantize_bc7_endpoint(e1, r1, &s1);
+		get_bc7_palette(r0, s0, r1, s1, palette);
+		if (select_bc7_indices(block, palette, refit) < error)
+		{
+			memcpy(q0, r0, sizeof(q0));
+			memcpy(q1, r1, sizeof(q1));
+			p0 = s0;
+			p1 = s1;
+			memcpy(indices, refit, sizeof(indices));
+		}
+	}
+
+	// the first index is stored without its high bit
+	if (indices[0] & 8)
+	{
+		int t[4];
+		memcpy(t, q0, sizeof(t));
+		memcpy(q0, q1, sizeof(t));
+		memcpy(q1, t, sizeof(t));
+		int p = p0; p0 = p1; p1 = p;
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	uint64_t bits[2] = { 0, 0 };
+	int pos = 0;
+
+	put_bits(bits, &pos, 1 << 6, 7);
+	for (int k = 0; k < 4; k++)
+	{
+		put_bits(bits, &pos, q0[k], 7);
+		put_bits(bits, &pos, q1[k], 7);
+	}
+	put_bits(bits, &pos, p0, 1);
+	put_bits(bits, &pos, p1, 1);
+	put_bits(bits, &pos, indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		put_bits(bits, &pos, indices[i], 4);
+
+	for (int i = 0; i < 16; i++)
+		out[i] = (bits[i >> 3] >> ((i & 7) * 8)) & 0xff;
+}
+
+// only decodes mode 6, which is all the encoder writes
+static void
+decode_bc7_block(const byte* in, byte* block)
+{
+	uint64_t bits[2] = { 0, 0 };
+	int q0[4], q1[4], palette[16][4];
+	int pos = 7;
+
+	for (int i = 0; i < 16; i++)
+		bits[i >> 3] |= (uint64_t)in[i] << ((i & 7) * 8);
+
+	if ((bits[0] & 0x7f) != 1 << 6)
+	{
+		memset(block, 0, 64);
+		return;
+	}
+
+	for (int k = 0; k < 4; k++)
+	{
+		q0[k] = get_bits(bits, &pos, 7);
+		q1[k] = get_bits(bits, &pos, 7);
+	}
+	int p0 = get_bits(bits, &pos, 1);
+	int p1 = get_bits(bits, &pos, 1);
+	get_bc7_palette(q0, p0, q1, p1, palette);
+
+	for (int i = 0; i < 16; i++)
+	{
+		int index = get_bits(bits, &pos, i ? 4 : 3);
+		for (int k = 0; k < 4; k++)
+			block[i * 4 + k] = palette[index][k];
+	}
+}
+
+// 4x4 block at the given block coordinates, edge texels are repeated
+static void
+get_block(const byte* pic, int width, int height, int bx, int by, byte* block)
+{
+	for (int y = 0; y < 4; y++)
+	{
+		const byte* row = pic + min(by * 4 + y, height - 1) * width * 4;
+		for (int x = 0; x < 4; x++)
+			memcpy(block + (y * 4 + x) * 4, row + min(bx * 4 + x, width - 1) * 4, 4);
+	}
+}
+
+static byte*
+encode_level(const byte* pic, int width, int height, VkFormat format, byte* out)
+{
+	byte block[64];
+
+	for (int by = 0; by < (height + 3) / 4; by++)
+	{
+		for (int bx = 0; bx < (width + 3) / 4; bx++)
+		{
+			get_block(pic, width, height, bx, by, block);
+			if (is_bc7(format))
+			{
+				encode_bc7_block(block, out);
+				out += 16;
+				continue;
+			}
+			if (is_bc3(format))
+			{
+				encode_alpha_block(block, out);
+				out += 8;
+			}
+			encode_color_block(block, out);
+			out += 8;
+		}
+	}
+
+	return out;
+}
+
+static void
+decode_level(const byte* in, int width, int height, VkFormat format, byte* pic)
+{
+	byte block[64];
+
+	for (int by = 0; by < (height + 3) / 4; by++)
+	{
+		for (int bx = 0; bx < (width + 3) / 4; bx++)
+		{
+			if (is_bc7(format))
+			{
+				decode_bc7_block(in, block);
+				in += 16;
+			}
+			else if (is_bc3(format))
+			{
+				decode_color_block(in + 8, block, qtrue);
+				decode_alpha_block(in, block);
+				in += 16;
+			}
+			else
+			{
+				decode_color_block(in, block, qfalse);
+				in += 8;
+			}
+
+			for (int y = 0; y < 4 && by * 4 + y < height; y++)
+			{
+				int w = min(4, width - bx * 4);
+				memcpy(pic + ((by * 4 + y) * width + bx * 4) * 4, block + y * 16, w * 4);
+			}
+		}
+	}
+}
+
+// 2x2 box filter, like the linear blits used for uncompressed textures
+static void
+downsample(const byte* src, int width, int height, byte* dst, qboolean srgb)
+{
+	int dst_width = max(width >> 1, 1);
+	int dst_height = max(height >> 1, 1);
+
+	for (int y = 0; y < dst_height; y++)
+	{
+		const byte* row0 = src + min(y * 2, height - 1) * width * 4;
+		const byte* row1 = src + min(y * 2 + 1, height - 1) * width * 4;
+
+		for (int x = 0; x < dst_width; x++, dst += 4)
+		{
+			const byte* p0 = row0 + min(x * 2, width - 1) * 4;
+			const byte* p1 = row0 + min(x * 2 + 1, width - 1) * 4;
+			const byte* p2 = row1 + min(x * 2, width - 1) * 4;
+			const byte* p3 = row1 + min(x * 2 + 1, width - 1) * 4;
+
+			for (int k = 0; k < 3; k++)
+			{
+				if (srgb)
+				{
+					float sum = srgb_to_linear[p0[k]] + srgb_to_linear[p1[k]]
+					          + srgb_to_linear[p2[k]] + srgb_to_linear[p3[k]];
+					dst[k] = linear_to_srgb[(int)(sum * (4095.f / 4.f) + 0.5f)];
+				}
+				else
+				{
+					dst[k] = (p0[k] + p1[k] + p2[k] + p3[k] + 2) >> 2;
+				}
+			}
+			dst[3] = (p0[3] + p1[3] + p2[3] + p3[3] + 2) >> 2;
+		}
+	}
+}
+
+// Builds a cache entry for the RGBA image, images with alpha are stored as
+// BC7 instead of BC3 if asked to. Thread safe once init_tables has been
+// called.
+static byte*
+encode_entry(const byte* pic, int width, int height, qboolean srgb, qboolean bc7,
+	uint32_t flags, uint64_t checksum, uint32_t source_size, size_t* size_p)
+{
+	qboolean alpha = qfalse;
+	for (int i = 0; i < width * height; i++)
+	{
+		if (pic[i * 4 + 3] != 255)
+		{
+			alpha = qtrue;
+			break;
+		}
+	}
+
+	VkFormat format = !alpha ? VK_FORMAT_BC1_RGBA_UNORM_BLOCK :
+		bc7 ? VK_FORMAT_BC7_UNORM_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+	int num_levels = get_num_levels(width, height);
+	size_t size = sizeof(texcache_header_t) + get_data_size(format, width, height);
+	byte* data = Z_Malloc(size);
+
+	texcache_header_t* h = (texcache_header_t*)data;
+	memset(h, 0, sizeof(*h));
+	h->header.magic = DDS_MAGIC;
+	h->header.size = sizeof(DDS_HEADER) - 4;
+	h->header.flags = DDS_HEADER_FLAGS_TEXTURE | DDS_HEADER_FLAGS_MIPMAP | DDS_HEADER_FLAGS_LINEARSIZE;
+	h->header.width = width;
+	h->header.height = height;
+	h->header.pitchOrLinearSize = vkpt_texture_cache_level_size(format, width, height);
+	h->header.mipMapCount = num_levels;
+	h->header.reserved1[FIELD_IDENT] = TEXCACHE_IDENT;
+	h->header.reserved1[FIELD_VERSION] = TEXCACHE_VERSION;
+	h->header.reserved1[FIELD_CHECKSUM_LO] = (uint32_t)checksum;
+	h->header.reserved1[FIELD_CHECKSUM_HI] = (uint32_t)(checksum >> 32);
+	h->header.reserved1[FIELD_SOURCE_SIZE] = source_size;
+	h->header.reserved1[FIELD_FLAGS] = flags;
+	h->header.ddspf.size = sizeof(DDS_PIXELFORMAT);
+	h->header.ddspf.flags = DDS_FOURCC;
+	h->header.ddspf.fourCC = MAKEFOURCC('D', 'X', '1', '0');
+	h->header.caps = DDS_SURFACE_FLAGS_TEXTURE | DDS_SURFACE_FLAGS_MIPMAP;
+	if (is_bc7(format))
+		h->dxt10.dxgiFormat = srgb ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+	else if (alpha)
+		h->dxt10.dxgiFormat = srgb ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM;
+	else
+		h->dxt10.dxgiFormat = srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+	h->dxt10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+	h->dxt10.arraySize = 1;
+
+	byte* scratch[2] = { NULL, NULL };
+	if (num_levels > 1)
+	{
+		size_t scratch_size = (size_t)max(width >> 1, 1) * max(height >> 1, 1) * 4;
+		scratch[0] = Z_Malloc(scratch_size);
+		scratch[1] = Z_Malloc(scratch_size);
+	}
+
+	byte* out = data + sizeof(*h);
+	const byte* src = pic;
+	for (int level = 0; level < num_levels; level++)
+	{
+		out = encode_level(src, width, height, format, out);
+
+		if (level + 1 < num_levels)
+		{
+			downsample(src, width, height, scratch[level & 1], srgb);
+			src = scratch[level & 1];
+			width = max(width >> 1, 1);
+			height = max(height >> 1, 1);
+		}
+	}
+
+	Z_Free(scratch[0]);
+	Z_Free(scratch[1]);
+
+	*size_p = size;
+	return data;
+}
+
+static qboolean
+is_cached_type(const image_t* image)
+{
+	return image->type == IT_WALL || image->type == IT_SKIN;
+}
+
+static qboolean
+is_normal_map(const image_t* image)
+{
+	return strstr(image->name, "_n.") != NULL;
+}
+
+static qboolean
+get_cache_path(char* path, size_t size, const char* filepath)
+{
+	return Q_concat(path, size, "texcache/", filepath, ".dds", NULL) < size;
+}
+
+void*
+IMG_ReadCache_RTX(const image_t *image, size_t *len)
+{
+	char path[MAX_QPATH];
+	void* data = NULL;
+	ssize_t ret;
+
+	if (!cvar_pt_texture_cache->integer || !is_cached_type(image) || !image->filepath[0])
+		return NULL;
+
+	if (!get_cache_path(path, sizeof(path), image->filepath))
+		return NULL;
+
+	ret = FS_LoadFile(path, &data);
+	if (!data)
+		return NULL;
+
+	*len = ret;
+	return data;
+}
+
+qboolean
+IMG_LoadCache_RTX(image_t *image, void *cache, size_t cache_len, const void *src, size_t src_len)
+{
+	texcache_info_t info;
+
+	if (!parse_entry(cache, cache_len, &info))
+		return qfalse;
+
+	if (info.source_size != src_len || info.checksum != get_checksum(src, src_len))
+		return qfalse;
+
+	if (is_srgb(info.format) != !!(image->flags & IF_SRGB))
+		return qfalse;
+
+	qboolean normalized = !!(info.flags & TEXCACHE_NORMALIZED);
+	if (image->type == IT_WALL && is_normal_map(image) && !normalized)
+		return qfalse;
+
+	image->width = image->upload_width = info.width;
+	image->height = image->upload_height = info.height;
+	image->dds_data = cache;
+	image->dds_size = cache_len;
+	image->processing_complete = normalized;
+	return qtrue;
+}
+
+VkFormat
+vkpt_texture_cache_format(const image_t* image)
+{
+	const texcache_header_t* h = (const texcache_header_t*)image->dds_data;
+
+	switch (h->dxt10.dxgiFormat)
+	{
+	case DXGI_FORMAT_BC1_UNORM_SRGB: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case DXGI_FORMAT_BC3_UNORM:      return VK_FORMAT_BC3_UNORM_BLOCK;
+	case DXGI_FORMAT_BC3_UNORM_SRGB: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case DXGI_FORMAT_BC7_UNORM:      return VK_FORMAT_BC7_UNORM_BLOCK;
+	case DXGI_FORMAT_BC7_UNORM_SRGB: return VK_FORMAT_BC7_SRGB_BLOCK;
+	default:                         return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	}
+}
+
+// all mip levels, largest first and tightly packed
+const byte*
+vkpt_texture_cache_levels(const image_t* image, size_t* size)
+{
+	*size = image->dds_size - sizeof(texcache_header_t);
+	return image->dds_data + sizeof(texcache_header_t);
+}
+
+// Decodes the largest mip level of a cached image into RGBA, or returns
+// NULL if the image isn't cached. The result is freed with Z_Free.
+byte*
+vkpt_texture_cache_decode(const image_t* image)
+{
+	if (!image->dds_data)
+		return NULL;
+
+	size_t size;
+	const byte* levels = vkpt_texture_cache_levels(image, &size);
+	byte* pic = Z_Malloc(image->upload_width * image->upload_height * 4);
+	decode_level(levels, image->upload_width, image->upload_height,
+		vkpt_texture_cache_format(image), pic);
+	return pic;
+}
+
+typedef struct {
+	image_t* image;
+	char path[MAX_QPATH];
+	uint64_t checksum;
+	uint32_t source_size;
+	uint32_t flags;
+	qboolean bc7;
+	byte* data;
+	size_t size;
+} texcache_item_t;
+
+static void
+encode_items(void* arg, int start, int end)
+{
+	texcache_item_t* items = arg;
+
+	for (int i = start; i < end; i++)
+	{
+		texcache_item_t* item = items + i;
+		const image_t* image = item->image;
+
+		item->data = encode_entry(image->pix_data, image->upload_width, image->upload_height,
+			image->is_srgb, item->bc7, item->flags, item->checksum, item->source_size, &item->size);
+	}
+}
+
+/*
+  Writes cache entries for all registered wall and skin textures that were
+  decoded from their source images. Reading the sources back for their
+  checksums and writing the entries happens on the main thread, encoding
+  on the job pool. With "bc7" as the argument, textures with alpha are
+  stored as BC7 instead of BC3.
+*/
+void
+vkpt_build_texture_cache(void)
+{
+	if (Cmd_Argc() > 2 || (Cmd_Argc() == 2 && Q_strcasecmp(Cmd_Argv(1), "bc7")))
+	{
+		Com_Printf("Usage: %s [bc7]\n", Cmd_Argv(0));
+		return;
+	}
+
+	texcache_item_t* items = Z_Mallocz(r_numImages * sizeof(texcache_item_t));
+	qboolean bc7 = Cmd_Argc() == 2;
+	int count = 0, cached = 0, failed = 0;
+	size_t rgba_size = 0, compressed_size = 0;
+
+	init_tables();
+
+	for (int i = 1; i < r_numImages; i++)
+	{
+		image_t* image = r_images + i;
+		texcache_item_t* item = items + count;
+
+		if (!image->registration_sequence || !is_cached_type(image))
+			continue;
+
+		if (image->dds_data)
+		{
+			cached++;
+			continue;
+		}
+
+		if (!image->pix_data || !image->filepath[0] ||
+			!get_cache_path(item->path, sizeof(item->path), image->filepath))
+			continue;
+
+		void* source = NULL;
+		ssize_t len = FS_LoadFile(image->filepath, &source);
+		if (!source)
+			continue;
+
+		item->image = image;
+		item->checksum = get_checksum(source, len);
+		item->source_size = len;
+		item->bc7 = bc7;
+		FS_FreeFile(source);
+
+		// keep the entry in sync with what registration did to the pixels
+		if (is_normal_map(image) && image->processing_complete)
+			item->flags |= TEXCACHE_NORMALIZED;
+
+		count++;
+	}
+
+	unsigned start = Sys_Milliseconds();
+	Com_ParallelFor(count, 1, encode_items, items);
+	unsigned encoded = Sys_Milliseconds();
+
+	for (int i = 0; i < count; i++)
+	{
+		texcache_item_t* item = items + i;
+		qerror_t ret = FS_WriteFile(item->path, item->data, item->size);
+
+		if (ret < 0)
+		{
+			Com_EPrintf("Couldn't write %s: %s\n", item->path, Q_ErrorString(ret));
+			failed++;
+		}
+		else
+		{
+			rgba_size += get_rgba_size(item->image->upload_width, item->image->upload_height);
+			compressed_size += item->size;
+		}
+
+		Z_Free(item->data);
+	}
+
+	Z_Free(items);
+
+	Com_Printf("Wrote %d texture cache entries (%d already cached, %d failed): "
+		"%.1f MB as RGBA8 with mips, %.1f MB compressed (%.1f:1), "
+		"%u msec encoding on %d threads\n",
+		count - failed, cached, failed, rgba_size / 1048576.0, compressed_size / 1048576.0,
+		(double)rgba_size / max(compressed_size, 1), encoded - start, Com_NumJobThreads());
+}
+
+#if USE_TESTS
+typedef struct {
+	int files;
+	int bc1;
+	int bc3;
+	int bc7;
+	int normal_maps;
+	int metallic_maps;
+	int failures;
+	size_t texels;
+	size_t rgba_size;
+	size_t compressed_size;
+	double squared_error;
+	size_t normal_texels;
+	double normal_angle_sum;
+	float normal_angle_max;
+	double metallic_squared_error;
+	uint64_t decode_usec;
+	uint64_t encode_usec;
+	uint64_t load_usec;
+} texcache_test_t;
+
+static double
+get_squared_error(const byte* a, const byte* b, int count)
+{
+	double sum = 0.0;
+
+	for (int i = 0; i < count * 4; i++)
+	{
+		int d = a[i] - b[i];
+		sum += d * d;
+	}
+
+	return sum;
+}
+
+static int
+get_max_error(const byte* a, const byte* b, int count)
+{
+	int error = 0;
+
+	for (int i = 0; i < count * 4; i++)
+		error = max(error, abs(a[i] - b[i]));
+
+	return error;
+}
+
+// Angle between source and decoded normals the way the path tracer reads
+// them, and squared error of the metallic alpha.
+static void
+add_normal_error(texcache_test_t* t, const byte* a, const byte* b, int count)
+{
+	for (int i = 0; i < count; i++, a += 4, b += 4)
+	{
+		vec3_t n1, n2;
+		VectorSet(n1, a[0] * (2.f / 255.f) - 1.f, a[1] * (2.f / 255.f) - 1.f, a[2] * (1.f / 255.f));
+		VectorSet(n2, b[0] * (2.f / 255.f) - 1.f, b[1] * (2.f / 255.f) - 1.f, b[2] * (1.f / 255.f));
+		float len = VectorLength(n1) * VectorLength(n2);
+		float angle = 0.f;
+		if (len > 0.f)
+		{
+			float cosine = DotProduct(n1, n2) / len;
+			clamp(cosine, -1.f, 1.f);
+			angle = RAD2DEG(acosf(cosine));
+		}
+
+		t->normal_angle_sum += angle;
+		t->normal_angle_max = max(t->normal_angle_max, angle);
+
+		int d = a[3] - b[3];
+		t->metallic_squared_error += d * d;
+	}
+
+	t->normal_texels += count;
+}
+
+// Checks the encoder and the entry validation on synthetic images.
+static int
+texture_cache_self_test(void)
+{
+	const int w = 64, h = 32;
+	byte* pic = Z_Malloc(w * h * 4);
+	byte* decoded = Z_Malloc(w * h * 4);
+	image_t image;
+	unsigned seed = 1;
+	int errors = 0;
+
+	// flat 8x8 areas: only 565 quantization error is allowed
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			uint32_t c = ((x / 8) * 2654435761u) ^ ((y / 8) * 40503u);
+			byte* p = pic + (y * w + x) * 4;
+			p[0] = c; p[1] = c >> 8; p[2] = c >> 16; p[3] = 255;
+		}
+	}
+
+	// BC1, then BC3 and BC7 for the same image with alpha
+	static const VkFormat formats[3] = {
+		VK_FORMAT_BC1_RGBA_UNORM_BLOCK, VK_FORMAT_BC3_UNORM_BLOCK, VK_FORMAT_BC7_UNORM_BLOCK
+	};
+	static const int limits[3] = { 4, 12, 8 };
+
+	for (int pass = 0; pass < 3; pass++)
+	{
+		size_t size;
+		byte* entry = encode_entry(pic, w, h, qfalse, pass == 2, 0, 0x123456789abcdefULL, 1234, &size);
+
+		texcache_info_t info;
+		if (!parse_entry(entry, size, &info) || info.width != w || info.height != h ||
+			info.num_levels != 7 || info.format != formats[pass])
+		{
+			Com_EPrintf("texture cache: entry %d doesn't parse\n", pass);
+			errors++;
+		}
+		else if (parse_entry(entry, size - 1, &info))
+		{
+			Com_EPrintf("texture cache: truncated entry %d accepted\n", pass);
+			errors++;
+		}
+
+		decode_level(entry + sizeof(texcache_header_t), w, h, formats[pass], decoded);
+		int max_error = get_max_error(pic, decoded, w * h);
+		int limit = limits[pass];
+		if (max_error > limit)
+		{
+			Com_EPrintf("texture cache: max error %d > %d in pass %d\n", max_error, limit, pass);
+			errors++;
+		}
+
+		Z_Free(entry);
+
+		if (pass)
+			continue;
+
+		// gradients and noisy alpha
+		for (int y = 0; y < h; y++)
+		{
+			for (int x = 0; x < w; x++)
+			{
+				byte* p = pic + (y * w + x) * 4;
+				p[0] = x * 4;
+				p[1] = y * 8;
+				p[2] = 255 - x * 2;
+				p[3] = 128 + x + (TST_Rand(&seed) & 7);
+			}
+		}
+	}
+
+	// checksum and source size must match, sRGB must match the flags
+	{
+		static const char source[] = "texture cache test source";
+		uint64_t checksum = get_checksum(source, sizeof(source));
+		size_t size;
+
+		memset(&image, 0, sizeof(image));
+		Q_strlcpy(image.name, "textures/test.tga", sizeof(image.name));
+		image.type = IT_WALL;
+		image.flags = IF_SRGB;
+
+		byte* entry = encode_entry(pic, w, h, qtrue, qfalse, 0, checksum, sizeof(source), &size);
+		if (IMG_LoadCache_RTX(&image, entry, size, "texture cache test sourcf", sizeof(source)) ||
+			IMG_LoadCache_RTX(&image, entry, size, source, sizeof(source) - 1))
+		{
+			Com_EPrintf("texture cache: entry accepted for a different source\n");
+			errors++;
+		}
+
+		image.flags = IF_NONE;
+		if (IMG_LoadCache_RTX(&image, entry, size, source, sizeof(source)))
+		{
+			Com_EPrintf("texture cache: sRGB entry accepted for a linear image\n");
+			errors++;
+		}
+
+		image.flags = IF_SRGB;
+		if (!IMG_LoadCache_RTX(&image, entry, size, source, sizeof(source)) ||
+			image.upload_width != w || image.upload_height != h ||
+			vkpt_texture_cache_format(&image) != VK_FORMAT_BC3_SRGB_BLOCK)
+		{
+			Com_EPrintf("texture cache: valid entry rejected\n");
+			errors++;
+			Z_Free(entry);
+		}
+		else
+		{
+			Z_Free(image.dds_data);
+		}
+
+		entry = encode_entry(pic, w, h, qtrue, qtrue, 0, checksum, sizeof(source), &size);
+		if (!IMG_LoadCache_RTX(&image, entry, size, source, sizeof(source)) ||
+			vkpt_texture_cache_format(&image) != VK_FORMAT_BC7_SRGB_BLOCK)
+		{
+			Com_EPrintf("texture cache: valid BC7 entry rejected\n");
+			errors++;
+			Z_Free(entry);
+		}
+		else
+		{
+			Z_Free(image.dds_data);
+		}
+
+		// world normal maps must have been normalized
+		memset(&image, 0, sizeof(image));
+		Q_strlcpy(image.name, "textures/test_n.tga", sizeof(image.name));
+		image.type = IT_WALL;
+		entry = encode_entry(pic, w, h, qfalse, qfalse, 0, checksum, sizeof(source), &size);
+		if (IMG_LoadCache_RTX(&image, entry, size, source, sizeof(source)))
+		{
+			Com_EPrintf("texture cache: unnormalized normal map accepted\n");
+			errors++;
+		}
+		Z_Free(entry);
+	}
+
+	Z_Free(pic);
+	Z_Free(decoded);
+	return errors;
+}
+
+static void
+texture_cache_test_file(texcache_test_t* t, const char* name, qboolean bc7)
+{
+	image_t image;
+	void* source = NULL;
+	ssize_t source_size;
+	uint64_t start, decoded, encoded;
+
+	memset(&image, 0, sizeof(image));
+
+	start = Sys_Microseconds();
+	if (load_img(name, &image) != Q_ERR_SUCCESS)
+	{
+		t->failures++;
+		return;
+	}
+	decoded = Sys_Microseconds();
+
+	qboolean normal_map = strstr(name, "_n.") != NULL;
+	if (normal_map)
+		vkpt_normalize_normal_map(&image);
+
+	int w = image.upload_width;
+	int h = image.upload_height;
+	size_t size;
+	byte* entry = encode_entry(image.pix_data, w, h, !normal_map, bc7,
+		normal_map ? TEXCACHE_NORMALIZED : 0, 0, 0, &size);
+	encoded = Sys_Microseconds();
+
+	// what loading from the cache costs, apart from reading the entry
+	texcache_info_t info;
+	parse_entry(entry, size, &info);
+	source_size = FS_LoadFile(name, &source);
+	if (source)
+	{
+		get_checksum(source, source_size);
+		FS_FreeFile(source);
+	}
+	t->load_usec += Sys_Microseconds() - encoded;
+	t->decode_usec += decoded - start;
+	t->encode_usec += encoded - decoded;
+
+	byte* pic = Z_Malloc(w * h * 4);
+	qboolean alpha = info.format != VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	decode_level(entry + sizeof(texcache_header_t), w, h, info.format, pic);
+	t->squared_error += get_squared_error(image.pix_data, pic, w * h);
+	if (normal_map)
+	{
+		add_normal_error(t, image.pix_data, pic, w * h);
+		t->normal_maps++;
+		if (alpha)
+			t->metallic_maps++;
+	}
+	Z_Free(pic);
+
+	t->files++;
+	if (is_bc7(info.format))
+		t->bc7++;
+	else if (alpha)
+		t->bc3++;
+	else
+		t->bc1++;
+	t->texels += w * h;
+	t->rgba_size += get_rgba_size(w, h);
+	t->compressed_size += size;
+
+	Z_Free(entry);
+	Z_Free(image.pix_data);
+}
+
+static void
+texture_cache_test_dir(texcache_test_t* t, const char* path, qboolean bc7)
+{
+	char name[MAX_QPATH];
+	void** list;
+	int count;
+
+	list = FS_ListFiles(path, ".tga;.png;.jpg", FS_SEARCH_SAVEPATH, &count);
+	for (int i = 0; i < count; i++)
+	{
+		if (Q_strlcpy(name, list[i], sizeof(name)) < sizeof(name))
+			texture_cache_test_file(t, name, bc7);
+	}
+	FS_FreeList(list);
+}
+
+/*
+  CPU-only test of the texture cache: checks the encoder and the entry
+  validation on synthetic images, then transcodes all images under the
+  given directory and its subdirectories, and prints compression ratio,
+  error and the time spent decoding the sources versus validating cache
+  entries for them. With "bc7" as the second argument, images with alpha
+  are encoded as BC7 instead of BC3. Nothing is written to the cache.
+*/
+void
+vkpt_texture_cache_test_f(void)
+{
+	const char* path = Cmd_Argc() > 1 ? Cmd_Argv(1) : "textures";
+	qboolean bc7 = Cmd_Argc() > 2 && !Q_strcasecmp(Cmd_Argv(2), "bc7");
+	char buffer[MAX_QPATH];
+	texcache_test_t t;
+	void** list;
+	int count;
+
+	init_tables();
+
+	int errors = texture_cache_self_test();
+	Com_Printf("texture cache self test %s\n", errors ? "FAILED" : "ok");
+
+	memset(&t, 0, sizeof(t));
+	texture_cache_test_dir(&t, path, bc7);
+
+	list = FS_ListFiles(path, NULL, FS_SEARCH_DIRSONLY, &count);
+	for (int i = 0; i < count; i++)
+	{
+		Q_concat(buffer, sizeof(buffer), path, "/", list[i], NULL);
+		texture_cache_test_dir(&t, buffer, bc7);
+	}
+	FS_FreeList(list);
+
+	if (!t.files)
+	{
+		Com_Printf("No images found in %s\n", path);
+		return;
+	}
+
+	Com_Printf("%d images (%d BC1, %d BC3, %d BC7), %d failed, %.1f Mtexels\n"
+		"%.1f MB as RGBA8 with mips, %.1f MB compressed (%.1f:1), RMSE %.2f\n"
+		"decoding %.1f msec, validating cache entries %.1f msec, encoding %.1f msec (1 thread)\n",
+		t.files, t.bc1, t.bc3, t.bc7, t.failures, t.texels * 1e-6,
+		t.rgba_size / 1048576.0, t.compressed_size / 1048576.0,
+		(double)t.rgba_size / max(t.compressed_size, 1), sqrt(t.squared_error / (t.texels * 4)),
+		t.decode_usec * 1e-3, t.load_usec * 1e-3, t.encode_usec * 1e-3);
+
+	if (t.normal_texels)
+	{
+		Com_Printf("%d normal maps, %d with metallic in alpha: mean normal error %.2f deg, "
+			"max %.1f deg, metallic RMSE %.2f\n",
+			t.normal_maps, t.metallic_maps, t.normal_angle_sum / t.normal_texels,
+			t.normal_angle_max, sqrt(t.metallic_squared_error / t.normal_texels));
+	}
+}
+#endif
@@ -21,6 +21,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "vk_util.h"
 #include "refresh/images.h"
 #include "device_memory_allocator.h"
+#include "common/tests.h"
+#include "system/system.h"
 
 #include <assert.h>
 
@@ -92,7 +94,7 @@ void vkpt_textures_prefetch()
 		if (!line)
 			continue;
 
-		image_t const * img1 = IMG_Find(line, IT_SKIN, IF_PERMANENT | IF_SRGB);
+		IMG_QueueLoad(line, IT_SKIN, IF_PERMANENT | IF_SRGB);
 
 		char other_name[MAX_QPATH];
 
@@ -101,19 +103,20 @@ void vkpt_textures_prefetch()
 			continue;
 		Q_concat(other_name, sizeof(other_name), other_name, "_n.tga", NULL);
 		FS_NormalizePath(other_name, other_name);
-		image_t const * img2 = IMG_Find(other_name, IT_SKIN, IF_PERMANENT);
-		/* if (img2 != R_NOTEXTURE)
-			Com_Printf("Prefetched '%s' (%d)\n", other_name, (int)(img2 - r_images)); */
+		IMG_QueueLoad(other_name, IT_SKIN, IF_PERMANENT);
 
 		// attempt loading a matching emissive map
 		if (!Q_strlcpy(other_name, line, strlen(line) - 3))
 			continue;
 		Q_concat(other_name, sizeof(other_name), other_name, "_light.tga", NULL);
 		FS_NormalizePath(other_name, other_name);
-		image_t const * img3 = IMG_Find(other_name, IT_SKIN, IF_PERMANENT | IF_SRGB);
+		IMG_QueueLoad(other_name, IT_SKIN, IF_PERMANENT | IF_SRGB);
 	}
     // Com_Printf("Loaded '%s'\n", filename);
     FS_FreeFile(buffer);
+
+	// decode everything on worker threads
+	IMG_FlushLoads();
 }
 
 static void textures_destroy_unused_set(uint32_t set_index)
@@ -528,13 +531,116 @@ static inline byte encode_linear(float x)
     return (byte)roundf(x * 255.f);
 }
 
+// decode_srgb of every 8-bit value, filled on the main thread before the
+// first job reads it
+static float srgb_to_linear_table[256];
+
+static void
+init_srgb_table(void)
+{
+	if (srgb_to_linear_table[255] != 0.f)
+		return;
+
+	for (int i = 0; i < 256; i++)
+		srgb_to_linear_table[i] = decode_srgb(i);
+}
+
+// rows per job of the texture post-processing loops
+#define PROCESS_ROW_GRAIN 16
+
+typedef struct {
+	vec3_t color;
+	int min_x, max_x;
+} emissive_row_t;
+
+typedef struct {
+	const image_t* image;
+	const byte* pixels;
+	emissive_row_t* rows;
+} emissive_job_t;
+
+static inline void
+add_emissive_pixel(emissive_row_t* row, const byte* pixel, int x)
+{
+	vec3_t color;
+	color[0] = srgb_to_linear_table[pixel[0]];
+	color[1] = srgb_to_linear_table[pixel[1]];
+	color[2] = srgb_to_linear_table[pixel[2]];
+
+	color[0] = max(0.f, color[0] + EMISSIVE_TRANSFORM_BIAS);
+	color[1] = max(0.f, color[1] + EMISSIVE_TRANSFORM_BIAS);
+	color[2] = max(0.f, color[2] + EMISSIVE_TRANSFORM_BIAS);
+
+	VectorAdd(row->color, color, row->color);
+
+	row->min_x = min(row->min_x, x);
+	row->max_x = max(row->max_x, x);
+}
+
+static void
+extract_emissive_rows(void* arg, int start, int end)
+{
+	emissive_job_t* job = arg;
+	int w = job->image->upload_width;
+
+	for (int y = start; y < end; y++) {
+		const byte* current_pixel = job->pixels + y * w * 4;
+		emissive_row_t* row = job->rows + y;
+		int x = 0;
+
+		VectorClear(row->color);
+		row->min_x = w;
+		row->max_x = -1;
+
+#if USE_SSE2
+		// emissive textures are mostly black, skip four black pixels at a
+		// time and add up the others in the same order as below
+		const __m128i rgb_mask = _mm_set1_epi32(0x00ffffff);
+		for (; x + 4 <= w; x += 4, current_pixel += 16) {
+			__m128i pixels = _mm_loadu_si128((const __m128i*)current_pixel);
+			__m128i black = _mm_cmpeq_epi32(_mm_and_si128(pixels, rgb_mask), _mm_setzero_si128());
+			int mask = _mm_movemask_ps(_mm_castsi128_ps(black));
+			if (mask == 15)
+				continue;
+
+			for (int i = 0; i < 4; i++) {
+				if (!(mask & (1 << i)))
+					add_emissive_pixel(row, current_pixel + i * 4, x + i);
+			}
+		}
+#endif
+
+		for (; x < w; x++) {
+			if(current_pixel[0] + current_pixel[1] + current_pixel[2] > 0)
+				add_emissive_pixel(row, current_pixel, x);
+			
+			current_pixel += 4;
+		}
+	}
+}
+
 void
 vkpt_extract_emissive_texture_info(image_t *image)
 {
 	int w = image->upload_width;
 	int h = image->upload_height;
 
-	byte* current_pixel = image->pix_data;
+	// textures loaded from the cache only have the compressed data
+	byte* decoded = vkpt_texture_cache_decode(image);
+
+	emissive_job_t job;
+	job.image = image;
+	job.pixels = decoded ? decoded : image->pix_data;
+	job.rows = Z_Malloc(h * sizeof(emissive_row_t));
+
+	init_srgb_table();
+
+	// rows are summed up in order below, so the result doesn't depend
+	// on the number of threads
+	Com_ParallelFor(h, PROCESS_ROW_GRAIN, extract_emissive_rows, &job);
+
+	Z_Free(decoded);
+
 	vec3_t emissive_color;
 	VectorClear(emissive_color);
 
@@ -544,30 +650,20 @@ vkpt_extract_emissive_texture_info(image_t *image)
 	int max_y = -1;
 	
 	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			if(current_pixel[0] + current_pixel[1] + current_pixel[2] > 0)
-			{
-				vec3_t color;
-				color[0] = decode_srgb(current_pixel[0]);
-				color[1] = decode_srgb(current_pixel[1]);
-				color[2] = decode_srgb(current_pixel[2]);
-
-				color[0] = max(0.f, color[0] + EMISSIVE_TRANSFORM_BIAS);
-				color[1] = max(0.f, color[1] + EMISSIVE_TRANSFORM_BIAS);
-				color[2] = max(0.f, color[2] + EMISSIVE_TRANSFORM_BIAS);
+		const emissive_row_t* row = job.rows + y;
+		if (row->max_x < 0)
+			continue;
 
-				VectorAdd(emissive_color, color, emissive_color);
+		VectorAdd(emissive_color, row->color, emissive_color);
 
-				min_x = min(min_x, x);
-				min_y = min(min_y, y);
-				max_x = max(max_x, x);
-				max_y = max(max_y, y);
-			}
-			
-			current_pixel += 4;
-		}
+		min_x = min(min_x, row->min_x);
+		max_x = max(max_x, row->max_x);
+		min_y = min(min_y, y);
+		max_y = max(max_y, y);
 	}
 
+	Z_Free(job.rows);
+
 	if (min_x <= max_x && min_y <= max_y)
 	{
 		float normalization = 1.f / (float)((max_x - min_x + 1) * (max_y - min_y + 1));
@@ -588,46 +684,286 @@ vkpt_extract_emissive_texture_info(image_t *image)
 	image->processing_complete = qtrue;
 }
 
-void
-vkpt_normalize_normal_map(image_t *image)
+static void
+normalize_normal_map_pixels_C(byte* current_pixel, int count)
 {
-    int w = image->upload_width;
-    int h = image->upload_height;
+    for (int x = 0; x < count; x++) 
+    {
+        vec3_t color;
+        color[0] = decode_linear(current_pixel[0]);
+        color[1] = decode_linear(current_pixel[1]);
+        color[2] = decode_linear(current_pixel[2]);
 
-    byte* current_pixel = image->pix_data;
+        color[0] = color[0] * 2.f - 1.f;
+        color[1] = color[1] * 2.f - 1.f;
 
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) 
+        if (VectorNormalize(color) == 0.f)
         {
-            vec3_t color;
-            color[0] = decode_linear(current_pixel[0]);
-            color[1] = decode_linear(current_pixel[1]);
-            color[2] = decode_linear(current_pixel[2]);
+            color[0] = 0.f;
+            color[1] = 0.f;
+            color[2] = 1.f;
+        }
 
-            color[0] = color[0] * 2.f - 1.f;
-            color[1] = color[1] * 2.f - 1.f;
+        color[0] = color[0] * 0.5f + 0.5f;
+        color[1] = color[1] * 0.5f + 0.5f;
+        
+        current_pixel[0] = encode_linear(color[0]);
+        current_pixel[1] = encode_linear(color[1]);
+        current_pixel[2] = encode_linear(color[2]);
 
-            if (VectorNormalize(color) == 0.f)
-            {
-                color[0] = 0.f;
-                color[1] = 0.f;
-                color[2] = 1.f;
-            }
+        current_pixel += 4;
+    }
+}
 
-            color[0] = color[0] * 0.5f + 0.5f;
-            color[1] = color[1] * 0.5f + 0.5f;
-            
-            current_pixel[0] = encode_linear(color[0]);
-            current_pixel[1] = encode_linear(color[1]);
-            current_pixel[2] = encode_linear(color[2]);
+#if USE_SSE2
 
-            current_pixel += 4;
-        }
+// encode_linear of four values, rounding halves away from zero like roundf
+static inline __m128i
+encode_linear_SIMD(__m128 x)
+{
+    x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(1.f)), _mm_setzero_ps());
+    x = _mm_mul_ps(x, _mm_set1_ps(255.f));
+
+    __m128i i = _mm_cvttps_epi32(x);
+    __m128 frac = _mm_sub_ps(x, _mm_cvtepi32_ps(i));
+    __m128i round_up = _mm_castps_si128(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f)));
+
+    return _mm_sub_epi32(i, round_up);
+}
+
+// Same math as normalize_normal_map_pixels_C, four pixels at a time. Only
+// IEEE exact operations are used, so the results are identical.
+static void
+normalize_normal_map_pixels_SIMD(byte* current_pixel, int count)
+{
+    const __m128i byte_mask = _mm_set1_epi32(0xff);
+    const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+    const __m128 scale = _mm_set1_ps(255.f);
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 two = _mm_set1_ps(2.f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4, current_pixel += 16)
+    {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)current_pixel);
+
+        __m128 r = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(pixels, byte_mask)), scale);
+        __m128 g = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 8), byte_mask)), scale);
+        __m128 b = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 16), byte_mask)), scale);
+
+        r = _mm_sub_ps(_mm_mul_ps(r, two), one);
+        g = _mm_sub_ps(_mm_mul_ps(g, two), one);
+
+        __m128 length = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(g, g)), _mm_mul_ps(b, b));
+        length = _mm_sqrt_ps(length);
+
+        // zero length vectors become (0, 0, 1)
+        __m128 zero = _mm_cmpeq_ps(length, _mm_setzero_ps());
+        __m128 ilength = _mm_div_ps(one, _mm_or_ps(length, _mm_and_ps(zero, one)));
+        r = _mm_andnot_ps(zero, _mm_mul_ps(r, ilength));
+        g = _mm_andnot_ps(zero, _mm_mul_ps(g, ilength));
+        b = _mm_or_ps(_mm_andnot_ps(zero, _mm_mul_ps(b, ilength)), _mm_and_ps(zero, one));
+
+        r = _mm_add_ps(_mm_mul_ps(r, half), half);
+        g = _mm_add_ps(_mm_mul_ps(g, half), half);
+
+        pixels = _mm_and_si128(pixels, alpha_mask);
+        pixels = _mm_or_si128(pixels, encode_linear_SIMD(r));
+        pixels = _mm_or_si128(pixels, _mm_slli_epi32(encode_linear_SIMD(g), 8));
+        pixels = _mm_or_si128(pixels, _mm_slli_epi32(encode_linear_SIMD(b), 16));
+        _mm_storeu_si128((__m128i*)current_pixel, pixels);
     }
 
+    normalize_normal_map_pixels_C(current_pixel, count - x);
+}
+
+#define normalize_normal_map_pixels normalize_normal_map_pixels_SIMD
+#else
+#define normalize_normal_map_pixels normalize_normal_map_pixels_C
+#endif
+
+static void
+normalize_normal_map_rows(void* arg, int start, int end)
+{
+    image_t* image = arg;
+    int w = image->upload_width;
+
+    normalize_normal_map_pixels(image->pix_data + start * w * 4, (end - start) * w);
+}
+
+void
+vkpt_normalize_normal_map(image_t *image)
+{
+    // normal maps are normalized before they are put into the texture cache
+    if (image->pix_data)
+        Com_ParallelFor(image->upload_height, PROCESS_ROW_GRAIN, normalize_normal_map_rows, image);
+
     image->processing_complete = qtrue;
 }
 
+#if USE_TESTS
+static void
+extract_emissive_reference(const byte* pixels, int w, int h, vec3_t color, int bounds[4])
+{
+	VectorClear(color);
+	bounds[0] = w; bounds[1] = h; bounds[2] = -1; bounds[3] = -1;
+
+	for (int y = 0; y < h; y++) {
+		vec3_t row_color;
+		VectorClear(row_color);
+		for (int x = 0; x < w; x++, pixels += 4) {
+			if (pixels[0] + pixels[1] + pixels[2] == 0)
+				continue;
+
+			for (int i = 0; i < 3; i++)
+				row_color[i] += max(0.f, decode_srgb(pixels[i]) + EMISSIVE_TRANSFORM_BIAS);
+
+			bounds[0] = min(bounds[0], x);
+			bounds[1] = min(bounds[1], y);
+			bounds[2] = max(bounds[2], x);
+			bounds[3] = max(bounds[3], y);
+		}
+		VectorAdd(color, row_color, color);
+	}
+}
+
+typedef struct
+{
+	image_t* image;
+	int bounds[4];
+	vec3_t color;
+	uint32_t* normals[2];
+	int count;
+} texture_kernel_test_t;
+
+static void emissive_test_run(void* arg, int k)
+{
+	texture_kernel_test_t* t = arg;
+	if (k)
+		vkpt_extract_emissive_texture_info(t->image);
+	else
+		extract_emissive_reference(t->image->pix_data, t->image->upload_width, t->image->upload_height, t->color, t->bounds);
+}
+
+static void normal_test_run(void* arg, int k)
+{
+	texture_kernel_test_t* t = arg;
+	if (k)
+		normalize_normal_map_pixels((byte*)t->normals[k], t->count);
+	else
+		normalize_normal_map_pixels_C((byte*)t->normals[k], t->count);
+}
+
+/*
+  CPU-only check of the texture post-processing kernels: the emissive
+  analysis against the original per-pixel powf code on mostly black
+  images, and the vectorized normal map normalization against the scalar
+  one on every RGB value. Prints timings of both.
+*/
+void vkpt_texture_kernel_test_f(void)
+{
+	int iterations = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 10;
+	clamp(iterations, 1, 1000);
+
+	unsigned seed = 1;
+	int errors = 0;
+
+	init_srgb_table();
+	for (int i = 0; i < 256; i++) {
+		if (srgb_to_linear_table[i] != decode_srgb(i))
+			errors++;
+	}
+
+	static const int sizes[][2] = { { 1, 1 }, { 7, 3 }, { 64, 64 }, { 517, 260 }, { 1024, 1024 } };
+	byte* pixels = Z_Malloc(1024 * 1024 * 4);
+	uint64_t emissive_usec[2] = { 0, 0 };
+	texture_kernel_test_t t;
+
+	for (int s = 0; s < LENGTH(sizes); s++) {
+		int w = sizes[s][0], h = sizes[s][1];
+
+		// black with a few lit rectangles and some noise
+		memset(pixels, 0, w * h * 4);
+		for (int n = 0; n < 4; n++) {
+			int x0 = TST_Rand(&seed) % w;
+			int y0 = TST_Rand(&seed) % h;
+			int x1 = x0 + 1 + TST_Rand(&seed) % 64;
+			int y1 = y0 + 1 + TST_Rand(&seed) % 64;
+			x1 = min(x1, w);
+			y1 = min(y1, h);
+			for (int y = y0; y < y1; y++)
+				for (int x = x0; x < x1; x++)
+					for (int i = 0; i < 4; i++)
+						pixels[(y * w + x) * 4 + i] = TST_Rand(&seed);
+		}
+		for (int n = 0; n < w * h / 256; n++) {
+			int offset = (TST_Rand(&seed) % (w * h)) * 4;
+			offset += TST_Rand(&seed) % 3;
+			pixels[offset] = TST_Rand(&seed);
+		}
+
+		image_t image;
+		memset(&image, 0, sizeof(image));
+		image.upload_width = w;
+		image.upload_height = h;
+		image.pix_data = pixels;
+
+		t.image = &image;
+		TST_TimeVariants(emissive_test_run, &t, iterations, emissive_usec);
+
+		float* color = t.color;
+		const int* bounds = t.bounds;
+
+		if (bounds[0] <= bounds[2])
+			VectorScale(color, 1.f / (float)((bounds[2] - bounds[0] + 1) * (bounds[3] - bounds[1] + 1)), color);
+		else
+			VectorClear(color);
+
+		if (!VectorCompare(color, image.light_color)
+			|| image.min_light_texcoord[0] != (float)bounds[0] / (float)w
+			|| image.min_light_texcoord[1] != (float)bounds[1] / (float)h
+			|| image.max_light_texcoord[0] != (float)(bounds[2] + 1) / (float)w
+			|| image.max_light_texcoord[1] != (float)(bounds[3] + 1) / (float)h)
+		{
+			Com_EPrintf("Emissive analysis differs for %dx%d image\n", w, h);
+			errors++;
+		}
+	}
+
+	Z_Free(pixels);
+
+	// every RGB value once, with random alpha
+	int count = 1 << 24;
+	uint32_t** normals = t.normals;
+	uint64_t normal_usec[2] = { 0, 0 };
+	normals[0] = Z_Malloc(count * sizeof(uint32_t));
+	normals[1] = Z_Malloc(count * sizeof(uint32_t));
+	for (int i = 0; i < count; i++)
+		normals[0][i] = LittleLong(i | (TST_Rand(&seed) << 24));
+	memcpy(normals[1], normals[0], count * sizeof(uint32_t));
+
+	t.count = count;
+	TST_TimeVariants(normal_test_run, &t, 1, normal_usec);
+
+	int mismatches = 0;
+	for (int i = 0; i < count; i++)
+		mismatches += normals[0][i] != normals[1][i];
+
+	if (mismatches) {
+		Com_EPrintf("%d normal map pixels differ\n", mismatches);
+		errors++;
+	}
+
+	Z_Free(normals[0]);
+	Z_Free(normals[1]);
+
+	Com_Printf("%d errors\n", errors);
+	TST_PrintTimes("emissive analysis", "powf", "table", emissive_usec, iterations);
+	TST_PrintTimes("normal maps, 16M pixels", "scalar", "vectorized", normal_usec, 1);
+}
+#endif
+
 void
 IMG_Load_RTX(image_t *image, byte *pic)
 {
@@ -642,6 +978,11 @@ IMG_Unload_RTX(image_t *image)
 		Z_Free(image->pix_data);
 	image->pix_data = NULL;
 
+	if(image->dds_data)
+		Z_Free(image->dds_data);
+	image->dds_data = NULL;
+	image->dds_size = 0;
+
 	const uint32_t index = image - r_images;
 
 	if (tex_images[index])
@@ -694,8 +1035,11 @@ void IMG_ReloadAll(void)
         if (load_img(filepath, &new_image) == Q_ERR_SUCCESS)
         {
             Z_Free(image->pix_data);
+            Z_Free(image->dds_data);
 
             image->pix_data = new_image.pix_data;
+            image->dds_data = NULL;
+            image->dds_size = 0;
             image->width = new_image.width;
             image->height = new_image.width;
             image->upload_width = new_image.upload_width;
@@ -1083,6 +1427,81 @@ static VkMemoryAllocateFlagsInfoKHR mem_alloc_flags_broadcast = {
 };
 #endif
 
+static VkFormat
+get_texture_format(const image_t* image)
+{
+	if (image->dds_data)
+		return vkpt_texture_cache_format(image);
+
+	return image->is_srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+}
+
+// staging buffer space for the image, cached images come with all mip levels
+static size_t
+get_texture_upload_size(const image_t* image, const VkMemoryRequirements* mem_req)
+{
+	size_t size = image->upload_width * image->upload_height * 4;
+
+	if (image->dds_data)
+		vkpt_texture_cache_levels(image, &size);
+
+	return MAX(mem_req->size, size);
+}
+
+// copies all mip levels of a cached image, leaves it ready for sampling
+static void
+upload_cached_texture(VkCommandBuffer cmd_buf, const image_t* q_img, VkImage image,
+	VkBuffer buffer, char* staging_buffer, size_t offset, int num_mip_levels)
+{
+	VkFormat format = vkpt_texture_cache_format(q_img);
+	size_t size;
+	const byte* levels = vkpt_texture_cache_levels(q_img, &size);
+
+	memcpy(staging_buffer + offset, levels, size);
+
+	uint32_t wd = q_img->upload_width;
+	uint32_t ht = q_img->upload_height;
+
+	for (int mip = 0; mip < num_mip_levels; mip++)
+	{
+		VkBufferImageCopy cpy_info = {
+			.bufferOffset = offset,
+			.imageSubresource = {
+				.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel       = mip,
+				.baseArrayLayer = 0,
+				.layerCount     = 1,
+			},
+			.imageOffset    = { 0, 0, 0 },
+			.imageExtent    = { wd, ht, 1 }
+		};
+
+		vkCmdCopyBufferToImage(cmd_buf, buffer, image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &cpy_info);
+
+		offset += vkpt_texture_cache_level_size(format, wd, ht);
+		wd = MAX(wd >> 1, 1);
+		ht = MAX(ht >> 1, 1);
+	}
+
+	VkImageSubresourceRange subresource_range = {
+		.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel   = 0,
+		.levelCount     = num_mip_levels,
+		.baseArrayLayer = 0,
+		.layerCount     = 1
+	};
+
+	IMAGE_BARRIER(cmd_buf,
+		.image            = image,
+		.subresourceRange = subresource_range,
+		.srcAccessMask    = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask    = VK_ACCESS_SHADER_READ_BIT,
+		.oldLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.newLayout        = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	);
+}
+
 VkResult
 vkpt_textures_end_registration()
 {
@@ -1141,13 +1560,13 @@ vkpt_textures_end_registration()
 	for(int i = 0; i < MAX_RIMAGES; i++) {
 		image_t *q_img = r_images + i;
 
-		if (tex_images[i] != VK_NULL_HANDLE || !q_img->registration_sequence || q_img->pix_data == NULL)
+		if (tex_images[i] != VK_NULL_HANDLE || !q_img->registration_sequence || (q_img->pix_data == NULL && q_img->dds_data == NULL))
 			continue;
 
 		img_info.extent.width = q_img->upload_width;
 		img_info.extent.height = q_img->upload_height;
 		img_info.mipLevels = get_num_miplevels(q_img->upload_width, q_img->upload_height);
-		img_info.format = q_img->is_srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+		img_info.format = get_texture_format(q_img);
 
 		_VK(vkCreateImage(qvk.device, &img_info, NULL, tex_images + i));
 		ATTACH_LABEL_VARIABLE(tex_images[i], IMAGE);
@@ -1158,7 +1577,7 @@ vkpt_textures_end_registration()
 		assert(!(mem_req.alignment & (mem_req.alignment - 1)));
 		total_size += mem_req.alignment - 1;
 		total_size &= ~(mem_req.alignment - 1);
-		total_size += mem_req.size;
+		total_size += get_texture_upload_size(q_img, &mem_req);
 
 		DeviceMemory* image_memory = tex_image_memory + i;
 		image_memory->size = mem_req.size;
@@ -1224,6 +1643,12 @@ vkpt_textures_end_registration()
 				.newLayout        = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
 		);
 
+		if (q_img->dds_data)
+		{
+			upload_cached_texture(cmd_buf, q_img, tex_images[i], buf_img_upload.buffer,
+				staging_buffer, offset, num_mip_levels);
+		}
+		else
 		{
 			memcpy(staging_buffer + offset, q_img->pix_data, wd * ht * 4);
 
@@ -1241,88 +1666,88 @@ vkpt_textures_end_registration()
 
 			vkCmdCopyBufferToImage(cmd_buf, buf_img_upload.buffer, tex_images[i],
 				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &cpy_info);
-		}
 
-		subresource_range.levelCount = 1;
+			subresource_range.levelCount = 1;
 
-		for (int mip = 1; mip < num_mip_levels; mip++) 
-		{
-			subresource_range.baseMipLevel = mip - 1;
-
-			IMAGE_BARRIER(cmd_buf,
-				.image = tex_images[i],
-				.subresourceRange = subresource_range,
-				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-				.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
-				.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				);
+			for (int mip = 1; mip < num_mip_levels; mip++) 
+			{
+				subresource_range.baseMipLevel = mip - 1;
 
-			int nwd = (wd > 1) ? (wd >> 1) : wd;
-			int nht = (ht > 1) ? (ht >> 1) : ht;
+				IMAGE_BARRIER(cmd_buf,
+					.image = tex_images[i],
+					.subresourceRange = subresource_range,
+					.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+					.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+					.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					);
+
+				int nwd = (wd > 1) ? (wd >> 1) : wd;
+				int nht = (ht > 1) ? (ht >> 1) : ht;
+
+				VkImageBlit region = {
+					.srcSubresource = {
+						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+						.mipLevel = mip - 1,
+						.baseArrayLayer = 0,
+						.layerCount = 1
+					},
+					.srcOffsets = { 
+						{ 0, 0, 0 }, 
+						{ wd, ht, 1 } },
+
+					.dstSubresource = {
+						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+						.mipLevel = mip,
+						.baseArrayLayer = 0,
+						.layerCount = 1
+					},
+					.dstOffsets = { 
+						{ 0, 0, 0 }, 
+						{ nwd, nht, 1 } }
+				};
 
-			VkImageBlit region = {
-				.srcSubresource = {
-					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-					.mipLevel = mip - 1,
-					.baseArrayLayer = 0,
-					.layerCount = 1
-				},
-				.srcOffsets = { 
-					{ 0, 0, 0 }, 
-					{ wd, ht, 1 } },
+				vkCmdBlitImage(
+					cmd_buf, 
+					tex_images[i], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 
+					tex_images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
+					1, &region, 
+					VK_FILTER_LINEAR);
 
-				.dstSubresource = {
-					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-					.mipLevel = mip,
-					.baseArrayLayer = 0,
-					.layerCount = 1
-				},
-				.dstOffsets = { 
-					{ 0, 0, 0 }, 
-					{ nwd, nht, 1 } }
-			};
+				subresource_range.baseMipLevel = mip - 1;
 
-			vkCmdBlitImage(
-				cmd_buf, 
-				tex_images[i], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 
-				tex_images[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-				1, &region, 
-				VK_FILTER_LINEAR);
+				IMAGE_BARRIER(cmd_buf,
+					.image = tex_images[i],
+					.subresourceRange = subresource_range,
+					.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+					.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+					.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					);
+
+				wd = nwd;
+				ht = nht;
+			}
 
-			subresource_range.baseMipLevel = mip - 1;
+			subresource_range.baseMipLevel = num_mip_levels - 1;
 
 			IMAGE_BARRIER(cmd_buf,
 				.image = tex_images[i],
 				.subresourceRange = subresource_range,
 				.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
 				.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-				.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 				.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 				);
-
-			wd = nwd;
-			ht = nht;
 		}
 
-		subresource_range.baseMipLevel = num_mip_levels - 1;
-
-		IMAGE_BARRIER(cmd_buf,
-			.image = tex_images[i],
-			.subresourceRange = subresource_range,
-			.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
-			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			);
-
 		img_view_info.image = tex_images[i];
 		img_view_info.subresourceRange.levelCount = num_mip_levels;
-		img_view_info.format = q_img->is_srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+		img_view_info.format = get_texture_format(q_img);
 		_VK(vkCreateImageView(qvk.device, &img_view_info, NULL, tex_image_views + i));
 		ATTACH_LABEL_VARIABLE(tex_image_views[i], IMAGE_VIEW);
 
-		offset += mem_req.size;
+		offset += get_texture_upload_size(q_img, &mem_req);
 	}
 
 	buffer_unmap(&buf_img_upload);
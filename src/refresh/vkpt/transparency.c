@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "shared/shared.h"
 #include "vkpt.h"
 #include "vk_util.h"
+#include "common/tests.h"
 
 #define TR_PARTICLE_MAX_NUM    MAX_PARTICLES
 #define TR_BEAM_MAX_NUM        MAX_ENTITIES
@@ -260,19 +261,16 @@ void get_transparency_counts(int* particle_num, int* beam_num, int* sprite_num)
 	*sprite_num = transparency.sprite_num;
 }
 
-static void write_particle_geometry(const float* view_matrix, const particle_t* particles, int particle_num)
+typedef struct
 {
-	const float particle_size = cvar_pt_particle_size->value;
-
-	const vec3_t view_y = { view_matrix[1], view_matrix[5], view_matrix[9] };
-
-	// TODO: remove vkpt_refdef.fd, it's better to calculate it from the view matrix
-	const vec3_t view_origin = { vkpt_refdef.fd->vieworg[0], vkpt_refdef.fd->vieworg[1], vkpt_refdef.fd->vieworg[2] };
-
-	// TODO: use better alignment?
-	vec3_t* vertex_positions = (vec3_t*)(transparency.mapped_host_buffer + transparency.vertex_position_host_offset);
-	float* particle_colors = (float*)(transparency.mapped_host_buffer + transparency.particle_color_host_offset);
+	vec3_t view_origin;
+	vec3_t view_y;
+	float particle_size;
+} particle_view_t;
 
+static void write_particles_C(const particle_view_t* view, const particle_t* particles, int particle_num,
+	vec3_t* vertex_positions, float* particle_colors)
+{
 	for (int i = 0; i < particle_num; i++)
 	{
 		const particle_t* particle = particles + i;
@@ -285,19 +283,19 @@ static void write_particle_geometry(const float* view_matrix, const particle_t*
 		VectorCopy(particle->origin, origin);
 
 		vec3_t z_axis;
-		VectorSubtract(view_origin, origin, z_axis);
+		VectorSubtract(view->view_origin, origin, z_axis);
 		VectorNormalize(z_axis);
 
 		vec3_t x_axis;
 		vec3_t y_axis;
-		CrossProduct(z_axis, view_y, x_axis);
+		CrossProduct(z_axis, view->view_y, x_axis);
 		CrossProduct(x_axis, z_axis, y_axis);
 
 		const float size_factor = pow(particle->alpha, 0.05f);
 		if (particle->radius == 0.f)
 		{
-			VectorScale(y_axis, particle_size * size_factor, y_axis);
-			VectorScale(x_axis, particle_size * size_factor, x_axis);
+			VectorScale(y_axis, view->particle_size * size_factor, y_axis);
+			VectorScale(x_axis, view->particle_size * size_factor, x_axis);
 		}
 		else
 		{
@@ -322,6 +320,169 @@ static void write_particle_geometry(const float* view_matrix, const particle_t*
 	}
 }
 
+#if USE_SSE2
+
+// log2(x) for positive normal x, absolute error below 1e-5
+static inline __m128 log2_ps(__m128 x)
+{
+	__m128i xi = _mm_castps_si128(x);
+	__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(xi, 23), _mm_set1_epi32(127)));
+	__m128 t = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_and_si128(xi, _mm_set1_epi32(0x007fffff)),
+		_mm_set1_epi32(0x3f800000))), _mm_set1_ps(1.f));
+
+	// log2(1 + t) / t on [0, 1)
+	__m128 p = _mm_set1_ps(-0.03382204473f);
+	p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(0.14447109401f));
+	p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.30163800716f));
+	p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(0.46865886449f));
+	p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(-0.72035878896f));
+	p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(1.44268143177f));
+
+	return _mm_add_ps(e, _mm_mul_ps(p, t));
+}
+
+// 2^x for x in [-126, 127], relative error below 2e-7
+static inline __m128 exp2_ps(__m128 x)
+{
+	__m128i i = _mm_cvttps_epi32(x);
+	// truncation rounds negative values up, make it floor
+	i = _mm_add_epi32(i, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(i), x)));
+	__m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(i));
+
+	// 2^f on [0, 1)
+	__m128 p = _mm_set1_ps(0.001893754f);
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.008949590847f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.05586033687f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.24014182389f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.69315451384f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.99999988079f));
+
+	return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23)));
+}
+
+/*
+  Same as write_particles_C, for four particles at a time. Origins and
+  parameters are loaded into SoA registers, the billboards are built with
+  the same operations in the same order as the scalar code, and the results
+  are transposed back into the vertex layout. Only the size falloff differs,
+  pow is replaced with a polynomial approximation.
+*/
+static void write_particles_SIMD(const particle_view_t* view, const particle_t* particles, int particle_num,
+	vec3_t* vertex_positions, float* particle_colors)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 vox = _mm_set1_ps(view->view_origin[0]);
+	const __m128 voy = _mm_set1_ps(view->view_origin[1]);
+	const __m128 voz = _mm_set1_ps(view->view_origin[2]);
+	const __m128 vyx = _mm_set1_ps(view->view_y[0]);
+	const __m128 vyy = _mm_set1_ps(view->view_y[1]);
+	const __m128 vyz = _mm_set1_ps(view->view_y[2]);
+	const __m128 particle_size = _mm_set1_ps(view->particle_size);
+	const __m128 inv_255 = _mm_set1_ps(1.f / 255.f);
+	const __m128i zeroi = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i + 4 <= particle_num; i += 4)
+	{
+		const particle_t* p = particles + i;
+
+		for (int k = 0; k < 4; k++)
+		{
+			uint32_t color = p[k].color < 0 ? p[k].rgba.u32 : d_8to24table[p[k].color & 0xff];
+			__m128i c = _mm_unpacklo_epi8(_mm_cvtsi32_si128(color), zeroi);
+			__m128 rgb = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(c, zeroi)), inv_255);
+			_mm_storeu_ps(particle_colors, _mm_mul_ps(rgb, _mm_set1_ps(p[k].brightness)));
+			particle_colors[3] = p[k].alpha;
+			particle_colors += 4;
+		}
+
+		__m128 ox = _mm_setr_ps(p[0].origin[0], p[1].origin[0], p[2].origin[0], p[3].origin[0]);
+		__m128 oy = _mm_setr_ps(p[0].origin[1], p[1].origin[1], p[2].origin[1], p[3].origin[1]);
+		__m128 oz = _mm_setr_ps(p[0].origin[2], p[1].origin[2], p[2].origin[2], p[3].origin[2]);
+		__m128 alpha = _mm_setr_ps(p[0].alpha, p[1].alpha, p[2].alpha, p[3].alpha);
+		__m128 radius = _mm_setr_ps(p[0].radius, p[1].radius, p[2].radius, p[3].radius);
+
+		// z axis points from the particle to the viewer
+		__m128 zx = _mm_sub_ps(vox, ox);
+		__m128 zy = _mm_sub_ps(voy, oy);
+		__m128 zz = _mm_sub_ps(voz, oz);
+		__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(zx, zx), _mm_mul_ps(zy, zy)), _mm_mul_ps(zz, zz)));
+		__m128 nonzero = _mm_cmpneq_ps(len, zero);
+		__m128 ilen = _mm_or_ps(_mm_and_ps(nonzero, _mm_div_ps(one, len)), _mm_andnot_ps(nonzero, one));
+		zx = _mm_mul_ps(zx, ilen);
+		zy = _mm_mul_ps(zy, ilen);
+		zz = _mm_mul_ps(zz, ilen);
+
+		// x = z cross view_y, y = x cross z
+		__m128 xx = _mm_sub_ps(_mm_mul_ps(zy, vyz), _mm_mul_ps(zz, vyy));
+		__m128 xy = _mm_sub_ps(_mm_mul_ps(zz, vyx), _mm_mul_ps(zx, vyz));
+		__m128 xz = _mm_sub_ps(_mm_mul_ps(zx, vyy), _mm_mul_ps(zy, vyx));
+		__m128 yx = _mm_sub_ps(_mm_mul_ps(xy, zz), _mm_mul_ps(xz, zy));
+		__m128 yy = _mm_sub_ps(_mm_mul_ps(xz, zx), _mm_mul_ps(xx, zz));
+		__m128 yz = _mm_sub_ps(_mm_mul_ps(xx, zy), _mm_mul_ps(xy, zx));
+
+		// pow(alpha, 0.05), zero for zero alpha
+		__m128 positive = _mm_cmpgt_ps(alpha, zero);
+		__m128 size_factor = _mm_and_ps(positive, exp2_ps(_mm_mul_ps(log2_ps(alpha), _mm_set1_ps(0.05f))));
+		__m128 use_size = _mm_cmpeq_ps(radius, zero);
+		__m128 scale = _mm_or_ps(_mm_and_ps(use_size, _mm_mul_ps(particle_size, size_factor)), _mm_andnot_ps(use_size, radius));
+
+		xx = _mm_mul_ps(xx, scale);
+		xy = _mm_mul_ps(xy, scale);
+		xz = _mm_mul_ps(xz, scale);
+		yx = _mm_mul_ps(yx, scale);
+		yy = _mm_mul_ps(yy, scale);
+		yz = _mm_mul_ps(yz, scale);
+
+		__m128 minus_x[3] = { _mm_sub_ps(ox, xx), _mm_sub_ps(oy, xy), _mm_sub_ps(oz, xz) };
+		__m128 plus_x[3] = { _mm_add_ps(ox, xx), _mm_add_ps(oy, xy), _mm_add_ps(oz, xz) };
+
+		// 12 rows of 4 particles, transposed in three 4x4 blocks into 4 rows of 12 floats
+		__m128 r0 = _mm_add_ps(minus_x[0], yx), r1 = _mm_add_ps(minus_x[1], yy), r2 = _mm_add_ps(minus_x[2], yz);
+		__m128 r3 = _mm_add_ps(plus_x[0], yx), r4 = _mm_add_ps(plus_x[1], yy), r5 = _mm_add_ps(plus_x[2], yz);
+		__m128 r6 = _mm_sub_ps(plus_x[0], yx), r7 = _mm_sub_ps(plus_x[1], yy), r8 = _mm_sub_ps(plus_x[2], yz);
+		__m128 r9 = _mm_sub_ps(minus_x[0], yx), r10 = _mm_sub_ps(minus_x[1], yy), r11 = _mm_sub_ps(minus_x[2], yz);
+
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_MM_TRANSPOSE4_PS(r4, r5, r6, r7);
+		_MM_TRANSPOSE4_PS(r8, r9, r10, r11);
+
+		float* dst = (float*)vertex_positions;
+		_mm_storeu_ps(dst + 0, r0); _mm_storeu_ps(dst + 4, r4); _mm_storeu_ps(dst + 8, r8);
+		_mm_storeu_ps(dst + 12, r1); _mm_storeu_ps(dst + 16, r5); _mm_storeu_ps(dst + 20, r9);
+		_mm_storeu_ps(dst + 24, r2); _mm_storeu_ps(dst + 28, r6); _mm_storeu_ps(dst + 32, r10);
+		_mm_storeu_ps(dst + 36, r3); _mm_storeu_ps(dst + 40, r7); _mm_storeu_ps(dst + 44, r11);
+
+		vertex_positions += 16;
+	}
+
+	write_particles_C(view, particles + i, particle_num - i, vertex_positions, particle_colors);
+}
+
+#else
+
+#define write_particles_SIMD    write_particles_C
+
+#endif
+
+static void write_particle_geometry(const float* view_matrix, const particle_t* particles, int particle_num)
+{
+	particle_view_t view;
+	view.particle_size = cvar_pt_particle_size->value;
+
+	VectorSet(view.view_y, view_matrix[1], view_matrix[5], view_matrix[9]);
+
+	// TODO: remove vkpt_refdef.fd, it's better to calculate it from the view matrix
+	VectorCopy(vkpt_refdef.fd->vieworg, view.view_origin);
+
+	// TODO: use better alignment?
+	vec3_t* vertex_positions = (vec3_t*)(transparency.mapped_host_buffer + transparency.vertex_position_host_offset);
+	float* particle_colors = (float*)(transparency.mapped_host_buffer + transparency.particle_color_host_offset);
+
+	write_particles_SIMD(&view, particles, particle_num, vertex_positions, particle_colors);
+}
+
 static void write_beam_geometry(const float* view_matrix, const entity_t* entities, int entity_num)
 {
 	const float beam_width = cvar_pt_beam_width->value;
@@ -581,6 +742,95 @@ static void write_sprite_geometry(const float* view_matrix, const entity_t* enti
 	}
 }
 
+#if USE_TESTS
+typedef struct
+{
+	const particle_view_t* view;
+	const particle_t* particles;
+	int particle_num;
+	vec3_t* positions[2];
+	float* colors[2];
+} particle_test_t;
+
+static void particle_test_run(void* arg, int k)
+{
+	particle_test_t* t = arg;
+	if (k)
+		write_particles_SIMD(t->view, t->particles, t->particle_num, t->positions[k], t->colors[k]);
+	else
+		write_particles_C(t->view, t->particles, t->particle_num, t->positions[k], t->colors[k]);
+}
+
+/*
+  CPU-only check of the vectorized particle billboards against the scalar
+  code on random particles. Prints the largest differences and the time
+  spent on the given number of particles.
+*/
+void vkpt_particle_test_f(void)
+{
+	int particle_num = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : MAX_PARTICLES;
+	int iterations = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 100;
+	clamp(particle_num, 1, TR_PARTICLE_MAX_NUM);
+	clamp(iterations, 1, 100000);
+
+	unsigned seed = 1;
+
+	particle_view_t view;
+	view.particle_size = cvar_pt_particle_size->value;
+	VectorSet(view.view_origin, TST_Frand(&seed) * 4096.f - 2048.f, TST_Frand(&seed) * 4096.f - 2048.f, TST_Frand(&seed) * 1024.f);
+	VectorSet(view.view_y, TST_Frand(&seed) - 0.5f, TST_Frand(&seed) - 0.5f, 1.f);
+	VectorNormalize(view.view_y);
+
+	particle_t* particles = Z_Mallocz(particle_num * sizeof(particle_t));
+	for (int i = 0; i < particle_num; i++)
+	{
+		particle_t* p = particles + i;
+		VectorSet(p->origin, TST_Frand(&seed) * 8192.f - 4096.f, TST_Frand(&seed) * 8192.f - 4096.f, TST_Frand(&seed) * 2048.f - 1024.f);
+		p->color = (TST_Rand(&seed) & 1) ? -1 : (int)(TST_Rand(&seed) & 255);
+		p->rgba.u32 = TST_Rand(&seed) | (TST_Rand(&seed) << 16);
+		p->alpha = (i % 16 == 0) ? 0.f : (i % 16 == 1) ? 1.f : TST_Frand(&seed);
+		p->brightness = TST_Frand(&seed) * 2.f;
+		p->radius = (i & 3) ? 0.f : TST_Frand(&seed) * 4.f;
+	}
+
+	// a particle at the view origin exercises the zero length normal
+	VectorCopy(view.view_origin, particles[0].origin);
+
+	particle_test_t t = { &view, particles, particle_num };
+	uint64_t usec[2] = { 0, 0 };
+
+	for (int k = 0; k < 2; k++)
+	{
+		t.positions[k] = Z_Malloc(particle_num * 4 * sizeof(vec3_t));
+		t.colors[k] = Z_Malloc(particle_num * 4 * sizeof(float));
+	}
+
+	TST_TimeVariants(particle_test_run, &t, iterations, usec);
+
+	float position_error = 0.f, color_error = 0.f;
+	for (int i = 0; i < particle_num * 4; i++)
+	{
+		for (int j = 0; j < 3; j++)
+			position_error = max(position_error, fabsf(t.positions[0][i][j] - t.positions[1][i][j]));
+		color_error = max(color_error, fabsf(t.colors[0][i] - t.colors[1][i]));
+	}
+
+	if (position_error > 1e-3f || color_error > 1e-5f)
+		Com_EPrintf("Vectorized particles differ from scalar particles\n");
+
+	Com_Printf("%d particles, max position error %g, max color error %g\n",
+		particle_num, position_error, color_error);
+	TST_PrintTimes("particles", "scalar", "vectorized", usec, iterations);
+
+	for (int k = 0; k < 2; k++)
+	{
+		Z_Free(t.positions[k]);
+		Z_Free(t.colors[k]);
+	}
+	Z_Free(particles);
+}
+#endif
+
 static void upload_geometry(VkCommandBuffer command_buffer)
 {
 	const size_t frame_offset = transparency.host_frame_index * transparency.host_frame_size;
@@ -100,12 +100,20 @@ vkpt_vertex_buffer_upload_bsp_mesh_to_staging(bsp_mesh_t *bsp_mesh)
 		num_vertices = MAX_VERT_BSP;
 	}
 
+	int num_indices = bsp_mesh->num_indices;
+	if (num_indices > MAX_VERT_BSP)
+	{
+		assert(!"Index buffer overflow");
+		num_indices = MAX_VERT_BSP;
+	}
+
 	memcpy(vbo->positions_bsp,  bsp_mesh->positions, num_vertices * sizeof(float) * 3   );
 	memcpy(vbo->tex_coords_bsp, bsp_mesh->tex_coords,num_vertices * sizeof(float) * 2   );
-    memcpy(vbo->tangents_bsp,   bsp_mesh->tangents,  num_vertices * sizeof(float));
-	memcpy(vbo->materials_bsp,  bsp_mesh->materials, num_vertices * sizeof(uint32_t) / 3);
-	memcpy(vbo->clusters_bsp, bsp_mesh->clusters, num_vertices * sizeof(uint32_t) / 3);
-	memcpy(vbo->texel_density_bsp, bsp_mesh->texel_density, num_vertices * sizeof(float) / 3);
+	memcpy(vbo->idx_bsp,        bsp_mesh->indices,   num_indices * sizeof(uint32_t)     );
+    memcpy(vbo->tangents_bsp,   bsp_mesh->tangents,  num_indices * sizeof(float));
+	memcpy(vbo->materials_bsp,  bsp_mesh->materials, num_indices * sizeof(uint32_t) / 3);
+	memcpy(vbo->clusters_bsp, bsp_mesh->clusters, num_indices * sizeof(uint32_t) / 3);
+	memcpy(vbo->texel_density_bsp, bsp_mesh->texel_density, num_indices * sizeof(float) / 3);
 
 	int num_clusters = bsp_mesh->num_clusters;
 	if (num_clusters > MAX_LIGHT_LISTS)
@@ -525,7 +533,7 @@ vkpt_vertex_buffer_create()
 
 	// Com_Printf("allocating %.02f MB of memory for vertex buffer\n", (double) sizeof(VertexBuffer) / (1024.0 * 1024.0));
 	buffer_create(&qvk.buf_vertex, sizeof(VertexBuffer),
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 	// Com_Printf("allocating %.02f MB of memory for staging vertex buffer\n", (double) sizeof(VertexBuffer) / (1024.0 * 1024.0));
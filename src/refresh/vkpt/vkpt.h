@@ -33,6 +33,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/common.h"
 #include "common/cvar.h"
 #include "common/files.h"
+#include "common/jobs.h"
 #include "common/math.h"
 #include "client/video.h"
 #include "client/client.h"
@@ -45,6 +46,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "shader/global_textures.h"
 #include "shader/vertex_buffer.h"
 
+// vectorized CPU side geometry generation
+#if USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #define LENGTH(a) ((sizeof (a)) / (sizeof(*(a))))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
@@ -496,6 +502,12 @@ void vkpt_extract_emissive_texture_info(image_t *image);
 void vkpt_textures_prefetch();
 void vkpt_init_light_textures();
 
+VkFormat vkpt_texture_cache_format(const image_t* image);
+const byte* vkpt_texture_cache_levels(const image_t* image, size_t* size);
+size_t vkpt_texture_cache_level_size(VkFormat format, int width, int height);
+byte* vkpt_texture_cache_decode(const image_t* image);
+void vkpt_build_texture_cache(void);
+
 VkCommandBuffer vkpt_begin_command_buffer(cmd_buf_group_t* group);
 void vkpt_free_command_buffers(cmd_buf_group_t* group);
 void vkpt_reset_command_buffers(cmd_buf_group_t* group);
@@ -584,7 +596,8 @@ VkResult vkpt_pt_create_pipelines();
 VkResult vkpt_pt_destroy_pipelines();
 
 VkResult vkpt_pt_create_toplevel(VkCommandBuffer cmd_buf, int idx, qboolean include_world, qboolean weapon_left_handed);
-VkResult vkpt_pt_create_static(VkBuffer vertex_buffer, size_t buffer_offset, int num_vertices, int num_vertices_transparent, int num_vertices_sky);
+VkResult vkpt_pt_create_static(VkBuffer vertex_buffer, size_t vertex_offset, size_t index_offset, int num_vertices,
+	int num_indices, int transparent_offset, int num_indices_transparent, int sky_offset, int num_indices_sky);
 VkResult vkpt_pt_destroy_static();
 VkResult vkpt_pt_record_cmd_buffer(VkCommandBuffer cmd_buf, uint32_t frame_num, float num_bounce_rays, int enable_denoiser);
 VkResult vkpt_pt_update_descripter_set_bindings(int idx);
@@ -635,6 +648,10 @@ void update_transparency(VkCommandBuffer command_buffer, const float* view_matri
 
 void build_transparency_blas(VkCommandBuffer cmd_buf);
 
+#if USE_TESTS
+void vkpt_particle_test_f(void);
+#endif
+
 VkAccelerationStructureNV get_transparency_particle_blas();
 VkAccelerationStructureNV get_transparency_beam_blas();
 VkAccelerationStructureNV get_transparency_sprite_blas();
@@ -740,6 +757,8 @@ int R_DrawString_RTX(int x, int y, int flags, size_t maxlen, const char *s, qhan
 void IMG_Load_RTX(image_t *image, byte *pic);
 void IMG_Unload_RTX(image_t *image);
 byte *IMG_ReadPixels_RTX(int *width, int *height, int *rowbytes);
+void *IMG_ReadCache_RTX(const image_t *image, size_t *len);
+qboolean IMG_LoadCache_RTX(image_t *image, void *cache, size_t cache_len, const void *src, size_t src_len);
 
 qerror_t MOD_LoadMD2_RTX(model_t *model, const void *rawdata, size_t length);
 qerror_t MOD_LoadMD3_RTX(model_t *model, const void *rawdata, size_t length);
@@ -499,7 +499,9 @@ static void SV_Kick_f(void)
             match->hits = 0;
             match->time = 0;
             match->comment[0] = 0;
-            List_Append(&sv_banlist, &match->entry);
+            if (SV_AddAddress(&sv_banlist, match)) {
+                Z_Free(match);
+            }
         }
     }
 
@@ -675,6 +677,38 @@ static void dump_settings(void)
     }
 }
 
+static unsigned bw_rate(const bandwidth_t *bw, uint64_t bytes)
+{
+    unsigned msec = svs.realtime - bw->time;
+
+    return msec ? bytes * 1000 / msec : 0;
+}
+
+static void dump_bandwidth(void)
+{
+    client_t    *cl;
+    bandwidth_t *bw;
+    uint64_t    frame, pstat, ents, sound, dnld;
+
+    Com_Printf(
+        "num name            total frame pstat  ents sound  dnld other\n"
+        "--- --------------- ----- ----- ----- ----- ----- ----- -----\n");
+
+    FOR_EACH_CLIENT(cl) {
+        bw = &cl->bw;
+        frame = bw->bytes[svc_frame];
+        pstat = bw->bytes[svc_playerinfo];
+        ents = bw->bytes[svc_packetentities];
+        sound = bw->bytes[svc_sound];
+        dnld = bw->bytes[svc_download] + bw->bytes[svc_zdownload];
+        Com_Printf("%3i %-15.15s %5u %5u %5u %5u %5u %5u %5u\n",
+                   cl->number, cl->name, bw_rate(bw, bw->total),
+                   bw_rate(bw, frame), bw_rate(bw, pstat), bw_rate(bw, ents),
+                   bw_rate(bw, sound), bw_rate(bw, dnld),
+                   bw_rate(bw, bw->total - frame - pstat - ents - sound - dnld));
+    }
+}
+
 /*
 ================
 SV_Status_f
@@ -702,6 +736,7 @@ static void SV_Status_f(void)
             case 'l': dump_lag(); break;
             case 'p': dump_protocols(); break;
             case 's': dump_settings(); break;
+            case 'b': dump_bandwidth(); break;
             default: dump_versions(); break;
             }
         } else {
@@ -713,6 +748,74 @@ static void SV_Status_f(void)
     SV_MvdStatus_f();
 }
 
+/*
+================
+SV_Bandwidth_f
+
+Prints bytes sent by message type for the given client,
+or for all clients since the server was started.
+================
+*/
+static void SV_Bandwidth_f(void)
+{
+    bandwidth_t *bw;
+    uint64_t    other;
+    unsigned    msec;
+    int         i;
+
+    if (!svs.initialized) {
+        Com_Printf("No server running.\n");
+        return;
+    }
+
+    if (Cmd_Argc() > 2) {
+        Com_Printf("Usage: %s [userid]\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (Cmd_Argc() > 1) {
+        if (!SV_SetPlayer())
+            return;
+        bw = &sv_client->bw;
+        Com_Printf("Bandwidth for %s", sv_client->name);
+        sv_client = NULL;
+        sv_player = NULL;
+    } else {
+        bw = &svs.bw;
+        Com_Printf("Bandwidth for all clients");
+    }
+
+    msec = svs.realtime - bw->time;
+    Com_Printf(" over %u seconds: %"PRIu64" bytes, %u bytes/sec\n\n",
+               msec / 1000, bw->total, bw_rate(bw, bw->total));
+
+    if (!bw->total) {
+        return;
+    }
+
+    Com_Printf(
+        "type                     count      bytes bytes/s     %%\n"
+        "------------------- ---------- ---------- ------- -----\n");
+
+    other = bw->total;
+    for (i = 0; i < svc_num_types; i++) {
+        if (!bw->count[i]) {
+            continue;
+        }
+        Com_Printf("%-19s %10"PRIu64" %10"PRIu64" %7u %5.1f\n",
+                   SV_BandwidthName(i), bw->count[i], bw->bytes[i],
+                   bw_rate(bw, bw->bytes[i]),
+                   bw->bytes[i] * 100.0 / bw->total);
+        other -= bw->bytes[i];
+    }
+
+    // frames that didn't fit may make this slightly negative
+    if ((int64_t)other > 0) {
+        Com_Printf("%-19s %10s %10"PRIu64" %7u %5.1f\n", "netchan/resend", "",
+                   other, bw_rate(bw, other), other * 100.0 / bw->total);
+    }
+}
+
 /*
 ==================
 SV_ConSay_f
@@ -1079,10 +1182,10 @@ static size_t format_mask(addrmatch_t *match, char *buf, size_t buf_size)
     return Q_snprintf(buf, buf_size, "%s/%d", NET_BaseAdrToString(&match->addr), bits);
 }
 
-void SV_AddMatch_f(list_t *list)
+void SV_AddMatch_f(addrlist_t *list)
 {
     char *s, buf[MAX_QPATH];
-    addrmatch_t *match;
+    addrmatch_t *match, *existing;
     netadr_t addr, mask;
     size_t len;
 
@@ -1096,15 +1199,6 @@ void SV_AddMatch_f(list_t *list)
         return;
     }
 
-    LIST_FOR_EACH(addrmatch_t, match, list, entry) {
-        if (NET_IsEqualBaseAdr(&match->addr, &addr) &&
-            NET_IsEqualBaseAdr(&match->mask, &mask)) {
-            format_mask(match, buf, sizeof(buf));
-            Com_Printf("Entry %s already exists.\n", buf);
-            return;
-        }
-    }
-
     s = Cmd_ArgsFrom(2);
     len = strlen(s);
     match = Z_Malloc(sizeof(*match) + len);
@@ -1113,13 +1207,19 @@ void SV_AddMatch_f(list_t *list)
     match->hits = 0;
     match->time = 0;
     memcpy(match->comment, s, len + 1);
-    List_Append(list, &match->entry);
+
+    existing = SV_AddAddress(list, match);
+    if (existing) {
+        format_mask(existing, buf, sizeof(buf));
+        Com_Printf("Entry %s already exists.\n", buf);
+        Z_Free(match);
+    }
 }
 
-void SV_DelMatch_f(list_t *list)
+void SV_DelMatch_f(addrlist_t *list)
 {
     char *s;
-    addrmatch_t *match, *next;
+    addrmatch_t *match;
     netadr_t addr, mask;
     int i;
 
@@ -1128,17 +1228,14 @@ void SV_DelMatch_f(list_t *list)
         return;
     }
 
-    if (LIST_EMPTY(list)) {
+    if (LIST_EMPTY(&list->list)) {
         Com_Printf("Address list is empty.\n");
         return;
     }
 
     s = Cmd_Argv(1);
     if (!strcmp(s, "all")) {
-        LIST_FOR_EACH_SAFE(addrmatch_t, match, next, list, entry) {
-            Z_Free(match);
-        }
-        List_Init(list);
+        SV_ClearAddresses(list);
         return;
     }
 
@@ -1149,7 +1246,7 @@ void SV_DelMatch_f(list_t *list)
             Com_Printf("Bad index: %d\n", i);
             return;
         }
-        match = LIST_INDEX(addrmatch_t, i - 1, list, entry);
+        match = LIST_INDEX(addrmatch_t, i - 1, &list->list, entry);
         if (match) {
             goto remove;
         }
@@ -1161,26 +1258,25 @@ void SV_DelMatch_f(list_t *list)
         return;
     }
 
-    LIST_FOR_EACH(addrmatch_t, match, list, entry) {
+    FOR_EACH_ADDRMATCH(match, list) {
         if (NET_IsEqualBaseAdr(&match->addr, &addr) &&
             NET_IsEqualBaseAdr(&match->mask, &mask)) {
 remove:
-            List_Remove(&match->entry);
-            Z_Free(match);
+            SV_RemoveAddress(list, match);
             return;
         }
     }
     Com_Printf("No such entry: %s\n", s);
 }
 
-void SV_ListMatches_f(list_t *list)
+void SV_ListMatches_f(addrlist_t *list)
 {
     addrmatch_t *match;
     char last[MAX_QPATH];
     char addr[MAX_QPATH];
     int count;
 
-    if (LIST_EMPTY(list)) {
+    if (LIST_EMPTY(&list->list)) {
         Com_Printf("Address list is empty.\n");
         return;
     }
@@ -1188,7 +1284,7 @@ void SV_ListMatches_f(list_t *list)
     Com_Printf("id address/mask       hits last hit     comment\n"
                "-- ------------------ ---- ------------ -------\n");
     count = 1;
-    LIST_FOR_EACH(addrmatch_t, match, list, entry) {
+    FOR_EACH_ADDRMATCH(match, list) {
         format_mask(match, addr, sizeof(addr));
         if (!match->time) {
             strcpy(last, "never");
@@ -1229,6 +1325,37 @@ static void SV_ListBlackHoles_f(void)
     SV_ListMatches_f(&sv_blacklist);
 }
 
+static void SV_DropStats_f(void)
+{
+    static const char *const names[DROP_MAX] = {
+        "blackholed addresses",
+        "sv_source_limit",
+        "sv_status_limit",
+        "sv_rcon_limit",
+        "sv_auth_limit",
+        "banned addresses"
+    };
+    int i;
+
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset")) {
+        memset(svs.drops, 0, sizeof(svs.drops));
+        svs.status_hits = svs.status_misses = 0;
+        svs.info_hits = svs.info_misses = 0;
+        return;
+    }
+
+    Com_Printf("dropped  rule\n"
+               "-------- --------------------\n");
+    for (i = 0; i < DROP_MAX; i++) {
+        Com_Printf("%8u %s\n", svs.drops[i], names[i]);
+    }
+
+    Com_Printf("\nstatus queries: %u from cache, %u rebuilt\n"
+               "info queries: %u from cache, %u rebuilt\n",
+               svs.status_hits, svs.status_misses,
+               svs.info_hits, svs.info_misses);
+}
+
 static list_t *SV_FindStuffList(void)
 {
     char *s = Cmd_Argv(1);
@@ -1550,6 +1677,7 @@ static const cmdreg_t c_server[] = {
     { "kick", SV_Kick_f, SV_SetPlayer_c },
     { "kickban", SV_Kick_f, SV_SetPlayer_c },
     { "status", SV_Status_f },
+    { "bandwidth", SV_Bandwidth_f, SV_SetPlayer_c },
     { "serverinfo", SV_Serverinfo_f },
     { "dumpuser", SV_DumpUser_f, SV_SetPlayer_c },
     { "stuff", SV_Stuff_f, SV_SetPlayer_c },
@@ -1570,6 +1698,7 @@ static const cmdreg_t c_server[] = {
     { "addblackhole", SV_AddBlackHole_f },
     { "delblackhole", SV_DelBlackHole_f },
     { "listblackholes", SV_ListBlackHoles_f },
+    { "dropstats", SV_DropStats_f },
     { "addstuffcmd", SV_AddStuffCmd_f, SV_StuffCmd_c },
     { "delstuffcmd", SV_DelStuffCmd_f, SV_StuffCmd_c },
     { "liststuffcmds", SV_ListStuffCmds_f, SV_StuffCmd_c },
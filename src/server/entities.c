@@ -176,6 +176,7 @@ void SV_WriteFrameToClient_Default(client_t *client)
     client_frame_t  *frame, *oldframe;
     player_packed_t *oldstate;
     int             lastframe;
+    size_t          cursize = msg_write.cursize;
 
     // this is the frame we are creating
     frame = &client->frames[client->framenum & UPDATE_MASK];
@@ -200,14 +201,19 @@ void SV_WriteFrameToClient_Default(client_t *client)
     // send over the areabits
     MSG_WriteByte(frame->areabytes);
     MSG_WriteData(frame->areabits, frame->areabytes);
+    SV_CountBytes(client, svc_frame, msg_write.cursize - cursize);
+    cursize = msg_write.cursize;
 
     // delta encode the playerstate
     MSG_WriteByte(svc_playerinfo);
     MSG_WriteDeltaPlayerstate_Default(oldstate, &frame->ps);
+    SV_CountBytes(client, svc_playerinfo, msg_write.cursize - cursize);
+    cursize = msg_write.cursize;
 
     // delta encode the entities
     MSG_WriteByte(svc_packetentities);
     SV_EmitPacketEntities(client, oldframe, frame, 0);
+    SV_CountBytes(client, svc_packetentities, msg_write.cursize - cursize);
 }
 
 /*
@@ -224,6 +230,7 @@ void SV_WriteFrameToClient_Enhanced(client_t *client)
     byte            *b1, *b2;
     msgPsFlags_t    psFlags;
     int             clientEntityNum;
+    size_t          cursize = msg_write.cursize;
 
     // this is the frame we are creating
     frame = &client->frames[client->framenum & UPDATE_MASK];
@@ -249,6 +256,8 @@ void SV_WriteFrameToClient_Enhanced(client_t *client)
     // send over the areabits
     MSG_WriteByte(frame->areabytes);
     MSG_WriteData(frame->areabits, frame->areabytes);
+    SV_CountBytes(client, svc_frame, msg_write.cursize - cursize);
+    cursize = msg_write.cursize;
 
     // ignore some parts of playerstate if not recording demo
     psFlags = 0;
@@ -314,8 +323,12 @@ void SV_WriteFrameToClient_Enhanced(client_t *client)
     client->suppress_count = 0;
     client->frameflags = 0;
 
+    SV_CountBytes(client, svc_playerinfo, msg_write.cursize - cursize);
+    cursize = msg_write.cursize;
+
     // delta encode the entities
     SV_EmitPacketEntities(client, oldframe, frame, clientEntityNum);
+    SV_CountBytes(client, svc_packetentities, msg_write.cursize - cursize);
 }
 
 /*
@@ -147,6 +147,8 @@ void SV_SpawnServer(mapcmd_t *cmd)
     Com_Printf("------- Server Initialization -------\n");
     Com_Printf("SpawnServer: %s\n", cmd->server);
 
+    SV_InvalidateStatus();
+
 	static qboolean warning_printed = qfalse;
 	if (dedicated->integer && !SV_NoSaveGames() && !warning_printed)
 	{
@@ -157,6 +159,9 @@ void SV_SpawnServer(mapcmd_t *cmd)
 		warning_printed = qtrue;
 	}
 
+    // load test bots can't follow map changes
+    SV_LoadTestStop();
+
     // everyone needs to reconnect
     FOR_EACH_CLIENT(client) {
         SV_ClientReset(client);
@@ -460,6 +465,9 @@ void SV_InitGame(unsigned mvd_spawn)
     // send heartbeat very soon
     svs.last_heartbeat = -(HEARTBEAT_SECONDS - 5) * 1000;
 
+    // start bandwidth accounting
+    svs.bw.time = svs.bw_log_time = svs.realtime;
+
     for (i = 0; i < sv_maxclients->integer; i++) {
         client = svs.client_pool + i;
         entnum = i + 1;
@@ -0,0 +1,617 @@
+/*
+Copyright (C) 2003-2008 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// loadtest.c -- deterministic load generation with scripted clients
+//
+
+#include "server.h"
+
+/*
+==============================================================================
+
+LOAD TEST CLIENTS
+
+Load test bots are fake clients maintained entirely server side, much like
+the dummy MVD client. Unlike the dummy, they are linked into the regular
+client list and talk to the server through a real netchan: every frame each
+bot builds a protocol 34 packet with a clc_move (or a connection stringcmd)
+and feeds it through the same path SV_PacketEvent uses for UDP clients.
+Server replies are acknowledged immediately, modelling a perfect network.
+
+In loopback mode replies are discarded before reaching the network layer.
+In UDP mode bots get a 127.0.0.1 address, so every reply goes through
+sendto() and the cost of the socket layer is included in the timings.
+
+While the test is running the server advances exactly one frame per
+SV_Frame call and never sleeps, so results only depend on bot count,
+frame count, seed and the map, not on wall clock timing.
+
+==============================================================================
+*/
+
+#define LT_QPORT_BASE       0x4c00
+#define LT_UDP_PORT         9       // discard service
+#define LT_MAX_WARMUP       50      // frames to wait for bots to spawn
+
+typedef struct {
+    client_t    *client;
+    int         qport;
+    int         outgoing_sequence;
+    unsigned    seed;
+    usercmd_t   cmds[3];
+    float       yaw, yaw_speed;
+    int         strafe_time;
+    int         sidemove;
+    qboolean    sent_begin;
+} lt_bot_t;
+
+static const char *const lt_stage_names[LT_NUM_STAGES] = {
+    "packets", "game", "build", "send", "total"
+};
+
+static struct {
+    qboolean    active;
+    qboolean    udp;
+    qboolean    quit;
+    int         numbots;
+    lt_bot_t    *bots;
+    int         frames_total;
+    int         frames_done;
+    int         warmup;
+    qhandle_t   csv;
+    char        csvname[MAX_OSPATH];
+
+    uint64_t    stage_start[LT_NUM_STAGES];
+    uint64_t    stage_frame[LT_NUM_STAGES];
+    uint64_t    stage_total[LT_NUM_STAGES];
+    uint64_t    stage_peak[LT_NUM_STAGES];
+    uint64_t    bytes_total;
+} lt;
+
+static unsigned lt_random(lt_bot_t *bot)
+{
+    bot->seed = bot->seed * 1103515245 + 12345;
+    return (bot->seed >> 16) & 0x7fff;
+}
+
+static client_t *lt_find_slot(void)
+{
+    client_t *c;
+    int i, j;
+
+    // leave reserved slots for real clients
+    j = sv_maxclients->integer - sv_reserved_slots->integer;
+    for (i = 0; i < j; i++) {
+        c = &svs.client_pool[i];
+        if (!c->state) {
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+static qboolean lt_connect(lt_bot_t *bot, int index)
+{
+    client_t *newcl;
+    char userinfo[MAX_INFO_STRING * 2];
+    netadr_t adr;
+    qboolean allow;
+    int number;
+
+    newcl = lt_find_slot();
+    if (!newcl) {
+        Com_EPrintf("No slot for load test client %d\n", index);
+        return qfalse;
+    }
+
+    memset(&adr, 0, sizeof(adr));
+    if (lt.udp) {
+        adr.type = NA_IP;
+        adr.ip.u8[0] = 127;
+        adr.ip.u8[3] = 1;
+        adr.port = BigShort(LT_UDP_PORT);
+    }
+
+    Q_snprintf(userinfo, MAX_INFO_STRING,
+               "\\name\\bot%d\\skin\\male/grunt\\rate\\25000"
+               "\\msg\\1\\hand\\2\\ip\\%s", index,
+               lt.udp ? NET_AdrToString(&adr) : "loopback");
+    userinfo[strlen(userinfo) + 1] = 0;
+
+    number = newcl - svs.client_pool;
+
+    // this mirrors SVC_DirectConnect for a protocol 34 client
+    memset(newcl, 0, sizeof(*newcl));
+    newcl->number = newcl->slot = number;
+    newcl->protocol = PROTOCOL_VERSION_DEFAULT;
+    newcl->edict = EDICT_NUM(number + 1);
+    newcl->gamedir = fs_game->string;
+    newcl->mapname = sv.name;
+    newcl->configstrings = (char *)sv.configstrings;
+    newcl->pool = (edict_pool_t *)&ge->edicts;
+    newcl->cm = &sv.cm;
+    newcl->spawncount = sv.spawncount;
+    newcl->maxclients = sv_maxclients->integer;
+    newcl->last_valid_cluster = -1;
+#if USE_FPS
+    newcl->framediv = sv.framediv;
+    newcl->settings[CLS_FPS] = BASE_FRAMERATE;
+#endif
+
+    newcl->pmp = sv_pmp;
+    newcl->pmp.airaccelerate = sv_airaccelerate->integer ? qtrue : qfalse;
+    newcl->pmp.strafehack = sv_strafejump_hack->integer >= 2 ? qtrue : qfalse;
+
+    sv_client = newcl;
+    sv_player = newcl->edict;
+    allow = ge->ClientConnect(newcl->edict, userinfo);
+    sv_client = NULL;
+    sv_player = NULL;
+    if (!allow) {
+        Com_EPrintf("Load test client %d rejected by game: %s\n", index,
+                    Info_ValueForKey(userinfo, "rejmsg"));
+        return qfalse;
+    }
+
+    bot->qport = (LT_QPORT_BASE + index) & 0xffff;
+    newcl->netchan = Netchan_Setup(NS_SERVER, NETCHAN_OLD, &adr, bot->qport,
+                                   MAX_PACKETLEN_WRITABLE_DEFAULT,
+                                   PROTOCOL_VERSION_DEFAULT);
+    newcl->numpackets = 1;
+
+    Q_strlcpy(newcl->userinfo, userinfo, sizeof(newcl->userinfo));
+    SV_UserinfoChanged(newcl);
+
+    SV_RateInit(&newcl->ratelimit_namechange, sv_namechange_limit->string);
+    SV_InitClientSend(newcl);
+    newcl->WriteFrame = SV_WriteFrameToClient_Default;
+
+    List_SeqAdd(&sv_clientlist, &newcl->entry);
+    SV_InvalidateStatus();
+
+    newcl->state = cs_assigned;
+    newcl->framenum = 1;
+    newcl->lastframe = -1;
+    newcl->lastmessage = svs.realtime;
+    newcl->lastactivity = svs.realtime;
+    newcl->min_ping = 9999;
+    newcl->connect_time = time(NULL);
+
+    bot->client = newcl;
+    bot->seed = index * 7919 + 1;
+    bot->yaw = lt_random(bot) * 360.0f / 32768;
+    bot->yaw_speed = (int)(lt_random(bot) % 90) - 45;
+    return qtrue;
+}
+
+// generate a plausible movement command: run forward, sweep the view,
+// change strafe direction every second or so, jump and fire at random
+static void lt_generate_cmd(lt_bot_t *bot, usercmd_t *cmd)
+{
+    unsigned r = lt_random(bot);
+
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->msec = SV_FRAMETIME;
+
+    bot->yaw += bot->yaw_speed * SV_FRAMETIME * 0.001f;
+    if (r % 64 == 0) {
+        bot->yaw_speed = (int)(lt_random(bot) % 360) - 180;
+    }
+    cmd->angles[YAW] = ANGLE2SHORT(anglemod(bot->yaw));
+    cmd->angles[PITCH] = ANGLE2SHORT((int)(r % 30) - 15);
+
+    if (--bot->strafe_time <= 0) {
+        bot->strafe_time = 5 + lt_random(bot) % 20;
+        bot->sidemove = bot->sidemove ? -bot->sidemove : (r & 1) ? 200 : -200;
+    }
+
+    cmd->forwardmove = 400;
+    cmd->sidemove = bot->sidemove;
+    if (r % 32 == 0) {
+        cmd->upmove = 200;
+    }
+    if ((r >> 5) % 4 == 0) {
+        cmd->buttons |= BUTTON_ATTACK;
+    }
+    cmd->buttons |= BUTTON_ANY;
+}
+
+static void lt_write_packet(lt_bot_t *bot)
+{
+    client_t *cl = bot->client;
+    netchan_old_t *chan = (netchan_old_t *)cl->netchan;
+    usercmd_t cmd;
+    int i;
+
+    SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
+
+    // acknowledge everything the server has sent so far
+    SZ_WriteLong(&msg_read, ++bot->outgoing_sequence);
+    SZ_WriteLong(&msg_read, (chan->pub.outgoing_sequence - 1) |
+                 (chan->reliable_sequence << 31));
+    SZ_WriteShort(&msg_read, bot->qport);
+
+    switch (cl->state) {
+    case cs_assigned:
+    case cs_connected:
+        SZ_WriteByte(&msg_read, clc_stringcmd);
+        SZ_WriteString(&msg_read, "new");
+        bot->sent_begin = qfalse;
+        break;
+    case cs_primed:
+        if (bot->sent_begin) {
+            SZ_WriteByte(&msg_read, clc_nop);
+            break;
+        }
+        SZ_WriteByte(&msg_read, clc_stringcmd);
+        SZ_WriteString(&msg_read, va("begin %d", sv.spawncount));
+        bot->sent_begin = qtrue;
+        break;
+    case cs_spawned:
+        lt_generate_cmd(bot, &cmd);
+        bot->cmds[0] = bot->cmds[1];
+        bot->cmds[1] = bot->cmds[2];
+        bot->cmds[2] = cmd;
+
+        MSG_WriteByte(clc_move);
+        MSG_WriteByte(0);   // checksum, not verified by server
+        MSG_WriteLong(cl->framenum - 1);
+        for (i = 0; i < 3; i++) {
+            MSG_WriteDeltaUsercmd(i ? &bot->cmds[i - 1] : NULL,
+                                  &bot->cmds[i], PROTOCOL_VERSION_DEFAULT);
+            MSG_WriteByte(0);   // lightlevel
+        }
+        SZ_Write(&msg_read, msg_write.data, msg_write.cursize);
+        SZ_Clear(&msg_write);
+        break;
+    default:
+        break;
+    }
+}
+
+static void lt_process_packet(lt_bot_t *bot)
+{
+    client_t *cl = bot->client;
+    netchan_t *netchan = cl->netchan;
+
+    // same as SV_PacketEvent after the client lookup
+    if (!netchan->Process(netchan))
+        return;
+
+    cl->lastmessage = svs.realtime;
+#if USE_ICMP
+    cl->unreachable = qfalse;
+#endif
+    if (netchan->dropped > 0)
+        cl->frameflags |= FF_CLIENTDROP;
+
+    SV_ExecuteClientMessage(cl);
+}
+
+static void lt_write_csv_header(void)
+{
+    int i;
+
+    FS_FPrintf(lt.csv, "frame,clients");
+    for (i = 0; i < LT_NUM_STAGES; i++) {
+        FS_FPrintf(lt.csv, ",%s_us", lt_stage_names[i]);
+    }
+    FS_FPrintf(lt.csv, ",bytes\n");
+}
+
+static void lt_print_summary(void)
+{
+    int i, frames = lt.frames_done;
+
+    Com_Printf("Load test: %d clients, %d frames", lt.numbots, frames);
+    if (lt.csv) {
+        Com_Printf(", results written to %s", lt.csvname);
+    }
+    Com_Printf("\n");
+
+    if (!frames) {
+        return;
+    }
+
+    Com_Printf("stage     avg_us  peak_us\n"
+               "-------- ------- --------\n");
+    for (i = 0; i < LT_NUM_STAGES; i++) {
+        Com_Printf("%-8s %7"PRIu64" %8"PRIu64"\n", lt_stage_names[i],
+                   lt.stage_total[i] / frames, lt.stage_peak[i]);
+    }
+    Com_Printf("%"PRIu64" bytes/frame sent, %.1f frames/sec sustainable\n",
+               lt.bytes_total / frames,
+               lt.stage_total[LT_TOTAL] ?
+               frames * 1e6 / lt.stage_total[LT_TOTAL] : 0.0);
+}
+
+/*
+==================
+SV_LoadTestStop
+==================
+*/
+void SV_LoadTestStop(void)
+{
+    lt_bot_t *bot;
+    int i;
+
+    if (!lt.active) {
+        return;
+    }
+
+    lt_print_summary();
+
+    for (i = 0, bot = lt.bots; i < lt.numbots; i++, bot++) {
+        if (bot->client && bot->client->state > cs_zombie) {
+            SV_DropClient(bot->client, "load test finished");
+            SV_RemoveClient(bot->client);
+        }
+    }
+
+    if (lt.csv) {
+        FS_FCloseFile(lt.csv);
+    }
+
+    Z_Free(lt.bots);
+
+    if (lt.quit) {
+        Cbuf_AddText(&cmd_buffer, "quit\n");
+    }
+
+    memset(&lt, 0, sizeof(lt));
+}
+
+qboolean SV_LoadTestActive(void)
+{
+    return lt.active;
+}
+
+void SV_LoadTestBeginStage(lt_stage_t stage)
+{
+    if (lt.active) {
+        lt.stage_start[stage] = Sys_Microseconds();
+    }
+}
+
+void SV_LoadTestEndStage(lt_stage_t stage)
+{
+    if (lt.active) {
+        lt.stage_frame[stage] += Sys_Microseconds() - lt.stage_start[stage];
+    }
+}
+
+/*
+==================
+SV_LoadTestRunBots
+
+Called after reading network packets, feeds one packet from each bot.
+==================
+*/
+void SV_LoadTestRunBots(void)
+{
+    lt_bot_t *bot;
+    int i;
+
+    if (!lt.active) {
+        return;
+    }
+
+    for (i = 0, bot = lt.bots; i < lt.numbots; i++, bot++) {
+        if (!bot->client) {
+            continue;
+        }
+
+        // dropped by the server, forget about it
+        if (bot->client->state <= cs_zombie) {
+            Com_WPrintf("Load test client %d dropped\n", i);
+            bot->client = NULL;
+            continue;
+        }
+
+        lt_write_packet(bot);
+        lt_process_packet(bot);
+    }
+
+    SZ_Init(&msg_read, msg_read_buffer, sizeof(msg_read_buffer));
+}
+
+/*
+==================
+SV_LoadTestEndFrame
+
+Called after each completed server frame, records stage timings.
+==================
+*/
+void SV_LoadTestEndFrame(void)
+{
+    lt_bot_t *bot;
+    size_t bytes;
+    int i, spawned;
+
+    if (!lt.active) {
+        return;
+    }
+
+    // build stage is accumulated inside of send stage
+    lt.stage_frame[LT_SEND] -= lt.stage_frame[LT_BUILD];
+
+    spawned = 0;
+    bytes = 0;
+    for (i = 0, bot = lt.bots; i < lt.numbots; i++, bot++) {
+        if (bot->client && bot->client->state == cs_spawned) {
+            bytes += bot->client->message_size[
+                (bot->client->framenum - 1) % RATE_MESSAGES];
+            spawned++;
+        }
+    }
+
+    // don't count frames until everyone is in game
+    if (spawned < lt.numbots && ++lt.warmup < LT_MAX_WARMUP) {
+        memset(lt.stage_frame, 0, sizeof(lt.stage_frame));
+        return;
+    }
+
+    for (i = 0; i < LT_NUM_STAGES; i++) {
+        lt.stage_total[i] += lt.stage_frame[i];
+        lt.stage_peak[i] = max(lt.stage_peak[i], lt.stage_frame[i]);
+    }
+    lt.bytes_total += bytes;
+
+    if (lt.csv) {
+        FS_FPrintf(lt.csv, "%d,%d", lt.frames_done, spawned);
+        for (i = 0; i < LT_NUM_STAGES; i++) {
+            FS_FPrintf(lt.csv, ",%"PRIu64, lt.stage_frame[i]);
+        }
+        FS_FPrintf(lt.csv, ",%"PRIz"\n", bytes);
+    }
+
+    memset(lt.stage_frame, 0, sizeof(lt.stage_frame));
+
+    if (++lt.frames_done >= lt.frames_total) {
+        SV_LoadTestStop();
+    }
+}
+
+static const cmd_option_t o_loadtest[] = {
+    { "h", "help", "display this message" },
+    { "o:string", "output", "write per-frame timings to CSV <string>" },
+    { "q", "quit", "quit when the test is finished" },
+    { "s:int", "seed", "seed random number generators with <int>" },
+    { "u", "udp", "send replies through UDP socket" },
+    { NULL }
+};
+
+static void SV_LoadTest_f(void)
+{
+    char buffer[MAX_OSPATH];
+    char *output = NULL;
+    unsigned seed = 0;
+    qboolean udp = qfalse, quit = qfalse;
+    int c, i, numbots, frames;
+
+    while ((c = Cmd_ParseOptions(o_loadtest)) != -1) {
+        switch (c) {
+        case 'h':
+            Cmd_PrintUsage(o_loadtest, "<clients> <frames>");
+            Com_Printf("Run server for a fixed number of frames "
+                       "with scripted clients.\n");
+            Cmd_PrintHelp(o_loadtest);
+            return;
+        case 'o':
+            output = cmd_optarg;
+            break;
+        case 'q':
+            quit = qtrue;
+            break;
+        case 's':
+            seed = atoi(cmd_optarg);
+            break;
+        case 'u':
+            udp = qtrue;
+            break;
+        default:
+            return;
+        }
+    }
+
+    if (Cmd_Argc() - cmd_optind < 2) {
+        Com_Printf("Missing arguments.\n");
+        Cmd_PrintHint();
+        return;
+    }
+
+    if (sv.state != ss_game) {
+        Com_Printf("No server running.\n");
+        return;
+    }
+
+    if (lt.active) {
+        Com_Printf("Load test already running.\n");
+        return;
+    }
+
+    numbots = atoi(Cmd_Argv(cmd_optind));
+    frames = atoi(Cmd_Argv(cmd_optind + 1));
+    if (numbots < 1 || numbots > sv_maxclients->integer) {
+        Com_Printf("Bad number of clients.\n");
+        return;
+    }
+    if (frames < 1) {
+        Com_Printf("Bad number of frames.\n");
+        return;
+    }
+
+    if (output) {
+        lt.csv = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE,
+                                 "", output, ".csv");
+        if (!lt.csv) {
+            return;
+        }
+        Q_strlcpy(lt.csvname, buffer, sizeof(lt.csvname));
+        lt_write_csv_header();
+    }
+
+    srand(seed);
+
+    lt.udp = udp;
+    lt.quit = quit;
+    lt.frames_total = frames;
+    lt.bots = SV_Mallocz(sizeof(lt.bots[0]) * numbots);
+
+    for (i = 0; i < numbots; i++) {
+        if (!lt_connect(&lt.bots[lt.numbots], i)) {
+            break;
+        }
+        lt.bots[lt.numbots++].seed += seed;
+    }
+
+    if (!lt.numbots) {
+        lt.active = qtrue;
+        SV_LoadTestStop();
+        return;
+    }
+
+    Com_Printf("Starting load test with %d clients for %d frames%s\n",
+               lt.numbots, frames, udp ? " over UDP" : "");
+
+    lt.active = qtrue;
+}
+
+static void SV_LoadTestStop_f(void)
+{
+    if (!lt.active) {
+        Com_Printf("No load test running.\n");
+        return;
+    }
+
+    SV_LoadTestStop();
+}
+
+static const cmdreg_t c_loadtest[] = {
+    { "loadtest", SV_LoadTest_f },
+    { "loadtest_stop", SV_LoadTestStop_f },
+
+    { NULL }
+};
+
+void SV_LoadTestRegister(void)
+{
+    Cmd_Register(c_loadtest);
+}
@@ -22,8 +22,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 pmoveParams_t   sv_pmp;
 
 LIST_DECL(sv_masterlist);   // address of group servers
-LIST_DECL(sv_banlist);
-LIST_DECL(sv_blacklist);
+ADDRLIST_DECL(sv_banlist);
+ADDRLIST_DECL(sv_blacklist);
 LIST_DECL(sv_cmdlist_connect);
 LIST_DECL(sv_cmdlist_begin);
 LIST_DECL(sv_filterlist);
@@ -88,8 +88,11 @@ cvar_t  *sv_iplimit;
 cvar_t  *sv_status_limit;
 cvar_t  *sv_status_show;
 cvar_t  *sv_uptime;
+cvar_t  *sv_bwlog;
+cvar_t  *sv_bwlog_name;
 cvar_t  *sv_auth_limit;
 cvar_t  *sv_rcon_limit;
+cvar_t  *sv_source_limit;
 cvar_t  *sv_namechange_limit;
 
 cvar_t  *sv_restrict_rtx;
@@ -220,6 +223,8 @@ void SV_DropClient(client_t *client, const char *reason)
     client->state = cs_zombie;        // become free in a few seconds
     client->lastmessage = svs.realtime;
 
+    SV_InvalidateStatus();
+
     // print the reason
     if (reason)
         print_drop_reason(client, reason, oldstate);
@@ -367,21 +372,297 @@ void SV_RateInit(ratelimit_t *r, const char *s)
     r->cost = rate2credits(rate);
 }
 
-addrmatch_t *SV_MatchAddress(list_t *list, netadr_t *addr)
+// per-address token buckets for connectionless packets, replaced in LRU
+// order within hash set when a new address arrives
+#define SOURCE_HASH_SIZE    1024
+#define SOURCE_HASH_WAYS    4
+
+typedef struct {
+    netadr_t    addr;
+    ratelimit_t limit;
+} source_limit_t;
+
+static source_limit_t   source_limits[SOURCE_HASH_SIZE][SOURCE_HASH_WAYS];
+
+static unsigned source_hash(const netadr_t *addr)
 {
-    addrmatch_t *match;
+    uint32_t h;
+
+    // IPv6 hosts typically control the whole /64
+    if (addr->type == NA_IP6) {
+        h = addr->ip.u32[0] ^ addr->ip.u32[1] * 0x9e3779b1;
+    } else {
+        h = addr->ip.u32[0];
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    return h & (SOURCE_HASH_SIZE - 1);
+}
+
+static qboolean source_equal(const netadr_t *a, const netadr_t *b)
+{
+    if (a->type != b->type)
+        return qfalse;
+
+    if (a->type == NA_IP6)
+        return a->ip.u32[0] == b->ip.u32[0] && a->ip.u32[1] == b->ip.u32[1];
+
+    return a->ip.u32[0] == b->ip.u32[0];
+}
+
+/*
+===============
+SV_SourceLimited
+
+Returns true if the source address exceeded sv_source_limit.
+===============
+*/
+static qboolean SV_SourceLimited(const netadr_t *addr)
+{
+    source_limit_t *set, *s, *oldest;
+    int i;
+
+    if (!svs.ratelimit_source.cost)
+        return qfalse;
+
+    if (addr->type != NA_IP && addr->type != NA_IP6)
+        return qfalse;
+
+    set = source_limits[source_hash(addr)];
+    oldest = set;
+    for (i = 0, s = set; i < SOURCE_HASH_WAYS; i++, s++) {
+        if (source_equal(&s->addr, addr))
+            return SV_RateLimited(&s->limit);
+        if (oldest->limit.cost && (!s->limit.cost || s->limit.time < oldest->limit.time))
+            oldest = s;
+    }
+
+    oldest->addr = *addr;
+    oldest->limit = svs.ratelimit_source;
+    oldest->limit.time = svs.realtime;
+    return SV_RateLimited(&oldest->limit);
+}
+
+/*
+==============================================================================
+
+ADDRESS LISTS
+
+==============================================================================
+*/
+
+// returns number of leading bits a and b have in common, up to max
+static int common_bits(const byte *a, const byte *b, int max)
+{
+    int i, bits;
+    byte x;
+
+    for (i = 0, bits = 0; bits < max; i++, bits += 8) {
+        x = a[i] ^ b[i];
+        if (x) {
+            while (!(x & 0x80)) {
+                x <<= 1;
+                bits++;
+            }
+            break;
+        }
+    }
 
-    LIST_FOR_EACH(addrmatch_t, match, list, entry) {
-        if (NET_IsEqualBaseAdrMask(addr, &match->addr, &match->mask)) {
-            match->hits++;
-            match->time = time(NULL);
-            return match;
+    return min(bits, max);
+}
+
+static inline int key_bit(const byte *key, int bit)
+{
+    return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+static addrnode_t *alloc_node(const byte *key, int bits, addrmatch_t *match)
+{
+    addrnode_t *n = Z_Mallocz(sizeof(*n));
+
+    memcpy(n->key, key, sizeof(n->key));
+    n->bits = bits;
+    n->match = match;
+    return n;
+}
+
+static void free_nodes(addrnode_t *n)
+{
+    if (n) {
+        free_nodes(n->child[0]);
+        free_nodes(n->child[1]);
+        Z_Free(n);
+    }
+}
+
+static int mask_bits(const addrmatch_t *match, int size)
+{
+    int i, c, bits = 0;
+
+    for (i = 0; i < size >> 3; i++) {
+        c = match->mask.ip.u8[i];
+        if (c != 0xff) {
+            while (c & 0x80) {
+                c = (c << 1) & 0xff;
+                bits++;
+            }
+            break;
+        }
+        bits += 8;
+    }
+
+    return bits;
+}
+
+// returns existing entry with the same address and mask, if any
+static addrmatch_t *insert_node(addrlist_t *list, addrmatch_t *match)
+{
+    addrnode_t **p, *n, *s;
+    byte key[16];
+    int i, size, bits, common;
+
+    size = match->addr.type == NA_IP6 ? 128 : 32;
+    bits = mask_bits(match, size);
+    for (i = 0; i < 16; i++) {
+        key[i] = match->addr.ip.u8[i] & match->mask.ip.u8[i];
+    }
+
+    p = &list->root[size == 128];
+    while ((n = *p) != NULL) {
+        common = common_bits(n->key, key, min(n->bits, bits));
+        if (common < n->bits) {
+            // n is more specific than the new entry or diverges from it
+            if (common == bits) {
+                s = alloc_node(key, bits, match);
+            } else {
+                s = alloc_node(key, common, NULL);
+                s->child[key_bit(key, common)] = alloc_node(key, bits, match);
+            }
+            s->child[key_bit(n->key, common)] = n;
+            *p = s;
+            return NULL;
+        }
+        if (n->bits == bits) {
+            if (n->match) {
+                return n->match;
+            }
+            n->match = match;
+            return NULL;
         }
+        p = &n->child[key_bit(key, n->bits)];
     }
 
+    *p = alloc_node(key, bits, match);
     return NULL;
 }
 
+/*
+===============
+SV_AddAddress
+
+Appends the entry to the list, unless an entry with the same address and
+mask already exists, in which case that entry is returned.
+===============
+*/
+addrmatch_t *SV_AddAddress(addrlist_t *list, addrmatch_t *match)
+{
+    addrmatch_t *existing = insert_node(list, match);
+
+    if (!existing) {
+        List_Append(&list->list, &match->entry);
+    }
+
+    return existing;
+}
+
+/*
+===============
+SV_RemoveAddress
+
+Removes and frees the entry. Tries are rebuilt from scratch, which is fine
+since removal is rare compared to matching.
+===============
+*/
+void SV_RemoveAddress(addrlist_t *list, addrmatch_t *match)
+{
+    addrmatch_t *m;
+
+    List_Remove(&match->entry);
+    Z_Free(match);
+
+    free_nodes(list->root[0]);
+    free_nodes(list->root[1]);
+    list->root[0] = list->root[1] = NULL;
+
+    FOR_EACH_ADDRMATCH(m, list) {
+        insert_node(list, m);
+    }
+}
+
+void SV_ClearAddresses(addrlist_t *list)
+{
+    addrmatch_t *match, *next;
+
+    LIST_FOR_EACH_SAFE(addrmatch_t, match, next, &list->list, entry) {
+        Z_Free(match);
+    }
+    List_Init(&list->list);
+
+    free_nodes(list->root[0]);
+    free_nodes(list->root[1]);
+    list->root[0] = list->root[1] = NULL;
+}
+
+/*
+===============
+SV_MatchAddress
+
+Returns the most specific entry matching the address.
+===============
+*/
+addrmatch_t *SV_MatchAddress(addrlist_t *list, netadr_t *addr)
+{
+    addrmatch_t *match;
+    addrnode_t *n;
+    int size;
+
+    switch (addr->type) {
+    case NA_IP:
+        size = 32;
+        n = list->root[0];
+        break;
+    case NA_IP6:
+        size = 128;
+        n = list->root[1];
+        break;
+    default:
+        return NULL;
+    }
+
+    match = NULL;
+    while (n) {
+        if (common_bits(n->key, addr->ip.u8, n->bits) < n->bits) {
+            break;
+        }
+        if (n->match) {
+            match = n->match;
+        }
+        if (n->bits == size) {
+            break;
+        }
+        n = n->child[key_bit(addr->ip.u8, n->bits)];
+    }
+
+    if (match) {
+        match->hits++;
+        match->time = time(NULL);
+    }
+
+    return match;
+}
+
 /*
 ==============================================================================
 
@@ -459,6 +740,53 @@ static size_t SV_StatusString(char *status)
     return total;
 }
 
+// rendered responses to connectionless queries are reused until the next
+// server frame, unless invalidated earlier by client list changes
+typedef struct {
+    char        data[MAX_PACKETLEN_DEFAULT];
+    size_t      len;
+    qboolean    valid;
+    int         framenum;
+    unsigned    time;
+} response_t;
+
+static response_t   status_response;
+static response_t   info_response;
+
+/*
+================
+SV_InvalidateStatus
+
+Called when the list of clients or their names change.
+================
+*/
+void SV_InvalidateStatus(void)
+{
+    status_response.valid = qfalse;
+    info_response.valid = qfalse;
+}
+
+static qboolean response_valid(response_t *r)
+{
+    // serverinfo changed from console
+    if (cvar_modified & CVAR_SERVERINFO) {
+        cvar_modified &= ~CVAR_SERVERINFO;
+        SV_InvalidateStatus();
+        return qfalse;
+    }
+
+    return r->valid && r->framenum == sv.framenum &&
+        svs.realtime - r->time < SV_FRAMETIME;
+}
+
+static void response_update(response_t *r, size_t len)
+{
+    r->len = len;
+    r->valid = qtrue;
+    r->framenum = sv.framenum;
+    r->time = svs.realtime;
+}
+
 /*
 ================
 SVC_Status
@@ -468,27 +796,35 @@ Responds with all the info that qplug or qspy can see
 */
 static void SVC_Status(void)
 {
-    char    buffer[MAX_PACKETLEN_DEFAULT];
-    size_t  len;
+    response_t  *r = &status_response;
+    size_t      len;
 
     if (!sv_status_show->integer) {
         return;
     }
 
     if (SV_RateLimited(&svs.ratelimit_status)) {
+        svs.drops[DROP_STATUS]++;
         Com_DPrintf("Dropping status request from %s\n",
                     NET_AdrToString(&net_from));
         return;
     }
 
-    // write the packet header
-    memcpy(buffer, "\xff\xff\xff\xffprint\n", 10);
-    len = 10;
+    if (response_valid(r)) {
+        svs.status_hits++;
+    } else {
+        // write the packet header
+        memcpy(r->data, "\xff\xff\xff\xffprint\n", 10);
+        len = 10;
 
-    len += SV_StatusString(buffer + len);
+        len += SV_StatusString(r->data + len);
+
+        response_update(r, len);
+        svs.status_misses++;
+    }
 
     // send the datagram
-    NET_SendPacket(NS_SERVER, buffer, len, &net_from);
+    NET_SendPacket(NS_SERVER, r->data, r->len, &net_from);
 }
 
 /*
@@ -524,9 +860,9 @@ The second parameter should be the current protocol version number.
 */
 static void SVC_Info(void)
 {
-    char    buffer[MAX_QPATH+10];
-    size_t  len;
-    int     version;
+    response_t  *r = &info_response;
+    size_t      len;
+    int         version;
 
     if (sv_maxclients->integer == 1)
         return; // ignore in single player
@@ -535,12 +871,19 @@ static void SVC_Info(void)
     if (version < PROTOCOL_VERSION_DEFAULT || version > PROTOCOL_VERSION_Q2PRO)
         return; // ignore invalid versions
 
-    len = Q_scnprintf(buffer, sizeof(buffer),
-                      "\xff\xff\xff\xffinfo\n%16s %8s %2i/%2i\n",
-                      sv_hostname->string, sv.name, SV_CountClients(),
-                      sv_maxclients->integer - sv_reserved_slots->integer);
+    if (response_valid(r)) {
+        svs.info_hits++;
+    } else {
+        len = Q_scnprintf(r->data, MAX_QPATH + 10,
+                          "\xff\xff\xff\xffinfo\n%16s %8s %2i/%2i\n",
+                          sv_hostname->string, sv.name, SV_CountClients(),
+                          sv_maxclients->integer - sv_reserved_slots->integer);
+
+        response_update(r, len);
+        svs.info_misses++;
+    }
 
-    NET_SendPacket(NS_SERVER, buffer, len, &net_from);
+    NET_SendPacket(NS_SERVER, r->data, r->len, &net_from);
 }
 
 /*
@@ -683,6 +1026,7 @@ static qboolean permit_connection(conn_params_t *p)
 
     // check for banned address
     if ((match = SV_MatchAddress(&sv_banlist, &net_from)) != NULL) {
+        svs.drops[DROP_BANNED]++;
         s = match->comment;
         if (!*s) {
             s = "Your IP address is banned from this server.";
@@ -856,8 +1200,10 @@ static qboolean parse_userinfo(conn_params_t *params, char *userinfo)
         if (!s[0])
             return reject("Please set your password before connecting.\n");
 
-        if (SV_RateLimited(&svs.ratelimit_auth))
+        if (SV_RateLimited(&svs.ratelimit_auth)) {
+            svs.drops[DROP_AUTH]++;
             return reject("Invalid password.\n");
+        }
 
         if (strcmp(sv_password->string, s))
             return reject("Invalid password.\n");
@@ -1163,6 +1509,7 @@ static void SVC_DirectConnect(void)
 
     // add them to the linked list of connected clients
     List_SeqAdd(&sv_clientlist, &newcl->entry);
+    SV_InvalidateStatus();
 
     Com_DPrintf("Going from cs_free to cs_assigned for %s\n", newcl->name);
     newcl->state = cs_assigned;
@@ -1197,6 +1544,7 @@ static void SVC_RemoteCommand(void)
     char *s;
 
     if (SV_RateLimited(&svs.ratelimit_rcon)) {
+        svs.drops[DROP_RCON]++;
         Com_DPrintf("Dropping rcon from %s\n",
                     NET_AdrToString(&net_from));
         return;
@@ -1252,10 +1600,17 @@ static void SV_ConnectionlessPacket(void)
     size_t  len;
 
     if (SV_MatchAddress(&sv_blacklist, &net_from)) {
+        svs.drops[DROP_BLACKHOLE]++;
         Com_DPrintf("ignored blackholed connectionless packet\n");
         return;
     }
 
+    if (SV_SourceLimited(&net_from)) {
+        svs.drops[DROP_SOURCE]++;
+        Com_DPrintf("ignored rate limited connectionless packet\n");
+        return;
+    }
+
     MSG_BeginReading();
     MSG_ReadLong();        // skip the -1 marker
 
@@ -1833,6 +2188,12 @@ unsigned SV_Frame(unsigned msec)
     time_before_game = time_after_game = 0;
 #endif
 
+    // load test runs exactly one frame per call
+    if (SV_LoadTestActive()) {
+        msec = SV_FRAMETIME;
+        sv.frameresidual = 0;
+    }
+
     // advance local server time
     svs.realtime += msec;
 
@@ -1846,10 +2207,18 @@ unsigned SV_Frame(unsigned msec)
     MVD_Frame();
 #endif
 
+    SV_LoadTestBeginStage(LT_TOTAL);
+    SV_LoadTestBeginStage(LT_PACKETS);
+
+    PROF_BEGIN("SV_ReadPackets");
+
     // read packets from UDP clients
     NET_GetPackets(NS_SERVER, SV_PacketEvent);
 
     if (svs.initialized) {
+        // read packets from load test clients
+        SV_LoadTestRunBots();
+
         // run connection to the anticheat server
         AC_Run();
 
@@ -1860,6 +2229,10 @@ unsigned SV_Frame(unsigned msec)
         SV_SendAsyncPackets();
     }
 
+    SV_LoadTestEndStage(LT_PACKETS);
+
+    PROF_END();
+
     // move autonomous things around if enough time has passed
     sv.frameresidual += msec;
     if (sv.frameresidual < SV_FRAMETIME) {
@@ -1867,6 +2240,8 @@ unsigned SV_Frame(unsigned msec)
     }
 
     if (svs.initialized && !check_paused()) {
+        PROF_BEGIN("SV_RunFrame");
+
         // check timeouts
         SV_CheckTimeouts();
 
@@ -1877,19 +2252,37 @@ unsigned SV_Frame(unsigned msec)
         SV_GiveMsec();
 
         // let everything in the world think and move
+        PROF_BEGIN("SV_RunGameFrame");
+        SV_LoadTestBeginStage(LT_GAME);
         SV_RunGameFrame();
+        SV_LoadTestEndStage(LT_GAME);
+        PROF_END();
 
         // send messages back to the UDP clients
+        PROF_BEGIN("SV_SendClientMessages");
+        SV_LoadTestBeginStage(LT_SEND);
         SV_SendClientMessages();
+        SV_LoadTestEndStage(LT_SEND);
+        PROF_END();
 
         // send a heartbeat to the master if needed
         SV_MasterHeartbeat();
 
+        // append bandwidth statistics to the log if needed
+        SV_LogBandwidth();
+
         // clear teleport flags, etc for next frame
         SV_PrepWorldFrame();
 
         // advance for next frame
         sv.framenum++;
+
+        PROF_END();
+
+        SV_LoadTestEndStage(LT_TOTAL);
+
+        // record timings, may finish the load test
+        SV_LoadTestEndFrame();
     }
 
     if (COM_DEDICATED) {
@@ -1899,6 +2292,12 @@ unsigned SV_Frame(unsigned msec)
         }
     }
 
+    // don't sleep between load test frames
+    if (SV_LoadTestActive()) {
+        sv.frameresidual = 0;
+        return 0;
+    }
+
     // decide how long to sleep next frame
     sv.frameresidual -= SV_FRAMETIME;
     if (sv.frameresidual < SV_FRAMETIME) {
@@ -1959,6 +2358,7 @@ void SV_UserinfoChanged(client_t *cl)
             }
     }
     memcpy(cl->name, name, len + 1);
+    SV_InvalidateStatus();
 
     // rate command
     val = Info_ValueForKey(cl->userinfo, "rate");
@@ -2019,11 +2419,19 @@ static void sv_rcon_limit_changed(cvar_t *self)
     SV_RateInit(&svs.ratelimit_rcon, self->string);
 }
 
+static void sv_source_limit_changed(cvar_t *self)
+{
+    SV_RateInit(&svs.ratelimit_source, self->string);
+    memset(source_limits, 0, sizeof(source_limits));
+}
+
 static void init_rate_limits(void)
 {
     SV_RateInit(&svs.ratelimit_status, sv_status_limit->string);
     SV_RateInit(&svs.ratelimit_auth, sv_auth_limit->string);
     SV_RateInit(&svs.ratelimit_rcon, sv_rcon_limit->string);
+    SV_RateInit(&svs.ratelimit_source, sv_source_limit->string);
+    memset(source_limits, 0, sizeof(source_limits));
 }
 
 static void sv_namechange_limit_changed(cvar_t *self)
@@ -2035,6 +2443,11 @@ static void sv_namechange_limit_changed(cvar_t *self)
     }
 }
 
+static void sv_bwlog_changed(cvar_t *self)
+{
+    SV_CloseBandwidthLog();
+}
+
 #if USE_SYSCON
 static void sv_hostname_changed(cvar_t *self)
 {
@@ -2067,6 +2480,8 @@ void SV_Init(void)
 
     SV_MvdRegister();
 
+    SV_LoadTestRegister();
+
 #if USE_MVD_CLIENT
     MVD_Register();
 #endif
@@ -2146,12 +2561,20 @@ void SV_Init(void)
 
     sv_uptime = Cvar_Get("sv_uptime", "0", 0);
 
+    sv_bwlog = Cvar_Get("sv_bwlog", "0", 0);
+    sv_bwlog->changed = sv_bwlog_changed;
+    sv_bwlog_name = Cvar_Get("sv_bwlog_name", "bandwidth", 0);
+    sv_bwlog_name->changed = sv_bwlog_changed;
+
     sv_auth_limit = Cvar_Get("sv_auth_limit", "1", 0);
     sv_auth_limit->changed = sv_auth_limit_changed;
 
     sv_rcon_limit = Cvar_Get("sv_rcon_limit", "1", 0);
     sv_rcon_limit->changed = sv_rcon_limit_changed;
 
+    sv_source_limit = Cvar_Get("sv_source_limit", "0", 0);
+    sv_source_limit->changed = sv_source_limit_changed;
+
     sv_namechange_limit = Cvar_Get("sv_namechange_limit", "5/min", 0);
     sv_namechange_limit->changed = sv_namechange_limit_changed;
 
@@ -2265,10 +2688,13 @@ void SV_Shutdown(const char *finalmsg, error_type_t type)
 
     AC_Disconnect();
 
+    SV_LoadTestStop();
+
     SV_MvdShutdown(type);
 
     SV_FinalMessage(finalmsg, type);
     SV_MasterShutdown();
+    SV_CloseBandwidthLog();
     SV_ShutdownGameProgs();
 
     // free current level
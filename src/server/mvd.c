@@ -84,8 +84,8 @@ static mvd_server_t     mvd;
 static LIST_DECL(gtv_client_list);
 static LIST_DECL(gtv_active_list);
 
-static LIST_DECL(gtv_white_list);
-static LIST_DECL(gtv_black_list);
+static ADDRLIST_DECL(gtv_white_list);
+static ADDRLIST_DECL(gtv_black_list);
 
 static cvar_t   *sv_mvd_enable;
 static cvar_t   *sv_mvd_maxclients;
@@ -87,6 +87,9 @@ static qboolean SV_RateDrop(client_t *client)
 
 static void SV_CalcSendTime(client_t *client, size_t size)
 {
+    client->bw.total += size;
+    svs.bw.total += size;
+
     // never drop over the loopback
     if (!client->rate) {
         client->send_time = svs.realtime;
@@ -441,6 +444,18 @@ static inline void free_msg_packet(client_t *client, message_packet_t *msg)
     }
 }
 
+// messages are accounted by their first opcode
+static inline void count_message(client_t *client, const byte *data, size_t len)
+{
+    int cmd = data[0] & SVCMD_MASK;
+
+    if (cmd >= svc_num_types) {
+        cmd = svc_bad;
+    }
+
+    SV_CountBytes(client, cmd, len);
+}
+
 #define FOR_EACH_MSG_SAFE(list) \
     LIST_FOR_EACH_SAFE(message_packet_t, msg, next, list, entry)
 #define MSG_FIRST(list) \
@@ -567,9 +582,12 @@ static void emit_snd(client_t *client, message_packet_t *msg)
 
 static inline void write_snd(client_t *client, message_packet_t *msg, size_t maxsize)
 {
+    size_t cursize = msg_write.cursize;
+
     // if this msg fits, write it
-    if (msg_write.cursize + MAX_SOUND_PACKET <= maxsize) {
+    if (cursize + MAX_SOUND_PACKET <= maxsize) {
         emit_snd(client, msg);
+        SV_CountBytes(client, svc_sound, msg_write.cursize - cursize);
     }
     List_Remove(&msg->entry);
     List_Insert(&client->msg_free_list, &msg->entry);
@@ -580,6 +598,7 @@ static inline void write_msg(client_t *client, message_packet_t *msg, size_t max
     // if this msg fits, write it
     if (msg_write.cursize + msg->cursize <= maxsize) {
         MSG_WriteData(msg->data, msg->cursize);
+        count_message(client, msg->data, msg->cursize);
     }
     free_msg_packet(client, msg);
 }
@@ -648,6 +667,7 @@ static void write_reliables_old(client_t *client, size_t maxsize)
                    __func__, client->name, count, msg->cursize);
 
         SZ_Write(&client->netchan->message, msg->data, msg->cursize);
+        count_message(client, msg->data, msg->cursize);
         free_msg_packet(client, msg);
         count++;
     }
@@ -779,6 +799,7 @@ static void add_message_new(client_t *client, byte *data,
     if (reliable) {
         // don't packetize, netchan level will do fragmentation as needed
         SZ_Write(&client->netchan->message, data, len);
+        count_message(client, data, len);
     } else {
         // still have to packetize, relative sounds need special processing
         add_msg_packet(client, data, len, qfalse);
@@ -916,8 +937,15 @@ void SV_SendClientMessages(void)
         }
 
         // build the new frame and write it
+        PROF_BEGIN("SV_BuildClientFrame");
+        SV_LoadTestBeginStage(LT_BUILD);
         SV_BuildClientFrame(client);
+        SV_LoadTestEndStage(LT_BUILD);
+        PROF_END();
+
+        PROF_BEGIN("SV_WriteDatagram");
         client->WriteDatagram(client);
+        PROF_END();
 
 advance:
         // advance for next frame
@@ -965,6 +993,7 @@ static void write_pending_download(client_t *client)
     SZ_WriteShort(buf, chunk);
     SZ_WriteByte(buf, percent);
     SZ_Write(buf, client->download + client->downloadcount - chunk, chunk);
+    SV_CountBytes(client, client->downloadcmd, chunk + 4);
 
     if (client->downloadcount == client->downloadsize) {
         SV_CloseDownload(client);
@@ -1046,6 +1075,7 @@ void SV_InitClientSend(client_t *newcl)
     List_Init(&newcl->msg_reliable_list);
 
     newcl->msg_pool = SV_Malloc(sizeof(message_packet_t) * MSG_POOLSIZE);
+    newcl->bw.time = svs.realtime;
     for (i = 0; i < MSG_POOLSIZE; i++) {
         List_Append(&newcl->msg_free_list, &newcl->msg_pool[i].entry);
     }
@@ -1070,3 +1100,120 @@ void SV_ShutdownClientSend(client_t *client)
     List_Init(&client->msg_free_list);
 }
 
+
+/*
+===============================================================================
+
+BANDWIDTH ACCOUNTING
+
+===============================================================================
+*/
+
+static const char *const bw_names[svc_num_types] = {
+    "bad", "muzzleflash", "muzzleflash2", "temp_entity", "layout",
+    "inventory", "nop", "disconnect", "reconnect", "sound", "print",
+    "stufftext", "serverdata", "configstring", "spawnbaseline",
+    "centerprint", "download", "playerstate", "entities",
+    "deltapacketentities", "frame", "zpacket", "zdownload", "gamestate",
+    "setting"
+};
+
+static qhandle_t    bw_log_file;
+
+const char *SV_BandwidthName(int cmd)
+{
+    return bw_names[cmd];
+}
+
+void SV_CloseBandwidthLog(void)
+{
+    if (bw_log_file) {
+        FS_FCloseFile(bw_log_file);
+        bw_log_file = 0;
+    }
+}
+
+static qboolean open_bandwidth_log(void)
+{
+    char buffer[MAX_OSPATH];
+    int i;
+
+    bw_log_file = FS_EasyOpenFile(buffer, sizeof(buffer),
+                                  FS_MODE_APPEND | FS_FLAG_TEXT,
+                                  "logs/", sv_bwlog_name->string, ".csv");
+    if (!bw_log_file) {
+        Cvar_Set("sv_bwlog", "0");
+        return qfalse;
+    }
+
+    FS_FPrintf(bw_log_file, "time,client,name,seconds,total,other");
+    for (i = 0; i < svc_num_types; i++) {
+        FS_FPrintf(bw_log_file, ",%s", bw_names[i]);
+    }
+    FS_FPrintf(bw_log_file, "\n");
+
+    Com_Printf("Logging bandwidth to %s\n", buffer);
+    return qtrue;
+}
+
+// writes difference since the last snapshot and updates the snapshot
+static void log_bandwidth(unsigned long now, int number, const char *name,
+                          bandwidth_t *bw, bandwidth_t *last, unsigned msec)
+{
+    uint64_t total, other;
+    int i;
+
+    total = bw->total - last->total;
+    other = total;
+    for (i = 0; i < svc_num_types; i++) {
+        other -= bw->bytes[i] - last->bytes[i];
+    }
+
+    FS_FPrintf(bw_log_file, "%lu,%d,\"%s\",%.1f,%"PRIu64",%"PRId64,
+               now, number, name, msec * 0.001f, total, (int64_t)other);
+    for (i = 0; i < svc_num_types; i++) {
+        FS_FPrintf(bw_log_file, ",%"PRIu64, bw->bytes[i] - last->bytes[i]);
+    }
+    FS_FPrintf(bw_log_file, "\n");
+
+    *last = *bw;
+}
+
+/*
+==================
+SV_LogBandwidth
+
+Appends per-client and aggregate byte counts for the last sv_bwlog
+seconds to the CSV log. Clients that connected in the middle of the
+interval are logged for the part of it they were connected.
+==================
+*/
+void SV_LogBandwidth(void)
+{
+    unsigned long   now;
+    client_t        *client;
+    unsigned        msec;
+
+    if (sv_bwlog->integer <= 0)
+        return;
+
+    msec = svs.realtime - svs.bw_log_time;
+    if (msec < (unsigned)sv_bwlog->integer * 1000)
+        return;
+
+    if (!bw_log_file && !open_bandwidth_log())
+        return;
+
+    now = (unsigned long)time(NULL);
+
+    FOR_EACH_CLIENT(client) {
+        if (client->state < cs_connected)
+            continue;
+        log_bandwidth(now, client->number, client->name, &client->bw,
+                      &client->bw_logged, min(msec, svs.realtime - client->bw.time));
+    }
+
+    log_bandwidth(now, -1, "all", &svs.bw, &svs.bw_logged, msec);
+
+    svs.bw_log_time = svs.realtime;
+}
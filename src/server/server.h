@@ -32,6 +32,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/net/net.h"
 #include "common/net/chan.h"
 #include "common/pmove.h"
+#include "common/prof.h"
 #include "common/prompt.h"
 #include "common/protocol.h"
 #include "common/x86/fpu.h"
@@ -253,6 +254,16 @@ typedef struct {
     unsigned    cost;
 } ratelimit_t;
 
+// bytes sent are accounted by svc opcode; frames are split into svc_frame
+// (header and areabits), svc_playerinfo and svc_packetentities even for
+// protocols that don't write the latter two opcodes explicitly
+typedef struct {
+    uint64_t    bytes[svc_num_types];
+    uint64_t    count[svc_num_types];
+    uint64_t    total;      // including netchan headers and retransmits
+    unsigned    time;       // svs.realtime accounting started at
+} bandwidth_t;
+
 typedef struct client_s {
     list_t          entry;
 
@@ -311,6 +322,10 @@ typedef struct client_s {
     int             suppress_count;                 // number of messages rate suppressed
     unsigned        send_time, send_delta;          // used to rate drop async packets
 
+    // bandwidth accounting
+    bandwidth_t     bw;
+    bandwidth_t     bw_logged;      // snapshot at last sv_bwlog write
+
     // current download
     byte            *download;      // file being downloaded
     int             downloadsize;   // total bytes (can't use EOF because of paks)
@@ -401,6 +416,39 @@ typedef struct {
     char        comment[1];
 } addrmatch_t;
 
+// path compressed binary trie node, keyed by masked address bits
+typedef struct addrnode_s {
+    struct addrnode_s   *child[2];
+    addrmatch_t         *match;     // NULL for branching nodes
+    int                 bits;       // prefix length
+    byte                key[16];
+} addrnode_t;
+
+// entries are kept in a list in order of addition for listing and removal
+// by index, and in per-family tries for longest prefix matching
+typedef struct {
+    list_t      list;
+    addrnode_t  *root[2];   // IPv4, IPv6
+} addrlist_t;
+
+#define ADDRLIST_DECL(name) \
+    addrlist_t name = { { &name.list, &name.list } }
+
+#define FOR_EACH_ADDRMATCH(match, addrlist) \
+    LIST_FOR_EACH(addrmatch_t, match, &(addrlist)->list, entry)
+
+// connectionless packet drop reasons
+typedef enum {
+    DROP_BLACKHOLE,
+    DROP_SOURCE,
+    DROP_STATUS,
+    DROP_RCON,
+    DROP_AUTH,
+    DROP_BANNED,
+
+    DROP_MAX
+} droprule_t;
+
 typedef struct {
     list_t  entry;
     int     len;
@@ -468,6 +516,17 @@ typedef struct server_static_s {
     ratelimit_t     ratelimit_status;
     ratelimit_t     ratelimit_auth;
     ratelimit_t     ratelimit_rcon;
+    ratelimit_t     ratelimit_source;   // template for per-address limits
+
+    unsigned        drops[DROP_MAX];
+
+    // connectionless queries answered from cache
+    unsigned        status_hits, status_misses;
+    unsigned        info_hits, info_misses;
+
+    bandwidth_t     bw;             // all clients since server start
+    bandwidth_t     bw_logged;
+    unsigned        bw_log_time;
 
     challenge_t     challenges[MAX_CHALLENGES]; // to prevent invalid IPs from connecting
 } server_static_t;
@@ -475,8 +534,8 @@ typedef struct server_static_s {
 //=============================================================================
 
 extern list_t      sv_masterlist; // address of the master server
-extern list_t      sv_banlist;
-extern list_t      sv_blacklist;
+extern addrlist_t  sv_banlist;
+extern addrlist_t  sv_blacklist;
 extern list_t      sv_cmdlist_connect;
 extern list_t      sv_cmdlist_begin;
 extern list_t      sv_filterlist;
@@ -499,6 +558,7 @@ extern cvar_t       *sv_fps;
 #endif
 extern cvar_t       *sv_force_reconnect;
 extern cvar_t       *sv_iplimit;
+extern cvar_t       *sv_namechange_limit;
 
 #ifdef _DEBUG
 extern cvar_t       *sv_debug;
@@ -523,7 +583,10 @@ extern cvar_t       *sv_status_limit;
 extern cvar_t       *sv_status_show;
 extern cvar_t       *sv_auth_limit;
 extern cvar_t       *sv_rcon_limit;
+extern cvar_t       *sv_source_limit;
 extern cvar_t       *sv_uptime;
+extern cvar_t       *sv_bwlog;
+extern cvar_t       *sv_bwlog_name;
 
 extern cvar_t       *sv_allow_unconnected_cmds;
 
@@ -558,9 +621,13 @@ qboolean SV_RateLimited(ratelimit_t *r);
 void SV_RateRecharge(ratelimit_t *r);
 void SV_RateInit(ratelimit_t *r, const char *s);
 
-addrmatch_t *SV_MatchAddress(list_t *list, netadr_t *address);
+addrmatch_t *SV_MatchAddress(addrlist_t *list, netadr_t *address);
+addrmatch_t *SV_AddAddress(addrlist_t *list, addrmatch_t *match);
+void SV_RemoveAddress(addrlist_t *list, addrmatch_t *match);
+void SV_ClearAddresses(addrlist_t *list);
 
 int SV_CountClients(void);
+void SV_InvalidateStatus(void);
 
 #if USE_ZLIB
 voidpf SV_zalloc(voidpf opaque, uInt items, uInt size);
@@ -603,6 +670,18 @@ void SV_ClientAddMessage(client_t *client, int flags);
 void SV_ShutdownClientSend(client_t *client);
 void SV_InitClientSend(client_t *newcl);
 
+const char *SV_BandwidthName(int cmd);
+void SV_LogBandwidth(void);
+void SV_CloseBandwidthLog(void);
+
+static inline void SV_CountBytes(client_t *client, int cmd, size_t len)
+{
+    client->bw.bytes[cmd] += len;
+    client->bw.count[cmd]++;
+    svs.bw.bytes[cmd] += len;
+    svs.bw.count[cmd]++;
+}
+
 //
 // sv_mvd.c
 //
@@ -650,6 +729,27 @@ void SV_MvdStop_f(void);
 #define SV_MvdStop_f()      (void)0
 #endif
 
+//
+// sv_loadtest.c
+//
+typedef enum {
+    LT_PACKETS,
+    LT_GAME,
+    LT_BUILD,
+    LT_SEND,
+    LT_TOTAL,
+
+    LT_NUM_STAGES
+} lt_stage_t;
+
+void SV_LoadTestRegister(void);
+void SV_LoadTestStop(void);
+qboolean SV_LoadTestActive(void);
+void SV_LoadTestBeginStage(lt_stage_t stage);
+void SV_LoadTestEndStage(lt_stage_t stage);
+void SV_LoadTestRunBots(void);
+void SV_LoadTestEndFrame(void);
+
 //
 // sv_ac.c
 //
@@ -705,9 +805,9 @@ void SV_AlignKeyFrames(client_t *client);
 extern const cmd_option_t o_record[];
 #endif
 
-void SV_AddMatch_f(list_t *list);
-void SV_DelMatch_f(list_t *list);
-void SV_ListMatches_f(list_t *list);
+void SV_AddMatch_f(addrlist_t *list);
+void SV_DelMatch_f(addrlist_t *list);
+void SV_ListMatches_f(addrlist_t *list);
 client_t *SV_GetPlayer(const char *s, qboolean partial);
 void SV_PrintMiscInfo(void);
 
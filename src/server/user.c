@@ -222,6 +222,8 @@ static void write_compressed_gamestate(void)
     patch[0] = svs.z.total_out & 255;
     patch[1] = (svs.z.total_out >> 8) & 255;
     buf->cursize += svs.z.total_out;
+
+    SV_CountBytes(sv_client, svc_zpacket, svs.z.total_out + 5);
 }
 
 static inline int z_flush(byte *buffer)
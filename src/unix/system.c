@@ -37,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <pthread.h>
 
 #if USE_CLIENT
 #include <SDL_video.h>
@@ -76,6 +77,14 @@ unsigned Sys_Milliseconds(void)
     return time;
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /*
 =================
 Sys_Quit
@@ -131,6 +140,134 @@ void Sys_Sleep(int msec)
     nanosleep(&req, NULL);
 }
 
+/*
+===============================================================================
+
+THREADS
+
+===============================================================================
+*/
+
+struct sys_thread_s {
+    pthread_t   thread;
+    void        (*func)(void *);
+    void        *arg;
+};
+
+struct sys_mutex_s {
+    pthread_mutex_t mutex;
+};
+
+struct sys_cond_s {
+    pthread_cond_t  cond;
+};
+
+static void *thread_func(void *arg)
+{
+    sys_thread_t *t = arg;
+
+    t->func(t->arg);
+    return NULL;
+}
+
+sys_thread_t *Sys_CreateThread(void (*func)(void *), void *arg)
+{
+    sys_thread_t *t = Z_Malloc(sizeof(*t));
+    int ret;
+
+    t->func = func;
+    t->arg = arg;
+    ret = pthread_create(&t->thread, NULL, thread_func, t);
+    if (ret) {
+        Com_EPrintf("Couldn't create thread: %s\n", strerror(ret));
+        Z_Free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void Sys_JoinThread(sys_thread_t *thread)
+{
+    pthread_join(thread->thread, NULL);
+    Z_Free(thread);
+}
+
+int Sys_NumProcessors(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? n : 1;
+}
+
+sys_mutex_t *Sys_CreateMutex(void)
+{
+    sys_mutex_t *m = Z_Malloc(sizeof(*m));
+
+    pthread_mutex_init(&m->mutex, NULL);
+    return m;
+}
+
+void Sys_DestroyMutex(sys_mutex_t *mutex)
+{
+    pthread_mutex_destroy(&mutex->mutex);
+    Z_Free(mutex);
+}
+
+void Sys_LockMutex(sys_mutex_t *mutex)
+{
+    pthread_mutex_lock(&mutex->mutex);
+}
+
+void Sys_UnlockMutex(sys_mutex_t *mutex)
+{
+    pthread_mutex_unlock(&mutex->mutex);
+}
+
+sys_cond_t *Sys_CreateCond(void)
+{
+    sys_cond_t *c = Z_Malloc(sizeof(*c));
+
+    pthread_cond_init(&c->cond, NULL);
+    return c;
+}
+
+void Sys_DestroyCond(sys_cond_t *cond)
+{
+    pthread_cond_destroy(&cond->cond);
+    Z_Free(cond);
+}
+
+qboolean Sys_WaitCond(sys_cond_t *cond, sys_mutex_t *mutex, int msec)
+{
+    struct timespec ts;
+
+    if (msec < 0) {
+        pthread_cond_wait(&cond->cond, &mutex->mutex);
+        return qtrue;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += msec / 1000;
+    ts.tv_nsec += (msec % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    return pthread_cond_timedwait(&cond->cond, &mutex->mutex, &ts) != ETIMEDOUT;
+}
+
+void Sys_SignalCond(sys_cond_t *cond)
+{
+    pthread_cond_signal(&cond->cond);
+}
+
+void Sys_BroadcastCond(sys_cond_t *cond)
+{
+    pthread_cond_broadcast(&cond->cond);
+}
+
 #if USE_AC_CLIENT
 qboolean Sys_GetAntiCheatAPI(void)
 {
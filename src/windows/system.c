@@ -646,6 +646,19 @@ unsigned Sys_Milliseconds(void)
     return timeGetTime();
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+
+    QueryPerformanceCounter(&count);
+    return count.QuadPart / freq.QuadPart * 1000000 +
+           count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+}
+
 void Sys_AddDefaultConfig(void)
 {
 }
@@ -655,6 +668,120 @@ void Sys_Sleep(int msec)
     Sleep(msec);
 }
 
+/*
+===============================================================================
+
+THREADS
+
+===============================================================================
+*/
+
+struct sys_thread_s {
+    HANDLE      handle;
+    void        (*func)(void *);
+    void        *arg;
+};
+
+struct sys_mutex_s {
+    CRITICAL_SECTION    cs;
+};
+
+struct sys_cond_s {
+    CONDITION_VARIABLE  cv;
+};
+
+static DWORD WINAPI thread_func(LPVOID arg)
+{
+    sys_thread_t *t = arg;
+
+    t->func(t->arg);
+    return 0;
+}
+
+sys_thread_t *Sys_CreateThread(void (*func)(void *), void *arg)
+{
+    sys_thread_t *t = Z_Malloc(sizeof(*t));
+
+    t->func = func;
+    t->arg = arg;
+    t->handle = CreateThread(NULL, 0, thread_func, t, 0, NULL);
+    if (!t->handle) {
+        Com_EPrintf("Couldn't create thread: %#lx\n", GetLastError());
+        Z_Free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void Sys_JoinThread(sys_thread_t *thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    Z_Free(thread);
+}
+
+int Sys_NumProcessors(void)
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
+sys_mutex_t *Sys_CreateMutex(void)
+{
+    sys_mutex_t *m = Z_Malloc(sizeof(*m));
+
+    InitializeCriticalSection(&m->cs);
+    return m;
+}
+
+void Sys_DestroyMutex(sys_mutex_t *mutex)
+{
+    DeleteCriticalSection(&mutex->cs);
+    Z_Free(mutex);
+}
+
+void Sys_LockMutex(sys_mutex_t *mutex)
+{
+    EnterCriticalSection(&mutex->cs);
+}
+
+void Sys_UnlockMutex(sys_mutex_t *mutex)
+{
+    LeaveCriticalSection(&mutex->cs);
+}
+
+sys_cond_t *Sys_CreateCond(void)
+{
+    sys_cond_t *c = Z_Malloc(sizeof(*c));
+
+    InitializeConditionVariable(&c->cv);
+    return c;
+}
+
+void Sys_DestroyCond(sys_cond_t *cond)
+{
+    Z_Free(cond);
+}
+
+qboolean Sys_WaitCond(sys_cond_t *cond, sys_mutex_t *mutex, int msec)
+{
+    return SleepConditionVariableCS(&cond->cv, &mutex->cs,
+                                    msec < 0 ? INFINITE : msec);
+}
+
+void Sys_SignalCond(sys_cond_t *cond)
+{
+    WakeConditionVariable(&cond->cv);
+}
+
+void Sys_BroadcastCond(sys_cond_t *cond)
+{
+    WakeAllConditionVariable(&cond->cv);
+}
+
 qboolean
 Sys_IsDir(const char *path)
 {